@@ -0,0 +1,25 @@
+#ifndef _AVEXCEPTION_H_
+#define _AVEXCEPTION_H_
+
+/*
+** Errors from the C++ frame I/O.  The end of the stream is not an error,
+** Libyuv::read() returns false for it.
+*/
+
+#include <stdexcept>
+#include <string>
+
+class AVException : public std::runtime_error
+{
+public:
+	AVException(const std::string &message, int code = 0) : std::runtime_error(message), code(code) { }
+
+	std::string getMessage() const { return what(); }
+	// the y4m error code, 0 when there isn't one
+	int getCode() const { return code; }
+
+private:
+	int code;
+};
+
+#endif
@@ -0,0 +1,287 @@
+/*
+ *  Libyuv.cpp
+ *    Mark Heath <mjpeg0 at silicontrip.org>
+ *  http://silicontrip.net/~mark/lavtools/
+ *
+ * y4m frame I/O for the C++ tools, with the next frame read on a thread
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdlib.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <mjpeg_logging.h>
+#include "Libyuv.h"
+#include "utilyuv.h"
+#include "progress.h"
+
+// Y4M_MAX_NUM_PLANES, 444 with alpha has four
+#define FRAME_PLANES 4
+
+namespace {
+
+struct PlaneFree {
+	void operator()(uint8_t *p) const { free(p); }
+};
+
+struct Frame {
+	std::unique_ptr<uint8_t, PlaneFree> plane[FRAME_PLANES];
+	// the same pointers, as the y4m functions want them
+	uint8_t *m[FRAME_PLANES];
+	y4m_frame_info_t fi;
+
+	Frame()
+	{
+		for (int p = 0; p < FRAME_PLANES; p++)
+			m[p] = NULL;
+		y4m_init_frame_info(&fi);
+	}
+
+	~Frame() { y4m_fini_frame_info(&fi); }
+
+	void alloc(const y4m_stream_info_t *si)
+	{
+		void *data;
+
+		for (int p = 0; p < y4m_si_get_plane_count(si); p++) {
+			if (posix_memalign(&data, PLANE_ALIGN, y4m_si_get_plane_length(si, p)))
+				throw AVException("Cannot allocate frame planes");
+			plane[p].reset((uint8_t *)data);
+			m[p] = plane[p].get();
+		}
+	}
+};
+
+}
+
+struct Libyuv::State {
+	int fdIn, fdOut;
+	y4m_stream_info_t si;
+	bool async;
+
+	// frame[current] is the caller's, the reader fills the other one
+	Frame frame[2];
+	int current;
+
+	std::thread reader;
+	std::mutex lock;
+	std::condition_variable cond;
+	// the reader is asked for a frame, it has one, it has to go
+	bool wanted, ready, stop;
+	int status;
+	// the error that ended the stream, Y4M_OK until then
+	int ended;
+
+	State(int in, int out) : fdIn(in), fdOut(out), async(true), current(0),
+		wanted(false), ready(false), stop(false), status(Y4M_OK), ended(Y4M_OK)
+	{
+		y4m_init_stream_info(&si);
+	}
+
+	~State()
+	{
+		if (reader.joinable()) {
+			{
+				std::lock_guard<std::mutex> l(lock);
+				stop = true;
+			}
+			cond.notify_all();
+			// a read in progress has to finish first
+			reader.join();
+		}
+		y4m_fini_stream_info(&si);
+	}
+
+	void readLoop()
+	{
+		std::unique_lock<std::mutex> l(lock);
+		int err;
+
+		for (;;) {
+			cond.wait(l, [this] { return wanted || stop; });
+			if (stop)
+				return;
+			wanted = false;
+			Frame &f = frame[1 - current];
+			progress_queue(0, 0, 1);
+
+			l.unlock();
+			err = yuv_read_frame(fdIn, &si, &f.fi, f.m);
+			l.lock();
+
+			status = err;
+			ready = true;
+			progress_queue(0, 1, 1);
+			cond.notify_all();
+			if (err != Y4M_OK)
+				return;
+		}
+	}
+
+	bool finish(int err)
+	{
+		if (err == Y4M_OK)
+			return true;
+		ended = err;
+		if (err == Y4M_ERR_EOF)
+			return false;
+		throw AVException(y4m_strerr(err), err);
+	}
+};
+
+Libyuv::Libyuv(int fdIn, int fdOut) : s(new State(fdIn, fdOut)) { }
+
+Libyuv::~Libyuv() { }
+
+Libyuv::Libyuv(Libyuv &&other) noexcept = default;
+Libyuv &Libyuv::operator=(Libyuv &&other) noexcept = default;
+
+void Libyuv::setExtensions(int accept)
+{
+	y4m_accept_extensions(accept);
+}
+
+void Libyuv::setAsync(bool async)
+{
+	if (s->reader.joinable())
+		throw AVException("Cannot change the reading mode after reading has started");
+	s->async = async;
+}
+
+void Libyuv::readHeader()
+{
+	int err = yuv_read_stream_header(s->fdIn, &s->si);
+
+	if (err != Y4M_OK)
+		throw AVException(std::string("Couldn't read YUV4MPEG2 header: ") + y4m_strerr(err), err);
+}
+
+void Libyuv::writeHeader()
+{
+	int err = yuv_write_stream_header(s->fdOut, &s->si);
+
+	if (err != Y4M_OK)
+		throw AVException(std::string("Couldn't write YUV4MPEG2 header: ") + y4m_strerr(err), err);
+}
+
+void Libyuv::copyStreamInfo(const Libyuv &from)
+{
+	y4m_copy_stream_info(&s->si, &from.s->si);
+}
+
+void Libyuv::dumpInfo() const
+{
+	y4m_log_stream_info(LOG_INFO, "  ", &s->si);
+}
+
+void Libyuv::allocFrameData()
+{
+	s->frame[0].alloc(&s->si);
+	s->frame[1].alloc(&s->si);
+}
+
+bool Libyuv::read()
+{
+	int err;
+
+	if (s->ended != Y4M_OK)
+		return false;
+	if (s->frame[0].m[0] == NULL)
+		allocFrameData();
+
+	if (!s->async) {
+		Frame &f = s->frame[s->current];
+		return s->finish(yuv_read_frame(s->fdIn, &s->si, &f.fi, f.m));
+	}
+
+	{
+		std::unique_lock<std::mutex> l(s->lock);
+
+		if (!s->reader.joinable()) {
+			// the reads overlap the processing, so it can't be timed between them
+			yuv_process_timing = 0;
+			s->wanted = true;
+			s->reader = std::thread(&State::readLoop, s.get());
+		}
+
+		s->cond.wait(l, [this] { return s->ready; });
+		s->ready = false;
+		err = s->status;
+		if (err == Y4M_OK) {
+			s->current = 1 - s->current;
+			s->wanted = true;
+		}
+	}
+	s->cond.notify_all();
+
+	return s->finish(err);
+}
+
+void Libyuv::write()
+{
+	Frame &f = s->frame[s->current];
+	int err = yuv_write_frame(s->fdOut, &s->si, &f.fi, f.m);
+
+	if (err != Y4M_OK)
+		throw AVException(std::string("Error writing frame: ") + y4m_strerr(err), err);
+}
+
+bool Libyuv::eof() const
+{
+	return s->ended == Y4M_ERR_EOF;
+}
+
+uint8_t **Libyuv::getYUVFrame()
+{
+	return s->frame[s->current].m;
+}
+
+y4m_stream_info_t *Libyuv::getStreamInfo()
+{
+	return &s->si;
+}
+
+y4m_frame_info_t *Libyuv::getFrameInfo()
+{
+	return &s->frame[s->current].fi;
+}
+
+int Libyuv::getWidth() const
+{
+	return y4m_si_get_plane_width(&s->si, 0);
+}
+
+int Libyuv::getHeight() const
+{
+	return y4m_si_get_plane_height(&s->si, 0);
+}
+
+int Libyuv::getChromaWidth() const
+{
+	return y4m_si_get_plane_count(&s->si) > 1 ? y4m_si_get_plane_width(&s->si, 1) : 0;
+}
+
+int Libyuv::getChromaHeight() const
+{
+	return y4m_si_get_plane_count(&s->si) > 1 ? y4m_si_get_plane_height(&s->si, 1) : 0;
+}
+
+int Libyuv::getPlaneLength(int plane) const
+{
+	return y4m_si_get_plane_length(&s->si, plane);
+}
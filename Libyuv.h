@@ -0,0 +1,72 @@
+#ifndef _LIBYUV_H_
+#define _LIBYUV_H_
+
+/*
+** y4m frame I/O for the C++ tools.
+**
+** A Libyuv owns the stream info and the planes of the current frame.  The
+** planes are aligned to PLANE_ALIGN bytes and freed with the object.  After
+** the first read() a thread reads the next frame into a second set of planes
+** while the caller works on the current one, read() waits for it and swaps
+** them, so a tool gets its reading overlapped with its processing without
+** doing anything.  The planes returned by getYUVFrame() change with every
+** read().
+**
+** read() returns false at the end of the stream.  Anything else that goes
+** wrong throws AVException.
+**
+** Frames go through yuv_read_frame and yuv_write_frame so the progress
+** statistics and the shared memory transport work as in the C tools.
+*/
+
+#include <stdint.h>
+#include <memory>
+#include <yuv4mpeg.h>
+#include "AVException.h"
+
+#define PLANE_ALIGN 64
+
+class Libyuv
+{
+public:
+	Libyuv(int fdIn = 0, int fdOut = 1);
+	~Libyuv();
+
+	// moving is safe while the reader is running, copying is not allowed
+	Libyuv(Libyuv &&other) noexcept;
+	Libyuv &operator=(Libyuv &&other) noexcept;
+	Libyuv(const Libyuv &) = delete;
+	Libyuv &operator=(const Libyuv &) = delete;
+
+	void setExtensions(int accept);
+	// read frames on the caller's thread, for tools that seek or share the input
+	void setAsync(bool async);
+
+	void readHeader();
+	void writeHeader();
+	void copyStreamInfo(const Libyuv &from);
+	void dumpInfo() const;
+
+	// made by the first read() if not called
+	void allocFrameData();
+
+	bool read();
+	void write();
+	bool eof() const;
+
+	uint8_t **getYUVFrame();
+	y4m_stream_info_t *getStreamInfo();
+	y4m_frame_info_t *getFrameInfo();
+
+	int getWidth() const;
+	int getHeight() const;
+	int getChromaWidth() const;
+	int getChromaHeight() const;
+	int getPlaneLength(int plane) const;
+
+private:
+	struct State;
+	std::unique_ptr<State> s;
+};
+
+#endif
@@ -12,6 +12,10 @@
  ** <p> using a post processing tool such as octave to average the graph
  ** may be useful</p>
  **
+ ** <p>-B file.ystats writes the graph to a binary statistics file rather
+ ** than text, with the columns time, total, type (the picture type) and
+ ** stream0 to streamN.  yuvstatsdump prints it in the text layout.</p>
+ **
 
  *
  * This program is free software; you can redistribute it and/or modify
@@ -45,8 +49,8 @@
 #include <unistd.h>
 #include <sys/stat.h>
 
-void progress_init(off_t b, off_t t);
-void progress_loadBar(off_t bytes);
+#include "progress.h"
+#include "yuvstats.h"
 
 static void print_usage()
 {
@@ -58,6 +62,7 @@ static void print_usage()
 			"\t -I <output interval> in seconds. Overrides -i. (larger than 0)\n"
 			"\t -P print progress bar.\n"
 			"\t -t print frame type only.\n"
+			"\t -B <file> write the graph to a binary statistics file (see yuvstatsdump)\n"
 			"produces a text bandwidth graph for any media file recognised by libav\n"
 			"\n"
 			);
@@ -70,6 +75,7 @@ struct settings {
 	char output_type;
 	int output_interval;
 	double output_interval_seconds;
+	char *stats_file;
 };
 
 void free_streams () {
@@ -117,6 +123,8 @@ int main(int argc, char *argv[])
 	int gop_count=0;
 
 	struct settings programSettings;
+	yuv_stats_t stats, *st=NULL;
+	char column_name[YUV_STATS_NAME];
 	struct stat fileStat;
 	off_t total_file_size;
 	double framerate;
@@ -128,10 +136,11 @@ int main(int argc, char *argv[])
 	programSettings.output_interval_seconds=0;
 	programSettings.output_progress=0;
 	programSettings.output_type=0;
+	programSettings.stats_file=NULL;
 
 
 	// parse commandline options
-	const static char *legal_flags = "s:i:I:ePht";
+	const static char *legal_flags = "s:i:I:ePhtB:";
 
 	int c;
 	char *error=NULL;
@@ -179,6 +188,9 @@ int main(int argc, char *argv[])
 			case 't':
 				programSettings.output_type=1;
 				break;
+			case 'B':
+				programSettings.stats_file=optarg;
+				break;
 			case 'h':
 			case '*':
 				print_usage();
@@ -346,6 +358,26 @@ int main(int argc, char *argv[])
 
 	int counter_interval=0;
 
+	// -t prints the picture types as letters and has no statistics file
+	if (programSettings.stats_file && !programSettings.output_type) {
+		if (numberStreams + 3 > YUV_STATS_MAX_COLUMNS) {
+			fprintf(stderr,"Too many streams for a statistics file\n");
+			return -1;
+		}
+		if (yuv_stats_create(&stats, programSettings.stats_file, "libav-bitrate", 0, 0)) {
+			fprintf(stderr,"Error: could not create %s.\n",programSettings.stats_file);
+			return -1;
+		}
+		yuv_stats_add_column(&stats, "time", YUV_STATS_DOUBLE);
+		yuv_stats_add_column(&stats, "total", YUV_STATS_DOUBLE);
+		yuv_stats_add_column(&stats, "type", YUV_STATS_INT32);
+		for(i=0; i<numberStreams; i++) {
+			snprintf(column_name, sizeof(column_name), "stream%d", i);
+			yuv_stats_add_column(&stats, column_name, YUV_STATS_DOUBLE);
+		}
+		st = &stats;
+	}
+
 
 	total_file_size=0;
 	// Loop until nothing read
@@ -387,7 +419,11 @@ int main(int argc, char *argv[])
 				total_ave += total_size;
 
 
-				if (!programSettings.output_type) {
+				if (st) {
+					yuv_stats_set_float(st, 0, frame_counter/framerate);
+					yuv_stats_set_float(st, 1, tave*8*framerate);
+					yuv_stats_set_int(st, 2, pFrame->pict_type);
+				} else if (!programSettings.output_type) {
 					printf ("%f ",frame_counter/framerate);
 					printf ("%f ",tave*8*framerate);
 				}
@@ -421,11 +457,20 @@ int main(int argc, char *argv[])
 					stream_ave[i] += stream_size[i];
 
 
-					printf ("%f ",stream_size[i]*8*framerate/ programSettings.output_interval);
+					if (st)
+						yuv_stats_set_float(st, i + 3, stream_size[i]*8*framerate/ programSettings.output_interval);
+					else
+						printf ("%f ",stream_size[i]*8*framerate/ programSettings.output_interval);
 
 					stream_size[i]=0;
 				}
-				printf("\n");
+				if (st) {
+					if (yuv_stats_row(st)) {
+						fprintf(stderr,"Error: could not write %s.\n",programSettings.stats_file);
+						return -1;
+					}
+				} else
+					printf("\n");
 				}
 
 				//}
@@ -445,6 +490,9 @@ int main(int argc, char *argv[])
 	}
 	if (programSettings.output_type) printf(" %d\n",gop_count);			
 
+	if (st && yuv_stats_close(st))
+		fprintf(stderr,"Error: could not write %s.\n",programSettings.stats_file);
+
 	free(stream_size);
 
 
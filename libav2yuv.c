@@ -40,6 +40,31 @@
 **any bugs or issues you have with the software I would like to hear about
 **so I can make this the best software.</p>
 **
+**<p>Cutting a range (-r or an EDL) normally decodes from the start of the
+**file.  <tt>libav2yuv -X file.mpg</tt> reads the packets of the file once,
+**without decoding, and writes file.mpg.avki, an index of the keyframes.
+**When the index is there libav2yuv seeks to the keyframe before the cut
+**and only decodes from there.  Frame numbers in the index count the
+**packets of the video stream.  The index is ignored if the file has
+**changed since it was written.</p>
+**
+**<p>With <tt>-a sound.wav</tt> the audio is written to a second file as the
+**video is written, so the file is only read and decoded once instead of a
+**second run with -w.  The audio is decoded on its own thread.  Each cut
+**is trimmed to the samples of its frames, video only EDL edits get
+**silence, and the audio is padded or cut back to the length of the video
+**at the end of every edit.</p>
+**
+**<p>Tools that only look at the picture, such as yuvaddetect, yuvcrop -d,
+**yuvvalues or yuvilace, do not need every frame at full quality.  For them
+**<tt>-dn</tt> or <tt>-dk</tt> only decodes the reference frames or the
+**keyframes and repeats the last one for the others, <tt>-l1</tt> or
+**<tt>-l2</tt> decodes at a half or a quarter of the size where the codec
+**can, and <tt>-m</tt> writes the luma only.  The frame rate and the number
+**of frames are the same as a full decode, so frame numbers found this way
+**can be used in an EDL.  For example
+**<tt>libav2yuv -dk -l2 -m archive.mpg | yuvvalues</tt></p>
+**
 **<h4>EXAMPLE</h4> <p> <tt> libav2yuv strangefile.avi | y4m-yuvfilter
 **| ffmpeg -f yuv4mpegpipe -i - -vcodec whatever wantedfile.avi</tt>
 **</p>
@@ -120,8 +145,15 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <limits.h>
 #include <regex.h>
+#include <sys/stat.h>
 
 #define BYTES_PER_SAMPLE 4
 
@@ -145,6 +177,19 @@ struct edlentry {
 	char *out;
 };
 
+// the next video edit reads on in the same file
+static int edl_next_in_file(struct edlentry *list, int entries, int current, const char *filename)
+{
+	int e;
+
+	if (list == NULL)
+		return 0;
+	for (e = current + 1; e < entries; e++)
+		if (list[e].video)
+			return !strcmp(list[e].filename, filename);
+	return 0;
+}
+
 // ^([^ /]+) ([AVBavb]|VA|va) (C) ([0-9]*:?[0-9]*:?[0-9]*[;:]?[0-9]+) ([0-9]*:?[0-9]*:?[0-9]*[;:]?[0-9]+)
 
 // going to use the regex library
@@ -479,12 +524,15 @@ void avchromacpy (uint8_t *dst[3], AVFrame *src, y4m_stream_info_t *sinfo)
 {
 
 	int y,h,w;
-	int cw,ch;
+	int cw=0,ch=0;
 
 	w = y4m_si_get_plane_width(sinfo,0);
 	h = y4m_si_get_plane_height(sinfo,0);
-	cw = y4m_si_get_plane_width(sinfo,1);
-	ch = y4m_si_get_plane_height(sinfo,1);
+	// mono only has the luma to copy
+	if (y4m_si_get_plane_count(sinfo) > 1) {
+		cw = y4m_si_get_plane_width(sinfo,1);
+		ch = y4m_si_get_plane_height(sinfo,1);
+	}
 
 	//mjpeg_debug ("copy %d bytes to: %x from: %x",w,dst[0]+y*w,(src->data[0])+y*src->linesize[0]);
 
@@ -529,6 +577,8 @@ static void print_usage()
 			 "converts any media file recognised by libav to yuv4mpeg stream\n"
 			 "\n"
 			 "\t -w Write a PCM file not a video file\n"
+			 "\t -a <file> also write the audio to this file as PCM (WAV if it ends in .wav)\n"
+			 "\t   the files are only decoded once, the audio is cut to match the video\n"
 			 "\t -I<pbt> Force interlace mode overides parameters read from media file\n"
 			 "\t -F<n:d> Force framerate\n"
 			 "\t -f <fmt> Force format type (if incorrectly detected)\n"
@@ -539,6 +589,12 @@ static void print_usage()
 			 "\t -s select stream other than stream 0\n"
 			 "\t -o<outputfile> write to file rather than stdout\n"
 			 "\t -r [[[HH:]MM:]SS:]FF-[[[HH:]MM:]SS:]FF playout only these frames\n"
+			 "\t -X write a keyframe index (file.avki) for each file and exit\n"
+			 "\t   -r and EDL edits then seek to the keyframe before the cut\n"
+			 "\t -d<n|k> decode only the reference frames (n) or keyframes (k)\n"
+			 "\t   the last decoded frame is repeated for the others, so timing is kept\n"
+			 "\t -l<n> decode at 1/2^n of the size, if the codec can\n"
+			 "\t -m write the luma only (mono), the chroma is not converted or copied\n"
 			 "\t -E enable y4m extensions (may be required if source file is not a common format)\n"
 			 "\t -h print this help\n"
 			 );
@@ -556,11 +612,16 @@ int parseCommandline (int argc, char *argv[],
 					  int *str,
 					  AVInputFormat *av,
 					  char **rs,
-					  int *sr)
+					  int *sr,
+					  int *bi,
+					  char **af,
+					  int *sf,
+					  int *lr,
+					  int *luma)
 {
 
 	int i;
-	const static char *legal_flags = "EwchI:F:A:S:o:s:f:r:e:v:";
+	const static char *legal_flags = "EwchXmd:l:a:I:F:A:S:o:s:f:r:e:v:";
 
 	*aw=0;
 	*sct=AVMEDIA_TYPE_VIDEO;
@@ -570,6 +631,11 @@ int parseCommandline (int argc, char *argv[],
 	*con = 0;
 	*str = 0;
 	*sr = 0;
+	*bi = 0;
+	*af = NULL;
+	*sf = AVDISCARD_DEFAULT;
+	*lr = 0;
+	*luma = 0;
 	av = NULL;
 
 
@@ -649,6 +715,31 @@ int parseCommandline (int argc, char *argv[],
 				// would like to split into 2 parts to bring inline with EDL version
 				*sr=1;
 				break;
+			case 'X':
+				*bi = 1;
+				break;
+			case 'a':
+				*af = optarg;
+				break;
+			case 'd':
+				switch (optarg[0]) {
+					case 'n':  *sf = AVDISCARD_NONREF;  break;
+					case 'k':  *sf = AVDISCARD_NONKEY;  break;
+					default:
+						mjpeg_error("Unknown value for discard: '%c'", optarg[0]);
+						return -1;
+				}
+				break;
+			case 'l':
+				*lr = atoi(optarg);
+				if (*lr < 0) {
+					mjpeg_error("Lowres must be 0 or more");
+					return -1;
+				}
+				break;
+			case 'm':
+				*luma = 1;
+				break;
 			case 'v':
 				mjpeg_default_handler_verbosity (atoi (optarg));
 				break;
@@ -665,7 +756,7 @@ int parseCommandline (int argc, char *argv[],
 
 }
 
-int open_av_file (AVFormatContext **pfc, char *fn, AVInputFormat *avif, int st, int sct,AVCodecContext **pcc, AVCodec **pCodec)
+int open_av_file (AVFormatContext **pfc, char *fn, AVInputFormat *avif, int st, int sct,AVCodecContext **pcc, AVCodec **pCodec, int lowres)
 {
 
 	int i,avStream=-1;
@@ -735,6 +826,18 @@ int open_av_file (AVFormatContext **pfc, char *fn, AVInputFormat *avif, int st,
 		return -1; // Codec not found
 	}
 
+	// reduced size decoding has to be asked for before the codec is opened
+	if (lowres > 0 && sct == AVMEDIA_TYPE_VIDEO) {
+		if (lowres > (*pCodec)->max_lowres) {
+			if ((*pCodec)->max_lowres == 0)
+				mjpeg_warn("open_av_file: %s cannot decode at a lower resolution", (*pCodec)->name);
+			else
+				mjpeg_warn("open_av_file: %s can only decode at 1/%d size", (*pCodec)->name, 1 << (*pCodec)->max_lowres);
+			lowres = (*pCodec)->max_lowres;
+		}
+		pCodecCtx->lowres = lowres;
+	}
+
 	// Open codec
 #if LIBAVCODEC_VERSION_MAJOR < 53
 	if(avcodec_open(pCodecCtx, *pCodec)<0) {
@@ -752,6 +855,644 @@ int open_av_file (AVFormatContext **pfc, char *fn, AVInputFormat *avif, int st,
 	return avStream;
 }
 
+// keyframe index sidecar (file.avki) written by -X
+// every keyframe of the video stream with its timestamps, byte position
+// and the number of packets of the stream before it.  The sidecar is
+// ignored if the file has changed since it was written.
+
+#define KEYINDEX_MAGIC "AVKIDX1\n"
+#define KEYINDEX_SUFFIX ".avki"
+
+#ifndef AV_PKT_FLAG_KEY
+#define AV_PKT_FLAG_KEY PKT_FLAG_KEY
+#endif
+
+struct keyindex_header {
+	char magic[8];
+	int64_t size;
+	int64_t mtime;
+	int64_t frames;
+	int32_t stream;
+	int32_t keyframes;
+};
+
+struct keyframe {
+	int64_t pts;
+	int64_t dts;
+	int64_t pos;
+	int64_t frame;
+};
+
+struct keyindex {
+	int count;
+	int64_t frames;
+	struct keyframe *kf;
+};
+
+static int keyindex_name(char *name, int len, const char *filename)
+{
+	return snprintf(name, len, "%s" KEYINDEX_SUFFIX, filename) >= len;
+}
+
+static void keyindex_free(struct keyindex *ki)
+{
+	free(ki->kf);
+	ki->kf = NULL;
+	ki->count = 0;
+}
+
+static int keyindex_load(struct keyindex *ki, const char *filename, int stream)
+{
+	struct keyindex_header hdr;
+	struct stat st;
+	char name[PATH_MAX];
+	size_t len;
+	int fd;
+
+	if (stat(filename, &st) || keyindex_name(name, sizeof(name), filename))
+		return -1;
+	fd = open(name, O_RDONLY);
+	if (fd == -1)
+		return -1;
+
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+		memcmp(hdr.magic, KEYINDEX_MAGIC, 8) ||
+		hdr.size != st.st_size || hdr.mtime != st.st_mtime ||
+		hdr.stream != stream || hdr.keyframes < 0) {
+		mjpeg_debug("keyframe index %s is not for this file", name);
+		close(fd);
+		return -1;
+	}
+
+	len = sizeof(struct keyframe) * hdr.keyframes;
+	ki->kf = (struct keyframe *)malloc(len + sizeof(struct keyframe));
+	if (ki->kf == NULL || read(fd, ki->kf, len) != len) {
+		close(fd);
+		keyindex_free(ki);
+		return -1;
+	}
+	close(fd);
+
+	ki->count = hdr.keyframes;
+	ki->frames = hdr.frames;
+	mjpeg_info("Using keyframe index %s, %d keyframes", name, ki->count);
+	return 0;
+}
+
+// one pass over the packets of the file, nothing is decoded
+static int keyindex_build(char *filename, AVInputFormat *avif, int st)
+{
+	AVFormatContext *pFormatCtx = NULL;
+	AVCodecContext *pCodecCtx;
+	AVCodec *pCodec;
+	AVPacket packet;
+	struct keyindex_header hdr;
+	struct keyframe *kf = NULL, *grow;
+	struct stat sb;
+	char name[PATH_MAX];
+	int stream, count = 0, size = 0, fd, err = 0;
+	int64_t frames = 0;
+	size_t len;
+
+	if (stat(filename, &sb) || keyindex_name(name, sizeof(name), filename))
+		return -1;
+
+	stream = open_av_file(&pFormatCtx, filename, avif, st, AVMEDIA_TYPE_VIDEO, &pCodecCtx, &pCodec, 0);
+	if (stream == -1)
+		return -1;
+
+	while (av_read_frame(pFormatCtx, &packet) >= 0) {
+		if (packet.stream_index == stream) {
+			if (packet.flags & AV_PKT_FLAG_KEY) {
+				if (count == size) {
+					size = size ? size * 2 : 1024;
+					grow = (struct keyframe *)realloc(kf, size * sizeof(struct keyframe));
+					if (grow == NULL) {
+						err = -1;
+						break;
+					}
+					kf = grow;
+				}
+				kf[count].pts = packet.pts;
+				kf[count].dts = packet.dts;
+				kf[count].pos = packet.pos;
+				kf[count].frame = frames;
+				count++;
+			}
+			frames++;
+		}
+#if LIBAVCODEC_VERSION_MAJOR < 52
+		av_freep(&packet);
+#else
+		av_free_packet(&packet);
+#endif
+	}
+
+	avcodec_close(pCodecCtx);
+	av_close_input_file(pFormatCtx);
+
+	if (!err) {
+		memcpy(hdr.magic, KEYINDEX_MAGIC, 8);
+		hdr.size = sb.st_size;
+		hdr.mtime = sb.st_mtime;
+		hdr.frames = frames;
+		hdr.stream = stream;
+		hdr.keyframes = count;
+
+		len = sizeof(struct keyframe) * count;
+		fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		if (fd == -1 || write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || write(fd, kf, len) != len) {
+			err = -1;
+			unlink(name);
+		} else {
+			mjpeg_info("%s: %lld frames, %d keyframes", name, (long long)frames, count);
+		}
+		if (fd != -1)
+			close(fd);
+	}
+
+	free(kf);
+	return err;
+}
+
+// seeks to the last keyframe at or before frame if that is past where
+// decoding has got to.  Returns the frame number of the keyframe, or -1
+// to carry on decoding from here.  Packets before the keyframe's byte
+// position are to be dropped, *resync is set to it.
+static int64_t keyindex_seek(AVFormatContext *pFormatCtx, AVCodecContext *pCodecCtx, int stream,
+							 struct keyindex *ki, int64_t frame, int64_t current, int64_t *resync)
+{
+	struct keyframe *k;
+	int lo = 0, hi = ki->count - 1, mid;
+	int flags = AVSEEK_FLAG_BACKWARD;
+	int64_t ts;
+
+	if (ki->count == 0 || ki->kf[0].frame > frame)
+		return -1;
+
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (ki->kf[mid].frame <= frame)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	k = &ki->kf[lo];
+	if (k->frame <= current)
+		return -1;
+
+	ts = k->dts != AV_NOPTS_VALUE ? k->dts : k->pts;
+	if (ts == AV_NOPTS_VALUE) {
+		flags = AVSEEK_FLAG_BYTE;
+		ts = k->pos;
+	}
+	if (ts < 0 || av_seek_frame(pFormatCtx, stream, ts, flags) < 0) {
+		mjpeg_warn("Cannot seek to keyframe at frame %lld, decoding from the start", (long long)k->frame);
+		return -1;
+	}
+	avcodec_flush_buffers(pCodecCtx);
+
+	mjpeg_info("Seeking to keyframe at frame %lld", (long long)k->frame);
+	*resync = k->pos >= 0 ? k->pos : 0;
+	return k->frame;
+}
+
+// after a seek drops the packets before the keyframe that was asked for
+static int keyindex_resync(AVPacket *packet, int64_t *resync)
+{
+	if (*resync < 0)
+		return 0;
+	if (!(packet->flags & AV_PKT_FLAG_KEY) || (packet->pos >= 0 && packet->pos < *resync))
+		return 1;
+	*resync = -1;
+	return 0;
+}
+
+// combined video and audio (-a)
+// The audio packets read with the video go to a thread that decodes them
+// and writes PCM.  Each cut is trimmed to the samples of its frames, and at
+// the end of every cut the audio is padded with silence or cut back so it
+// is as long as the video written so far.
+
+#define AUDIO_QUEUE 256
+// how far past the end of a cut to read for its audio, in frames
+#define AUDIO_DRAIN 50
+#define WAV_HEADER 44
+
+#define AUDIO_PACKET 0
+#define AUDIO_EDIT_START 1
+#define AUDIO_EDIT_END 2
+#define AUDIO_QUIT 3
+
+struct audio_item {
+	int type;
+	AVPacket packet;
+	// AUDIO_EDIT_START: the samples of the cut, last -1 to the end of the file
+	int64_t first, last;
+	int newfile, seeked, mute;
+	// AUDIO_EDIT_END: video frames written in the cut
+	int64_t frames;
+};
+
+struct audio_out {
+	int fd;
+	int wav;
+	// the audio stream of the current file, -1 if it has none
+	int stream;
+	AVCodecContext *cc;
+	AVRational time_base;
+	int64_t start_time;
+	// the output format, from the first file with audio
+	int rate, channels;
+	y4m_ratio_t fps;
+	// the end of the current cut, for reading past the last frame
+	int64_t edit_last;
+	int edit_mute;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	struct audio_item q[AUDIO_QUEUE];
+	int head, count, busy;
+
+	// only used by the audio thread
+	int16_t *buffer;
+	int64_t position;
+	int64_t first, last;
+	int mute, resync;
+	int64_t frames;
+	int64_t written;
+	int error;
+};
+
+static int write_all(int fd, const uint8_t *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void put_le(uint8_t *p, uint32_t v, int bytes)
+{
+	int i;
+
+	for (i=0; i<bytes; i++)
+		p[i] = v >> (i * 8);
+}
+
+// 16 bit PCM, a length of ~0 for a stream that can't be rewound
+static void wav_header(uint8_t *h, int rate, int channels, uint32_t length)
+{
+	memcpy(h, "RIFF", 4);
+	put_le(h + 4, length == 0xffffffff ? length : length + WAV_HEADER - 8, 4);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	put_le(h + 16, 16, 4);
+	put_le(h + 20, 1, 2);
+	put_le(h + 22, channels, 2);
+	put_le(h + 24, rate, 4);
+	put_le(h + 28, rate * channels * 2, 4);
+	put_le(h + 32, channels * 2, 2);
+	put_le(h + 34, 16, 2);
+	memcpy(h + 36, "data", 4);
+	put_le(h + 40, length, 4);
+}
+
+// samples of audio in the first frames of video
+static int64_t audio_frame_samples(struct audio_out *ao, int64_t frames)
+{
+	return frames * ao->rate * ao->fps.d / ao->fps.n;
+}
+
+static void audio_write(struct audio_out *ao, const int16_t *samples, int64_t n)
+{
+	if (write_all(ao->fd, (const uint8_t *)samples, n * ao->channels * 2)) {
+		if (!ao->error)
+			mjpeg_error("Error writing audio: %s", strerror(errno));
+		ao->error = 1;
+	}
+	ao->written += n;
+}
+
+static void audio_pad(struct audio_out *ao, int64_t n)
+{
+	int64_t chunk, max = AVCODEC_MAX_AUDIO_FRAME_SIZE / (ao->channels * 2);
+
+	memset(ao->buffer, 0, AVCODEC_MAX_AUDIO_FRAME_SIZE);
+	while (n > 0) {
+		chunk = n < max ? n : max;
+		audio_write(ao, ao->buffer, chunk);
+		n -= chunk;
+	}
+}
+
+static void audio_decode(struct audio_out *ao, AVPacket *packet)
+{
+	AVPacket pkt = *packet;
+	int len, bytes, n;
+	int64_t s, e;
+
+	// after a seek the packet time says where in the audio this is
+	if (ao->resync && packet->pts != AV_NOPTS_VALUE) {
+		ao->position = av_rescale_q(packet->pts - ao->start_time, ao->time_base, (AVRational){1, ao->rate});
+		ao->resync = 0;
+	}
+
+	while (pkt.size > 0) {
+		bytes = AVCODEC_MAX_AUDIO_FRAME_SIZE;
+#if LIBAVCODEC_VERSION_MAJOR < 53
+		len = avcodec_decode_audio2(ao->cc, ao->buffer, &bytes, pkt.data, pkt.size);
+#else
+		len = avcodec_decode_audio3(ao->cc, ao->buffer, &bytes, &pkt);
+#endif
+		if (len < 0) {
+			mjpeg_warn("error decoding audio at PTS: %lld", (long long)packet->pts);
+			break;
+		}
+		pkt.data += len;
+		pkt.size -= len;
+
+		// the part of these samples inside the cut
+		n = bytes / (ao->channels * 2);
+		s = ao->position > ao->first ? ao->position : ao->first;
+		e = ao->position + n;
+		if (ao->last >= 0 && e > ao->last)
+			e = ao->last;
+		if (!ao->resync && !ao->mute && e > s)
+			audio_write(ao, ao->buffer + (s - ao->position) * ao->channels, e - s);
+		ao->position += n;
+	}
+}
+
+// makes the audio as long as the video written so far
+static void audio_edit_end(struct audio_out *ao, int64_t frames)
+{
+	int64_t target;
+
+	ao->frames += frames;
+	// nothing to match until a file with audio sets the format
+	if (ao->rate == 0)
+		return;
+	target = audio_frame_samples(ao, ao->frames);
+
+	if (ao->written < target) {
+		audio_pad(ao, target - ao->written);
+	} else if (ao->written > target) {
+		off_t length = (ao->wav ? WAV_HEADER : 0) + target * ao->channels * 2;
+		if (ftruncate(ao->fd, length) == 0 && lseek(ao->fd, length, SEEK_SET) == length)
+			ao->written = target;
+		else
+			mjpeg_warn("Audio is %lld samples longer than the video", (long long)(ao->written - target));
+	}
+}
+
+static void *audio_thread(void *arg)
+{
+	struct audio_out *ao = (struct audio_out *)arg;
+	struct audio_item item;
+
+	for (;;) {
+		pthread_mutex_lock(&ao->lock);
+		while (ao->count == 0)
+			pthread_cond_wait(&ao->not_empty, &ao->lock);
+		item = ao->q[ao->head];
+		ao->head = (ao->head + 1) % AUDIO_QUEUE;
+		ao->count--;
+		ao->busy = 1;
+		pthread_cond_broadcast(&ao->not_full);
+		pthread_mutex_unlock(&ao->lock);
+
+		switch (item.type) {
+			case AUDIO_PACKET:
+				// decoded even in a silent cut to keep count of where the audio is
+				audio_decode(ao, &item.packet);
+				av_free_packet(&item.packet);
+				break;
+			case AUDIO_EDIT_START:
+				if (item.newfile)
+					ao->position = 0;
+				ao->resync = item.seeked;
+				ao->first = item.first;
+				ao->last = item.last;
+				ao->mute = item.mute;
+				break;
+			case AUDIO_EDIT_END:
+				audio_edit_end(ao, item.frames);
+				break;
+		}
+
+		pthread_mutex_lock(&ao->lock);
+		ao->busy = 0;
+		pthread_cond_broadcast(&ao->not_full);
+		pthread_mutex_unlock(&ao->lock);
+
+		if (item.type == AUDIO_QUIT)
+			return NULL;
+	}
+}
+
+// blocks while the queue is full
+static void audio_put(struct audio_out *ao, struct audio_item *item)
+{
+	pthread_mutex_lock(&ao->lock);
+	while (ao->count == AUDIO_QUEUE)
+		pthread_cond_wait(&ao->not_full, &ao->lock);
+	ao->q[(ao->head + ao->count) % AUDIO_QUEUE] = *item;
+	ao->count++;
+	pthread_cond_signal(&ao->not_empty);
+	pthread_mutex_unlock(&ao->lock);
+}
+
+// waits until the thread has done everything queued
+static void audio_sync(struct audio_out *ao)
+{
+	pthread_mutex_lock(&ao->lock);
+	while (ao->count || ao->busy)
+		pthread_cond_wait(&ao->not_full, &ao->lock);
+	pthread_mutex_unlock(&ao->lock);
+}
+
+// the audio thread owns the packet after this
+static void audio_packet(struct audio_out *ao, AVPacket *packet)
+{
+	struct audio_item item;
+
+	if (av_dup_packet(packet) < 0)
+		return;
+	item.type = AUDIO_PACKET;
+	item.packet = *packet;
+	audio_put(ao, &item);
+	av_init_packet(packet);
+	packet->data = NULL;
+	packet->size = 0;
+}
+
+static void audio_edit_start(struct audio_out *ao, y4m_ratio_t fps, int64_t startFrame, int64_t endFrame,
+							 int newfile, int seeked, int mute)
+{
+	struct audio_item item;
+
+	ao->fps = fps;
+	item.type = AUDIO_EDIT_START;
+	item.first = audio_frame_samples(ao, startFrame);
+	item.last = endFrame < 0 ? -1 : audio_frame_samples(ao, endFrame + 1);
+	item.newfile = newfile;
+	item.seeked = seeked;
+	item.mute = mute || ao->stream == -1;
+	ao->edit_last = item.last;
+	ao->edit_mute = item.mute;
+	audio_put(ao, &item);
+}
+
+static void audio_edit_finish(struct audio_out *ao, int64_t frames)
+{
+	struct audio_item item;
+
+	item.type = AUDIO_EDIT_END;
+	item.frames = frames;
+	audio_put(ao, &item);
+	audio_sync(ao);
+}
+
+// the audio for the last frames of a cut may be later in the file than they are.
+// the video packets read past the cut are lost, so only drain a file that is closed after it
+static void audio_drain(struct audio_out *ao, AVFormatContext *pFormatCtx, int stream)
+{
+	AVPacket packet;
+	int frames = 0;
+	int64_t pos;
+
+	if (ao->edit_mute || ao->edit_last < 0)
+		return;
+
+	while (frames < AUDIO_DRAIN && av_read_frame(pFormatCtx, &packet) >= 0) {
+		if (packet.stream_index == stream) {
+			frames++;
+		} else if (packet.stream_index == ao->stream) {
+			// queued even when past the cut, the thread counts every sample
+			pos = packet.pts != AV_NOPTS_VALUE ?
+				av_rescale_q(packet.pts - ao->start_time, ao->time_base, (AVRational){1, ao->rate}) : -1;
+			audio_packet(ao, &packet);
+			if (pos >= ao->edit_last) {
+				av_free_packet(&packet);
+				break;
+			}
+		}
+		av_free_packet(&packet);
+	}
+}
+
+// the first audio stream of the file, the thread must be idle
+static void audio_open_stream(struct audio_out *ao, AVFormatContext *pFormatCtx, char *filename)
+{
+	AVCodec *codec;
+	AVStream *st;
+	int i;
+
+	ao->stream = -1;
+	for (i=0; i<pFormatCtx->nb_streams; i++)
+		if (pFormatCtx->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO) {
+			ao->stream = i;
+			break;
+		}
+	if (ao->stream == -1) {
+		mjpeg_warn("%s has no audio, writing silence", filename);
+		return;
+	}
+
+	st = pFormatCtx->streams[ao->stream];
+	ao->cc = st->codec;
+	codec = avcodec_find_decoder(ao->cc->codec_id);
+#if LIBAVCODEC_VERSION_MAJOR < 53
+	if (codec == NULL || avcodec_open(ao->cc, codec) < 0)
+#else
+	if (codec == NULL || avcodec_open2(ao->cc, codec, NULL) < 0)
+#endif
+		mjpeg_error_exit1("Cannot open the audio decoder for %s", filename);
+
+	ao->time_base = st->time_base;
+	ao->start_time = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+
+	if (ao->rate == 0) {
+		ao->rate = ao->cc->sample_rate;
+		ao->channels = ao->cc->channels;
+		mjpeg_info("Audio: %d Hz %d channels", ao->rate, ao->channels);
+		if (ao->wav) {
+			uint8_t h[WAV_HEADER];
+			wav_header(h, ao->rate, ao->channels, 0xffffffff);
+			if (write_all(ao->fd, h, WAV_HEADER))
+				mjpeg_error_exit1("Error writing audio: %s", strerror(errno));
+		}
+	} else if (ao->rate != ao->cc->sample_rate || ao->channels != ao->cc->channels) {
+		mjpeg_error_exit1("The audio of %s is %d Hz %d channels, not %d Hz %d channels",
+						  filename, ao->cc->sample_rate, ao->cc->channels, ao->rate, ao->channels);
+	}
+}
+
+static void audio_close_stream(struct audio_out *ao)
+{
+	if (ao->cc)
+		avcodec_close(ao->cc);
+	ao->cc = NULL;
+	ao->stream = -1;
+}
+
+static void audio_start(struct audio_out *ao, char *filename)
+{
+	int len = strlen(filename);
+
+	memset(ao, 0, sizeof(*ao));
+	ao->stream = -1;
+	ao->wav = len > 4 && !strcasecmp(filename + len - 4, ".wav");
+	ao->fd = open(filename, O_CREAT|O_WRONLY|O_TRUNC, 0644);
+	if (ao->fd == -1)
+		mjpeg_error_exit1("Cannot open %s for the audio", filename);
+
+	ao->buffer = (int16_t *)malloc(AVCODEC_MAX_AUDIO_FRAME_SIZE);
+	if (ao->buffer == NULL)
+		mjpeg_error_exit1("Cannot allocate the audio buffer");
+
+	pthread_mutex_init(&ao->lock, NULL);
+	pthread_cond_init(&ao->not_empty, NULL);
+	pthread_cond_init(&ao->not_full, NULL);
+	if (pthread_create(&ao->thread, NULL, audio_thread, ao))
+		mjpeg_error_exit1("Cannot start the audio thread");
+}
+
+static void audio_finish(struct audio_out *ao)
+{
+	struct audio_item item;
+	uint8_t h[WAV_HEADER];
+
+	item.type = AUDIO_QUIT;
+	audio_put(ao, &item);
+	pthread_join(ao->thread, NULL);
+	audio_close_stream(ao);
+
+	// the real lengths, when the output can be rewound
+	if (ao->wav && ao->rate && lseek(ao->fd, 0, SEEK_SET) == 0) {
+		wav_header(h, ao->rate, ao->channels, ao->written * ao->channels * 2);
+		write_all(ao->fd, h, WAV_HEADER);
+	}
+	close(ao->fd);
+	mjpeg_info("%lld audio samples written", (long long)ao->written);
+
+	pthread_cond_destroy(&ao->not_full);
+	pthread_cond_destroy(&ao->not_empty);
+	pthread_mutex_destroy(&ao->lock);
+	free(ao->buffer);
+}
+
 int init_video(y4m_ratio_t *yuv_frame_rate, int stream, AVFormatContext *pFormatCtx, y4m_ratio_t *yuv_aspect,
 			   int *convert, int *yuv_ss_mode, int *convert_mode, y4m_stream_info_t *si, AVFrame **pFrame)
 {
@@ -775,6 +1516,28 @@ int init_video(y4m_ratio_t *yuv_frame_rate, int stream, AVFormatContext *pFormat
 		yuv_aspect->d=1;
 	}
 
+	if (*yuv_ss_mode == Y4M_CHROMA_MONO && !*convert) {
+		// the luma of the planar formats is copied as it is, anything else goes through the scaler
+		switch (pCodecCtx->pix_fmt) {
+			case PIX_FMT_YUV420P:
+			case PIX_FMT_YUV422P:
+			case PIX_FMT_YUV444P:
+			case PIX_FMT_YUV411P:
+			case PIX_FMT_YUVJ420P:
+			case PIX_FMT_YUVJ422P:
+			case PIX_FMT_YUVJ444P:
+			case PIX_FMT_GRAY8:
+				break;
+			default:
+				*convert = 1;
+				break;
+		}
+		if (!*convert) {
+			mjpeg_info("Writing the luma only");
+			y4m_accept_extensions(1);
+		}
+	}
+
 	if (*convert) {
 		if (*yuv_ss_mode == Y4M_UNKNOWN) {
 			mjpeg_warn("init_video: Convert to Unknown Chroma Subsampling mode\n");
@@ -872,7 +1635,8 @@ int process_video (AVCodecContext  *pCodecCtx, AVFrame *pFrame, AVFrame **pFrame
 	//	mjpeg_debug ("decode video");
 
 	// will this cause dropped frames to be output...?? or simply crash.
-	while (!frameFinished) {
+	// frames discarded by -d never finish, the previous frame is written for them
+	for (;;) {
 #if LIBAVCODEC_VERSION_MAJOR < 52
 		bytesDecoded = avcodec_decode_video(pCodecCtx, pFrame, &frameFinished, packet->data, packet->size);
 #else
@@ -1032,7 +1796,10 @@ int process_video (AVCodecContext  *pCodecCtx, AVFrame *pFrame, AVFrame **pFrame
 	else
 		mjpeg_warn ("FRAME NOT FINISHED");
 	*/
+		if (frameFinished || pCodecCtx->skip_frame > AVDISCARD_DEFAULT)
+			break;
 	}
+	return frameFinished;
 }
 
 int main(int argc, char *argv[])
@@ -1070,6 +1837,13 @@ int main(int argc, char *argv[])
 	int edlfiles,edlcounter;
 	struct edlentry *edllist = NULL;
 	int skip=0;
+	int buildIndex = 0;
+	struct keyindex keyindex = { 0, 0, NULL };
+	int64_t keyFrame, preroll = 0, resync = -1;
+	char *audioFile = NULL;
+	struct audio_out ao;
+	int64_t editFrames = 0;
+	int skipFrame, lowres, lumaOnly;
 
 	uint8_t            *yuv_data[3] ;
 	struct SwsContext *img_convert_ctx =NULL;
@@ -1091,7 +1865,8 @@ int main(int argc, char *argv[])
 
 	// Parse commandline arguments
 	if (parseCommandline(argc,argv,&yuv_interlacing,&yuv_frame_rate,&yuv_aspect, &yuv_ss_mode,&fdOut,
-						 &audioWrite,&search_codec_type,&convert,&stream,avif,&rangeString,&subRange) == -1) {
+						 &audioWrite,&search_codec_type,&convert,&stream,avif,&rangeString,&subRange,&buildIndex,&audioFile,
+						 &skipFrame,&lowres,&lumaOnly) == -1) {
 		print_usage();
 		exit (-1);
 	}
@@ -1105,6 +1880,26 @@ int main(int argc, char *argv[])
 		return 0 ;
 	}
 
+	if (buildIndex) {
+		for (i=1; i<argc; i++)
+			if (keyindex_build(argv[i], avif, stream))
+				mjpeg_error_exit1("Cannot write the keyframe index for %s", argv[i]);
+		return 0;
+	}
+
+	if (lumaOnly) {
+		if (convert || (yuv_ss_mode != Y4M_UNKNOWN && yuv_ss_mode != Y4M_CHROMA_MONO))
+			mjpeg_error_exit1("-m writes mono, it cannot be used with another chroma mode");
+		yuv_ss_mode = Y4M_CHROMA_MONO;
+	}
+
+	ao.fd = -1;
+	if (audioFile) {
+		if (audioWrite)
+			mjpeg_error_exit1("-a writes the audio alongside the video, it cannot be used with -w");
+		audio_start(&ao, audioFile);
+	}
+
 	if (rangeString)
 		if (splitTimecode(&tc_in,&tc_out,rangeString)==-1) {
 			fprintf (stderr,"Timecode range, incorrect format. Should be:\n\t[[[hh:]mm:]ss:]ff-[[[hh:]mm:]ss:]ff\n\t[[[hh:]mm:]ss;]ff-[[[hh:]mm:]ss;]ff for NTSC drop code\nmm and ss may be 60 or greater if they are the leading digit.\nff maybe FPS or greater if leading digit\n");
@@ -1194,6 +1989,8 @@ int main(int argc, char *argv[])
 								}
 							}
 						} else {
+							if (ao.fd != -1)
+								audio_close_stream(&ao);
 							avcodec_close(pCodecCtx);
 							av_close_input_file(pFormatCtx);
 						}
@@ -1208,7 +2005,7 @@ int main(int argc, char *argv[])
 			if (!skip) {
 				if (newFile) {
 				//	fprintf (stderr,"not new file\n");
-					stream = open_av_file(&pFormatCtx, openfile, avif, stream, search_codec_type, &pCodecCtx, &pCodec);
+					stream = open_av_file(&pFormatCtx, openfile, avif, stream, search_codec_type, &pCodecCtx, &pCodec, lowres);
 					if (stream == -1) {
 						mjpeg_error("Error with video file: %s",openfile);
 					}
@@ -1232,10 +2029,15 @@ int main(int argc, char *argv[])
 							mjpeg_error_exit1("Error initialising video file: %s",openfile);
 							exit (-1);
 						}
+						pCodecCtx->skip_frame = skipFrame;
 						if (convert) {
 							img_convert_ctx = sws_getContext(pCodecCtx->width, pCodecCtx->height, pCodecCtx->pix_fmt,
 															 pCodecCtx->width, pCodecCtx->height, convert_mode, SWS_BICUBIC, NULL, NULL, NULL);
 						}
+						if (ao.fd != -1) {
+							audio_close_stream(&ao);
+							audio_open_stream(&ao, pFormatCtx, openfile);
+						}
 					} else {
 						numBytes = AVCODEC_MAX_AUDIO_FRAME_SIZE;
 						if (tc_in) {
@@ -1273,6 +2075,28 @@ int main(int argc, char *argv[])
 						}
 						frameCounter = 0; sampleCounter = 0;
 					}
+
+					keyindex_free(&keyindex);
+					if (tc_in && audioWrite==0)
+						keyindex_load(&keyindex, openfile, stream);
+				}
+
+				// jump to the keyframe before the cut rather than decoding up to it
+				preroll = startFrame - 25;
+				keyFrame = -1;
+				if (tc_in && audioWrite==0 && keyindex.kf) {
+					keyFrame = keyindex_seek(pFormatCtx, pCodecCtx, stream, &keyindex, startFrame, frameCounter, &resync);
+					if (keyFrame >= 0) {
+						frameCounter = keyFrame;
+						// decode everything from the keyframe, it is the reference for what follows
+						preroll = keyFrame;
+					}
+				}
+
+				if (ao.fd != -1) {
+					audio_edit_start(&ao, yuv_frame_rate, tc_in ? startFrame : 0, tc_in ? endFrame : -1,
+									 newFile, keyFrame >= 0, edllist && !edllist[edlcounter].audio);
+					editFrames = 0;
 				}
 
 #ifdef DEBUG
@@ -1283,14 +2107,14 @@ int main(int argc, char *argv[])
 
 				//	fprintf (stderr,"loop until nothing left (%x:%x)\n",pFormatCtx,&packet);
 				// Loop until nothing read
-				while(av_read_frame(pFormatCtx, &packet)>=0 && !finishedit)
+				while(!finishedit && av_read_frame(pFormatCtx, &packet)>=0)
 				{
 
 					// fprintf (stderr,"inside loop until nothing left searching for stream %d==%d with %x\n",stream,packet.stream_index,pFormatCtx);
 
 
 					// Is this a packet from the desired stream?
-					if(packet.stream_index==stream)
+					if(packet.stream_index==stream && !keyindex_resync(&packet, &resync))
 					{
 						// Decode video frame
 						//fprintf (stderr,"check for audio write\n");
@@ -1302,6 +2126,8 @@ int main(int argc, char *argv[])
 								process_video (pCodecCtx, pFrame, &pFrame444, &packet, &buffer,
 											   &header_written, &yuv_interlacing, convert, convert_mode, &streaminfo,
 											   yuv_data, fdOut, &frameinfo,1,img_convert_ctx);
+								if (header_written)
+									editFrames++;
 
 							} else
 							/*
@@ -1313,7 +2139,7 @@ int main(int argc, char *argv[])
 							 }
 							 */
 
-								if (frameCounter >= (startFrame-25) && frameCounter< startFrame) {
+								if (frameCounter >= preroll && frameCounter< startFrame) {
 
 									// need to decode about 1 second before the start but not write until the correct frame.
 									// decode without writing
@@ -1424,6 +2250,8 @@ int main(int argc, char *argv[])
 						 fprintf (stderr,"SKIPPED COUNTING FRAME...\n");
 						 }
 						 */
+					} else if (ao.fd != -1 && packet.stream_index == ao.stream) {
+						audio_packet(&ao, &packet);
 					}
 
 
@@ -1438,6 +2266,12 @@ int main(int argc, char *argv[])
 					//fprintf (stderr,"End Loop : %x  %x\n",pFormatCtx, &packet);
 
 				}
+
+				if (ao.fd != -1) {
+					if (finishedit && !edl_next_in_file(edllist, edlfiles, edlcounter, openfile))
+						audio_drain(&ao, pFormatCtx, stream);
+					audio_edit_finish(&ao, editFrames);
+				}
 			}
 
 			// Free the packet that was allocated by av_read_frame
@@ -1450,6 +2284,9 @@ int main(int argc, char *argv[])
 
 	}
 
+	if (ao.fd != -1)
+		audio_finish(&ao);
+
 	if (audioWrite==0) {
 		// Free the YUV frame
 		mjpeg_debug("Freeing pFrame: %x",pFrame);
@@ -1507,5 +2344,6 @@ int main(int argc, char *argv[])
 	}
 	if(edllist!=NULL)
 		free(edllist);
+	keyindex_free(&keyindex);
     return 0;
 }
@@ -17,6 +17,10 @@
 **<p>The demuxer works quite well, however the muxing part still has bugs and
 **has not correctly produced a working file.  This is still a work in progress.
 **</p>
+**<p>Muxing now runs a read ahead thread per input file, each with a large
+**IO buffer, feeding a queue of packets.  The main thread takes the packet with
+**the lowest DTS from the queues and writes it, so the reads for each input
+**no longer wait on the writes.  Throughput and queue depth are printed to stderr.</p>
 */
 
 #include <libavcodec/avcodec.h>
@@ -28,6 +32,14 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+
+#include "progress.h"
+
+#define DEFAULT_IO_BUFFER (4 * 1024 * 1024)
+#define DEFAULT_QUEUE_LENGTH 512
 
 
 static void print_usage()
@@ -38,28 +50,254 @@ static void print_usage()
 		   "Single input file will demux into streams\n"
 		   "Multiple files mux into output file specified by -o\n"
 		   "-F specifies the container format (avi, mov, asf, mpegps...)\n"
+		   "-b <bytes> IO buffer size for each file (default 4194304)\n"
+		   "-q <packets> read ahead queue length for each input (default 512)\n"
            "\n"
          );
 }
 
-/* libav demuxer
- * expects an array of open files, one per stream
+/* packet queue between a read ahead thread and the writer */
+
+struct packet_queue {
+	AVPacket *pkt;
+	int size;
+	int head;
+	int count;
+	int eof;
+	// the writer has given up, the reader stops
+	int abort;
+	int peak;
+	int64_t depth_total;
+	int64_t depth_samples;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+};
+
+struct mux_input {
+	AVFormatContext *fc;
+	AVStream *out_st;
+	struct packet_queue q;
+	int64_t bytes;
+	pthread_t thread;
+	int running;
+};
+
+int queue_init (struct packet_queue *q, int size)
+{
+	q->pkt = (AVPacket *) malloc (sizeof(AVPacket) * size);
+	if (!q->pkt)
+		return -1;
+	q->size = size;
+	q->head = 0;
+	q->count = 0;
+	q->eof = 0;
+	q->abort = 0;
+	q->peak = 0;
+	q->depth_total = 0;
+	q->depth_samples = 0;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+	return 0;
+}
+
+void queue_free (struct packet_queue *q)
+{
+	while (q->count) {
+		av_free_packet(&q->pkt[q->head]);
+		q->head = (q->head + 1) % q->size;
+		q->count--;
+	}
+	pthread_cond_destroy(&q->not_full);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_mutex_destroy(&q->lock);
+	free(q->pkt);
+}
+
+// blocks while the queue is full, returns -1 without queueing once aborted
+int queue_put (struct packet_queue *q, AVPacket *pkt)
+{
+	pthread_mutex_lock(&q->lock);
+	while (q->count == q->size && !q->abort)
+		pthread_cond_wait(&q->not_full, &q->lock);
+	if (q->abort) {
+		pthread_mutex_unlock(&q->lock);
+		return -1;
+	}
+	q->pkt[(q->head + q->count) % q->size] = *pkt;
+	q->count++;
+	if (q->count > q->peak)
+		q->peak = q->count;
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->lock);
+	return 0;
+}
+
+void queue_abort (struct packet_queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->abort = 1;
+	pthread_cond_signal(&q->not_full);
+	pthread_mutex_unlock(&q->lock);
+}
+
+void queue_set_eof (struct packet_queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->eof = 1;
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->lock);
+}
+
+// waits for the next packet without removing it.
+// returns NULL once the reader has finished and the queue is drained.
+AVPacket *queue_peek (struct packet_queue *q)
+{
+	AVPacket *pkt = NULL;
+
+	pthread_mutex_lock(&q->lock);
+	while (q->count == 0 && !q->eof)
+		pthread_cond_wait(&q->not_empty, &q->lock);
+	if (q->count) {
+		pkt = &q->pkt[q->head];
+		q->depth_total += q->count;
+		q->depth_samples++;
+	}
+	pthread_mutex_unlock(&q->lock);
+	return pkt;
+}
+
+// the caller owns the packet data after this
+void queue_pop (struct packet_queue *q, AVPacket *pkt)
+{
+	pthread_mutex_lock(&q->lock);
+	*pkt = q->pkt[q->head];
+	q->head = (q->head + 1) % q->size;
+	q->count--;
+	pthread_cond_signal(&q->not_full);
+	pthread_mutex_unlock(&q->lock);
+}
+
+int queue_depth (struct packet_queue *q)
+{
+	int c;
+	pthread_mutex_lock(&q->lock);
+	c = q->count;
+	pthread_mutex_unlock(&q->lock);
+	return c;
+}
+
+// read ahead thread, one per input file.
+void *read_input (void *arg)
+{
+	struct mux_input *in = (struct mux_input *)arg;
+	AVPacket packet;
+
+	while (av_read_frame(in->fc, &packet) >= 0) {
+		// elementary streams only have the one stream
+		if (packet.stream_index != 0) {
+			av_free_packet(&packet);
+			continue;
+		}
+		// the demuxer may own the packet data, take a copy before queueing
+		if (av_dup_packet(&packet) < 0) {
+			av_free_packet(&packet);
+			break;
+		}
+		in->bytes += packet.size;
+		if (queue_put(&in->q, &packet)) {
+			av_free_packet(&packet);
+			break;
+		}
+	}
+	queue_set_eof(&in->q);
+	return NULL;
+}
+
+// packet time in AV_TIME_BASE units, used to interleave the inputs.
+int64_t packet_time (struct mux_input *in, AVPacket *pkt)
+{
+	int64_t t = pkt->dts;
+
+	if (t == AV_NOPTS_VALUE)
+		t = pkt->pts;
+	if (t == AV_NOPTS_VALUE)
+		return INT64_MIN;
+	return av_rescale_q(t, in->fc->streams[0]->time_base, AV_TIME_BASE_Q);
+}
+
+double elapsed (struct timeval *start)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+void print_mux_status (struct mux_input *in, int len, int64_t written, double secs, char end)
+{
+	int i;
+
+	if (secs <= 0)
+		secs = 1;
+
+	fprintf (stderr,"muxed %lld bytes %.2f MB/s queue",(long long)written, written / secs / 1048576);
+	for (i = 1; i < len; i++)
+		fprintf (stderr," %d/%d",queue_depth(&in[i].q),in[i].q.size);
+	fprintf (stderr,"%c",end);
+}
+
+// stops the read ahead threads and closes the input files
+void close_inputs (struct mux_input *in, int len)
+{
+	int i;
+
+	for (i = 1; i < len; i++) {
+		if (in[i].running) {
+			queue_abort(&in[i].q);
+			pthread_join(in[i].thread, NULL);
+		}
+		if (in[i].q.pkt)
+			queue_free(&in[i].q);
+		if (in[i].fc)
+			av_close_input_file(in[i].fc);
+	}
+	free(in);
+}
+
+// the output streams share the inputs' codec contexts, which are freed with the inputs
+void close_output (AVFormatContext *oc, int opened)
+{
+	int i;
+
+	for(i = 0; i < oc->nb_streams; i++) {
+		oc->streams[i]->codec = NULL;
+		av_freep(&oc->streams[i]);
+	}
+	if (opened)
+		url_fclose(oc->pb);
+	av_free(oc);
+}
+
+/* libav muxer
+ * expects an array of file names, one per stream
  */
 
 
-int mux_files (char *outname, char **inname, int len, char *format) {
+int mux_files (char *outname, char **inname, int len, char *format, int io_buffer, int queue_length) {
 
 	int i;
-	AVFormatContext **pFormatCtx;
 	AVOutputFormat *fmt;
 	AVFormatContext *oc;
-	AVStream *audio_st, *video_st;
-	AVPacket packet;
-	double audio_pts, video_pts;
-	int audio,video;
-	int read_bytes=0;
-	unsigned int audio_bytes=0;
-	unsigned int video_bytes=0;
+	AVStream *audio_st=NULL, *video_st=NULL;
+	AVPacket packet,*next;
+	struct mux_input *in;
+	int audio=0,video=0;
+	int best, size, opened=0;
+	int64_t t, best_t;
+	int64_t written=0;
+	struct timeval start;
+	double last_report=0, secs;
 
 
 
@@ -84,7 +322,12 @@ int mux_files (char *outname, char **inname, int len, char *format) {
     snprintf(oc->filename, sizeof(oc->filename), "%s", outname);
 
 	//fprintf (stderr,"list len: %d\n",len);
-	pFormatCtx = (AVFormatContext **) malloc (sizeof(AVFormatContext *) * len);
+	in = (struct mux_input *) calloc (len, sizeof(struct mux_input));
+	if (!in) {
+		fprintf(stderr, "couldn't allocate memory for inputs\n");
+		av_free(oc);
+		return -1;
+	}
 
 
 // TODO: Need to re order the streams so that the video is added first
@@ -92,18 +335,21 @@ int mux_files (char *outname, char **inname, int len, char *format) {
 
 	for (i =1; i < len; i++) {
 		//fprintf (stderr,"file %d: %s\n",i,inname[i]);
-		if(av_open_input_file(&pFormatCtx[i], inname[i], NULL, 0, NULL)!=0)
-			return -1;
-		if(av_find_stream_info(pFormatCtx[i])<0)
-			return -1; // Couldn't find stream information
+		// the buffer size argument gives each input a large read buffer
+		if(av_open_input_file(&in[i].fc, inname[i], NULL, io_buffer, NULL)!=0) {
+			in[i].fc = NULL;
+			goto fail;
+		}
+		if(av_find_stream_info(in[i].fc)<0)
+			goto fail; // Couldn't find stream information
 
 
-		dump_format(pFormatCtx[i], i, inname[i], 0);
+		dump_format(in[i].fc, i, inname[i], 0);
 
-		if(pFormatCtx[i]->streams[0]->codec->codec_type==CODEC_TYPE_VIDEO)
+		if(in[i].fc->streams[0]->codec->codec_type==CODEC_TYPE_VIDEO)
 		{
 
-			fprintf (stderr,"Video FR: %d/%d\n",pFormatCtx[i]->streams[0]->codec ->time_base.num , pFormatCtx[i]->streams[0]->codec ->time_base.den);
+			fprintf (stderr,"Video FR: %d/%d\n",in[i].fc->streams[0]->codec ->time_base.num , in[i].fc->streams[0]->codec ->time_base.den);
 
 
 			video_st = av_new_stream(oc,0);
@@ -111,13 +357,15 @@ int mux_files (char *outname, char **inname, int len, char *format) {
 
 			if (!video_st) {
 				fprintf(stderr, "Could not alloc stream\n");
-				return -1;
+				goto fail;
 			}
 			video = i;
-			video_st->codec = pFormatCtx[i]->streams[0]->codec;
-			video_st->codec->time_base.num = 1; // pFormatCtx[i]->streams[0]->codec ->time_base.num;
-			video_st->codec->time_base.den = 25; // pFormatCtx[i]->streams[0]->codec ->time_base.den;
-	//		video_st->codec->codec_id = pFormatCtx[i]->streams[0]->codec->codec_id;
+			in[i].out_st = video_st;
+			av_freep(&video_st->codec);
+			video_st->codec = in[i].fc->streams[0]->codec;
+			video_st->codec->time_base.num = 1; // in[i].fc->streams[0]->codec ->time_base.num;
+			video_st->codec->time_base.den = 25; // in[i].fc->streams[0]->codec ->time_base.den;
+	//		video_st->codec->codec_id = in[i].fc->streams[0]->codec->codec_id;
 
 			fprintf (stderr,"Video codec FR %d/%d\n", video_st->codec->time_base.num , video_st->codec->time_base.den);
 
@@ -127,23 +375,25 @@ int mux_files (char *outname, char **inname, int len, char *format) {
 			if(oc->oformat->flags & AVFMT_GLOBALHEADER)
 				video_st->codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
 			// fprintf (stderr,"video codec: %s\n",oc->streams[0]->codec->codec->name);
-			fprintf (stderr,"video format: %s\n",pFormatCtx[i]->iformat->name);
+			fprintf (stderr,"video format: %s\n",in[i].fc->iformat->name);
 
 
 
-		} else if (pFormatCtx[i]->streams[0]->codec->codec_type==CODEC_TYPE_AUDIO) {
+		} else if (in[i].fc->streams[0]->codec->codec_type==CODEC_TYPE_AUDIO) {
 			audio_st = av_new_stream(oc,1);
-		//	audio_st = add_audio_stream(oc,pFormatCtx[i]->streams[0]->codec);
+		//	audio_st = add_audio_stream(oc,in[i].fc->streams[0]->codec);
 
 			if (!audio_st) {
 				fprintf(stderr, "Could not alloc stream\n");
-				return -1;
+				goto fail;
 			}
 			audio=i;
-			audio_st->codec = pFormatCtx[i]->streams[0]->codec;
+			in[i].out_st = audio_st;
+			av_freep(&audio_st->codec);
+			audio_st->codec = in[i].fc->streams[0]->codec;
 
 			// fprintf (stderr,"audio codec: %s\n",oc->streams[1]->codec->codec->name);
-						fprintf (stderr,"audio format: %s\n",pFormatCtx[i]->iformat->name);
+						fprintf (stderr,"audio format: %s\n",in[i].fc->iformat->name);
 
 		}
 	}
@@ -152,7 +402,7 @@ int mux_files (char *outname, char **inname, int len, char *format) {
 
 	if (av_set_parameters(oc, NULL) < 0) {
         fprintf(stderr, "Invalid output format parameters\n");
-        return -1;
+		goto fail;
     }
 
 
@@ -161,8 +411,10 @@ int mux_files (char *outname, char **inname, int len, char *format) {
 	if (!(fmt->flags & AVFMT_NOFILE)) {
         if (url_fopen(&oc->pb, outname, URL_WRONLY) < 0) {
             fprintf(stderr, "Could not open '%s'\n", outname);
-			return -1;
+			goto fail;
         }
+		opened = 1;
+		url_setbufsize(oc->pb, io_buffer);
     }
 
 
@@ -171,107 +423,97 @@ fprintf (stderr,"Video file: %d Audio File: %d\n",video,audio);
 
 	av_write_header(oc);
 
-//fprintf (stderr,"while...\n");
-
-/* need to re-engineer this part of the muxing code */
-    while(read_bytes>=0) {
-        /* compute current audio and video time */
-        if (audio_st)
-            audio_pts = (double)audio_st->pts.val * audio_st->time_base.num / audio_st->time_base.den;
-        else
-            audio_pts = 0.0;
-
-        if (video_st)
-            video_pts = (double)video_st->pts.val * video_st->codec->time_base.num / video_st->codec->time_base.den;
-        else
-            video_pts = 0.0;
-
-/*
-        if ((!audio_st || audio_pts >= STREAM_DURATION) &&
-            (!video_st || video_pts >= STREAM_DURATION))
-            break;
-*/
-
-	//	fprintf (stderr,"audio or video...\n");
-
-//fprintf (stderr,"PTS A: %d  V: %d \n",audio_st->pts.val,video_st->pts.val);
-
-
-        /* write interleaved audio and video frames */
-        if (!video_st || (video_st && audio_st && audio_pts < video_pts)) {
-           // write_audio_frame(oc, audio_st);
-
-			//fprintf (stderr,"read audio...\n");
-
-			read_bytes=av_read_frame(pFormatCtx[audio], &packet);
-				audio_bytes += packet.size;
-				packet.stream_index=1;
-		//	fprintf (stderr,"OUT A: PTS %d DTS %d\n",packet.pts,packet.dts);
-
-			//	packet.pts = audio_st->pts.val;
-			//	packet.dts = audio_st->cur_dts;
-
-				av_interleaved_write_frame(oc, &packet);
-
-//				av_write_frame(oc, &packet);
-				av_free_packet(&packet);
-
-        } else {
-           // write_video_frame(oc, video_st);
-
-
-			//fprintf (stderr,"read video...\n");
-
-		read_bytes=av_read_frame(pFormatCtx[video], &packet);
-
-				video_bytes+=packet.size;
-
-				packet.stream_index=0;
-	//		fprintf (stderr,"OUT V: PTS %d DTS %d\n",packet.pts,packet.dts);
-
-			//	packet.pts = video_st->pts.val;
-			//	packet.dts = video_st->cur_dts;
-
-			//fprintf (stderr,"write video...\n");
-
-			// a
-
-//			packet.pts= av_rescale_q(c->coded_frame->pts, c->time_base, st->time_base);
-
-
-				//av_write_frame(oc, &packet);
-				av_interleaved_write_frame(oc, &packet);
-
-				av_free_packet(&packet);
-
-        }
-
-    }
+	// start the read ahead threads, inputs that are neither audio nor video are ignored
+	for (i = 1; i < len; i++) {
+		if (queue_init(&in[i].q, queue_length)) {
+			fprintf(stderr, "couldn't allocate memory for packet queue\n");
+			in[i].q.pkt = NULL;
+			goto fail;
+		}
+		if (!in[i].out_st) {
+			in[i].q.eof = 1;
+			continue;
+		}
+		if (pthread_create(&in[i].thread, NULL, read_input, &in[i])) {
+			fprintf(stderr, "Could not start read thread for '%s'\n", inname[i]);
+			goto fail;
+		}
+		in[i].running = 1;
+	}
 
-	// post calculate the bitrate...
+	gettimeofday(&start, NULL);
+
+	// write the queued packet with the lowest DTS until every input is drained
+	for (;;) {
+		best = -1;
+		best_t = INT64_MAX;
+		for (i = 1; i < len; i++) {
+			next = queue_peek(&in[i].q);
+			if (next) {
+				t = packet_time(&in[i], next);
+				if (best == -1 || t < best_t) {
+					best = i;
+					best_t = t;
+				}
+			}
+		}
+		if (best == -1)
+			break;
+
+		queue_pop(&in[best].q, &packet);
+
+		packet.stream_index = in[best].out_st->index;
+		if (packet.pts != AV_NOPTS_VALUE)
+			packet.pts = av_rescale_q(packet.pts, in[best].fc->streams[0]->time_base, in[best].out_st->time_base);
+		if (packet.dts != AV_NOPTS_VALUE)
+			packet.dts = av_rescale_q(packet.dts, in[best].fc->streams[0]->time_base, in[best].out_st->time_base);
+
+		// writing the packet clears it
+		size = packet.size;
+		written += size;
+		av_interleaved_write_frame(oc, &packet);
+		av_free_packet(&packet);
+
+		if (progress_stats_enabled)
+			for (i = 1; i < len; i++)
+				progress_queue(i - 1, queue_depth(&in[i].q), in[i].q.size);
+		progress_frame(size);
+
+		secs = elapsed(&start);
+		if (secs - last_report >= 1.0) {
+			last_report = secs;
+			print_mux_status(in, len, written, secs, '\r');
+		}
+	}
 
-//fprintf (stderr,"PTS A: %g %u V: %g %u\n",audio_pts,audio_bytes,video_pts,video_bytes);
+	secs = elapsed(&start);
+	print_mux_status(in, len, written, secs, '\n');
 
+	// the trailer still needs the inputs' codec contexts
 	av_write_trailer(oc);
-    for(i = 0; i < oc->nb_streams; i++) {
-        av_freep(&oc->streams[i]->codec);
-        av_freep(&oc->streams[i]);
-    }
-
-    if (!(fmt->flags & AVFMT_NOFILE)) {
-        /* close the output file */
-        url_fclose(oc->pb);
-    }
 
-
-	av_free(oc);
+	for (i = 1; i < len; i++) {
+		if (in[i].running) {
+			pthread_join(in[i].thread, NULL);
+			in[i].running = 0;
+		}
+		if (in[i].q.depth_samples)
+			fprintf (stderr,"%s: read %lld bytes, queue peak %d average %.1f\n",inname[i],(long long)in[i].bytes,
+					 in[i].q.peak, (double)in[i].q.depth_total / in[i].q.depth_samples);
+	}
+	close_inputs(in, len);
+	close_output(oc, opened);
 
     return 0;
 
+fail:
+	close_inputs(in, len);
+	close_output(oc, opened);
+	return -1;
 
 }
 
-int demux_file (char *filen)
+int demux_file (char *filen, int io_buffer)
 {
 
 	AVFormatContext *pFormatCtx;
@@ -281,7 +523,7 @@ int demux_file (char *filen)
 	int i;
 
     // Open video file
-    if(av_open_input_file(&pFormatCtx, filen, NULL, 0, NULL)!=0)
+    if(av_open_input_file(&pFormatCtx, filen, NULL, io_buffer, NULL)!=0)
         return -1; // Couldn't open file
 
     // Retrieve stream information
@@ -344,10 +586,12 @@ int main(int argc, char *argv[])
 	int mode = MODE_DEMUX;
 	char *containername = NULL;
 	char *outname;
+	int io_buffer = DEFAULT_IO_BUFFER;
+	int queue_length = DEFAULT_QUEUE_LENGTH;
 
 	// Parse Args
 
-	const static char *legal_flags = "F:o:h?";
+	const static char *legal_flags = "F:o:b:q:h?";
 
 	while ((i = getopt (argc, argv, legal_flags)) != -1) {
 		fprintf (stderr,"checking opt: %c\n",i);
@@ -361,6 +605,20 @@ int main(int argc, char *argv[])
 				containername = (char *) malloc (strlen(optarg)+1);
 				strcpy(containername,optarg);
 				break;
+			case 'b':
+				io_buffer = atoi(optarg);
+				if (io_buffer < 4096) {
+					fprintf (stderr,"IO buffer must be at least 4096 bytes\n");
+					return -1;
+				}
+				break;
+			case 'q':
+				queue_length = atoi(optarg);
+				if (queue_length < 1) {
+					fprintf (stderr,"Queue length must be at least 1\n");
+					return -1;
+				}
+				break;
 			case 'h':
 			case '?':
 			default:
@@ -384,12 +642,14 @@ int main(int argc, char *argv[])
     // Register all formats and codecs
     av_register_all();
 
+	progress_stats_init("libavmux");
+
 	if (mode == MODE_DEMUX) {
-		demux_file(argv[1]);
+		demux_file(argv[1], io_buffer);
 	}
 
 	if (mode == MODE_MUX) {
-		mux_files(outname, argv, argc, containername);
+		mux_files(outname, argv, argc, containername, io_buffer, queue_length);
 	}
 
 }
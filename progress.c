@@ -1,7 +1,15 @@
 #include <time.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdarg.h>
+
+#include "progress.h"
 
 
 off_t progress_bytes;
@@ -133,3 +141,241 @@ void progress_loadBar(off_t bytes)
 	fprintf  (stderr,"\r");
 	fflush(stderr);
 }
+
+
+
+/*
+** Stage instrumentation.
+** The counters are updated with atomic adds so the reader, writer and worker
+** threads of a pipelined tool can all report without taking a lock.
+** When PROGRESS_STATS is not set every call returns after testing one flag.
+*/
+
+int progress_stats_enabled = 0;
+static int progress_stats_ready = 0;
+
+static const char *progress_stage_name[PROGRESS_STAGES] = { "read", "process", "write" };
+
+static char progress_tool[64];
+static int progress_fd = 2;
+static int64_t progress_interval;
+static int64_t progress_start;
+static int64_t progress_next_report;
+
+static int64_t progress_stage_wall[PROGRESS_STAGES];
+static int64_t progress_stage_cpu[PROGRESS_STAGES];
+static int64_t progress_frames;
+static int64_t progress_frame_bytes;
+
+static int progress_queue_depth[PROGRESS_QUEUES];
+static int progress_queue_size[PROGRESS_QUEUES];
+
+static int64_t progress_last_time;
+static int64_t progress_last_frames;
+static int64_t progress_last_bytes;
+
+// nanosecond clocks
+static inline int64_t progress_wall_now(void)
+{
+	struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	ts.tv_sec = tv.tv_sec;
+	ts.tv_nsec = tv.tv_usec * 1000;
+#endif
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline int64_t progress_cpu_now(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#else
+	return (int64_t)clock() * (1000000000LL / CLOCKS_PER_SEC);
+#endif
+}
+
+static long progress_maxrss_kb(void)
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+	return ru.ru_maxrss / 1024;
+#else
+	return ru.ru_maxrss;
+#endif
+}
+
+// the end of the line always fits after the stages and queues
+#define PROGRESS_LINE 1024
+#define PROGRESS_LINE_END 64
+
+// appends to the n characters of line, a piece that doesn't fit before limit is left out
+static int progress_append(char *line, int n, int limit, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(line + n, limit - n, fmt, ap);
+	va_end(ap);
+	if (len < 0 || n + len >= limit) {
+		line[n] = '\0';
+		return n;
+	}
+	return n + len;
+}
+
+// writes one JSON line, in a single write so lines from several tools don't mix.
+static void progress_report(int64_t now, int final)
+{
+	char line[PROGRESS_LINE];
+	int n,s,q;
+	double secs, dt;
+	int64_t frames, bytes;
+
+	frames = progress_frames;
+	bytes = progress_frame_bytes;
+
+	secs = (now - progress_start) / 1e9;
+	if (final)
+		dt = secs;
+	else
+		dt = (now - progress_last_time) / 1e9;
+	if (dt <= 0)
+		dt = 1e-9;
+
+	n = progress_append(line, 0, PROGRESS_LINE - PROGRESS_LINE_END, "{\"tool\":\"%s\",\"pid\":%d,\"final\":%s,\"t\":%.3f,\"frames\":%lld,"
+				 "\"fps\":%.2f,\"MBps\":%.2f",
+				 progress_tool, (int)getpid(), final ? "true" : "false", secs, (long long)frames,
+				 (final ? frames : frames - progress_last_frames) / dt,
+				 (final ? bytes : bytes - progress_last_bytes) / dt / 1048576.0);
+
+	for (s = 0; s < PROGRESS_STAGES; s++)
+		n = progress_append(line, n, PROGRESS_LINE - PROGRESS_LINE_END, ",\"%s\":{\"wall\":%.3f,\"cpu\":%.3f}",
+					  progress_stage_name[s], progress_stage_wall[s] / 1e9, progress_stage_cpu[s] / 1e9);
+
+	n = progress_append(line, n, PROGRESS_LINE - PROGRESS_LINE_END, ",\"queues\":[");
+	for (q = 0; q < PROGRESS_QUEUES; q++)
+		if (progress_queue_size[q])
+			n = progress_append(line, n, PROGRESS_LINE - PROGRESS_LINE_END, "%s{\"id\":%d,\"depth\":%d,\"size\":%d}",
+						  n && line[n-1] == '[' ? "" : ",", q, progress_queue_depth[q], progress_queue_size[q]);
+
+	n = progress_append(line, n, PROGRESS_LINE, "],\"maxrss_kb\":%ld}\n", progress_maxrss_kb());
+
+	if (write(progress_fd, line, n) != n)
+		progress_stats_enabled = 0;
+
+	progress_last_time = now;
+	progress_last_frames = frames;
+	progress_last_bytes = bytes;
+}
+
+static void progress_stats_atexit(void)
+{
+	progress_stats_end();
+}
+
+// reads the environment, tool may be NULL to use the program name.
+void progress_stats_init(const char *tool)
+{
+	char *interval, *file;
+	double i;
+
+	if (progress_stats_ready)
+		return;
+	progress_stats_ready = 1;
+
+	interval = getenv("PROGRESS_STATS");
+	if (!interval)
+		return;
+
+	i = atof(interval);
+	if (i <= 0)
+		i = 1;
+	progress_interval = i * 1e9;
+
+	if (!tool) {
+#if defined(__GLIBC__)
+		extern char *program_invocation_short_name;
+		tool = program_invocation_short_name;
+#elif defined(__APPLE__) || defined(__FreeBSD__)
+		tool = getprogname();
+#else
+		tool = "unknown";
+#endif
+	}
+	strncpy(progress_tool, tool, sizeof(progress_tool) - 1);
+
+	file = getenv("PROGRESS_STATS_FILE");
+	if (file) {
+		progress_fd = open(file, O_WRONLY|O_CREAT|O_APPEND, 0644);
+		if (progress_fd == -1) {
+			fprintf(stderr,"progress: cannot open %s\n",file);
+			return;
+		}
+	}
+
+	progress_start = progress_wall_now();
+	progress_last_time = progress_start;
+	progress_next_report = progress_start + progress_interval;
+	progress_stats_enabled = 1;
+	atexit(progress_stats_atexit);
+}
+
+// prints the totals, called at exit.
+void progress_stats_end(void)
+{
+	if (!progress_stats_enabled)
+		return;
+	progress_report(progress_wall_now(), 1);
+	progress_stats_enabled = 0;
+	if (progress_fd != 2)
+		close(progress_fd);
+}
+
+void progress_stage_begin(progress_mark_t *m)
+{
+	if (!progress_stats_enabled)
+		return;
+	m->wall = progress_wall_now();
+	m->cpu = progress_cpu_now();
+}
+
+void progress_stage_end(int stage, progress_mark_t *m)
+{
+	if (!progress_stats_enabled)
+		return;
+	__sync_fetch_and_add(&progress_stage_wall[stage], progress_wall_now() - m->wall);
+	__sync_fetch_and_add(&progress_stage_cpu[stage], progress_cpu_now() - m->cpu);
+}
+
+void progress_frame(int64_t bytes)
+{
+	int64_t now, next;
+
+	if (!progress_stats_enabled)
+		return;
+
+	__sync_fetch_and_add(&progress_frames, 1);
+	__sync_fetch_and_add(&progress_frame_bytes, bytes);
+
+	now = progress_wall_now();
+	next = progress_next_report;
+	// only the thread that moves the report time on prints
+	if (now >= next && __sync_bool_compare_and_swap(&progress_next_report, next, now + progress_interval))
+		progress_report(now, 0);
+}
+
+void progress_queue(int q, int depth, int size)
+{
+	if (!progress_stats_enabled || q < 0 || q >= PROGRESS_QUEUES)
+		return;
+	progress_queue_depth[q] = depth;
+	progress_queue_size[q] = size;
+}
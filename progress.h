@@ -0,0 +1,51 @@
+#ifndef _PROGRESS_H_
+#define _PROGRESS_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// percentage bar from byte counts
+void progress_init(off_t b, off_t t);
+void progress_loadBar(off_t bytes);
+
+// Per stage instrumentation.
+// Turned on by setting PROGRESS_STATS to the report interval in seconds.
+// One JSON object per line is written to PROGRESS_STATS_FILE (appended to,
+// so a whole chain of tools can share the one file) or stderr.
+
+#define PROGRESS_STAGE_READ 0
+#define PROGRESS_STAGE_PROCESS 1
+#define PROGRESS_STAGE_WRITE 2
+#define PROGRESS_STAGES 3
+
+#define PROGRESS_QUEUES 8
+
+typedef struct {
+	int64_t wall;
+	int64_t cpu;
+} progress_mark_t;
+
+extern int progress_stats_enabled;
+
+void progress_stats_init(const char *tool);
+void progress_stats_end(void);
+
+// time a stage, begin and end may be called from any thread
+void progress_stage_begin(progress_mark_t *m);
+void progress_stage_end(int stage, progress_mark_t *m);
+
+// count a frame through the tool, also emits the periodic report
+void progress_frame(int64_t bytes);
+
+// queue occupancy for pipelined tools
+void progress_queue(int q, int depth, int size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
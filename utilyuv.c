@@ -1,5 +1,15 @@
 #include "utilyuv.h"
+#include "progress.h"
+#include "yuvspool.h"
 #include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <pthread.h>
 /*
 ** <p>this is a utility library. It doesn't do anything itself</p>
 
@@ -151,14 +161,9 @@ void copyfield(uint8_t *m[3],uint8_t *n[3],y4m_stream_info_t *sinfo, int which)
 		mjpeg_warn("copyfield() invalid interlace selected (%d)",which);
 	}
 
-	for (; r < h; r += 2)
-	{
-		memcpy(&m[0][r * w], &n[0][r * w], w);
-		if (r<ch) {
-			memcpy(&m[1][r*cw], &n[1][r*cw], cw);
-			memcpy(&m[2][r*cw], &n[2][r*cw], cw);
-		}
-	}
+	yuv_kernel.copyfield(m[0], n[0], w, h, r);
+	yuv_kernel.copyfield(m[1], n[1], cw, ch, r);
+	yuv_kernel.copyfield(m[2], n[2], cw, ch, r);
 }
 
 
@@ -171,9 +176,9 @@ void chromaset(uint8_t *m[3], y4m_stream_info_t  *sinfo, int y, int u, int v )
 	fs = y4m_si_get_plane_length(sinfo,0);
 	cfs = y4m_si_get_plane_length(sinfo,1);
 
-	memset (m[0],y,fs);
-	memset (m[1],u,cfs);
-	memset (m[2],v,cfs);
+	yuv_kernel.fill(m[0],y,fs);
+	yuv_kernel.fill(m[1],u,cfs);
+	yuv_kernel.fill(m[2],v,cfs);
 
 }
 
@@ -186,6 +191,29 @@ void chromafree(uint8_t *m[3])
 
 }
 
+int planealloc(uint8_t *m[YUV_MAX_PLANES], y4m_stream_info_t *sinfo)
+{
+	int p, err = 0;
+
+	for (p=0; p<YUV_MAX_PLANES; p++) {
+		m[p] = NULL;
+		if (p < y4m_si_get_plane_count(sinfo)) {
+			m[p] = (uint8_t *)malloc(y4m_si_get_plane_length(sinfo,p));
+			if (m[p] == NULL)
+				err = -1;
+		}
+	}
+	return err;
+}
+
+void planefree(uint8_t *m[YUV_MAX_PLANES])
+{
+	int p;
+
+	for (p=0; p<YUV_MAX_PLANES; p++)
+		free(m[p]);
+}
+
 // Get a pixel, with bounds checking.
 //how easy is it to make this for all planes
 uint8_t get_pixel(register int x, register int y, int plane, uint8_t *m[3],y4m_stream_info_t *si)
@@ -463,3 +491,1881 @@ void y4m_dump_frame(y4m_stream_info_t  *si, uint8_t *m[3])
 
 }
 
+// removes a tag of ours, so it isn't passed on by y4m_copy_stream_info()
+static const char *yuv_xtag_strip(y4m_stream_info_t *si, const char *prefix, char *tag, int len)
+{
+	y4m_xtag_list_t *xtags = y4m_si_xtags(si);
+	const char *x;
+	int n;
+
+	for (n=0; n<y4m_xtag_count(xtags); n++) {
+		x = y4m_xtag_get(xtags, n);
+		if (!strncmp(x, prefix, strlen(prefix))) {
+			strncpy(tag, x, len - 1);
+			tag[len - 1] = '\0';
+			y4m_xtag_remove(xtags, n);
+			return tag;
+		}
+	}
+	return NULL;
+}
+
+/*
+** Random access to y4m files.
+** The file is mapped and the frames are found by walking the FRAME lines,
+** or from a sidecar index (<file>.y4mi, written by yuvindex) if one is
+** present and still matches the file.  yuv_index_frame() returns plane
+** pointers into the mapping, nothing is copied.  The frames of a spool
+** file are decoded into a frame of the index's own, which the next
+** yuv_index_frame() reuses.
+*/
+
+#define YUV_INDEX_MAGIC "Y4MIDX1\n"
+#define YUV_INDEX_SUFFIX ".y4mi"
+
+struct yuv_index_header {
+	char magic[8];
+	int64_t size;
+	int64_t mtime;
+	int64_t first;
+	int32_t framelength;
+	int32_t frames;
+};
+
+static int yuv_index_sidecar_name(char *name, int len, const char *filename)
+{
+	return snprintf(name, len, "%s" YUV_INDEX_SUFFIX, filename) >= len;
+}
+
+static int yuv_index_read_sidecar(yuv_index_t *yi, const char *filename, struct stat *st)
+{
+	struct yuv_index_header hdr;
+	char name[PATH_MAX];
+	size_t len;
+	int fd;
+
+	if (yuv_index_sidecar_name(name, sizeof(name), filename))
+		return -1;
+	fd = open(name, O_RDONLY);
+	if (fd == -1)
+		return -1;
+
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+		memcmp(hdr.magic, YUV_INDEX_MAGIC, 8) ||
+		hdr.size != st->st_size || hdr.mtime != st->st_mtime || hdr.first != yi->first ||
+		hdr.framelength != y4m_si_get_framelength(&yi->si) || hdr.frames < 0) {
+		close(fd);
+		return -1;
+	}
+
+	len = sizeof(int64_t) * hdr.frames;
+	yi->offset = (int64_t *)malloc(len + sizeof(int64_t));
+	if (yi->offset == NULL || read(fd, yi->offset, len) != len) {
+		close(fd);
+		free(yi->offset);
+		yi->offset = NULL;
+		return -1;
+	}
+	close(fd);
+
+	yi->frames = hdr.frames;
+	return 0;
+}
+
+// walks the FRAME lines, the per frame parameters may make each line a different length
+static int yuv_index_scan(yuv_index_t *yi, off_t pos)
+{
+	int framelength = y4m_si_get_framelength(&yi->si);
+	int size = 1024;
+	struct yuv_spool_frame head;
+	uint8_t *nl;
+	size_t line;
+
+	yi->frames = 0;
+	yi->offset = (int64_t *)malloc(sizeof(int64_t) * size);
+	if (yi->offset == NULL)
+		return -1;
+
+	while (pos + 6 <= yi->length) {
+		if (memcmp(yi->map + pos, Y4M_FRAME_MAGIC, 5))
+			return -1;
+		line = yi->length - pos < Y4M_LINE_MAX ? yi->length - pos : Y4M_LINE_MAX;
+		nl = memchr(yi->map + pos, '\n', line);
+		if (nl == NULL)
+			return -1;
+		pos = nl - yi->map + 1;
+		// a spool frame says how long it is
+		if (yi->spool) {
+			if (pos + sizeof(head) > yi->length)
+				break;
+			memcpy(&head, yi->map + pos, sizeof(head));
+			if (memcmp(head.magic, YUV_SPOOL_MAGIC, 4))
+				return -1;
+			framelength = sizeof(head) + head.length;
+		}
+		// a truncated last frame is left out
+		if (pos + framelength > yi->length)
+			break;
+
+		if (yi->frames == size) {
+			int64_t *offset;
+			size *= 2;
+			offset = (int64_t *)realloc(yi->offset, sizeof(int64_t) * size);
+			if (offset == NULL)
+				return -1;
+			yi->offset = offset;
+		}
+		yi->offset[yi->frames++] = pos;
+		pos += framelength;
+	}
+	return 0;
+}
+
+static int yuv_index_map(yuv_index_t *yi, const char *filename)
+{
+	struct stat st;
+
+	// the first FRAME line, straight after the stream header
+	yi->first = lseek(yi->fd, 0, SEEK_CUR);
+	if (yi->first == -1 || fstat(yi->fd, &st) || !S_ISREG(st.st_mode))
+		return -1;
+
+	yi->length = st.st_size;
+	yi->map = mmap(NULL, yi->length, PROT_READ, MAP_SHARED, yi->fd, 0);
+	if (yi->map == MAP_FAILED) {
+		yi->map = NULL;
+		return -1;
+	}
+
+	if (filename && !yuv_index_read_sidecar(yi, filename, &st))
+		return 0;
+
+	return yuv_index_scan(yi, yi->first);
+}
+
+static void yuv_index_init(yuv_index_t *yi, int fd, int close_fd)
+{
+	yi->fd = fd;
+	yi->close_fd = close_fd;
+	yi->first = 0;
+	yi->map = NULL;
+	yi->length = 0;
+	yi->frames = 0;
+	yi->offset = NULL;
+	yi->spool = NULL;
+	yi->frame = NULL;
+	y4m_init_stream_info(&yi->si);
+}
+
+// the frames are decoded into yi->frame
+static int yuv_index_spool(yuv_index_t *yi)
+{
+	yi->spool = (yuv_spool_t *)malloc(sizeof(yuv_spool_t));
+	if (yi->spool == NULL)
+		return -1;
+	if (yuv_spool_init(yi->spool, &yi->si)) {
+		free(yi->spool);
+		yi->spool = NULL;
+		return -1;
+	}
+	yi->frame = (uint8_t *)malloc(y4m_si_get_framelength(&yi->si));
+	return yi->frame ? 0 : -1;
+}
+
+static int yuv_index_spool_tag(yuv_index_t *yi)
+{
+	char tag[Y4M_MAX_XTAG_SIZE + 1];
+
+	if (!yuv_xtag_strip(&yi->si, YUV_SPOOL_TAG, tag, sizeof(tag)))
+		return 0;
+	if (atoi(tag + strlen(YUV_SPOOL_TAG)) != YUV_SPOOL_VERSION)
+		return -1;
+	return yuv_index_spool(yi);
+}
+
+int yuv_index_open(yuv_index_t *yi, const char *filename)
+{
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return -1;
+
+	yuv_index_init(yi, fd, 1);
+	if (y4m_read_stream_header(fd, &yi->si) != Y4M_OK || yuv_index_spool_tag(yi) ||
+		yuv_index_map(yi, filename)) {
+		yuv_index_close(yi);
+		return -1;
+	}
+	return 0;
+}
+
+int yuv_index_fd(yuv_index_t *yi, int fd, const y4m_stream_info_t *si)
+{
+	char *filename = NULL;
+#if defined(__linux__)
+	char proc[64], path[PATH_MAX];
+	ssize_t len;
+
+	// finds the sidecar for a redirected stdin
+	snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+	len = readlink(proc, path, sizeof(path) - 1);
+	if (len > 0) {
+		path[len] = '\0';
+		filename = path;
+	}
+#endif
+
+	// the caller has read the stream header and keeps the fd,
+	// yuv_read_stream_header() has taken the spool tag off already
+	yuv_index_init(yi, fd, 0);
+	y4m_copy_stream_info(&yi->si, si);
+	if (yuv_index_spool_tag(yi) || (!yi->spool && yuv_spool_reading(fd) && yuv_index_spool(yi)) ||
+		yuv_index_map(yi, filename)) {
+		yuv_index_close(yi);
+		return -1;
+	}
+	return 0;
+}
+
+// the planes are read only
+int yuv_index_frame(yuv_index_t *yi, int n, uint8_t *m[3])
+{
+	uint8_t *p;
+	int c;
+
+	if (n < 0 || n >= yi->frames)
+		return Y4M_ERR_RANGE;
+
+	p = yi->map + yi->offset[n];
+	if (yi->spool) {
+		uint8_t *d[YUV_SPOOL_PLANES];
+
+		for (c=0, d[0]=yi->frame; c<y4m_si_get_plane_count(&yi->si) - 1; c++)
+			d[c+1] = d[c] + y4m_si_get_plane_length(&yi->si,c);
+		if (yuv_spool_decode(yi->spool, p, yi->length - yi->offset[n], d))
+			return Y4M_ERR_HEADER;
+		p = yi->frame;
+	}
+	m[1] = m[2] = NULL;
+	for (c=0; c<y4m_si_get_plane_count(&yi->si); c++) {
+		m[c] = p;
+		p += y4m_si_get_plane_length(&yi->si,c);
+	}
+	return Y4M_OK;
+}
+
+off_t yuv_index_end(yuv_index_t *yi, int n)
+{
+	struct yuv_spool_frame head;
+
+	if (yi->spool) {
+		memcpy(&head, yi->map + yi->offset[n], sizeof(head));
+		return yi->offset[n] + sizeof(head) + head.length;
+	}
+	return yi->offset[n] + y4m_si_get_framelength(&yi->si);
+}
+
+int yuv_index_write(yuv_index_t *yi, const char *filename)
+{
+	struct yuv_index_header hdr;
+	struct stat st;
+	char name[PATH_MAX];
+	size_t len;
+	int fd;
+
+	if (fstat(yi->fd, &st) || yuv_index_sidecar_name(name, sizeof(name), filename))
+		return -1;
+
+	memcpy(hdr.magic, YUV_INDEX_MAGIC, 8);
+	hdr.size = st.st_size;
+	hdr.mtime = st.st_mtime;
+	hdr.first = yi->first;
+	hdr.framelength = y4m_si_get_framelength(&yi->si);
+	hdr.frames = yi->frames;
+
+	fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd == -1)
+		return -1;
+
+	len = sizeof(int64_t) * yi->frames;
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || write(fd, yi->offset, len) != len) {
+		close(fd);
+		unlink(name);
+		return -1;
+	}
+	return close(fd);
+}
+
+void yuv_index_close(yuv_index_t *yi)
+{
+	if (yi->map)
+		munmap(yi->map, yi->length);
+	if (yi->close_fd)
+		close(yi->fd);
+	free(yi->offset);
+	if (yi->spool) {
+		yuv_spool_fini(yi->spool);
+		free(yi->spool);
+	}
+	free(yi->frame);
+	y4m_fini_stream_info(&yi->si);
+	yi->map = NULL;
+	yi->offset = NULL;
+	yi->spool = NULL;
+	yi->frame = NULL;
+	yi->fd = -1;
+}
+
+/*
+** Shared memory transport.
+** When YUV_SHM is set in the writer's environment and its output is a pipe,
+** yuv_write_stream_header() puts a ring of frame slots in a memfd and offers
+** it with an XYUVSHM=<pid>.<fd> tag in the stream header.  A reader that uses
+** yuv_read_stream_header() attaches to the ring, after that only the FRAME
+** lines go down the pipe and the frame data is copied through the slots.
+** Readers that don't know the tag ignore it; the writer waits YUV_SHM_TIMEOUT
+** seconds at the first frame and then sends the frames down the pipe as usual.
+** YUV_SHM=<n> sets the number of slots.
+*/
+
+#define YUV_SHM_TAG "XYUVSHM="
+#define YUV_SHM_MAGIC 0x4d485359
+#define YUV_SHM_SLOTS 4
+#define YUV_SHM_TIMEOUT 2
+#define YUV_SHM_HEADER 4096
+#define YUV_MAX_TRANSPORTS 8
+
+// the transport and spool tables are looked up by the reader thread of a
+// tool while its main thread writes, entries are never taken out
+static pthread_mutex_t yuv_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#if defined(SYS_memfd_create) && defined(SYS_futex)
+#define HAVE_YUV_SHM
+#endif
+#endif
+
+#ifdef HAVE_YUV_SHM
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <linux/futex.h>
+
+#define YUV_SHM_OFFERED 0
+#define YUV_SHM_ATTACHED 1
+#define YUV_SHM_PIPE 2
+
+struct yuv_shm_ring {
+	uint32_t magic;
+	volatile int32_t state;
+	// the pipe the ring was offered on, stops a copied header tag being used
+	uint64_t dev;
+	uint64_t ino;
+	uint32_t slots;
+	uint32_t slot_size;
+	volatile int32_t head; // frames written
+	volatile int32_t tail; // frames read
+};
+
+struct yuv_transport {
+	int fd;
+	int reader;
+	int memfd;
+	size_t length;
+	struct yuv_shm_ring *ring;
+};
+
+static struct yuv_transport yuv_transports[YUV_MAX_TRANSPORTS];
+static int yuv_transport_count = 0;
+
+static int yuv_futex_wait(volatile int32_t *addr, int32_t val, const struct timespec *to)
+{
+	return syscall(SYS_futex, addr, FUTEX_WAIT, val, to, NULL, 0);
+}
+
+static void yuv_futex_wake(volatile int32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static struct yuv_transport *yuv_transport_find(int fd)
+{
+	struct yuv_transport *found = NULL;
+	int t;
+
+	pthread_mutex_lock(&yuv_table_lock);
+	for (t=0; t<yuv_transport_count; t++)
+		if (yuv_transports[t].fd == fd) {
+			found = &yuv_transports[t];
+			break;
+		}
+	pthread_mutex_unlock(&yuv_table_lock);
+	return found;
+}
+
+// fills in the next entry, -1 if the table is full, call with yuv_table_lock held
+static int yuv_transport_add(const struct yuv_transport *from)
+{
+	if (yuv_transport_count == YUV_MAX_TRANSPORTS)
+		return -1;
+	yuv_transports[yuv_transport_count++] = *from;
+	return 0;
+}
+
+// back to the pipe, the entry stays so other threads can keep looking up their fd
+static void yuv_transport_close(struct yuv_transport *t)
+{
+	munmap(t->ring, t->length);
+	if (t->memfd != -1)
+		close(t->memfd);
+	t->memfd = -1;
+	t->ring = NULL;
+}
+
+// creates the ring, returns 0 and the header tag on success
+static int yuv_shm_offer(int fd, const y4m_stream_info_t *si, int slots, char *tag, int len)
+{
+	struct yuv_transport t;
+	struct stat st;
+	uint32_t slot_size;
+	size_t length;
+	int memfd, err;
+
+	if (fstat(fd, &st) || !S_ISFIFO(st.st_mode))
+		return -1;
+
+	slot_size = (y4m_si_get_framelength(si) + 63) & ~63;
+	length = YUV_SHM_HEADER + (size_t)slot_size * slots;
+
+	memfd = syscall(SYS_memfd_create, "yuvshm", 0);
+	if (memfd == -1)
+		return -1;
+	if (ftruncate(memfd, length)) {
+		close(memfd);
+		return -1;
+	}
+
+	t.ring = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_SHARED, memfd, 0);
+	if (t.ring == MAP_FAILED) {
+		close(memfd);
+		return -1;
+	}
+	t.fd = fd;
+	t.reader = 0;
+	t.memfd = memfd;
+	t.length = length;
+
+	t.ring->magic = YUV_SHM_MAGIC;
+	t.ring->state = YUV_SHM_OFFERED;
+	t.ring->dev = st.st_dev;
+	t.ring->ino = st.st_ino;
+	t.ring->slots = slots;
+	t.ring->slot_size = slot_size;
+	t.ring->head = 0;
+	t.ring->tail = 0;
+
+	pthread_mutex_lock(&yuv_table_lock);
+	err = yuv_transport_add(&t);
+	pthread_mutex_unlock(&yuv_table_lock);
+	if (err) {
+		yuv_transport_close(&t);
+		return -1;
+	}
+	snprintf(tag, len, YUV_SHM_TAG "%d.%d", (int)getpid(), memfd);
+	return 0;
+}
+
+// the writer's /proc entry reopens the memfd
+static void yuv_shm_attach(int fd, const y4m_stream_info_t *si, const char *tag)
+{
+	struct yuv_transport t;
+	struct yuv_shm_ring *ring;
+	struct stat st, pst;
+	char path[64];
+	int pid, wfd, memfd;
+
+	if (sscanf(tag + strlen(YUV_SHM_TAG), "%d.%d", &pid, &wfd) != 2)
+		return;
+	if (fstat(fd, &pst) || !S_ISFIFO(pst.st_mode))
+		return;
+
+	snprintf(path, sizeof(path), "/proc/%d/fd/%d", pid, wfd);
+	memfd = open(path, O_RDWR);
+	if (memfd == -1)
+		return;
+	if (fstat(memfd, &st) || st.st_size < YUV_SHM_HEADER) {
+		close(memfd);
+		return;
+	}
+
+	ring = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, memfd, 0);
+	close(memfd);
+	if (ring == MAP_FAILED)
+		return;
+
+	t.fd = fd;
+	t.reader = 1;
+	t.memfd = -1;
+	t.length = st.st_size;
+	t.ring = ring;
+
+	// the entry is taken as the ring is claimed, once it is attached the writer only uses the slots
+	pthread_mutex_lock(&yuv_table_lock);
+	if (ring->magic != YUV_SHM_MAGIC || ring->dev != pst.st_dev || ring->ino != pst.st_ino ||
+		ring->slot_size < y4m_si_get_framelength(si) ||
+		YUV_SHM_HEADER + (size_t)ring->slot_size * ring->slots > st.st_size ||
+		yuv_transport_count == YUV_MAX_TRANSPORTS ||
+		!__sync_bool_compare_and_swap(&ring->state, YUV_SHM_OFFERED, YUV_SHM_ATTACHED)) {
+		pthread_mutex_unlock(&yuv_table_lock);
+		munmap(ring, st.st_size);
+		return;
+	}
+	yuv_transport_add(&t);
+	pthread_mutex_unlock(&yuv_table_lock);
+	yuv_futex_wake(&ring->state);
+
+	mjpeg_debug("reading frames through shared memory, %d slots", ring->slots);
+}
+
+// waits for the reader at the first frame, returns 1 if it attached
+static int yuv_shm_accepted(struct yuv_transport *t)
+{
+	struct timespec to;
+	int waited;
+
+	for (waited = 0; t->ring->state == YUV_SHM_OFFERED && waited < YUV_SHM_TIMEOUT * 10; waited++) {
+		to.tv_sec = 0;
+		to.tv_nsec = 100000000;
+		yuv_futex_wait(&t->ring->state, YUV_SHM_OFFERED, &to);
+	}
+	__sync_bool_compare_and_swap(&t->ring->state, YUV_SHM_OFFERED, YUV_SHM_PIPE);
+
+	if (t->ring->state == YUV_SHM_ATTACHED) {
+		// the reader has it mapped now
+		close(t->memfd);
+		t->memfd = -1;
+		mjpeg_debug("writing frames through shared memory, %d slots", t->ring->slots);
+		return 1;
+	}
+	mjpeg_debug("reader did not attach, writing frames to the pipe");
+	return 0;
+}
+
+static uint8_t *yuv_shm_slot(struct yuv_shm_ring *ring, int32_t n)
+{
+	return (uint8_t *)ring + YUV_SHM_HEADER + (size_t)ring->slot_size * (n % ring->slots);
+}
+
+static int yuv_shm_write(struct yuv_transport *t, const y4m_stream_info_t *si, const y4m_frame_info_t *fi, uint8_t * const *m)
+{
+	struct yuv_shm_ring *ring = t->ring;
+	struct timespec to;
+	struct pollfd pfd;
+	int32_t head, tail;
+	uint8_t *slot;
+	int p, len;
+
+	head = ring->head;
+	while (head - (tail = ring->tail) >= (int32_t)ring->slots) {
+		to.tv_sec = 0;
+		to.tv_nsec = 100000000;
+		if (yuv_futex_wait(&ring->tail, tail, &to) == -1 && errno == ETIMEDOUT) {
+			// a reader that has gone away never frees a slot
+			pfd.fd = t->fd;
+			pfd.events = POLLOUT;
+			if (poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLERR))
+				return Y4M_ERR_SYSTEM;
+		}
+	}
+
+	slot = yuv_shm_slot(ring, head);
+	for (p=0; p<y4m_si_get_plane_count(si); p++) {
+		len = y4m_si_get_plane_length(si,p);
+		memcpy(slot, m[p], len);
+		slot += len;
+	}
+	__sync_fetch_and_add(&ring->head, 1);
+
+	// the FRAME line tells the reader the slot is full
+	return y4m_write_frame_header(t->fd, si, fi);
+}
+
+static int yuv_shm_read(struct yuv_transport *t, const y4m_stream_info_t *si, y4m_frame_info_t *fi, uint8_t * const *m)
+{
+	struct yuv_shm_ring *ring = t->ring;
+	uint8_t *slot;
+	int p, len, err;
+
+	err = y4m_read_frame_header(t->fd, si, fi);
+	if (err != Y4M_OK)
+		return err;
+	if (ring->head == ring->tail)
+		return Y4M_ERR_BADEOF;
+
+	slot = yuv_shm_slot(ring, ring->tail);
+	for (p=0; p<y4m_si_get_plane_count(si); p++) {
+		len = y4m_si_get_plane_length(si,p);
+		memcpy(m[p], slot, len);
+		slot += len;
+	}
+	__sync_fetch_and_add(&ring->tail, 1);
+	yuv_futex_wake(&ring->tail);
+
+	return Y4M_OK;
+}
+#endif
+
+/*
+** Lossless spool.
+** yuv_write_spool() before the stream header, or YUV_SPOOL in the
+** environment of a tool whose output is a regular file, makes the output
+** a spool: the stream header gets an XYUVSPOOL=<version> tag and each
+** FRAME line is followed by the frame coded by yuvspool.c.  The reader
+** takes the tag off in yuv_read_stream_header() and yuv_read_frame()
+** decodes the frames, so a spool is read as y4m is.  Other y4m readers
+** can't read a spool.
+*/
+
+static int yuv_writev_all(int fd, struct iovec *iov, int n);
+
+struct yuv_spool_file {
+	int fd;
+	int writer;
+	// the coder is set up for the stream
+	int ready;
+	yuv_spool_t sp;
+	// a coded frame as it is read
+	uint8_t *frame;
+	size_t frame_max;
+};
+
+static struct yuv_spool_file yuv_spool_files[YUV_MAX_TRANSPORTS];
+static int yuv_spool_count = 0;
+
+// call with yuv_table_lock held
+static struct yuv_spool_file *yuv_spool_lookup(int fd)
+{
+	int f;
+
+	for (f=0; f<yuv_spool_count; f++)
+		if (yuv_spool_files[f].fd == fd)
+			return &yuv_spool_files[f];
+	return NULL;
+}
+
+static struct yuv_spool_file *yuv_spool_find(int fd)
+{
+	struct yuv_spool_file *f;
+
+	pthread_mutex_lock(&yuv_table_lock);
+	f = yuv_spool_lookup(fd);
+	pthread_mutex_unlock(&yuv_table_lock);
+	return f;
+}
+
+static struct yuv_spool_file *yuv_spool_add(int fd, int writer)
+{
+	struct yuv_spool_file *f;
+
+	pthread_mutex_lock(&yuv_table_lock);
+	f = yuv_spool_lookup(fd);
+	if (f == NULL && yuv_spool_count < YUV_MAX_TRANSPORTS) {
+		f = &yuv_spool_files[yuv_spool_count];
+		f->fd = fd;
+		f->ready = 0;
+		f->frame = NULL;
+		yuv_spool_count++;
+	}
+	if (f)
+		f->writer = writer;
+	pthread_mutex_unlock(&yuv_table_lock);
+	return f;
+}
+
+// sets the coder up for the stream, again if the fd has another stream header
+static int yuv_spool_start(struct yuv_spool_file *f, const y4m_stream_info_t *si)
+{
+	if (f->ready) {
+		yuv_spool_fini(&f->sp);
+		free(f->frame);
+		f->frame = NULL;
+		f->ready = 0;
+	}
+	if (yuv_spool_init(&f->sp, si))
+		return -1;
+	if (!f->writer) {
+		f->frame_max = yuv_spool_frame_max(&f->sp);
+		f->frame = (uint8_t *)malloc(f->frame_max);
+		if (f->frame == NULL) {
+			yuv_spool_fini(&f->sp);
+			return -1;
+		}
+	}
+	f->ready = 1;
+	return 0;
+}
+
+int yuv_write_spool(int fd)
+{
+	return yuv_spool_add(fd, 1) ? 0 : -1;
+}
+
+int yuv_spool_reading(int fd)
+{
+	struct yuv_spool_file *f = yuv_spool_find(fd);
+
+	return f && f->ready && !f->writer;
+}
+
+static int yuv_spool_write(struct yuv_spool_file *f, const y4m_stream_info_t *si, const y4m_frame_info_t *fi, uint8_t * const *m)
+{
+	struct iovec iov[YUV_SPOOL_MAX_SLICES + 2];
+	int n, err;
+
+	n = yuv_spool_encode(&f->sp, m, iov);
+	err = y4m_write_frame_header(f->fd, si, fi);
+	if (err == Y4M_OK && yuv_writev_all(f->fd, iov, n))
+		err = Y4M_ERR_SYSTEM;
+	return err;
+}
+
+static int yuv_spool_read(struct yuv_spool_file *f, const y4m_stream_info_t *si, y4m_frame_info_t *fi, uint8_t * const *m)
+{
+	struct yuv_spool_frame *head = (struct yuv_spool_frame *)f->frame;
+	int err;
+
+	err = y4m_read_frame_header(f->fd, si, fi);
+	if (err != Y4M_OK)
+		return err;
+	if (y4m_read(f->fd, head, sizeof(*head)))
+		return Y4M_ERR_BADEOF;
+	if (memcmp(head->magic, YUV_SPOOL_MAGIC, 4) || head->length > f->frame_max - sizeof(*head))
+		return Y4M_ERR_HEADER;
+	if (y4m_read(f->fd, head + 1, head->length))
+		return Y4M_ERR_BADEOF;
+	// a damaged frame
+	if (yuv_spool_decode(&f->sp, f->frame, sizeof(*head) + head->length, m))
+		return Y4M_ERR_HEADER;
+	return Y4M_OK;
+}
+
+int yuv_read_stream_header(int fd, y4m_stream_info_t *si)
+{
+	struct yuv_spool_file *f;
+	char tag[Y4M_MAX_XTAG_SIZE + 1];
+	int err;
+
+	err = y4m_read_stream_header(fd, si);
+	if (err != Y4M_OK)
+		return err;
+
+	if (yuv_xtag_strip(si, YUV_SHM_TAG, tag, sizeof(tag))) {
+#ifdef HAVE_YUV_SHM
+		yuv_shm_attach(fd, si, tag);
+#endif
+	}
+
+	if (yuv_xtag_strip(si, YUV_SPOOL_TAG, tag, sizeof(tag))) {
+		if (atoi(tag + strlen(YUV_SPOOL_TAG)) != YUV_SPOOL_VERSION)
+			return Y4M_ERR_FEATURE;
+		f = yuv_spool_add(fd, 0);
+		if (f == NULL || yuv_spool_start(f, si))
+			return Y4M_ERR_SYSTEM;
+	}
+	return err;
+}
+
+int yuv_write_stream_header(int fd, const y4m_stream_info_t *si)
+{
+	struct yuv_spool_file *f;
+	y4m_stream_info_t hsi;
+	struct stat st;
+	char tag[Y4M_MAX_XTAG_SIZE + 1];
+	int err;
+
+	y4m_init_stream_info(&hsi);
+	y4m_copy_stream_info(&hsi, si);
+	yuv_xtag_strip(&hsi, YUV_SHM_TAG, tag, sizeof(tag));
+	yuv_xtag_strip(&hsi, YUV_SPOOL_TAG, tag, sizeof(tag));
+
+	f = yuv_spool_find(fd);
+	if (f == NULL && getenv("YUV_SPOOL") && !fstat(fd, &st) && S_ISREG(st.st_mode))
+		f = yuv_spool_add(fd, 1);
+
+	if (f && f->writer) {
+		if (yuv_spool_start(f, si)) {
+			y4m_fini_stream_info(&hsi);
+			return Y4M_ERR_SYSTEM;
+		}
+		snprintf(tag, sizeof(tag), YUV_SPOOL_TAG "%d", YUV_SPOOL_VERSION);
+		y4m_xtag_add(y4m_si_xtags(&hsi), tag);
+	} else {
+#ifdef HAVE_YUV_SHM
+	char *slots = getenv("YUV_SHM");
+	if (slots && !yuv_transport_find(fd)) {
+		int n = atoi(slots);
+		if (n < 2)
+			n = YUV_SHM_SLOTS;
+		if (!yuv_shm_offer(fd, si, n, tag, sizeof(tag)))
+			y4m_xtag_add(y4m_si_xtags(&hsi), tag);
+	}
+#endif
+	}
+
+	err = y4m_write_stream_header(fd, &hsi);
+	y4m_fini_stream_info(&hsi);
+
+	return err;
+}
+
+// the process stage is the time between reading a frame and writing it.
+// threaded tools that read and write in different threads time it themselves.
+int yuv_process_timing = 1;
+static progress_mark_t yuv_process_mark;
+static int yuv_process_started = 0;
+
+int yuv_read_frame(int fd, const y4m_stream_info_t *si, y4m_frame_info_t *fi, uint8_t * const *m)
+{
+	progress_mark_t mark;
+	int err;
+
+	progress_stats_init(NULL);
+
+	progress_stage_begin(&mark);
+	struct yuv_spool_file *f = yuv_spool_find(fd);
+#ifdef HAVE_YUV_SHM
+	struct yuv_transport *t = yuv_transport_find(fd);
+#endif
+	if (f && f->ready)
+		err = yuv_spool_read(f, si, fi, m);
+	else
+#ifdef HAVE_YUV_SHM
+	if (t && t->ring)
+		err = yuv_shm_read(t, si, fi, m);
+	else
+#endif
+	err = y4m_read_frame(fd, si, fi, m);
+	progress_stage_end(PROGRESS_STAGE_READ, &mark);
+
+	if (err == Y4M_OK) {
+		progress_frame(y4m_si_get_framelength(si));
+		if (!yuv_process_timing)
+			return err;
+		progress_stage_begin(&yuv_process_mark);
+		yuv_process_started = 1;
+	}
+	return err;
+}
+
+int yuv_write_frame(int fd, const y4m_stream_info_t *si, const y4m_frame_info_t *fi, uint8_t * const *m)
+{
+	progress_mark_t mark;
+	int err;
+
+	if (yuv_process_started) {
+		progress_stage_end(PROGRESS_STAGE_PROCESS, &yuv_process_mark);
+		yuv_process_started = 0;
+	}
+
+	progress_stage_begin(&mark);
+	struct yuv_spool_file *f = yuv_spool_find(fd);
+#ifdef HAVE_YUV_SHM
+	struct yuv_transport *t = yuv_transport_find(fd);
+	if (t && t->ring && t->ring->state == YUV_SHM_OFFERED && !yuv_shm_accepted(t))
+		yuv_transport_close(t);
+#endif
+	if (f && f->ready)
+		err = yuv_spool_write(f, si, fi, m);
+	else
+#ifdef HAVE_YUV_SHM
+	if (t && t->ring)
+		err = yuv_shm_write(t, si, fi, m);
+	else
+#endif
+	err = y4m_write_frame(fd, si, fi, m);
+	progress_stage_end(PROGRESS_STAGE_WRITE, &mark);
+
+	return err;
+}
+
+/*
+** Pass through.
+** yuv_pass_frame() copies the next frame from fdin to fdout as it is, for
+** the frames a filter leaves alone, without reading it into planes.
+** Between plain y4m streams the frame data is moved by the kernel, with
+** splice() when either side is a pipe and copy_file_range() between files,
+** or through one buffer when neither works.  A spool copied to a spool
+** keeps its coded frame.  Shared memory, or a spool on one side only, goes
+** through yuv_read_frame() and yuv_write_frame() as usual.
+*/
+
+#if defined(__linux__) && defined(SYS_splice)
+#define HAVE_YUV_SPLICE
+#ifndef SPLICE_F_MOVE
+#define SPLICE_F_MOVE 1
+#endif
+#ifndef SPLICE_F_MORE
+#define SPLICE_F_MORE 4
+#endif
+#endif
+
+static uint8_t *yuv_pass_buffer = NULL;
+static size_t yuv_pass_size = 0;
+
+static uint8_t *yuv_pass_alloc(size_t len)
+{
+	uint8_t *b;
+
+	if (len > yuv_pass_size) {
+		b = (uint8_t *)realloc(yuv_pass_buffer, len);
+		if (b == NULL)
+			return NULL;
+		yuv_pass_buffer = b;
+		yuv_pass_size = len;
+	}
+	return yuv_pass_buffer;
+}
+
+// the kernel can't move data between these two
+static int yuv_pass_unsupported(int err)
+{
+	return err == EINVAL || err == EXDEV || err == ENOSYS || err == EOPNOTSUPP || err == EBADF;
+}
+
+// moves len bytes from fdin to fdout, returns a Y4M_ERR code
+static int yuv_pass_bytes(int fdin, int fdout, size_t len)
+{
+	uint8_t *buf;
+	ssize_t n;
+
+#ifdef HAVE_YUV_SPLICE
+	size_t left = len;
+
+	while (left > 0) {
+		n = syscall(SYS_splice, fdin, NULL, fdout, NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (n == 0)
+			return Y4M_ERR_BADEOF;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (left == len && yuv_pass_unsupported(errno))
+				break;
+			return Y4M_ERR_SYSTEM;
+		}
+		left -= n;
+	}
+	if (left == 0)
+		return Y4M_OK;
+
+#ifdef SYS_copy_file_range
+	while (left > 0) {
+		n = syscall(SYS_copy_file_range, fdin, NULL, fdout, NULL, left, 0);
+		if (n == 0)
+			return Y4M_ERR_BADEOF;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (left == len && yuv_pass_unsupported(errno))
+				break;
+			return Y4M_ERR_SYSTEM;
+		}
+		left -= n;
+	}
+	if (left == 0)
+		return Y4M_OK;
+#endif
+#endif
+
+	buf = yuv_pass_alloc(len);
+	if (buf == NULL)
+		return Y4M_ERR_SYSTEM;
+	if (y4m_read(fdin, buf, len))
+		return Y4M_ERR_BADEOF;
+	if (y4m_write(fdout, buf, len))
+		return Y4M_ERR_SYSTEM;
+	return Y4M_OK;
+}
+
+// a coded frame from one spool to another
+static int yuv_pass_spool(struct yuv_spool_file *in, int fdout, const y4m_stream_info_t *si, y4m_frame_info_t *fi)
+{
+	struct yuv_spool_frame head;
+	int err;
+
+	err = y4m_read_frame_header(in->fd, si, fi);
+	if (err != Y4M_OK)
+		return err;
+	if (y4m_read(in->fd, &head, sizeof(head)))
+		return Y4M_ERR_BADEOF;
+	if (memcmp(head.magic, YUV_SPOOL_MAGIC, 4) || head.length > in->frame_max - sizeof(head))
+		return Y4M_ERR_HEADER;
+
+	err = y4m_write_frame_header(fdout, si, fi);
+	if (err != Y4M_OK)
+		return err;
+	if (y4m_write(fdout, &head, sizeof(head)))
+		return Y4M_ERR_SYSTEM;
+	return yuv_pass_bytes(in->fd, fdout, head.length);
+}
+
+int yuv_pass_frame(int fdin, int fdout, const y4m_stream_info_t *si, y4m_frame_info_t *fi)
+{
+	struct yuv_spool_file *in = yuv_spool_find(fdin);
+	struct yuv_spool_file *out = yuv_spool_find(fdout);
+	int spool_in = in && in->ready && !in->writer;
+	int spool_out = out && out->ready && out->writer;
+	progress_mark_t mark;
+	uint8_t *buf, *m[4];
+	int p, err, buffered = spool_in != spool_out;
+
+#ifdef HAVE_YUV_SHM
+	struct yuv_transport *t;
+
+	t = yuv_transport_find(fdin);
+	if (t && t->ring)
+		buffered = 1;
+	t = yuv_transport_find(fdout);
+	if (t && t->ring)
+		buffered = 1;
+#endif
+
+	if (buffered) {
+		buf = yuv_pass_alloc(y4m_si_get_framelength(si));
+		if (buf == NULL)
+			return Y4M_ERR_SYSTEM;
+		for (p=0; p<y4m_si_get_plane_count(si); p++) {
+			m[p] = buf;
+			buf += y4m_si_get_plane_length(si,p);
+		}
+		err = yuv_read_frame(fdin, si, fi, m);
+		if (err == Y4M_OK)
+			err = yuv_write_frame(fdout, si, fi, m);
+		return err;
+	}
+
+	progress_stats_init(NULL);
+	if (yuv_process_started) {
+		progress_stage_end(PROGRESS_STAGE_PROCESS, &yuv_process_mark);
+		yuv_process_started = 0;
+	}
+
+	// the frame is read and written in one go, it is all counted as writing
+	progress_stage_begin(&mark);
+	if (spool_in)
+		err = yuv_pass_spool(in, fdout, si, fi);
+	else {
+		err = y4m_read_frame_header(fdin, si, fi);
+		if (err == Y4M_OK)
+			err = y4m_write_frame_header(fdout, si, fi);
+		if (err == Y4M_OK)
+			err = yuv_pass_bytes(fdin, fdout, y4m_si_get_framelength(si));
+	}
+	progress_stage_end(PROGRESS_STAGE_WRITE, &mark);
+
+	if (err == Y4M_OK)
+		progress_frame(y4m_si_get_framelength(si));
+	return err;
+}
+
+/*
+** Field views.
+** A field is read where it is in the frame, its planes start at the first
+** row of the field and step two frame rows at a time.  yuv_write_weave()
+** and yuv_write_stacked() write a frame made of two fields, which may be
+** from different frames, with a writev of the rows so nothing is copied.
+** Rows that follow each other in memory go out as one vector.  When the
+** output is a shared memory transport the rows are copied into the slot.
+*/
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+void yuv_field_view(yuv_field_t *f, uint8_t * const *m, const y4m_stream_info_t *si, int which)
+{
+	int p, r, h;
+
+	r = which == Y4M_ILACE_BOTTOM_FIRST ? 1 : 0;
+	for (p=0; p<YUV_MAX_PLANES; p++) {
+		if (p < y4m_si_get_plane_count(si)) {
+			h = y4m_si_get_plane_height(si,p);
+			f->width[p] = y4m_si_get_plane_width(si,p);
+			f->stride[p] = f->width[p] * 2;
+			f->height[p] = (h - r + 1) / 2;
+			f->data[p] = m[p] + r * f->width[p];
+		} else {
+			f->width[p] = f->stride[p] = f->height[p] = 0;
+			f->data[p] = NULL;
+		}
+	}
+}
+
+static int yuv_writev_all(int fd, struct iovec *iov, int n)
+{
+	ssize_t len;
+
+	while (n > 0) {
+		len = writev(fd, iov, n > IOV_MAX ? IOV_MAX : n);
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		while (n > 0 && len >= (ssize_t)iov->iov_len) {
+			len -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n > 0) {
+			iov->iov_base = (uint8_t *)iov->iov_base + len;
+			iov->iov_len -= len;
+		}
+	}
+	return 0;
+}
+
+// rows of the output frame in order, weaved or one field above the other
+static int yuv_field_rows(struct iovec *iov, const yuv_field_t *top, const yuv_field_t *bottom, int weave)
+{
+	const yuv_field_t *f;
+	uint8_t *row;
+	int p, r, rows, n = 0;
+
+	for (p=0; p<YUV_MAX_PLANES; p++) {
+		rows = top->height[p] + bottom->height[p];
+		for (r=0; r<rows; r++) {
+			if (weave) {
+				f = r & 1 ? bottom : top;
+				row = f->data[p] + (r >> 1) * f->stride[p];
+			} else if (r < top->height[p]) {
+				f = top;
+				row = f->data[p] + r * f->stride[p];
+			} else {
+				f = bottom;
+				row = f->data[p] + (r - top->height[p]) * f->stride[p];
+			}
+			if (n && (uint8_t *)iov[n-1].iov_base + iov[n-1].iov_len == row) {
+				iov[n-1].iov_len += f->width[p];
+			} else {
+				iov[n].iov_base = row;
+				iov[n].iov_len = f->width[p];
+				n++;
+			}
+		}
+	}
+	return n;
+}
+
+static int yuv_write_fields(int fd, const y4m_stream_info_t *si, const y4m_frame_info_t *fi,
+							const yuv_field_t *top, const yuv_field_t *bottom, int weave)
+{
+	progress_mark_t mark;
+	struct iovec *iov;
+	int n, err;
+
+	if (yuv_process_started) {
+		progress_stage_end(PROGRESS_STAGE_PROCESS, &yuv_process_mark);
+		yuv_process_started = 0;
+	}
+
+	iov = (struct iovec *)malloc(sizeof(struct iovec) * (top->height[0] + bottom->height[0]) * YUV_MAX_PLANES);
+	if (iov == NULL)
+		return Y4M_ERR_SYSTEM;
+	n = yuv_field_rows(iov, top, bottom, weave);
+
+	progress_stage_begin(&mark);
+	struct yuv_spool_file *f = yuv_spool_find(fd);
+	int copy = f && f->ready;
+#ifdef HAVE_YUV_SHM
+	struct yuv_transport *t = yuv_transport_find(fd);
+	if (t && t->ring && t->ring->state == YUV_SHM_OFFERED && !yuv_shm_accepted(t))
+		yuv_transport_close(t);
+	if (t && t->ring)
+		copy = 1;
+#endif
+	// the coder and the slots want the frame in one piece
+	if (copy) {
+		uint8_t *frame, *m[YUV_MAX_PLANES];
+		size_t off = 0;
+		int i, p;
+
+		frame = (uint8_t *)malloc(y4m_si_get_framelength(si));
+		if (frame == NULL) {
+			err = Y4M_ERR_SYSTEM;
+		} else {
+			for (i=0; i<n; i++) {
+				memcpy(frame + off, iov[i].iov_base, iov[i].iov_len);
+				off += iov[i].iov_len;
+			}
+			for (p=0, off=0; p<YUV_MAX_PLANES; p++) {
+				m[p] = frame + off;
+				if (p < y4m_si_get_plane_count(si))
+					off += y4m_si_get_plane_length(si,p);
+			}
+			if (f && f->ready)
+				err = yuv_spool_write(f, si, fi, m);
+#ifdef HAVE_YUV_SHM
+			else
+				err = yuv_shm_write(t, si, fi, m);
+#endif
+			free(frame);
+		}
+	} else {
+		err = y4m_write_frame_header(fd, si, fi);
+		if (err == Y4M_OK && yuv_writev_all(fd, iov, n))
+			err = Y4M_ERR_SYSTEM;
+	}
+	progress_stage_end(PROGRESS_STAGE_WRITE, &mark);
+
+	free(iov);
+	return err;
+}
+
+int yuv_write_weave(int fd, const y4m_stream_info_t *si, const y4m_frame_info_t *fi, const yuv_field_t *top, const yuv_field_t *bottom)
+{
+	return yuv_write_fields(fd, si, fi, top, bottom, 1);
+}
+
+int yuv_write_stacked(int fd, const y4m_stream_info_t *si, const y4m_frame_info_t *fi, const yuv_field_t *top, const yuv_field_t *bottom)
+{
+	return yuv_write_fields(fd, si, fi, top, bottom, 0);
+}
+
+/*
+** CPU dispatch.
+** yuv_kernel holds the kernels for the CPU we are running on, it starts with
+** the scalar versions and yuv_cpu_init() replaces them at startup.  The SIMD
+** versions are compiled with target attributes so the binary still runs on
+** any x86, and not at all on other CPUs.  YUV_CPU=<name> limits the level
+** used (scalar, sse2, ssse3, sse41, avx2, avx512) and YUV_CPU_CHECK compares
+** every level with the scalar kernels before the tool starts.
+** copyfield, fill, histogram and lut are the same at every level, libc
+** already picks its memcpy and memset for the CPU and the histogram and
+** lut are bound by the table lookups.
+*/
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define HAVE_YUV_X86
+#include <immintrin.h>
+#if defined(__clang__) || __GNUC__ >= 7
+#define HAVE_YUV_AVX512
+#endif
+#endif
+
+static const char *yuv_cpu_names[] = { "scalar", "sse2", "ssse3", "sse41", "avx2", "avx512" };
+
+int yuv_cpu_level = YUV_CPU_SCALAR;
+
+static unsigned int sad_c(const uint8_t *a, const uint8_t *b, int len)
+{
+	unsigned int s = 0;
+	int i;
+
+	for (i=0; i<len; i++)
+		s += abs(a[i] - b[i]);
+	return s;
+}
+
+static void blend_c(uint8_t *d, const uint8_t *a, const uint8_t *b, int w, int len)
+{
+	int i;
+
+	for (i=0; i<len; i++)
+		d[i] = (a[i] * (256 - w) + b[i] * w + 128) >> 8;
+}
+
+static void copyfield_c(uint8_t *d, const uint8_t *s, int width, int height, int field)
+{
+	int r;
+
+	for (r=field; r<height; r+=2)
+		memcpy(d + r * width, s + r * width, width);
+}
+
+static void fill_c(uint8_t *d, uint8_t v, int len)
+{
+	memset(d, v, len);
+}
+
+// four tables so repeated values don't wait on each other's stores
+static void histogram_c(const uint8_t *s, int len, uint32_t hist[256])
+{
+	uint32_t h[4][256];
+	int i;
+
+	memset(h, 0, sizeof(h));
+	for (i=0; i+4<=len; i+=4) {
+		h[0][s[i]]++;
+		h[1][s[i+1]]++;
+		h[2][s[i+2]]++;
+		h[3][s[i+3]]++;
+	}
+	for (; i<len; i++)
+		h[0][s[i]]++;
+	for (i=0; i<256; i++)
+		hist[i] += h[0][i] + h[1][i] + h[2][i] + h[3][i];
+}
+
+static void minmaxsum_c(const uint8_t *s, int len, uint8_t *min, uint8_t *max, uint64_t *sum)
+{
+	uint8_t lo = 255, hi = 0;
+	uint64_t t = 0;
+	int i;
+
+	for (i=0; i<len; i++) {
+		if (s[i] < lo) lo = s[i];
+		if (s[i] > hi) hi = s[i];
+		t += s[i];
+	}
+	*min = lo;
+	*max = hi;
+	*sum = t;
+}
+
+static void lut_c(uint8_t *d, const uint8_t *s, const uint8_t table[256], int len)
+{
+	int i;
+
+	for (i=0; i+4<=len; i+=4) {
+		d[i] = table[s[i]];
+		d[i+1] = table[s[i+1]];
+		d[i+2] = table[s[i+2]];
+		d[i+3] = table[s[i+3]];
+	}
+	for (; i<len; i++)
+		d[i] = table[s[i]];
+}
+
+static inline int chroma_clamp(int c)
+{
+	return c < -112 ? 16 : c > 112 ? 240 : c + 128;
+}
+
+static void chroma_matrix_c(uint8_t *u, uint8_t *v, const int16_t m[4], const int32_t off[2], int shift, int len)
+{
+	int i, cu, cv;
+
+	for (i=0; i<len; i++) {
+		cu = u[i] - 128;
+		cv = v[i] - 128;
+		u[i] = chroma_clamp((m[0] * cu + m[1] * cv + off[0]) >> shift);
+		v[i] = chroma_clamp((m[2] * cu + m[3] * cv + off[1]) >> shift);
+	}
+}
+
+static void accumulate_c(uint16_t *acc, const uint8_t *s, int len)
+{
+	int i;
+
+	for (i=0; i<len; i++)
+		acc[i] += s[i];
+}
+
+yuv_kernels_t yuv_kernel = { sad_c, blend_c, copyfield_c, fill_c, histogram_c, minmaxsum_c, lut_c, chroma_matrix_c, accumulate_c };
+
+#ifdef HAVE_YUV_X86
+
+__attribute__((target("sse2")))
+static unsigned int sad_sse2(const uint8_t *a, const uint8_t *b, int len)
+{
+	__m128i acc = _mm_setzero_si128();
+	int i;
+
+	for (i=0; i+16<=len; i+=16)
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(a+i)),
+											  _mm_loadu_si128((const __m128i *)(b+i))));
+	acc = _mm_add_epi64(acc, _mm_srli_si128(acc, 8));
+	return _mm_cvtsi128_si32(acc) + sad_c(a+i, b+i, len-i);
+}
+
+__attribute__((target("sse2")))
+static void blend_sse2(uint8_t *d, const uint8_t *a, const uint8_t *b, int w, int len)
+{
+	__m128i z = _mm_setzero_si128();
+	__m128i wa = _mm_set1_epi16(256 - w), wb = _mm_set1_epi16(w), r = _mm_set1_epi16(128);
+	__m128i va, vb, lo, hi;
+	int i;
+
+	// a * (256 - w) + b * w + 128 fits in an unsigned 16 bit lane
+	for (i=0; i+16<=len; i+=16) {
+		va = _mm_loadu_si128((const __m128i *)(a+i));
+		vb = _mm_loadu_si128((const __m128i *)(b+i));
+		lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, z), wa), _mm_mullo_epi16(_mm_unpacklo_epi8(vb, z), wb));
+		hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, z), wa), _mm_mullo_epi16(_mm_unpackhi_epi8(vb, z), wb));
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, r), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, r), 8);
+		_mm_storeu_si128((__m128i *)(d+i), _mm_packus_epi16(lo, hi));
+	}
+	blend_c(d+i, a+i, b+i, w, len-i);
+}
+
+__attribute__((target("sse2")))
+static void minmaxsum_sse2(const uint8_t *s, int len, uint8_t *min, uint8_t *max, uint64_t *sum)
+{
+	__m128i lo = _mm_set1_epi8((char)255), hi = _mm_setzero_si128(), acc = _mm_setzero_si128();
+	__m128i v, z = _mm_setzero_si128();
+	uint8_t l[16], h[16];
+	uint64_t t;
+	int i, j;
+
+	for (i=0; i+16<=len; i+=16) {
+		v = _mm_loadu_si128((const __m128i *)(s+i));
+		lo = _mm_min_epu8(lo, v);
+		hi = _mm_max_epu8(hi, v);
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(v, z));
+	}
+	_mm_storeu_si128((__m128i *)l, lo);
+	_mm_storeu_si128((__m128i *)h, hi);
+	acc = _mm_add_epi64(acc, _mm_srli_si128(acc, 8));
+#ifdef __x86_64__
+	t = _mm_cvtsi128_si64(acc);
+#else
+	_mm_storel_epi64((__m128i *)&t, acc);
+#endif
+
+	minmaxsum_c(s+i, len-i, min, max, sum);
+	*sum += t;
+	for (j=0; j<16 && i; j++) {
+		if (l[j] < *min) *min = l[j];
+		if (h[j] > *max) *max = h[j];
+	}
+}
+
+// the u,v pairs are interleaved so madd does a row of the matrix at a time
+__attribute__((target("sse2")))
+static void chroma_matrix_sse2(uint8_t *u, uint8_t *v, const int16_t m[4], const int32_t off[2], int shift, int len)
+{
+	__m128i z = _mm_setzero_si128(), c128 = _mm_set1_epi16(128);
+	__m128i lo = _mm_set1_epi16(-112), hi = _mm_set1_epi16(112);
+	__m128i mu = _mm_set1_epi32(((uint32_t)(uint16_t)m[1] << 16) | (uint16_t)m[0]);
+	__m128i mv = _mm_set1_epi32(((uint32_t)(uint16_t)m[3] << 16) | (uint16_t)m[2]);
+	__m128i ou = _mm_set1_epi32(off[0]), ov = _mm_set1_epi32(off[1]);
+	__m128i sh = _mm_cvtsi32_si128(shift);
+	__m128i vu, vv, ul, uh, vl, vh, p[4], ru[4], rv[4], a, b;
+	int i, j;
+
+	for (i=0; i+16<=len; i+=16) {
+		vu = _mm_loadu_si128((const __m128i *)(u+i));
+		vv = _mm_loadu_si128((const __m128i *)(v+i));
+		ul = _mm_sub_epi16(_mm_unpacklo_epi8(vu, z), c128);
+		uh = _mm_sub_epi16(_mm_unpackhi_epi8(vu, z), c128);
+		vl = _mm_sub_epi16(_mm_unpacklo_epi8(vv, z), c128);
+		vh = _mm_sub_epi16(_mm_unpackhi_epi8(vv, z), c128);
+		p[0] = _mm_unpacklo_epi16(ul, vl);
+		p[1] = _mm_unpackhi_epi16(ul, vl);
+		p[2] = _mm_unpacklo_epi16(uh, vh);
+		p[3] = _mm_unpackhi_epi16(uh, vh);
+		for (j=0; j<4; j++) {
+			ru[j] = _mm_sra_epi32(_mm_add_epi32(_mm_madd_epi16(p[j], mu), ou), sh);
+			rv[j] = _mm_sra_epi32(_mm_add_epi32(_mm_madd_epi16(p[j], mv), ov), sh);
+		}
+		a = _mm_add_epi16(_mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(ru[0], ru[1]), lo), hi), c128);
+		b = _mm_add_epi16(_mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(ru[2], ru[3]), lo), hi), c128);
+		_mm_storeu_si128((__m128i *)(u+i), _mm_packus_epi16(a, b));
+		a = _mm_add_epi16(_mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(rv[0], rv[1]), lo), hi), c128);
+		b = _mm_add_epi16(_mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(rv[2], rv[3]), lo), hi), c128);
+		_mm_storeu_si128((__m128i *)(v+i), _mm_packus_epi16(a, b));
+	}
+	chroma_matrix_c(u+i, v+i, m, off, shift, len-i);
+}
+
+__attribute__((target("sse2")))
+static void accumulate_sse2(uint16_t *acc, const uint8_t *s, int len)
+{
+	__m128i z = _mm_setzero_si128(), v;
+	int i;
+
+	for (i=0; i+16<=len; i+=16) {
+		v = _mm_loadu_si128((const __m128i *)(s+i));
+		_mm_storeu_si128((__m128i *)(acc+i), _mm_add_epi16(_mm_loadu_si128((const __m128i *)(acc+i)), _mm_unpacklo_epi8(v, z)));
+		_mm_storeu_si128((__m128i *)(acc+i+8), _mm_add_epi16(_mm_loadu_si128((const __m128i *)(acc+i+8)), _mm_unpackhi_epi8(v, z)));
+	}
+	accumulate_c(acc+i, s+i, len-i);
+}
+
+__attribute__((target("avx2")))
+static unsigned int sad_avx2(const uint8_t *a, const uint8_t *b, int len)
+{
+	__m256i acc = _mm256_setzero_si256();
+	__m128i t;
+	int i;
+
+	for (i=0; i+32<=len; i+=32)
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(a+i)),
+													_mm256_loadu_si256((const __m256i *)(b+i))));
+	t = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	t = _mm_add_epi64(t, _mm_srli_si128(t, 8));
+	return _mm_cvtsi128_si32(t) + sad_sse2(a+i, b+i, len-i);
+}
+
+__attribute__((target("avx2")))
+static void blend_avx2(uint8_t *d, const uint8_t *a, const uint8_t *b, int w, int len)
+{
+	__m256i z = _mm256_setzero_si256();
+	__m256i wa = _mm256_set1_epi16(256 - w), wb = _mm256_set1_epi16(w), r = _mm256_set1_epi16(128);
+	__m256i va, vb, lo, hi;
+	int i;
+
+	// unpack and pack both work within 128 bit lanes, so the order comes back out
+	for (i=0; i+32<=len; i+=32) {
+		va = _mm256_loadu_si256((const __m256i *)(a+i));
+		vb = _mm256_loadu_si256((const __m256i *)(b+i));
+		lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(va, z), wa), _mm256_mullo_epi16(_mm256_unpacklo_epi8(vb, z), wb));
+		hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(va, z), wa), _mm256_mullo_epi16(_mm256_unpackhi_epi8(vb, z), wb));
+		lo = _mm256_srli_epi16(_mm256_add_epi16(lo, r), 8);
+		hi = _mm256_srli_epi16(_mm256_add_epi16(hi, r), 8);
+		_mm256_storeu_si256((__m256i *)(d+i), _mm256_packus_epi16(lo, hi));
+	}
+	blend_sse2(d+i, a+i, b+i, w, len-i);
+}
+
+__attribute__((target("avx2")))
+static void minmaxsum_avx2(const uint8_t *s, int len, uint8_t *min, uint8_t *max, uint64_t *sum)
+{
+	__m256i lo = _mm256_set1_epi8((char)255), hi = _mm256_setzero_si256(), acc = _mm256_setzero_si256();
+	__m256i v, z = _mm256_setzero_si256();
+	uint8_t l[32], h[32];
+	uint64_t a[4];
+	int i, j;
+
+	for (i=0; i+32<=len; i+=32) {
+		v = _mm256_loadu_si256((const __m256i *)(s+i));
+		lo = _mm256_min_epu8(lo, v);
+		hi = _mm256_max_epu8(hi, v);
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(v, z));
+	}
+	_mm256_storeu_si256((__m256i *)l, lo);
+	_mm256_storeu_si256((__m256i *)h, hi);
+	_mm256_storeu_si256((__m256i *)a, acc);
+
+	minmaxsum_sse2(s+i, len-i, min, max, sum);
+	*sum += a[0] + a[1] + a[2] + a[3];
+	for (j=0; j<32 && i; j++) {
+		if (l[j] < *min) *min = l[j];
+		if (h[j] > *max) *max = h[j];
+	}
+}
+
+__attribute__((target("avx2")))
+static void chroma_matrix_avx2(uint8_t *u, uint8_t *v, const int16_t m[4], const int32_t off[2], int shift, int len)
+{
+	__m256i z = _mm256_setzero_si256(), c128 = _mm256_set1_epi16(128);
+	__m256i lo = _mm256_set1_epi16(-112), hi = _mm256_set1_epi16(112);
+	__m256i mu = _mm256_set1_epi32(((uint32_t)(uint16_t)m[1] << 16) | (uint16_t)m[0]);
+	__m256i mv = _mm256_set1_epi32(((uint32_t)(uint16_t)m[3] << 16) | (uint16_t)m[2]);
+	__m256i ou = _mm256_set1_epi32(off[0]), ov = _mm256_set1_epi32(off[1]);
+	__m128i sh = _mm_cvtsi32_si128(shift);
+	__m256i vu, vv, ul, uh, vl, vh, p[4], ru[4], rv[4], a, b;
+	int i, j;
+
+	// every unpack has its pack in the same 128 bit lane
+	for (i=0; i+32<=len; i+=32) {
+		vu = _mm256_loadu_si256((const __m256i *)(u+i));
+		vv = _mm256_loadu_si256((const __m256i *)(v+i));
+		ul = _mm256_sub_epi16(_mm256_unpacklo_epi8(vu, z), c128);
+		uh = _mm256_sub_epi16(_mm256_unpackhi_epi8(vu, z), c128);
+		vl = _mm256_sub_epi16(_mm256_unpacklo_epi8(vv, z), c128);
+		vh = _mm256_sub_epi16(_mm256_unpackhi_epi8(vv, z), c128);
+		p[0] = _mm256_unpacklo_epi16(ul, vl);
+		p[1] = _mm256_unpackhi_epi16(ul, vl);
+		p[2] = _mm256_unpacklo_epi16(uh, vh);
+		p[3] = _mm256_unpackhi_epi16(uh, vh);
+		for (j=0; j<4; j++) {
+			ru[j] = _mm256_sra_epi32(_mm256_add_epi32(_mm256_madd_epi16(p[j], mu), ou), sh);
+			rv[j] = _mm256_sra_epi32(_mm256_add_epi32(_mm256_madd_epi16(p[j], mv), ov), sh);
+		}
+		a = _mm256_add_epi16(_mm256_min_epi16(_mm256_max_epi16(_mm256_packs_epi32(ru[0], ru[1]), lo), hi), c128);
+		b = _mm256_add_epi16(_mm256_min_epi16(_mm256_max_epi16(_mm256_packs_epi32(ru[2], ru[3]), lo), hi), c128);
+		_mm256_storeu_si256((__m256i *)(u+i), _mm256_packus_epi16(a, b));
+		a = _mm256_add_epi16(_mm256_min_epi16(_mm256_max_epi16(_mm256_packs_epi32(rv[0], rv[1]), lo), hi), c128);
+		b = _mm256_add_epi16(_mm256_min_epi16(_mm256_max_epi16(_mm256_packs_epi32(rv[2], rv[3]), lo), hi), c128);
+		_mm256_storeu_si256((__m256i *)(v+i), _mm256_packus_epi16(a, b));
+	}
+	chroma_matrix_sse2(u+i, v+i, m, off, shift, len-i);
+}
+
+__attribute__((target("avx2")))
+static void accumulate_avx2(uint16_t *acc, const uint8_t *s, int len)
+{
+	int i;
+
+	for (i=0; i+16<=len; i+=16)
+		_mm256_storeu_si256((__m256i *)(acc+i), _mm256_add_epi16(_mm256_loadu_si256((const __m256i *)(acc+i)),
+									_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(s+i)))));
+	accumulate_c(acc+i, s+i, len-i);
+}
+
+#ifdef HAVE_YUV_AVX512
+__attribute__((target("avx512f,avx512bw")))
+static unsigned int sad_avx512(const uint8_t *a, const uint8_t *b, int len)
+{
+	__m512i acc = _mm512_setzero_si512();
+	int i;
+
+	for (i=0; i+64<=len; i+=64)
+		acc = _mm512_add_epi64(acc, _mm512_sad_epu8(_mm512_loadu_si512((const void *)(a+i)),
+													_mm512_loadu_si512((const void *)(b+i))));
+	return _mm512_reduce_add_epi64(acc) + sad_avx2(a+i, b+i, len-i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void blend_avx512(uint8_t *d, const uint8_t *a, const uint8_t *b, int w, int len)
+{
+	__m512i z = _mm512_setzero_si512();
+	__m512i wa = _mm512_set1_epi16(256 - w), wb = _mm512_set1_epi16(w), r = _mm512_set1_epi16(128);
+	__m512i va, vb, lo, hi;
+	int i;
+
+	for (i=0; i+64<=len; i+=64) {
+		va = _mm512_loadu_si512((const void *)(a+i));
+		vb = _mm512_loadu_si512((const void *)(b+i));
+		lo = _mm512_add_epi16(_mm512_mullo_epi16(_mm512_unpacklo_epi8(va, z), wa), _mm512_mullo_epi16(_mm512_unpacklo_epi8(vb, z), wb));
+		hi = _mm512_add_epi16(_mm512_mullo_epi16(_mm512_unpackhi_epi8(va, z), wa), _mm512_mullo_epi16(_mm512_unpackhi_epi8(vb, z), wb));
+		lo = _mm512_srli_epi16(_mm512_add_epi16(lo, r), 8);
+		hi = _mm512_srli_epi16(_mm512_add_epi16(hi, r), 8);
+		_mm512_storeu_si512((void *)(d+i), _mm512_packus_epi16(lo, hi));
+	}
+	blend_avx2(d+i, a+i, b+i, w, len-i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void minmaxsum_avx512(const uint8_t *s, int len, uint8_t *min, uint8_t *max, uint64_t *sum)
+{
+	__m512i lo = _mm512_set1_epi8((char)255), hi = _mm512_setzero_si512(), acc = _mm512_setzero_si512();
+	__m512i v, z = _mm512_setzero_si512();
+	uint8_t l[64], h[64];
+	uint64_t t;
+	int i, j;
+
+	for (i=0; i+64<=len; i+=64) {
+		v = _mm512_loadu_si512((const void *)(s+i));
+		lo = _mm512_min_epu8(lo, v);
+		hi = _mm512_max_epu8(hi, v);
+		acc = _mm512_add_epi64(acc, _mm512_sad_epu8(v, z));
+	}
+	_mm512_storeu_si512((void *)l, lo);
+	_mm512_storeu_si512((void *)h, hi);
+	t = _mm512_reduce_add_epi64(acc);
+
+	minmaxsum_avx2(s+i, len-i, min, max, sum);
+	*sum += t;
+	for (j=0; j<64 && i; j++) {
+		if (l[j] < *min) *min = l[j];
+		if (h[j] > *max) *max = h[j];
+	}
+}
+#endif
+#endif
+
+int yuv_cpu_detect(void)
+{
+#ifdef HAVE_YUV_X86
+	__builtin_cpu_init();
+#ifdef HAVE_YUV_AVX512
+	if (__builtin_cpu_supports("avx512bw"))
+		return YUV_CPU_AVX512;
+#endif
+	if (__builtin_cpu_supports("avx2"))
+		return YUV_CPU_AVX2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return YUV_CPU_SSE41;
+	if (__builtin_cpu_supports("ssse3"))
+		return YUV_CPU_SSSE3;
+	if (__builtin_cpu_supports("sse2"))
+		return YUV_CPU_SSE2;
+#endif
+	return YUV_CPU_SCALAR;
+}
+
+const char *yuv_cpu_name(int level)
+{
+	if (level < YUV_CPU_SCALAR || level > YUV_CPU_AVX512)
+		return "unknown";
+	return yuv_cpu_names[level];
+}
+
+// fills k for the level, limited to what this CPU has.  Returns the level used.
+int yuv_kernels_select(yuv_kernels_t *k, int level)
+{
+	int cpu = yuv_cpu_detect();
+
+	if (level > cpu)
+		level = cpu;
+
+	k->sad = sad_c;
+	k->blend = blend_c;
+	k->copyfield = copyfield_c;
+	k->fill = fill_c;
+	k->histogram = histogram_c;
+	k->minmaxsum = minmaxsum_c;
+	k->lut = lut_c;
+	k->chroma_matrix = chroma_matrix_c;
+	k->accumulate = accumulate_c;
+
+#ifdef HAVE_YUV_X86
+	if (level >= YUV_CPU_SSE2) {
+		k->sad = sad_sse2;
+		k->blend = blend_sse2;
+		k->minmaxsum = minmaxsum_sse2;
+		k->chroma_matrix = chroma_matrix_sse2;
+		k->accumulate = accumulate_sse2;
+	}
+	if (level >= YUV_CPU_AVX2) {
+		k->sad = sad_avx2;
+		k->blend = blend_avx2;
+		k->minmaxsum = minmaxsum_avx2;
+		k->chroma_matrix = chroma_matrix_avx2;
+		k->accumulate = accumulate_avx2;
+	}
+#ifdef HAVE_YUV_AVX512
+	if (level >= YUV_CPU_AVX512) {
+		k->sad = sad_avx512;
+		k->blend = blend_avx512;
+		k->minmaxsum = minmaxsum_avx512;
+	}
+#endif
+#endif
+	return level;
+}
+
+// compares the kernels of every level this CPU has with the scalar ones
+int yuv_cpu_selfcheck(int verbose)
+{
+	static const int lengths[] = { 0, 1, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 129, 255, 1000, 4099 };
+	static const int weights[] = { 0, 1, 128, 255, 256 };
+	// identity, rotation and saturation, inversion, the largest gain
+	static const int16_t matrices[][4] = { { 8192, 0, 0, 8192 }, { 7094, -4096, 4096, 7094 },
+										   { -8192, 0, 0, -8192 }, { 32767, -32768, 32767, 32767 } };
+	static const int32_t offsets[][2] = { { 0, 0 }, { 4096, -4096 }, { 0, 0 }, { 255 << 13, -255 << 13 } };
+	yuv_kernels_t k;
+	uint8_t *a, *b, *d1, *d2;
+	uint16_t *s1, *s2;
+	uint8_t lo1, hi1, lo2, hi2;
+	uint64_t sum1, sum2;
+	uint32_t h1[256], h2[256], seed = 1;
+	int level, cpu, i, l, o, w, errors = 0, err;
+
+	a = (uint8_t *)malloc(8192);
+	b = (uint8_t *)malloc(8192);
+	d1 = (uint8_t *)malloc(8192);
+	d2 = (uint8_t *)malloc(8192);
+	s1 = (uint16_t *)malloc(4096 * sizeof(uint16_t));
+	s2 = (uint16_t *)malloc(4096 * sizeof(uint16_t));
+	if (!a || !b || !d1 || !d2 || !s1 || !s2)
+		mjpeg_error_exit1 ("Cannot allocate memory for the kernel check");
+
+	for (i=0; i<8192; i++) {
+		seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+		a[i] = seed;
+		b[i] = seed >> 8;
+	}
+	// the extremes, so the sums and blends overflow if they can
+	memset(a + 4096, 255, 1024);
+	memset(b + 5120, 255, 1024);
+
+	cpu = yuv_cpu_detect();
+	for (level=YUV_CPU_SCALAR; level<=cpu; level++) {
+		yuv_kernels_select(&k, level);
+		err = 0;
+		for (l=0; l<sizeof(lengths)/sizeof(int); l++) {
+			for (o=0; o<4096; o+=1021) {
+				if (k.sad(a+o, b+o+3, lengths[l]) != sad_c(a+o, b+o+3, lengths[l]))
+					err |= 1;
+
+				for (w=0; w<sizeof(weights)/sizeof(int); w++) {
+					k.blend(d1+o+1, a+o, b+o+7, weights[w], lengths[l]);
+					blend_c(d2+o+1, a+o, b+o+7, weights[w], lengths[l]);
+					if (memcmp(d1+o+1, d2+o+1, lengths[l]))
+						err |= 2;
+				}
+
+				k.minmaxsum(a+o, lengths[l], &lo1, &hi1, &sum1);
+				minmaxsum_c(a+o, lengths[l], &lo2, &hi2, &sum2);
+				if (lo1 != lo2 || hi1 != hi2 || sum1 != sum2)
+					err |= 4;
+
+				memset(h1, 0, sizeof(h1));
+				memset(h2, 0, sizeof(h2));
+				k.histogram(b+o, lengths[l], h1);
+				histogram_c(b+o, lengths[l], h2);
+				if (memcmp(h1, h2, sizeof(h1)))
+					err |= 8;
+
+				k.lut(d1+o, a+o, b+2048, lengths[l]);
+				lut_c(d2+o, a+o, b+2048, lengths[l]);
+				if (memcmp(d1+o, d2+o, lengths[l]))
+					err |= 32;
+
+				for (w=0; w<sizeof(matrices)/sizeof(matrices[0]); w++) {
+					memcpy(d1, a+o, lengths[l]);
+					memcpy(d1+4096, b+o, lengths[l]);
+					memcpy(d2, a+o, lengths[l]);
+					memcpy(d2+4096, b+o, lengths[l]);
+					k.chroma_matrix(d1, d1+4096, matrices[w], offsets[w], 13, lengths[l]);
+					chroma_matrix_c(d2, d2+4096, matrices[w], offsets[w], 13, lengths[l]);
+					if (memcmp(d1, d2, lengths[l]) || memcmp(d1+4096, d2+4096, lengths[l]))
+						err |= 64;
+				}
+
+				// started near the top of the lanes, the sums wrap the same way
+				for (i=0; i<lengths[l] && i<4096; i++)
+					s1[i] = s2[i] = 65535 - a[i];
+				for (w=0; w<3; w++) {
+					k.accumulate(s1, b+o+w, lengths[l] < 4096 ? lengths[l] : 4096);
+					accumulate_c(s2, b+o+w, lengths[l] < 4096 ? lengths[l] : 4096);
+				}
+				if (memcmp(s1, s2, (lengths[l] < 4096 ? lengths[l] : 4096) * sizeof(uint16_t)))
+					err |= 128;
+
+				memset(d1, 0, 8192);
+				memset(d2, 0, 8192);
+				k.copyfield(d1, a+o, 64, lengths[l] / 64, 1);
+				copyfield_c(d2, a+o, 64, lengths[l] / 64, 1);
+				k.fill(d1+o, o, lengths[l]);
+				fill_c(d2+o, o, lengths[l]);
+				if (memcmp(d1, d2, 8192))
+					err |= 16;
+			}
+		}
+		if (err) {
+			mjpeg_warn ("%s kernels differ from scalar:%s%s%s%s%s%s%s%s", yuv_cpu_name(level),
+						err & 1 ? " sad" : "", err & 2 ? " blend" : "", err & 4 ? " minmaxsum" : "",
+						err & 8 ? " histogram" : "", err & 16 ? " copyfield/fill" : "",
+						err & 32 ? " lut" : "", err & 64 ? " chroma_matrix" : "",
+						err & 128 ? " accumulate" : "");
+			errors++;
+		} else if (verbose) {
+			mjpeg_info ("%s kernels match scalar", yuv_cpu_name(level));
+		}
+	}
+
+	free(a);
+	free(b);
+	free(d1);
+	free(d2);
+	free(s1);
+	free(s2);
+	return errors;
+}
+
+#ifdef __GNUC__
+__attribute__((constructor))
+#endif
+void yuv_cpu_init(void)
+{
+	char *env;
+	int level = YUV_CPU_AVX512, l;
+
+	env = getenv("YUV_CPU");
+	if (env)
+		for (l=YUV_CPU_SCALAR; l<=YUV_CPU_AVX512; l++)
+			if (!strcmp(env, yuv_cpu_names[l]))
+				level = l;
+
+	yuv_cpu_level = yuv_kernels_select(&yuv_kernel, level);
+
+	if (getenv("YUV_CPU_CHECK") && yuv_cpu_selfcheck(1))
+		mjpeg_error_exit1 ("SIMD kernels do not match the scalar kernels");
+}
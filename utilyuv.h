@@ -5,12 +5,20 @@
 #include <mpegconsts.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/types.h>
 #include <math.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 // allocates the plane buffers based on the stream info
 int chromalloc(uint8_t *m[3], y4m_stream_info_t *sinfo);
 void chromafree(uint8_t *m[3]);
+// every plane of the stream, the alpha plane of 444alpha too, the others are NULL
+#define YUV_MAX_PLANES 4
+int planealloc(uint8_t *m[YUV_MAX_PLANES], y4m_stream_info_t *sinfo);
+void planefree(uint8_t *m[YUV_MAX_PLANES]);
 
 
 // functions for temporal based filters
@@ -52,4 +60,103 @@ void framecount2timecode(y4m_stream_info_t  *si, int *h, int *m, int *s, int *f,
 
 void y4m_dump_frame(y4m_stream_info_t  *si, uint8_t *m[3]);
 
+// frame I/O wrappers around y4m_read_frame/y4m_write_frame
+// these time the read, process and write stages for progress.c,
+// move the frames through shared memory when YUV_SHM is set
+// and read and write lossless spool files (YUV_SPOOL, yuvspool.h).
+int yuv_read_stream_header(int fd, y4m_stream_info_t *si);
+int yuv_write_stream_header(int fd, const y4m_stream_info_t *si);
+int yuv_read_frame(int fd, const y4m_stream_info_t *si, y4m_frame_info_t *fi, uint8_t * const *m);
+int yuv_write_frame(int fd, const y4m_stream_info_t *si, const y4m_frame_info_t *fi, uint8_t * const *m);
+extern int yuv_process_timing;
+// copies the next frame from fdin to fdout untouched, for filters that leave a frame alone.
+// fi gets the frame header, the frame data isn't read into the process if it can be helped.
+int yuv_pass_frame(int fdin, int fdout, const y4m_stream_info_t *si, y4m_frame_info_t *fi);
+// the stream written to fd is a spool, called before yuv_write_stream_header()
+int yuv_write_spool(int fd);
+// 1 if the stream read from fd is a spool
+int yuv_spool_reading(int fd);
+
+// a field of a frame in place, every second row of the frame's planes
+typedef struct {
+	uint8_t *data[YUV_MAX_PLANES];
+	int stride[YUV_MAX_PLANES];
+	int width[YUV_MAX_PLANES];
+	int height[YUV_MAX_PLANES];
+} yuv_field_t;
+
+// which is Y4M_ILACE_TOP_FIRST for the top field, Y4M_ILACE_BOTTOM_FIRST for the bottom.
+// m has a plane for every plane of the stream, from planealloc() when it may have alpha
+void yuv_field_view(yuv_field_t *f, uint8_t * const *m, const y4m_stream_info_t *si, int which);
+// write a frame of two fields without copying them, weaved or the top field above the bottom
+int yuv_write_weave(int fd, const y4m_stream_info_t *si, const y4m_frame_info_t *fi, const yuv_field_t *top, const yuv_field_t *bottom);
+int yuv_write_stacked(int fd, const y4m_stream_info_t *si, const y4m_frame_info_t *fi, const yuv_field_t *top, const yuv_field_t *bottom);
+
+// random access to the frames of a y4m file
+typedef struct {
+	int fd;
+	int close_fd;
+	y4m_stream_info_t si;
+	uint8_t *map;
+	size_t length;
+	off_t first;
+	int frames;
+	int64_t *offset;
+	// a spool file is decoded into frame
+	struct yuv_spool *spool;
+	uint8_t *frame;
+} yuv_index_t;
+
+int yuv_index_open(yuv_index_t *yi, const char *filename);
+// for a stream whose header has been read, fails unless it is a regular file
+int yuv_index_fd(yuv_index_t *yi, int fd, const y4m_stream_info_t *si);
+// points m at the planes of frame n, which must not be written to
+int yuv_index_frame(yuv_index_t *yi, int n, uint8_t *m[3]);
+// the file offset just past the data of frame n
+off_t yuv_index_end(yuv_index_t *yi, int n);
+// writes the <file>.y4mi sidecar
+int yuv_index_write(yuv_index_t *yi, const char *filename);
+void yuv_index_close(yuv_index_t *yi);
+
+// kernels picked for the CPU at startup, YUV_CPU=<name> limits the level
+#define YUV_CPU_SCALAR 0
+#define YUV_CPU_SSE2 1
+#define YUV_CPU_SSSE3 2
+#define YUV_CPU_SSE41 3
+#define YUV_CPU_AVX2 4
+#define YUV_CPU_AVX512 5
+
+typedef struct {
+	// sum of absolute differences
+	unsigned int (*sad)(const uint8_t *a, const uint8_t *b, int len);
+	// d = (a * (256 - w) + b * w + 128) >> 8, w is 0..256
+	void (*blend)(uint8_t *d, const uint8_t *a, const uint8_t *b, int w, int len);
+	// copies rows field, field + 2 ... of a plane
+	void (*copyfield)(uint8_t *d, const uint8_t *s, int width, int height, int field);
+	void (*fill)(uint8_t *d, uint8_t v, int len);
+	// adds to the counts in hist
+	void (*histogram)(const uint8_t *s, int len, uint32_t hist[256]);
+	void (*minmaxsum)(const uint8_t *s, int len, uint8_t *min, uint8_t *max, uint64_t *sum);
+	// d = table[s]
+	void (*lut)(uint8_t *d, const uint8_t *s, const uint8_t table[256], int len);
+	// u,v -= 128; u,v = (m * (u,v) + off) >> shift, clamped to +-112; u,v += 128
+	void (*chroma_matrix)(uint8_t *u, uint8_t *v, const int16_t m[4], const int32_t off[2], int shift, int len);
+	// acc += s, 16 bit lanes that wrap, 257 frames of 8 bit samples fit
+	void (*accumulate)(uint16_t *acc, const uint8_t *s, int len);
+} yuv_kernels_t;
+
+extern yuv_kernels_t yuv_kernel;
+extern int yuv_cpu_level;
+
+int yuv_cpu_detect(void);
+const char *yuv_cpu_name(int level);
+int yuv_kernels_select(yuv_kernels_t *k, int level);
+// returns the number of levels whose kernels differ from the scalar ones
+int yuv_cpu_selfcheck(int verbose);
+void yuv_cpu_init(void);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -5,6 +5,9 @@
  *
  **<p> Converts full swing levels to broadcast swing for file which have been incorrectly labelled.</p>
  ** <p> Performs clipping, scaling or detection of out of range Luma values (16-235)</P>
+ ** <p> Each plane goes through a lookup table, in slices on the filter graph threads.
+ ** Once the frame count runs out without finding anything the frames are passed through
+ ** untouched.</p>
  *
  * This file is part of FFmpeg.
  *
@@ -37,13 +40,50 @@
 #include <strings.h>
 
 
+// one slice per thread, at most
+#define MAX_SLICES 64
+
 typedef struct
 {
 	int mode;
 	int frames;
 	int hsub, vsub;
+	// the legalised value of each level, and if that level is out of range
+	uint8_t lut[3][256];
+	uint8_t out_of_range[3][256];
 } levelsContext;
 
+typedef struct
+{
+	AVFrame *in, *out;
+	int w, h;
+	int detect;
+} ThreadData;
+
+// Broadcast swing levels, min and max.  Chroma uses the luma limits.
+static void build_luts(levelsContext *lctx)
+{
+	int min=16;
+	int max=235;
+	int p,v,o;
+
+	for (p=0; p<3; p++) {
+		for (v=0; v<256; v++) {
+			o = v;
+			if (lctx->mode == 1) { // clip
+				if (v > max) o = max;
+				if (v < min) o = min;
+			} else if (lctx->mode == 2) { // scale
+				if (v > max || v < min)
+					o = v * (max-min) / 255 + min;
+			}
+			// detect leaves the picture alone
+			lctx->lut[p][v] = o;
+			lctx->out_of_range[p][v] = (v > max || v < min);
+		}
+	}
+}
+
 /*
  static av_cold void uninit(AVFilterContext *ctx)
  {
@@ -111,6 +151,7 @@ static av_cold int init(AVFilterContext *ctx, const char *args)
 			return -1;
 		}
 
+		build_luts(lctx);
 
 		return 0;
 	}
@@ -149,162 +190,108 @@ static int config_props(AVFilterLink *outlink)
 
 }
 
-// static void draw_slice(AVFilterLink *link, int y, int h, int slice_dir)
-static int filter_frame(AVFilterLink *link, AVFrame *in)
+// each plane is run through its table on its own, the slice is a band of rows
+static int filter_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
+	levelsContext *lctx = ctx->priv;
+	ThreadData *td = arg;
+	const uint8_t *lut, *range, *src;
+	uint8_t *dst;
+	int p,i,j,w,h,start,end;
+	int bad = 0;
+
+	for (p=0; p<3; p++) {
+		w = p ? -((-td->w) >> lctx->hsub) : td->w;
+		h = p ? -((-td->h) >> lctx->vsub) : td->h;
+		start = h * jobnr / nb_jobs;
+		end = h * (jobnr+1) / nb_jobs;
+		lut = lctx->lut[p];
+		range = lctx->out_of_range[p];
+
+		for (j=start; j<end; j++) {
+			src = td->in->data[p] + j * td->in->linesize[p];
+			dst = td->out->data[p] + j * td->out->linesize[p];
+
+			if (td->detect)
+				for (i=0; i<w; i++)
+					bad |= range[src[i]];
+
+			if (lctx->mode != 3)
+				for (i=0; i<w; i++)
+					dst[i] = lut[src[i]];
+			else if (dst != src)
+				memcpy(dst, src, w);
+		}
+	}
 
-    levelsContext *lctx = link->dst->priv;
-    AVFilterLink *outlink = link->dst->outputs[0];
-    AVFrame *out; // = link->dst->outputs[0]->outpic;
-	AVFilterContext *ctx = link->src;
-
-
-    int y = 0;
-    int h = outlink->h;
-
-	// Broadcast swing levels, min and max
-	int min=16;
-	int max=235;
-	int luma,chromab,chromar;
-	int i,j;
+	return bad;
+}
 
-    out = ff_get_video_buffer(outlink, outlink->w, outlink->h);
-    av_frame_copy_props(out, in);
+static int filter_frame(AVFilterLink *link, AVFrame *in)
+{
 
+    levelsContext *lctx = link->dst->priv;
+	AVFilterContext *ctx = link->dst;
+    AVFilterLink *outlink = ctx->outputs[0];
+    AVFrame *out;
+	ThreadData td;
+	int ret[MAX_SLICES];
+	int i, nb_jobs, bad = 0;
 
 	if (lctx->frames == 0) {
 		// nothing detected, shut off
-		memcpy((out->data[0]+y*out->linesize[0]),(in->data[0]+y*in->linesize[0]),in->linesize[0]*h);
-		memcpy((out->data[1]+(y>>lctx->vsub)*out->linesize[1]),(in->data[1]+(y>>lctx->vsub)*in->linesize[1]),in->linesize[1]*(h>>lctx->vsub));
-		memcpy((out->data[2]+(y>>lctx->vsub)*out->linesize[2]),(in->data[2]+(y>>lctx->vsub)*in->linesize[2]),in->linesize[2]*(h>>lctx->vsub));
-	} else {
-
-		if (lctx->frames > 0) {
-				av_log(ctx, AV_LOG_DEBUG, "frames %d.\n", lctx->frames);
-				lctx->frames--;
-		}
-		// run filter, either in detect mode
-		// or permanently
-
-		// copy chroma
-		// now scaling chroma too
-		//memcpy((out->data[1]+(y>>lctx->vsub)*out->linesize[1]),(in->data[1]+(y>>lctx->vsub)*in->linesize[1]),in->linesize[1]*(h>>lctx->vsub));
-		//memcpy((out->data[2]+(y>>lctx->vsub)*out->linesize[2]),(in->data[2]+(y>>lctx->vsub)*in->linesize[2]),in->linesize[2]*(h>>lctx->vsub));
-
-
-		for (j=0; j<h; j++) {
-			for (i=0;i<link->w;i++) {
-				luma = *((in->data[0])+(j+y)*in->linesize[0]+i);
-				 if (!(j%(1<<lctx->vsub) && i%(1<<lctx->hsub))) {
-					 chromab=*((in->data[1])+((j+y)>>lctx->vsub)*in->linesize[1]+(i>>lctx->hsub));
-					 chromar=*((in->data[2])+((j+y)>>lctx->vsub)*in->linesize[2]+(i>>lctx->hsub));
-				 }
-
-				// should put some strategy here rather than this conditional logic
-
-				if (lctx->mode == 1) { // clip
-					if (luma >max) {
-						if (lctx->frames >0) {
-							av_log(ctx, AV_LOG_WARNING, "Out of range level detected. Filter locked. (%d)\n",luma);
-							lctx->frames = -1;  // continue permanently
-						}
-						luma = max;
-
-					}
-					if (luma < min) {
-						if (lctx->frames >0) {
-							av_log(ctx, AV_LOG_WARNING, "Out of range level detected. Filter locked. (%d)\n",luma);
-							lctx->frames = -1;  // continue permanently
-						}
-						luma = min;
-
-					}
-					if (chromab >max) {
-						if (lctx->frames >0) {
-							av_log(ctx, AV_LOG_WARNING, "Out of range level detected. Filter locked. (%d)\n",chromab);
-							lctx->frames = -1;  // continue permanently
-						}
-						chromab = max;
-
-					}
-					if (chromab < min) {
-						if (lctx->frames >0) {
-							av_log(ctx, AV_LOG_WARNING, "Out of range level detected. Filter locked. (%d)\n",chromab);
-							lctx->frames = -1;  // continue permanently
-						}
-						chromab = min;
-
-					}
-					if (chromar >max) {
-						if (lctx->frames >0) {
-							av_log(ctx, AV_LOG_WARNING, "Out of range level detected. Filter locked. (%d)\n",chromar);
-							lctx->frames = -1;  // continue permanently
-						}
-						chromar = max;
-
-					}
-					if (chromar < min) {
-						if (lctx->frames >0) {
-							av_log(ctx, AV_LOG_WARNING, "Out of range level detected. Filter locked. (%d)\n",chromar);
-							lctx->frames = -1;  // continue permanently
-						}
-						chromar = min;
-
-					}
-
-
-				} else if (lctx->mode == 2) { // scale
-
-					if (luma >max || luma < min)  {
-						if (lctx->frames >0) {
-							av_log(ctx, AV_LOG_WARNING, "Out of range level detected. Filter locked. (%d)\n",luma);
-							lctx->frames = -1;  // continue permanently
-						}
-
-						luma= luma * (max-min) / 255 + min  ;
-					}
-					if (chromab >max || chromab < min)  {
-						if (lctx->frames >0) {
-							av_log(ctx, AV_LOG_WARNING, "Out of range level detected. Filter locked. (%d)\n",chromab);
-							lctx->frames = -1;  // continue permanently
-						}
-
-						chromab= chromab * (max-min) / 255 + min  ;
-					}
-					if (chromar >max || chromar < min)  {
-						if (lctx->frames >0) {
-							av_log(ctx, AV_LOG_WARNING, "Out of range level detected. Filter locked. (%d)\n",chromar);
-							lctx->frames = -1;  // continue permanently
-						}
-
-						chromar= chromar * (max-min) / 255 + min  ;
-					}
-
-				} else if (lctx->mode == 1) { // detect
-					// scan, we will stop after frames number of frames
-					// not continue if detected
-
-					if (luma >max || luma < min)
-						av_log(ctx, AV_LOG_WARNING, "Out of range level detected. (%d)\n",luma);
-
-				}
-
-
-				*((out->data[0])+(j+y)*out->linesize[0]+i) = luma;
+		return ff_filter_frame(outlink, in);
+	}
 
-				// do I need to perform Chroma compression?
+	if (lctx->frames > 0) {
+		av_log(ctx, AV_LOG_DEBUG, "frames %d.\n", lctx->frames);
+		lctx->frames--;
+	}
 
-				 if (!(j%(1<<lctx->vsub) && i%(1<<lctx->hsub))) {
-					 *((out->data[1])+((j+y)>>lctx->vsub)*out->linesize[1]+(i>>lctx->hsub))=chromab;
-					 *((out->data[2])+((j+y)>>lctx->vsub)*out->linesize[2]+(i>>lctx->hsub))=chromar;
-				 }
-			}
+	// run filter, either in detect mode
+	// or permanently
+	if (av_frame_is_writable(in)) {
+		out = in;
+	} else {
+		out = ff_get_video_buffer(outlink, outlink->w, outlink->h);
+		if (!out) {
+			av_frame_free(&in);
+			return AVERROR(ENOMEM);
 		}
+		av_frame_copy_props(out, in);
 	}
 
+	td.in = in;
+	td.out = out;
+	td.w = link->w;
+	td.h = link->h;
+	// only worth looking while we might still lock, or to report
+	td.detect = (lctx->frames > 0 || lctx->mode == 3);
+
+#ifdef AVFILTER_FLAG_SLICE_THREADS
+	nb_jobs = FFMIN(FFMIN(td.h >> lctx->vsub, ctx->graph->nb_threads), MAX_SLICES);
+	if (nb_jobs < 1)
+		nb_jobs = 1;
+	ctx->internal->execute(ctx, filter_slice, &td, ret, nb_jobs);
+#else
+	nb_jobs = 1;
+	ret[0] = filter_slice(ctx, &td, 0, 1);
+#endif
+
+	for (i=0; i<nb_jobs; i++)
+		bad |= ret[i];
+
+	if (bad) {
+		if (lctx->mode == 3) {
+			av_log(ctx, AV_LOG_WARNING, "Out of range level detected.\n");
+		} else if (lctx->frames > 0) {
+			av_log(ctx, AV_LOG_WARNING, "Out of range level detected. Filter locked.\n");
+			lctx->frames = -1;  // continue permanently
+		}
+	}
 
-
-	av_frame_free(&in);
+	if (out != in)
+		av_frame_free(&in);
     return ff_filter_frame(outlink, out);
 }
 
@@ -338,6 +325,9 @@ AVFilter avfilter_vf_broadcast = {
     .query_formats = query_formats,
 
 	.priv_size = sizeof(levelsContext),
+#ifdef AVFILTER_FLAG_SLICE_THREADS
+	.flags = AVFILTER_FLAG_SLICE_THREADS,
+#endif
 
     .inputs    = avfilter_vf_broadcast_inputs,
     .outputs   = avfilter_vf_broadcast_outputs,
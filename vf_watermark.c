@@ -4,6 +4,8 @@
  * http://silicontrip.net/~mark/lavtools/
  *
  * Places a transparent static image over the video.
+ * The image and its alpha are turned into blend planes when the filter is
+ * configured, each frame only has the overlay rectangle blended in place.
  *
  * This file is part of FFmpeg.
  *
@@ -59,11 +61,19 @@ typedef struct
 // it appears that maskFrame is erased
 	AVFrame  *maskFrame;
 
+	// the overlay at the output's chroma resolution, clipped to the frame.
+	// out = (in * inv + pre) / 255
+	int roiX[3], roiY[3], roiW[3], roiH[3];
+	uint8_t *inv[3];	// 255 - mask
+	uint16_t *pre[3];	// overlay * mask
+
 } OverlayContext;
 
 static av_cold void uninit(AVFilterContext *ctx)
 {
     OverlayContext *ovl = ctx->priv;
+	int p;
+
 	if (ovl->pFrame)
 		av_free(ovl->pFrame);
 
@@ -73,6 +83,10 @@ static av_cold void uninit(AVFilterContext *ctx)
 	if (ovl->imageName)
 		av_free(ovl->imageName);
 
+	for (p=0; p<3; p++) {
+		av_freep(&ovl->inv[p]);
+		av_freep(&ovl->pre[p]);
+	}
 
 	av_log(ctx, AV_LOG_DEBUG, "uninit().\n");
 
@@ -232,6 +246,75 @@ static int query_formats(AVFilterContext *ctx)
 
 
 
+/* Works out which overlay and mask pixel ends up in each output sample, once.
+** A chroma sample takes the last pixel of its block that the old per pixel
+** loop wrote to it, so unaligned positions give the same picture as before.
+** Samples whose pixel is outside the overlay are left as they are.
+*/
+static int build_planes(AVFilterContext *ctx, int w, int h)
+{
+	OverlayContext *ovl = ctx->priv;
+	int x0, y0, x1, y1;
+	int p, cx, cy;
+
+	// the overlay rectangle clipped to the frame, in luma pixels
+	x0 = FFMAX(ovl->printX, 0);
+	y0 = FFMAX(ovl->printY, 0);
+	x1 = FFMIN(ovl->printX + ovl->printW, w);
+	y1 = FFMIN(ovl->printY + ovl->printH, h);
+
+	for (p=0; p<3; p++) {
+		int sh = p ? ovl->hsub : 0;
+		int sv = p ? ovl->vsub : 0;
+
+		// the planes of an earlier configuration
+		av_freep(&ovl->inv[p]);
+		av_freep(&ovl->pre[p]);
+
+		if (x1 <= x0 || y1 <= y0) {
+			ovl->roiW[p] = ovl->roiH[p] = 0;
+			continue;
+		}
+
+		ovl->roiX[p] = x0 >> sh;
+		ovl->roiY[p] = y0 >> sv;
+		ovl->roiW[p] = ((x1 - 1) >> sh) - ovl->roiX[p] + 1;
+		ovl->roiH[p] = ((y1 - 1) >> sv) - ovl->roiY[p] + 1;
+
+		ovl->inv[p] = av_malloc(ovl->roiW[p] * ovl->roiH[p]);
+		ovl->pre[p] = av_malloc(ovl->roiW[p] * ovl->roiH[p] * sizeof(uint16_t));
+		if (!ovl->inv[p] || !ovl->pre[p])
+			return AVERROR(ENOMEM);
+
+		for (cy=0; cy < ovl->roiH[p]; cy++) {
+			for (cx=0; cx < ovl->roiW[p]; cx++) {
+				int wx, wy, m = 0, print = 0;
+				int n = cy * ovl->roiW[p] + cx;
+
+				// the pixel that wrote this sample last
+				wy = FFMIN(((ovl->roiY[p] + cy) << sv) + (1 << sv) - 1, h - 1);
+				if (wy % (1 << sv))
+					wx = (ovl->roiX[p] + cx) << sh;
+				else
+					wx = FFMIN(((ovl->roiX[p] + cx) << sh) + (1 << sh) - 1, w - 1);
+
+				if (wx >= x0 && wx < x1 && wy >= y0 && wy < y1) {
+					int ox = wx - ovl->printX;
+					int oy = wy - ovl->printY;
+
+					m = ovl->mask ? *(ovl->maskFrame->data[0] + oy * ovl->maskFrame->linesize[0] + ox) : 255;
+					print = *(ovl->pFrame->data[p] + (oy >> sv) * ovl->pFrame->linesize[p] + (ox >> sh));
+				}
+
+				ovl->inv[p][n] = 255 - m;
+				ovl->pre[p][n] = print * m;
+			}
+		}
+	}
+
+	return 0;
+}
+
 static int config_props(AVFilterLink *outlink)
 {
 
@@ -249,6 +332,7 @@ static int config_props(AVFilterLink *outlink)
 
 	int avStream = -1;
 	int frameFinished;
+	int ret;
 
 	struct SwsContext *sws;
 
@@ -434,6 +518,14 @@ static int config_props(AVFilterLink *outlink)
 	sws_scale(sws, (const uint8_t * const *)overlay->data, overlay->linesize, 0, pCodecCtx->height,
 				ovl->pFrame->data, ovl->pFrame->linesize);
 
+	ret = build_planes(ctx, outlink->w, outlink->h);
+
+	// only the blend planes are needed from here on
+	av_free(data);
+	av_free(maskData);
+	av_free(tempData);
+	av_freep(&ovl->pFrame);
+	av_freep(&ovl->maskFrame);
 
 	av_free(tempMask);
 	av_free(overlay);
@@ -447,116 +539,55 @@ static int config_props(AVFilterLink *outlink)
     av_log(ctx, AV_LOG_DEBUG, "<<< config_props().\n");
 
 
-    return 0;
+    return ret;
 
 
 }
 
-/*
-static void start_frame(AVFilterLink *link, AVFilterPicRef *picref)
+// x / 255 is (x + 1 + (x >> 8)) >> 8 for x up to 255 * 255, which keeps
+// the whole row in 16 bits so the compiler can vectorise it.
+static void blend_row(uint8_t *d, const uint8_t *inv, const uint16_t *pre, int w)
 {
-    AVFilterLink *outlink = link->dst->outputs[0];
-    AVFilterPicRef *outpicref;
+	int i;
+	uint16_t x;
 
-    outpicref = ff_get_video_buffer(outlink, outlink->w, outlink->h);
-    outpicref->pts = picref->pts;
-
-    outlink->outpic = outpicref;
-
-	avfilter_start_frame(outlink, avfilter_ref_pic(outpicref, ~0));
+	for (i=0; i<w; i++) {
+		x = d[i] * inv[i] + pre[i];
+		d[i] = (x + 1 + (x >> 8)) >> 8;
+	}
 }
-*/
-// replaced by filter_frame...
-// need refactoring
-// static void draw_slice(AVFilterLink *link, int y, int h, int slice_dir)
+
+// only the overlay rectangle is touched, the rest of the frame goes through as it is
 static int filter_frame(AVFilterLink *link, AVFrame *in)
 {
     OverlayContext *ovl = link->dst->priv;
     AVFilterLink *outlink = link->dst->outputs[0];
-
-    AVFrame *out;
-
-    int i, j;
-	int lumaFrame, lumaPrint, lumaMask,uPrint,vPrint;
-	int py;
-	int h = link->h;
-    int y = 0;
+	int i, j, p, ret;
+	uint8_t *d;
 
     av_log(link->src, AV_LOG_DEBUG, "filter_frame().\n");
 
-
-	py = ovl->printY;
-
-	// use py to disable the watermark for interval display
-
+	// interval display, the watermark is off
 	if (ovl->printINT > 0) {
 		i = (in->pts / AV_TIME_BASE) % ovl->printINT ;
-		if (i >= ovl->printON) py = y+h+1; // hack to turn off water mark
+		if (i >= ovl->printON)
+			return ff_filter_frame(outlink, in);
 	}
 
-    out = ff_get_video_buffer(outlink, outlink->w, outlink->h);
-    av_frame_copy_props(out, in);
-
-
-	lumaMask=255;
-
-	for (j=0; j<h; j++) {
-		if (y+j<py || y+j>=py+ovl->printH) {
-			memcpy((out->data[0])+(j+y)*out->linesize[0],(in->data[0])+(y+j)*in->linesize[0],link->w);
-
-			if (j%(1<<ovl->vsub)) {
-				memcpy((out->data[1])+((j+y)>>ovl->vsub)*out->linesize[1],(in->data[1])+((j+y)>>ovl->vsub)*in->linesize[1],link->w >> ovl->hsub);
-				memcpy((out->data[2])+((j+y)>>ovl->vsub)*out->linesize[2],(in->data[2])+((j+y)>>ovl->vsub)*in->linesize[2],link->w >> ovl->hsub);
-			}
-		} else {
-
-			for (i=0;i<link->w;i++) {
-			// check X to see if we are over the overlay
-				if (i<ovl->printX || i>=ovl->printX+ovl->printW) {
-					*((out->data[0])+(j+y)*out->linesize[0]+i) = *((in->data[0])+(j+y)*in->linesize[0]+i);
-				 if (!(j%(1<<ovl->vsub) && i%(1<<ovl->hsub))) {
-						*((out->data[1])+((j+y)>>ovl->vsub)*out->linesize[1]+(i>>ovl->hsub))=*((in->data[1])+((j+y)>>ovl->vsub)*in->linesize[1]+(i>>ovl->hsub));
-						*((out->data[2])+((j+y)>>ovl->vsub)*out->linesize[2]+(i>>ovl->hsub))=*((in->data[2])+((j+y)>>ovl->vsub)*in->linesize[2]+(i>>ovl->hsub));
-				}
-				} else {
-					// draw image
-
-					lumaFrame = *((in->data[0])+(j+y)*in->linesize[0]+i); // input luma
-					lumaPrint = *((ovl->pFrame->data[0])+(j+y-ovl->printY)*ovl->pFrame->linesize[0]+i-ovl->printX);  // overlay luma
-					uPrint = *((ovl->pFrame->data[1])+((j+y-ovl->printY)>>(ovl->vsub))*ovl->pFrame->linesize[1]+((i-ovl->printX)>>(ovl->hsub))); // overlay chroma
-					vPrint = *((ovl->pFrame->data[2])+((j+y-ovl->printY)>>(ovl->vsub))*ovl->pFrame->linesize[2]+((i-ovl->printX)>>(ovl->hsub))); // overlay chroma
-
-					if (ovl->mask) {
-						lumaMask = *(ovl->maskFrame->data[0] + (j+y - ovl->printY) * ovl->maskFrame->linesize[0] + i-ovl->printX ); // mask intensity
-					}
+	// copies the frame only if someone else holds it
+	if ((ret = av_frame_make_writable(in)) < 0) {
+		av_frame_free(&in);
+		return ret;
+	}
 
-					if (lumaMask == 255) { 	// optimize for completely opaque
-						*((out->data[0])+(j+y)*out->linesize[0]+i) = lumaPrint;
-						if (!(j%(1<<ovl->vsub) && i%(1<<ovl->hsub))) {
-							*((out->data[1])+((j+y)>>ovl->vsub)*out->linesize[1]+(i>>ovl->hsub))= uPrint;
-							*((out->data[2])+((j+y)>>ovl->vsub)*out->linesize[2]+(i>>ovl->hsub))= vPrint;
-						}
-					} else if (lumaMask == 0) { // optimize for completely transparent
-
-						*((out->data[0])+(j+y)*out->linesize[0]+i) = *((in->data[0])+(j+y)*in->linesize[0]+i);
-						if (!(j%(1<<ovl->vsub) && i%(1<<ovl->hsub))) {
-							*((out->data[1])+((j+y)>>ovl->vsub)*out->linesize[1]+(i>>ovl->hsub))=*((in->data[1])+((j+y)>>ovl->vsub)*in->linesize[1]+(i>>ovl->hsub));
-							*((out->data[2])+((j+y)>>ovl->vsub)*out->linesize[2]+(i>>ovl->hsub))=*((in->data[2])+((j+y)>>ovl->vsub)*in->linesize[2]+(i>>ovl->hsub));
-						}
-					} else {
-						*((out->data[0])+(j+y)*out->linesize[0]+i) = (lumaFrame* (255 - lumaMask) + lumaPrint * lumaMask) / 255;
-					if (!(j%(1<<ovl->vsub) && i%(1<<ovl->hsub))) {
-							*((out->data[1])+((j+y)>>ovl->vsub)*out->linesize[1]+(i>>ovl->hsub))= (*((in->data[1])+((j+y)>>ovl->vsub)*in->linesize[1]+(i>>ovl->hsub)) * (255-lumaMask) + uPrint *lumaMask) / 255;
-							*((out->data[2])+((j+y)>>ovl->vsub)*out->linesize[2]+(i>>ovl->hsub))=(*((in->data[2])+((j+y)>>ovl->vsub)*in->linesize[2]+(i>>ovl->hsub)) * (255-lumaMask) + vPrint *lumaMask) / 255;
-						}
-					}
-				}
-			}
+	for (p=0; p<3; p++) {
+		for (j=0; j < ovl->roiH[p]; j++) {
+			d = in->data[p] + (ovl->roiY[p] + j) * in->linesize[p] + ovl->roiX[p];
+			blend_row(d, ovl->inv[p] + j * ovl->roiW[p], ovl->pre[p] + j * ovl->roiW[p], ovl->roiW[p]);
 		}
 	}
-	av_frame_free(&in);
-    return ff_filter_frame(outlink, out);
 
+    return ff_filter_frame(outlink, in);
 }
 
 
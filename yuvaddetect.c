@@ -1,13 +1,38 @@
 /*
 
 ** <h3>Advertisement detection</h3>
-** <p>Most of the functionality of this code has been replaced by yuvvalues.c any further work on this will be focussed there.</p>
-** <h4>INCOMPLETE</h4>
+** <p>Finds the chapters of a broadcast capture and the advertisement breaks
+** between them, to author a DVD from TV without scrubbing through it by
+** hand.  The idea is that there is a black fade before and after
+** advertisements.</p>
 **
-** <p> Currently only produces a text file (which can be graphed by
-** gnuplot) of the average lightness of the sourceframes.  The idea
-** is that there is a black fade before and after advertisements.  To
-** produce chapter markers for DVDs from TV.</p>
+** <p>Each frame's luma is scaled down to 1/8 in both directions, which
+** keeps the work for a frame in the CPU cache and runs many times faster
+** than real time.  Two things are looked for in the small frame:</p>
+** <ul>
+** <li>Black frames.  A run of them is a gap between two segments of the
+** capture.  Segments no longer than an advertisement (-a, 65 seconds) are
+** an advertisement break, the rest are programme.
+** <li>Scene cuts.  The difference between the luma histograms of a frame and
+** the one before it, which is a cut when it is over the threshold (-t) and
+** several times the rolling average of the frames before.
+** </ul>
+** <p>The boundaries are printed as they are found, a frame number in the
+** y4m stream, its timecode and what starts there:</p>
+** <pre>
+**0 00:00:00:00 chapter
+**20472 00:13:38:22 black 6
+**20478 00:13:39:03 break
+**24960 00:16:38:10 black 4
+**24964 00:16:38:14 chapter
+**</pre>
+** <p>-c prints the scene cuts too, -D a dvdauthor chapters list at the end.
+** There is no audio in y4m, so silence isn't used, only the pictures.</p>
+**
+** <p>-g prints the frame by frame numbers instead (frame, difference of the
+** small frames, histogram difference, average luma and black), which can
+** be graphed by gnuplot to choose the thresholds.  -B file.ystats writes
+** them to a binary statistics file, see yuvstatsdump.</p>
 **
 ** <h4>RESULTS</h4>
 ** <p>
@@ -15,15 +40,13 @@
 ** </p>
 **
 ** <p>
-** From looking at this above graph it appears that this program is doing a frame difference,
-** rather than averaging luma. Which is the same function as yuvdiff.
-**
-** Now we can quite easily see scene changes, shown as sharp spikes. At about 810 and 1500</p>
-** <p>
-** We can also tell that the video has gone through a frame rate doubling by
-** frame dupliation. Shown by the high frequency component.
+** The graph is the difference of the small frames from -g.  Scene changes
+** show as sharp spikes, at about 810 and 1500, and the high frequency
+** component shows the video has had its frame rate doubled by duplicating
+** frames.
 ** </p>
-** <p><i>I should move this image down to YUV diff</i></p>
+** <h4>EXAMPLE</h4>
+** <pre>libav2yuv -dk capture.ts | yuvaddetect -D &gt; capture.chapters</pre>
 
   *
   *  This program is free software; you can redistribute it and/or modify
@@ -52,110 +75,309 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
+#include <string.h>
 
 #include "yuv4mpeg.h"
 #include "mpegconsts.h"
-
-#define YUVFPS_VERSION "0.1"
+#include "utilyuv.h"
+#include "yuvstats.h"
+
+#define YUVFPS_VERSION "0.2"
+
+// the luma is scaled down by this in both directions
+#define DECIMATE 8
+// histogram bins of the small frame compared for cuts
+#define CUT_BINS 64
+// frames in the rolling average a cut is compared with
+#define CUT_WINDOW 16
+// a cut is this many times the rolling average
+#define CUT_RATIO 3.0
+// the shortest scene, cuts closer than this are flashes
+#define CUT_MIN_SCENE 5
+// the part of the small frame that may be brighter than black, a channel logo
+#define BLACK_BRIGHT 0.02
 
 static void print_usage()
 {
   fprintf (stderr,
-	   "usage: yuvaddetect [-v -h -i|-p]\n"
-	   "yuvaddetect produces a 2d graph showing time vs frame difference\n"
+	   "usage: yuvaddetect [-v -h -g -c -d -D] [-t <cut>] [-b <black>] [-m <frames>] [-a <seconds>] [-B file.ystats]\n"
+	   "yuvaddetect finds the chapters and advertisement breaks of a broadcast capture\n"
            "\n"
 	   "\t -v Verbosity degree : 0=quiet, 1=normal, 2=verbose/debug\n"
-	   "\t -i Force interlace\n"
-	   "\t -p Force progressive\n"
+	   "\t -t histogram difference (0-2) that is a scene cut (default 0.5)\n"
+	   "\t -b luma level at or below which a frame is black (default 32)\n"
+	   "\t -m fewest black frames that make a gap between segments (default 1)\n"
+	   "\t -a longest advertisement in seconds (default 65)\n"
+	   "\t -c print the scene cuts as well\n"
+	   "\t -d use NTSC drop frame timecode\n"
+	   "\t -D print a dvdauthor chapters list at the end\n"
+	   "\t -g print the frame by frame numbers for gnuplot instead\n"
+	   "\t -B write the frame by frame numbers to a binary statistics file\n"
 	   "\t -h print this help\n"
          );
 }
 
-static void detect(  int fdIn , y4m_stream_info_t  *inStrInfo)
+struct detector {
+  // options
+  double cut_threshold;
+  int black_level;
+  int black_min;
+  int ad_frames;
+  int print_cuts;
+  int graph;
+  int drop_frame;
+  y4m_stream_info_t *si;
+  yuv_stats_t *st;
+
+  // the small frames, this one and the one before
+  int w, dw, dh;
+  uint16_t *acc;
+  uint8_t *dec, *prev;
+  uint32_t hist[256], prev_hist[256];
+
+  // the rolling average of the histogram differences
+  double window[CUT_WINDOW];
+  double window_sum;
+  int last_cut;
+  int prev_black;
+
+  // the segment being read, and the cuts in it
+  int seg_start;
+  int black_start;
+  int in_break;
+  int *cuts;
+  int ncuts, cuts_size;
+
+  // the chapters for -D
+  int *chapters;
+  int nchapters, chapters_size;
+};
+
+static int *append(int *list, int *n, int *size, int v)
 {
-  y4m_frame_info_t   in_frame ;
-  uint8_t            *yuv_data[3] ;
-  uint8_t            *yuv_odata[3] ;
-
-  int                frame_data_size ;
-  int                read_error_code ;
-  int                write_error_code ;
-  int                src_frame_counter ;
-  int bri=0,l=0;
-
-  // Allocate memory for the YUV channels
-  frame_data_size = y4m_si_get_height(inStrInfo) * y4m_si_get_width(inStrInfo);
-  yuv_data[0] = (uint8_t *)malloc( frame_data_size );
-  yuv_data[1] = (uint8_t *)malloc( frame_data_size >> 2);
-  yuv_data[2] = (uint8_t *)malloc( frame_data_size >> 2);
-
-  yuv_odata[0] = (uint8_t *)malloc( frame_data_size );
-  yuv_odata[1] = (uint8_t *)malloc( frame_data_size >> 2);
-  yuv_odata[2] = (uint8_t *)malloc( frame_data_size >> 2);
-
-
-  if( !yuv_data[0] || !yuv_data[1] || !yuv_data[2] ||
-      !yuv_odata[0] || !yuv_odata[1] || !yuv_odata[2]  )
-    mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
+  if (*n == *size) {
+    *size = *size ? *size * 2 : 64;
+    list = (int *)realloc(list, sizeof(int) * *size);
+    if (list == NULL)
+      mjpeg_error_exit1 ("Could'nt allocate memory for the segments");
+  }
+  list[(*n)++] = v;
+  return list;
+}
 
+static void event (struct detector *d, int frame, const char *what, int length)
+{
+  int tch,tcm,tcs,tcf,df = d->drop_frame;
+
+  if (d->graph)
+    return;
+  framecount2timecode(d->si, &tch,&tcm,&tcs,&tcf, frame, &df);
+  printf ("%d %02d:%02d:%02d%c%02d %s",frame,tch,tcm,tcs,df?';':':',tcf,what);
+  if (length)
+    printf (" %d",length);
+  printf ("\n");
+}
 
-  write_error_code = Y4M_OK ;
+static void output (struct detector *d, int frame, int diff, double hist, double luma, int black)
+{
+  yuv_stats_t *st = d->st;
+
+  if (st) {
+    yuv_stats_set_int(st, 0, frame);
+    yuv_stats_set_int(st, 1, diff);
+    yuv_stats_set_float(st, 2, hist);
+    yuv_stats_set_float(st, 3, luma);
+    yuv_stats_set_int(st, 4, black);
+    if (yuv_stats_row(st))
+      mjpeg_error_exit1 ("Error writing the statistics file");
+  } else if (d->graph) {
+    printf ("%d %d %g %g %d\n",frame,diff,hist,luma,black);
+  }
+}
 
-  src_frame_counter = 0 ;
-  y4m_init_frame_info( &in_frame );
-  read_error_code = y4m_read_frame(fdIn,inStrInfo,&in_frame,yuv_odata );
-  ++src_frame_counter ;
+/* the segment from start to end - 1 is over.  It is printed with the cuts
+** in it once it is known whether it is programme or advertisement.
+*/
+static void segment (struct detector *d, int start, int end)
+{
+  int c;
+
+  if (end <= start)
+    return;
+
+  if (end - start <= d->ad_frames) {
+    if (!d->in_break)
+      event (d, start, "break", 0);
+    d->in_break = 1;
+  } else {
+    event (d, start, "chapter", 0);
+    d->chapters = append(d->chapters, &d->nchapters, &d->chapters_size, start);
+    d->in_break = 0;
+  }
 
-  while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
+  if (d->print_cuts)
+    for (c=0; c<d->ncuts; c++)
+      event (d, d->cuts[c], "cut", 0);
+  d->ncuts = 0;
+}
 
-	read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+// 8x8 block averages of the luma, the rows of a block are added up 16 bits wide
+static void decimate (struct detector *d, const uint8_t *y)
+{
+  int bx, by, r, c, sum;
+  uint16_t *a;
+
+  for (by=0; by<d->dh; by++) {
+    memset(d->acc, 0, sizeof(uint16_t) * d->dw * DECIMATE);
+    for (r=0; r<DECIMATE; r++)
+      yuv_kernel.accumulate(d->acc, y + (by * DECIMATE + r) * d->w, d->dw * DECIMATE);
+    for (bx=0, a=d->acc; bx<d->dw; bx++, a+=DECIMATE) {
+      for (c=0, sum=0; c<DECIMATE; c++)
+        sum += a[c];
+      d->dec[by * d->dw + bx] = (sum + DECIMATE * DECIMATE / 2) / (DECIMATE * DECIMATE);
+    }
+  }
+}
 
-	// check for read error
+static void detect_frame (struct detector *d, int frame, const uint8_t *y)
+{
+  int pixels = d->dw * d->dh;
+  int diff = 0, black, bright, b, i, j;
+  double hist = 0, luma = 0, mean;
+  uint8_t *t;
+
+  decimate (d, y);
+  memset(d->hist, 0, sizeof(d->hist));
+  yuv_kernel.histogram(d->dec, pixels, d->hist);
+
+  for (b=0, bright=0; b<256; b++) {
+    luma += (double)b * d->hist[b];
+    if (b > d->black_level)
+      bright += d->hist[b];
+  }
+  luma /= pixels;
+  black = luma <= d->black_level && bright <= pixels * BLACK_BRIGHT;
+
+  if (frame > 0) {
+    diff = yuv_kernel.sad(d->dec, d->prev, pixels);
+    for (b=0; b<256; b+=256/CUT_BINS) {
+      for (i=0, j=0; i<256/CUT_BINS; i++)
+        j += (int)d->hist[b+i] - (int)d->prev_hist[b+i];
+      hist += abs(j);
+    }
+    hist /= pixels;
+
+    // a sudden change from the frames before, not a fade, a pan or a flash.
+    // the picture coming out of black isn't a cut, the gap is the boundary
+    // there are no cuts until the window is full, the average of a few frames isn't one
+    mean = d->window_sum / CUT_WINDOW;
+    if (frame > CUT_WINDOW && !black && !d->prev_black && hist > d->cut_threshold && hist > mean * CUT_RATIO &&
+        frame - d->last_cut >= CUT_MIN_SCENE && frame - d->seg_start >= CUT_MIN_SCENE) {
+      d->cuts = append(d->cuts, &d->ncuts, &d->cuts_size, frame);
+      d->last_cut = frame;
+    }
+    d->window_sum += hist - d->window[frame % CUT_WINDOW];
+    d->window[frame % CUT_WINDOW] = hist;
+  }
 
+  output (d, frame, diff, hist, luma, black);
 
-	// perform frame difference.
-	// only comparing Luma, less noise, more resolution... blah blah
+  // a black gap closes the segment before it
+  if (black && d->black_start == -1) {
+    d->black_start = frame;
+  } else if (!black && d->black_start != -1) {
+    if (frame - d->black_start >= d->black_min) {
+      segment (d, d->seg_start, d->black_start);
+      event (d, d->black_start, "black", frame - d->black_start);
+      d->seg_start = frame;
+    }
+    d->black_start = -1;
+  }
 
-	// if progressive
-	bri = 0;
-	for (l=0; l< frame_data_size; l++)
-		bri += abs(yuv_data[0][l]-yuv_odata[0][l]);
+  t = d->prev; d->prev = d->dec; d->dec = t;
+  memcpy(d->prev_hist, d->hist, sizeof(d->hist));
+  d->prev_black = black;
+}
 
-	printf ("%d %d\n",src_frame_counter,bri);
+static void detect_end (struct detector *d, int frames)
+{
+  if (d->black_start != -1 && frames - d->black_start >= d->black_min) {
+    segment (d, d->seg_start, d->black_start);
+    event (d, d->black_start, "black", frames - d->black_start);
+  } else {
+    segment (d, d->seg_start, frames);
+  }
+}
 
-	++src_frame_counter ;
+// dvdauthor takes the chapters as h:mm:ss.fff
+static void print_chapters (struct detector *d)
+{
+  y4m_ratio_t rate = y4m_si_get_framerate(d->si);
+  double t;
+  int c;
+
+  printf ("chapters=\"");
+  for (c=0; c<d->nchapters; c++) {
+    t = (double)d->chapters[c] * rate.d / rate.n;
+    printf ("%s%d:%02d:%06.3f", c ? "," : "", (int)t / 3600, ((int)t / 60) % 60, t - ((int)t / 60) * 60);
+  }
+  printf ("\"\n");
+}
 
-	y4m_fini_frame_info( &in_frame );
-	y4m_init_frame_info( &in_frame );
+static void detect(  int fdIn , y4m_stream_info_t  *inStrInfo, struct detector *d)
+{
+  y4m_frame_info_t   in_frame ;
+  uint8_t            *yuv_data[YUV_MAX_PLANES] ;
+  int                read_error_code ;
+  int                src_frame_counter ;
 
-	read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_odata );
+  // Allocate memory for the YUV channels
+  if (planealloc(yuv_data,inStrInfo))
+    mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
 
-// check for read error
+  d->si = inStrInfo;
+  d->w = y4m_si_get_plane_width(inStrInfo,0);
+  d->dw = d->w / DECIMATE;
+  d->dh = y4m_si_get_plane_height(inStrInfo,0) / DECIMATE;
+  if (d->dw < 1 || d->dh < 1)
+    mjpeg_error_exit1 ("The frames are too small");
+
+  d->acc = (uint16_t *)malloc(sizeof(uint16_t) * d->dw * DECIMATE);
+  d->dec = (uint8_t *)malloc(d->dw * d->dh);
+  d->prev = (uint8_t *)malloc(d->dw * d->dh);
+  if (!d->acc || !d->dec || !d->prev)
+    mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
 
-	bri = 0;
-	for (l=0; l< frame_data_size; l++)
-		bri += abs(yuv_data[0][l]-yuv_odata[0][l]);
+  d->seg_start = 0;
+  d->black_start = -1;
+  d->last_cut = -CUT_MIN_SCENE;
 
-	printf ("%d %d\n",src_frame_counter,bri);
+  src_frame_counter = 0 ;
+  y4m_init_frame_info( &in_frame );
+  read_error_code = yuv_read_frame(fdIn,inStrInfo,&in_frame,yuv_data );
 
-	++src_frame_counter ;
+  while( Y4M_OK == read_error_code ) {
 
-	y4m_fini_frame_info( &in_frame );
-	y4m_init_frame_info( &in_frame );
+    // only comparing Luma, less noise, more resolution... blah blah
+    detect_frame (d, src_frame_counter, yuv_data[0]);
+    ++src_frame_counter ;
 
+    y4m_fini_frame_info( &in_frame );
+    y4m_init_frame_info( &in_frame );
+    read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+  }
+  if( read_error_code != Y4M_ERR_EOF )
+    mjpeg_error_exit1 ("Error reading from input stream!");
+  detect_end (d, src_frame_counter);
 
-    }
   // Clean-up regardless an error happened or not
   y4m_fini_frame_info( &in_frame );
-  free( yuv_data[0] );
-  free( yuv_data[1] );
-  free( yuv_data[2] );
-
-  if( read_error_code != Y4M_ERR_EOF )
-    mjpeg_error_exit1 ("Error reading from input stream!");
-  if( write_error_code != Y4M_OK )
-    mjpeg_error_exit1 ("Error writing output stream!");
+  planefree(yuv_data);
+  free(d->acc);
+  free(d->dec);
+  free(d->prev);
 
+  mjpeg_info ("%d frames, %d chapters", src_frame_counter, d->nchapters);
 }
 
 // *************************************************************************************
@@ -164,13 +386,24 @@ static void detect(  int fdIn , y4m_stream_info_t  *inStrInfo)
 int main (int argc, char *argv[])
 {
 
-  int verbose = 4; // LOG_ERROR ;
+  int verbose = 1;
   int fdIn = 0 ;
   y4m_stream_info_t in_streaminfo;
-
-  const static char *legal_flags = "v:h";
+  char *stats_file = NULL;
+  yuv_stats_t stats;
+  y4m_ratio_t rate;
+  struct detector d;
+  double ad_seconds = 65;
+  int dvd = 0;
+
+  const static char *legal_flags = "v:hB:t:b:m:a:cdDg";
   int c ;
 
+  memset(&d, 0, sizeof(d));
+  d.cut_threshold = 0.5;
+  d.black_level = 32;
+  d.black_min = 1;
+
   while ((c = getopt (argc, argv, legal_flags)) != -1) {
     switch (c) {
       case 'v':
@@ -178,6 +411,35 @@ int main (int argc, char *argv[])
         if (verbose < 0 || verbose > 2)
           mjpeg_error_exit1 ("Verbose level must be [0..2]");
         break;
+      case 'B':
+        stats_file = optarg;
+        break;
+      case 't':
+        d.cut_threshold = atof (optarg);
+        break;
+      case 'b':
+        d.black_level = atoi (optarg);
+        break;
+      case 'm':
+        d.black_min = atoi (optarg);
+        if (d.black_min < 1)
+          d.black_min = 1;
+        break;
+      case 'a':
+        ad_seconds = atof (optarg);
+        break;
+      case 'c':
+        d.print_cuts = 1;
+        break;
+      case 'd':
+        d.drop_frame = 1;
+        break;
+      case 'D':
+        dvd = 1;
+        break;
+      case 'g':
+        d.graph = 1;
+        break;
 
         case 'h':
         case '?':
@@ -197,21 +459,38 @@ int main (int argc, char *argv[])
   // The streaminfo structure is filled in
   // ***************************************************************
   // INPUT comes from stdin, we check for a correct file header
-  if (y4m_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+  if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
     mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
 
-  // Prepare output stream
-
   // Information output
-  mjpeg_info ("yuv2fps (version " YUVFPS_VERSION
-              ") is a general frame resampling utility for yuv streams");
-  mjpeg_info ("(C) 2002 Alfonso Garcia-Patino Barbolani <barbolani@jazzfree.com>");
-  mjpeg_info ("yuvaddetect -h for help, or man yuvaddetect");
+  mjpeg_info ("yuvaddetect (version " YUVFPS_VERSION
+              ") finds the chapters and advertisement breaks of yuv streams");
+  mjpeg_info ("yuvaddetect -h for help");
 
+  rate = y4m_si_get_framerate(&in_streaminfo);
+  if (rate.n <= 0 || rate.d <= 0)
+    mjpeg_error_exit1 ("The stream has no frame rate");
+  d.ad_frames = ad_seconds * rate.n / rate.d;
 
   /* in that function we do all the important work */
-  detect( fdIn,&in_streaminfo);
-
+  if (stats_file) {
+    if (yuv_stats_create(&stats, stats_file, "yuvaddetect", rate.n, rate.d))
+      mjpeg_error_exit1 ("Cannot create %s", stats_file);
+    yuv_stats_add_column(&stats, "frame", YUV_STATS_INT32);
+    yuv_stats_add_column(&stats, "diff", YUV_STATS_INT32);
+    yuv_stats_add_column(&stats, "hist", YUV_STATS_DOUBLE);
+    yuv_stats_add_column(&stats, "luma", YUV_STATS_DOUBLE);
+    yuv_stats_add_column(&stats, "black", YUV_STATS_INT32);
+    d.st = &stats;
+  }
+  detect( fdIn,&in_streaminfo,&d);
+  if (stats_file && yuv_stats_close(&stats))
+    mjpeg_error_exit1 ("Error writing %s", stats_file);
+  if (dvd && !d.graph)
+    print_chapters (&d);
+
+  free(d.cuts);
+  free(d.chapters);
   y4m_fini_stream_info (&in_streaminfo);
 
   return 0;
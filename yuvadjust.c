@@ -7,6 +7,9 @@
 **shift and hue rotation. Supports negative values for inversion.
 **</p>
 **<UL>
+**<li>Luma goes through a lookup table and chroma through a fixed point
+**matrix, in bands of rows on all CPUs (YUV_THREADS sets how many).
+**<li>Can be run as a yuvchain stage.
 **<li>10th Aug 2008 Now supports upper and lower level adjustment for contrast stretching.
 **<li>10th May 2008 Phill Clarke noticed that none of my yuvtools will compile with mjpegutils RC3.
 **Due to a change in the mjpeg_logging type. This code has the change that should work under rc3.
@@ -43,6 +46,9 @@ gcc -O3 -L/sw/lib -I/sw/include/mjpegtools -lmjpegutils yuvadjust.c -o yuvadjust
 
 #include <yuv4mpeg.h>
 #include <mpegconsts.h>
+#include "utilyuv.h"
+#include "yuvstage.h"
+#include "yuvbands.h"
 
 #define YUVRFPS_VERSION "0.3"
 
@@ -65,141 +71,122 @@ static void print_usage()
          );
 }
 
-static void adjust(  int fdIn , y4m_stream_info_t  *inStrInfo,
-	int fdOut, y4m_stream_info_t  *outStrInfo,
-	float adj_bri, float adj_con, int adj_con_cen,
-	float adj_sat, float adj_hue, float adj_u, float adj_v)
-{
-	y4m_frame_info_t   in_frame ;
-	uint8_t            *yuv_data[3],*yuv_odata[3];
-
-	int                y_frame_data_size, uv_frame_data_size ;
-	int                read_error_code ;
-	int                write_error_code ;
-	int                src_frame_counter ;
-	float vy,vu,vv,nvu,nvv;
-	float sin_hue, cos_hue;
-	int x,y,w,h,cw,ch;
-
-	w = y4m_si_get_plane_width(inStrInfo,0);
-	h = y4m_si_get_plane_height(inStrInfo,0);
-	cw = y4m_si_get_plane_width(inStrInfo,1);
-	ch = y4m_si_get_plane_height(inStrInfo,1);
-
-
-  // Allocate memory for the YUV channels
-
-	y_frame_data_size = y4m_si_get_plane_length(inStrInfo,0);
-	uv_frame_data_size = y4m_si_get_plane_length(inStrInfo,1);
-
-
-		yuv_data[0] = (uint8_t *)malloc( y_frame_data_size);
-		yuv_data[1] = (uint8_t *)malloc( uv_frame_data_size);
-		yuv_data[2] = (uint8_t *)malloc( uv_frame_data_size);
-		if( !yuv_data[0] || !yuv_data[1] || !yuv_data[2])
-		    mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
-
-
-  write_error_code = Y4M_OK ;
-
-  src_frame_counter = 0 ;
-
-
-	sin_hue = sin(adj_hue);
-	cos_hue = cos(adj_hue);
-
+struct parameters {
 
-// initialise and read the first number of frames
-	y4m_init_frame_info( &in_frame );
-	read_error_code = y4m_read_frame(fdIn,inStrInfo,&in_frame,yuv_data );
+	float adj_bri, adj_con, adj_sat, adj_hue, adj_u, adj_v;
+	int adj_con_cen;
+	int verbose;
 
-	while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
-
-		for (x=0; x<w; x++) {
-			for (y=0; y<h; y++) {
-			// perform magic
-				vy = *(yuv_data[0]+x+(y*w)) - adj_con_cen;
-
-				vy = vy * adj_con + adj_bri + adj_con_cen; // Brightness and contrast operation
-			// clamping
-				if (vy > 240 ) vy = 240;
-				if (vy < 16 ) vy = 16;
-
-				*(yuv_data[0]+x+(y*w)) = vy;
-
-				if ((x < cw) && (y<ch)) {
-					vu = *(yuv_data[1]+x+(y*cw)) - 128 ;
-					vv = *(yuv_data[2]+x+(y*cw)) - 128 ;
-
-					// hue rotation, saturation and shift
-					nvu = (cos_hue * vu - sin_hue * vv) * adj_sat + adj_v;
-					nvv = (sin_hue * vu + cos_hue * vv) * adj_sat + adj_u;
-
-					if (nvu > 112) nvu = 112;
-					if (nvu < -112) nvu = -112;
-					if (nvv > 112) nvv = 112;
-					if (nvv < -112) nvv = -112;
-
-					*(yuv_data[1]+x+(y*cw)) = nvu + 128;
-					*(yuv_data[2]+x+(y*cw)) = nvv + 128;
-
-				}
-			}
-		}
-	write_error_code = y4m_write_frame( fdOut, outStrInfo, &in_frame, yuv_data );
-		y4m_fini_frame_info( &in_frame );
-		y4m_init_frame_info( &in_frame );
-		read_error_code = y4m_read_frame(fdIn,inStrInfo,&in_frame,yuv_data );
-		++src_frame_counter ;
+	float sin_hue, cos_hue;
+	int w,h,cw,ch;
+
+	// luma lookup and the chroma matrix in fixed point
+	uint8_t lut[256];
+	int16_t matrix[4];
+	int32_t offset[2];
+	int shift;
+
+	uint8_t **yuv_data;
+};
+
+/* brightness and contrast only depend on the luma value, so they are worked out
+** once for each of the 256 values.  Hue, saturation and shift are a 2x2 matrix
+** and an offset on the chroma pair, held in 16 bit fixed point for the kernel.
+*/
+static void adjust_tables(struct parameters *this)
+{
+	float vy, m[4], big = 0;
+	int i;
+
+	for (i=0; i<256; i++) {
+		vy = i - this->adj_con_cen;
+		vy = vy * this->adj_con + this->adj_bri + this->adj_con_cen; // Brightness and contrast operation
+		if (vy > 240 ) vy = 240;
+		if (vy < 16 ) vy = 16;
+		this->lut[i] = vy;
+	}
 
+	m[0] = this->cos_hue * this->adj_sat;
+	m[1] = -this->sin_hue * this->adj_sat;
+	m[2] = this->sin_hue * this->adj_sat;
+	m[3] = this->cos_hue * this->adj_sat;
+
+	for (i=0; i<4; i++)
+		if (fabs(m[i]) > big)
+			big = fabs(m[i]);
+
+	// as many fraction bits as the largest coefficient allows
+	for (this->shift = 14; this->shift > 0 && big * (1 << this->shift) > 32767; this->shift--)
+		;
+
+	for (i=0; i<4; i++) {
+		if (m[i] * (1 << this->shift) > 32767)
+			this->matrix[i] = 32767;
+		else if (m[i] * (1 << this->shift) < -32768)
+			this->matrix[i] = -32768;
+		else
+			this->matrix[i] = lrintf(m[i] * (1 << this->shift));
 	}
 
-  // Clean-up regardless an error happened or not
+	this->offset[0] = lrintf(this->adj_v * (1 << this->shift));
+	this->offset[1] = lrintf(this->adj_u * (1 << this->shift));
+}
 
-y4m_fini_frame_info( &in_frame );
+// rows first to last - 1 of the luma, and the chroma rows that go with them
+static void adjust_band(void *arg, int first, int last)
+{
+	struct parameters *this = arg;
+	uint8_t **yuv_data = this->yuv_data;
+	int cfirst, clast;
 
-		free( yuv_data[0] );
-		free( yuv_data[1] );
-		free( yuv_data[2] );
+	yuv_kernel.lut(yuv_data[0] + first * this->w, yuv_data[0] + first * this->w, this->lut, (last - first) * this->w);
 
-  if( read_error_code != Y4M_ERR_EOF )
-    mjpeg_error_exit1 ("Error reading from input stream!");
-  if( write_error_code != Y4M_OK )
-    mjpeg_error_exit1 ("Error writing output stream!");
+	cfirst = (int64_t)first * this->ch / this->h;
+	clast = (int64_t)last * this->ch / this->h;
+	yuv_kernel.chroma_matrix(yuv_data[1] + cfirst * this->cw, yuv_data[2] + cfirst * this->cw,
+							 this->matrix, this->offset, this->shift, (clast - cfirst) * this->cw);
+}
 
+static void adjust( struct parameters *this, uint8_t **yuv_data)
+{
+	this->yuv_data = yuv_data;
+	yuv_bands(adjust_band, this, this->h);
 }
 
 // *************************************************************************************
-// MAIN
+// STAGE
 // *************************************************************************************
-int main (int argc, char *argv[])
-{
 
-	int verbose = 1 ; // LOG_ERROR ?
-	int fdIn = 0 ;
-	int fdOut = 1 ;
-	y4m_stream_info_t in_streaminfo,out_streaminfo;
+static void *adjust_init (int argc, char *argv[])
+{
+	struct parameters *this;
 	const static char *legal_flags = "h:c:C:B:W:b:s:u:v:V:";
-	float adj_bri=0,adj_con=1,adj_sat=1,adj_hue=0,adj_u=0,adj_v=0;
-	int c, adj_con_cen = 128;
+	int c;
 	int adj_lev_blk = -1, adj_lev_wht = -1;
 
+	this = (struct parameters *)calloc(1, sizeof(struct parameters));
+	if (this == NULL)
+		mjpeg_error_exit1 ("Could'nt allocate memory for adjust parameters");
+
+	this->verbose = 1 ; // LOG_ERROR ?
+	this->adj_bri=0; this->adj_con=1; this->adj_sat=1; this->adj_hue=0; this->adj_u=0; this->adj_v=0;
+	this->adj_con_cen = 128;
 
   while ((c = getopt (argc, argv, legal_flags)) != -1) {
     switch (c) {
       case 'V':
-        verbose = atoi (optarg);
-        if (verbose < 0 || verbose > 2)
+        this->verbose = atoi (optarg);
+        if (this->verbose < 0 || this->verbose > 2)
           mjpeg_error_exit1 ("Verbose level must be [0..2]");
         break;
     case 'h':
-	    adj_hue = atof(optarg);
+	    this->adj_hue = atof(optarg);
 		break;
 	case 'c':
-		adj_con = atof(optarg);
+		this->adj_con = atof(optarg);
 		break;
 	case 'C':
-		adj_con_cen = atoi(optarg);
+		this->adj_con_cen = atoi(optarg);
 		break;
 	case 'B':
 		adj_lev_blk = atoi(optarg);
@@ -208,28 +195,106 @@ int main (int argc, char *argv[])
 		adj_lev_wht = atoi(optarg);
 		break;
 	case 'b':
-	    adj_bri = atof(optarg);
+	    this->adj_bri = atof(optarg);
 		break;
 	case 's':
-		adj_sat = atof(optarg);
+		this->adj_sat = atof(optarg);
 		break;
 	case 'u':
-		adj_u = atof(optarg);
+		this->adj_u = atof(optarg);
 		break;
 	case 'v':
-		adj_v = atof(optarg);
+		this->adj_v = atof(optarg);
 		break;
 
 	case '?':
-          print_usage (argv);
-          return 0 ;
-          break;
+		free(this);
+		return NULL;
+		break;
     }
   }
 
+	/* convert hue into radians */
+
+	this->adj_hue = this->adj_hue / 180 * M_PI;
+
+	/* if black and white levels are set, calculate apropriate con and con_cen value */
+
+	if (adj_lev_blk != -1 && adj_lev_wht != -1 ) {
+
+	//	adj_con_cen = (16 - adj_lev_blk);
+		this->adj_con = 224.0 / (adj_lev_wht - adj_lev_blk);  // rise over run
+		if (this->adj_con == 1.0) {
+			this->adj_con_cen = 128;
+		} else {
+			this->adj_con_cen = - (( ( adj_lev_blk - 16 ) * this->adj_con ) / ( 1 - this->adj_con) - 16 );
+		}
+
+	fprintf (stderr,"centre: %d contrast: %g\n",this->adj_con_cen, this->adj_con);
+
+
+	}
+
+// would like gamma, anyone for gamma?
+
+	this->sin_hue = sin(this->adj_hue);
+	this->cos_hue = cos(this->adj_hue);
+
+	return this;
+}
+
+static int adjust_config (void *priv, y4m_stream_info_t *in, y4m_stream_info_t *out)
+{
+	struct parameters *this = priv;
+
+	this->w = y4m_si_get_plane_width(in,0);
+	this->h = y4m_si_get_plane_height(in,0);
+	this->cw = y4m_si_get_plane_width(in,1);
+	this->ch = y4m_si_get_plane_height(in,1);
+
+	adjust_tables(this);
+
+	y4m_copy_stream_info( out, in );
+
+	return 0;
+}
+
+static int adjust_process (void *priv, uint8_t **in, uint8_t **out)
+{
+	adjust(priv, in);
+	return 1;
+}
+
+static void adjust_fini (void *priv)
+{
+	free(priv);
+}
+
+struct yuvstage yuvadjust_stage = {
+	"yuvadjust", 1,
+	adjust_init, adjust_config, adjust_process, NULL, adjust_fini, print_usage
+};
+
+#ifndef YUVCHAIN
+// *************************************************************************************
+// MAIN
+// *************************************************************************************
+int main (int argc, char *argv[])
+{
+
+	int fdIn = 0 ;
+	int fdOut = 1 ;
+	y4m_stream_info_t in_streaminfo,out_streaminfo;
+	struct parameters *this;
+
+	this = adjust_init(argc, argv);
+	if (this == NULL) {
+          print_usage (argv);
+          return 0 ;
+	}
 
   // mjpeg tools global initialisations
-  mjpeg_default_handler_verbosity (verbose);
+  mjpeg_default_handler_verbosity (this->verbose);
 
   // Initialize input streams
   y4m_init_stream_info (&in_streaminfo);
@@ -240,10 +305,10 @@ int main (int argc, char *argv[])
   // The streaminfo structure is filled in
   // ***************************************************************
   // INPUT comes from stdin, we check for a correct file header
-	if (y4m_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+	if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
 		mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
 
-	y4m_copy_stream_info( &out_streaminfo, &in_streaminfo );
+	adjust_config(this, &in_streaminfo, &out_streaminfo);
 
 
   // Information output
@@ -251,38 +316,17 @@ int main (int argc, char *argv[])
   mjpeg_info ("yuvadjust -? for help");
 
   /* in that function we do all the important work */
-	y4m_write_stream_header(fdOut,&out_streaminfo);
-
-	/* convert hue into radians */
-
-	adj_hue = adj_hue / 180 * M_PI;
-
-	/* if black and white levels are set, calculate apropriate con and con_cen value */
-
-	if (adj_lev_blk != -1 && adj_lev_wht != -1 ) {
-
-	//	adj_con_cen = (16 - adj_lev_blk);
-		adj_con = 224.0 / (adj_lev_wht - adj_lev_blk);  // rise over run
-		if (adj_con == 1.0) {
-			adj_con_cen = 128;
-		} else {
-			adj_con_cen = - (( ( adj_lev_blk - 16 ) * adj_con ) / ( 1 - adj_con) - 16 );
-		}
-
-	fprintf (stderr,"centre: %d contrast: %g\n",adj_con_cen, adj_con);
-
-
-	}
-
-// would like gamma, anyone for gamma?
+	yuv_write_stream_header(fdOut,&out_streaminfo);
 
-	adjust( fdIn,&in_streaminfo,fdOut,&out_streaminfo,adj_bri,adj_con,adj_con_cen,adj_sat,adj_hue,adj_u,adj_v);
+	yuvstage_run(&yuvadjust_stage, this, fdIn, fdOut, &in_streaminfo, &out_streaminfo);
 
   y4m_fini_stream_info (&in_streaminfo);
   y4m_fini_stream_info (&out_streaminfo);
+	adjust_fini(this);
 
   return 0;
 }
+#endif
 /*
  * Local variables:
  *  tab-width: 8
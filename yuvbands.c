@@ -0,0 +1,148 @@
+/*
+ *  yuvbands.c
+ *    Mark Heath <mjpeg0 at silicontrip.org>
+ *  http://silicontrip.net/~mark/lavtools/
+ *
+ * row band thread pool for the filters
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <yuv4mpeg.h>
+#include "yuvbands.h"
+
+#define YUV_BANDS_MAX_THREADS 64
+// fewer rows than this in a band costs more in wake ups than it saves
+#define YUV_BANDS_MIN_ROWS 16
+
+static pthread_mutex_t bands_run = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t bands_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bands_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t bands_done = PTHREAD_COND_INITIALIZER;
+
+static int bands_threads = 0;
+static unsigned int bands_generation = 0;
+static int bands_pending;
+
+// the current job
+static yuv_band_fn bands_fn;
+static void *bands_arg;
+static int bands_rows;
+static int bands_count;
+static volatile int bands_next;
+
+static void bands_work(void)
+{
+	int b;
+
+	while ((b = __sync_fetch_and_add(&bands_next, 1)) < bands_count)
+		bands_fn(bands_arg, (int)((int64_t)bands_rows * b / bands_count),
+				 (int)((int64_t)bands_rows * (b + 1) / bands_count));
+}
+
+static void *bands_worker(void *arg)
+{
+	unsigned int seen = 0;
+
+	pthread_mutex_lock(&bands_lock);
+	for (;;) {
+		while (seen == bands_generation)
+			pthread_cond_wait(&bands_start, &bands_lock);
+		seen = bands_generation;
+		pthread_mutex_unlock(&bands_lock);
+
+		bands_work();
+
+		pthread_mutex_lock(&bands_lock);
+		if (--bands_pending == 0)
+			pthread_cond_signal(&bands_done);
+	}
+	return NULL;
+}
+
+int yuv_bands_threads(void)
+{
+	pthread_t thread;
+	char *env;
+	int i, n;
+
+	if (bands_threads)
+		return bands_threads;
+
+	env = getenv("YUV_THREADS");
+	n = env ? atoi(env) : sysconf(_SC_NPROCESSORS_ONLN);
+	if (n < 1)
+		n = 1;
+	if (n > YUV_BANDS_MAX_THREADS)
+		n = YUV_BANDS_MAX_THREADS;
+
+	// the caller is one of the threads
+	for (i=1; i<n; i++)
+		if (pthread_create(&thread, NULL, bands_worker, NULL)) {
+			mjpeg_warn ("Could only start %d band threads", i);
+			break;
+		} else {
+			pthread_detach(thread);
+		}
+
+	bands_threads = i;
+	return bands_threads;
+}
+
+void yuv_bands(yuv_band_fn fn, void *arg, int rows)
+{
+	int count;
+
+	if (pthread_mutex_trylock(&bands_run)) {
+		fn(arg, 0, rows);
+		return;
+	}
+
+	count = rows / YUV_BANDS_MIN_ROWS;
+	if (count > yuv_bands_threads())
+		count = bands_threads;
+
+	if (count < 2) {
+		pthread_mutex_unlock(&bands_run);
+		fn(arg, 0, rows);
+		return;
+	}
+
+	pthread_mutex_lock(&bands_lock);
+	bands_fn = fn;
+	bands_arg = arg;
+	bands_rows = rows;
+	bands_count = count;
+	bands_next = 0;
+	bands_pending = bands_threads - 1;
+	bands_generation++;
+	pthread_cond_broadcast(&bands_start);
+	pthread_mutex_unlock(&bands_lock);
+
+	bands_work();
+
+	pthread_mutex_lock(&bands_lock);
+	while (bands_pending)
+		pthread_cond_wait(&bands_done, &bands_lock);
+	pthread_mutex_unlock(&bands_lock);
+
+	pthread_mutex_unlock(&bands_run);
+}
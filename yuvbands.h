@@ -0,0 +1,19 @@
+#ifndef _YUVBANDS_H_
+#define _YUVBANDS_H_
+
+/*
+** Runs a function over bands of rows on a pool of threads, the calling
+** thread works on a band as well.  fn(arg, first, last) processes rows
+** first to last - 1 and must not touch rows outside its band.
+**
+** The pool is started on the first call.  YUV_THREADS sets the number of
+** threads, the default is one per CPU.  When another thread is already
+** using the pool (yuvchain stages) the bands are run in the caller.
+*/
+
+typedef void (*yuv_band_fn)(void *arg, int first, int last);
+
+void yuv_bands(yuv_band_fn fn, void *arg, int rows);
+int yuv_bands_threads(void);
+
+#endif
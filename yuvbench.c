@@ -0,0 +1,600 @@
+/*
+ *  yuvbench.c
+ *    Mark Heath <mjpeg0 at silicontrip.org>
+ *  http://silicontrip.net/~mark/lavtools/
+ *
+** <h3>Throughput benchmark</h3>
+** <p>Generates synthetic y4m clips and times the tools on them.  The clips
+** are made of noise, moving gradients, an interlaced moving box and
+** letterbox bars, in SD, HD or UHD and 420, 422 or 444 chroma.  The same
+** seed always makes the same clip.</p>
+** <p>Each tool is run on a clip read from a file with its output thrown
+** away, the best of several runs is kept.  One JSON line per run is written
+** with the frames per second, MB per second and the peak resident memory.
+** Given a baseline from an earlier run, a tool that is slower or uses more
+** memory than the tolerance allows is reported and the exit status is 1.</p>
+** <p><tt>make bench</tt> builds the tools and runs the benchmark against
+** bench-baseline.json, <tt>make bench-baseline</tt> keeps the last results
+** as the new baseline.  -k checks the SIMD kernels in utilyuv against the
+** scalar ones, YUV_CPU=sse2 (or scalar, avx2 ...) runs the benchmark with
+** the kernels of a smaller CPU.</p>
+** <h4>EXAMPLE</h4>
+** <pre>yuvbench -s sd,hd -c 420jpeg,444 -n 100 -b bench-baseline.json -o bench-results.json
+** yuvbench -g -s uhd -c 422 -n 25 &gt; test.y4m
+** YUV_CPU=sse2 yuvbench -k</pre>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <yuv4mpeg.h>
+#include <mpegconsts.h>
+#include "utilyuv.h"
+
+#define VERSION "0.1"
+
+#define PATTERN_NOISE 1
+#define PATTERN_GRADIENT 2
+#define PATTERN_MOTION 4
+#define PATTERN_LETTERBOX 8
+#define PATTERN_ALL 15
+
+#define MAX_ARGS 16
+
+struct size {
+	const char *name;
+	int width, height;
+};
+
+struct chroma {
+	const char *name;
+	int mode;
+};
+
+// the tools and the options they are timed with
+struct tool {
+	const char *name;
+	const char *args;
+};
+
+static const struct size sizes[] = {
+	{ "sd", 720, 576 },
+	{ "hd", 1920, 1080 },
+	{ "uhd", 3840, 2160 },
+	{ NULL, 0, 0 }
+};
+
+static const struct chroma chromas[] = {
+	{ "420jpeg", Y4M_CHROMA_420JPEG },
+	{ "422", Y4M_CHROMA_422 },
+	{ "444", Y4M_CHROMA_444 },
+	{ NULL, 0 }
+};
+
+static const struct tool tools[] = {
+	{ "yuvadjust", "-h 10 -b 10 -c 1.2 -s 1.1" },
+	{ "yuvconvolve", "" },
+	{ "yuvbilateral", "-r 2 -d 2" },
+	{ "yuvtbilateral", "-r 2 -d 1" },
+	{ "yuvnlmeans", "" },
+	{ "yuvyadif", "-I t" },
+	{ "yuvmdeinterlace", "" },
+	{ "yuvdiff", "-g" },
+	{ "yuvcrop", "" },
+	{ "yuvtshot", "-m 1" },
+	{ "yuvfieldrev", "" },
+	{ "yuvhsync", "" },
+	{ "yuvvalues", "" },
+	{ NULL, NULL }
+};
+
+struct result {
+	char tool[64];
+	char size[16];
+	char chroma[16];
+	double fps;
+	long maxrss_kb;
+};
+
+static void print_usage()
+{
+	fprintf (stderr,
+			 "usage: yuvbench [-s sizes] [-c chromas] [-n frames] [-r runs] [-d dir] [-b baseline] [-o results] [-t tolerance] [-v 0..2] [tool ...]\n"
+			 "       yuvbench -g [-p patterns] [-s size] [-c chroma] [-n frames] > clip.y4m\n"
+			 "       yuvbench -k\n"
+			 "\t -s comma separated sizes: sd, hd, uhd (default sd,hd)\n"
+			 "\t -c comma separated chroma: 420jpeg, 422, 444 (default 420jpeg)\n"
+			 "\t -n frames in each clip (default 50)\n"
+			 "\t -r runs of each tool, the fastest is kept (default 3)\n"
+			 "\t -d directory holding the tools (default .)\n"
+			 "\t -b baseline results to compare with\n"
+			 "\t -o write the results here (default stdout)\n"
+			 "\t -t tolerance in percent before a change is a regression (default 10)\n"
+			 "\t -g write a clip to stdout instead of timing\n"
+			 "\t -p comma separated patterns: noise, gradient, motion, letterbox (default all)\n"
+			 "\t -S random seed (default 1)\n"
+			 "\t -k check the SIMD kernels of this CPU against the scalar ones\n"
+			 "\t -v Verbosity degree : 0=quiet, 1=normal, 2=verbose/debug\n"
+			 );
+}
+
+// true if name is in the comma separated list
+static int in_list(const char *list, const char *name)
+{
+	size_t len = strlen(name);
+	const char *p = list;
+
+	while ((p = strstr(p, name)) != NULL) {
+		if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == '\0'))
+			return 1;
+		p += len;
+	}
+	return 0;
+}
+
+static int parse_patterns(const char *list)
+{
+	int p = 0;
+
+	if (in_list(list, "noise")) p |= PATTERN_NOISE;
+	if (in_list(list, "gradient")) p |= PATTERN_GRADIENT;
+	if (in_list(list, "motion")) p |= PATTERN_MOTION;
+	if (in_list(list, "letterbox")) p |= PATTERN_LETTERBOX;
+	if (in_list(list, "all")) p |= PATTERN_ALL;
+	return p;
+}
+
+// xorshift, so clips are the same on every platform
+static inline uint32_t rnd(uint32_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 17;
+	*s ^= *s << 5;
+	return *s;
+}
+
+static inline uint8_t clip(int v, int lo, int hi)
+{
+	return v < lo ? lo : v > hi ? hi : v;
+}
+
+static void make_frame(uint8_t *m[3], y4m_stream_info_t *si, int n, int pattern, uint32_t *seed)
+{
+	int w, h, x, y, c, v;
+	int bar, bx, by, bw, bh, shift;
+	uint8_t *p;
+
+	for (c=0; c<3; c++) {
+		w = y4m_si_get_plane_width(si, c);
+		h = y4m_si_get_plane_height(si, c);
+		bar = (pattern & PATTERN_LETTERBOX) ? h / 8 : 0;
+
+		// the box moves 8 luma pixels a field, so the fields do not line up
+		bw = w / 6;
+		bh = h / 4;
+		bx = (n * 16 * w / y4m_si_get_plane_width(si, 0)) % (w - bw);
+		by = (h - bh) / 2;
+		shift = 8 * w / y4m_si_get_plane_width(si, 0);
+
+		for (y=0; y<h; y++) {
+			p = m[c] + y * w;
+			if (y < bar || y >= h - bar) {
+				memset(p, c ? 128 : 16, w);
+				continue;
+			}
+			for (x=0; x<w; x++) {
+				if (pattern & PATTERN_GRADIENT) {
+					if (c == 0)
+						v = 16 + ((x + y + n * 4) % (w + h)) * 219 / (w + h);
+					else if (c == 1)
+						v = 16 + ((y + n * 2) % h) * 224 / h;
+					else
+						v = 240 - ((x + n * 2) % w) * 224 / w;
+				} else {
+					v = c ? 128 : 126;
+				}
+				if ((pattern & PATTERN_MOTION) && y >= by && y < by + bh &&
+					x >= bx + (y & 1) * shift && x < bx + (y & 1) * shift + bw)
+					v = c ? (c == 1 ? 90 : 240) : 235;
+				if (pattern & PATTERN_NOISE)
+					v += (int)(rnd(seed) & 31) - 16;
+				p[x] = clip(v, 16, c ? 240 : 235);
+			}
+		}
+	}
+}
+
+static void make_stream_info(y4m_stream_info_t *si, const struct size *sz, const struct chroma *ch)
+{
+	y4m_ratio_t rate = { 25, 1 };
+	y4m_ratio_t square = { 1, 1 };
+
+	y4m_si_set_width(si, sz->width);
+	y4m_si_set_height(si, sz->height);
+	y4m_si_set_chroma(si, ch->mode);
+	y4m_si_set_interlace(si, Y4M_ILACE_TOP_FIRST);
+	y4m_si_set_framerate(si, rate);
+	y4m_si_set_sampleaspect(si, square);
+}
+
+static int write_clip(int fd, const struct size *sz, const struct chroma *ch, int frames, int pattern, uint32_t seed)
+{
+	y4m_stream_info_t si;
+	y4m_frame_info_t fi;
+	uint8_t *m[3];
+	int n, err = 0;
+
+	y4m_accept_extensions(1);
+	y4m_init_stream_info(&si);
+	y4m_init_frame_info(&fi);
+	make_stream_info(&si, sz, ch);
+
+	if (chromalloc(m, &si))
+		mjpeg_error_exit1 ("Cannot allocate frame");
+
+	if (y4m_write_stream_header(fd, &si) != Y4M_OK)
+		err = 1;
+	for (n=0; n<frames && !err; n++) {
+		make_frame(m, &si, n, pattern, &seed);
+		if (y4m_write_frame(fd, &si, &fi, m) != Y4M_OK)
+			err = 1;
+	}
+
+	chromafree(m);
+	y4m_fini_frame_info(&fi);
+	y4m_fini_stream_info(&si);
+	return err;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// runs the tool once with the clip as stdin, returns the wall time or -1
+static double run_tool(const char *dir, const struct tool *t, int fdClip, int verbose, long *maxrss_kb)
+{
+	char path[1024], args[256];
+	char *argv[MAX_ARGS];
+	struct rusage ru;
+	double start;
+	int argc = 0, status, fd;
+	pid_t pid;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, t->name);
+	strncpy(args, t->args, sizeof(args) - 1);
+	args[sizeof(args) - 1] = '\0';
+
+	argv[argc++] = path;
+	for (argv[argc] = strtok(args, " "); argv[argc] && argc < MAX_ARGS - 1; argv[argc] = strtok(NULL, " "))
+		argc++;
+	argv[argc] = NULL;
+
+	lseek(fdClip, 0, SEEK_SET);
+	start = now();
+
+	pid = fork();
+	if (pid == -1)
+		return -1;
+	if (pid == 0) {
+		dup2(fdClip, 0);
+		fd = open("/dev/null", O_WRONLY);
+		dup2(fd, 1);
+		if (verbose < 2)
+			dup2(fd, 2);
+		execv(path, argv);
+		_exit(127);
+	}
+
+	if (wait4(pid, &status, 0, &ru) == -1 || !WIFEXITED(status) || WEXITSTATUS(status))
+		return -1;
+
+#ifdef __APPLE__
+	*maxrss_kb = ru.ru_maxrss / 1024;
+#else
+	*maxrss_kb = ru.ru_maxrss;
+#endif
+	return now() - start;
+}
+
+// finds "key":"value" in a JSON line written by us
+static int json_string(const char *line, const char *key, char *val, int len)
+{
+	char k[64];
+	const char *p;
+	int i;
+
+	snprintf(k, sizeof(k), "\"%s\":\"", key);
+	if ((p = strstr(line, k)) == NULL)
+		return -1;
+	p += strlen(k);
+	for (i=0; i<len-1 && p[i] && p[i] != '"'; i++)
+		val[i] = p[i];
+	val[i] = '\0';
+	return 0;
+}
+
+static int json_number(const char *line, const char *key, double *val)
+{
+	char k[64];
+	const char *p;
+
+	snprintf(k, sizeof(k), "\"%s\":", key);
+	if ((p = strstr(line, k)) == NULL)
+		return -1;
+	*val = atof(p + strlen(k));
+	return 0;
+}
+
+static int read_baseline(const char *filename, struct result **base)
+{
+	char line[1024];
+	struct result *r = NULL;
+	double v;
+	int n = 0;
+	FILE *fh;
+
+	if ((fh = fopen(filename, "r")) == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), fh)) {
+		r = (struct result *)realloc(r, sizeof(struct result) * (n + 1));
+		if (r == NULL)
+			mjpeg_error_exit1 ("Cannot allocate memory for baseline");
+		if (json_string(line, "tool", r[n].tool, sizeof(r[n].tool)) ||
+			json_string(line, "size", r[n].size, sizeof(r[n].size)) ||
+			json_string(line, "chroma", r[n].chroma, sizeof(r[n].chroma)) ||
+			json_number(line, "fps", &r[n].fps))
+			continue;
+		r[n].maxrss_kb = json_number(line, "maxrss_kb", &v) ? 0 : v;
+		n++;
+	}
+	fclose(fh);
+	*base = r;
+	return n;
+}
+
+static struct result *find_result(struct result *base, int n, const struct result *r)
+{
+	int i;
+
+	for (i=0; i<n; i++)
+		if (!strcmp(base[i].tool, r->tool) && !strcmp(base[i].size, r->size) &&
+			!strcmp(base[i].chroma, r->chroma))
+			return &base[i];
+	return NULL;
+}
+
+// *************************************************************************************
+// MAIN
+// *************************************************************************************
+int main (int argc, char *argv[])
+{
+
+	int verbose = 1;
+	int frames = 50, runs = 3, generate = 0;
+	int pattern = PATTERN_ALL, check = 0;
+	double tolerance = 10;
+	uint32_t seed = 1;
+	const char *size_list = "sd,hd", *chroma_list = "420jpeg";
+	const char *dir = ".", *baseline = NULL, *output = NULL;
+	struct result *base = NULL, r, *b;
+	int nbase = 0, regressions = 0;
+	const struct size *sz;
+	const struct chroma *ch;
+	const struct tool *t;
+	char clipname[1024], line[512];
+	char *tmpdir;
+	double secs, best, bytes;
+	long rss, maxrss;
+	int c, i, fdClip, fdOut = 1, n, found;
+	const static char *legal_flags = "s:c:n:r:d:b:o:t:gp:S:kv:h";
+
+	while ((c = getopt (argc, argv, legal_flags)) != -1) {
+		switch (c) {
+			case 's':
+				size_list = optarg;
+				break;
+			case 'c':
+				chroma_list = optarg;
+				break;
+			case 'n':
+				frames = atoi(optarg);
+				break;
+			case 'r':
+				runs = atoi(optarg);
+				break;
+			case 'd':
+				dir = optarg;
+				break;
+			case 'b':
+				baseline = optarg;
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			case 't':
+				tolerance = atof(optarg);
+				break;
+			case 'g':
+				generate = 1;
+				break;
+			case 'p':
+				pattern = parse_patterns(optarg);
+				break;
+			case 'S':
+				seed = strtoul(optarg, NULL, 0);
+				break;
+			case 'k':
+				check = 1;
+				break;
+			case 'v':
+				verbose = atoi (optarg);
+				if (verbose < 0 || verbose > 2)
+					mjpeg_error_exit1 ("Verbose level must be [0..2]");
+				break;
+			case 'h':
+			case '?':
+				print_usage ();
+				return 0 ;
+				break;
+		}
+	}
+
+	// mjpeg tools global initialisations
+	mjpeg_default_handler_verbosity (verbose);
+
+	if (frames < 1 || runs < 1)
+		mjpeg_error_exit1 ("Frames and runs must be at least 1");
+	// xorshift never leaves 0
+	if (seed == 0)
+		seed = 1;
+
+	if (check) {
+		mjpeg_info ("CPU: %s, using %s", yuv_cpu_name(yuv_cpu_detect()), yuv_cpu_name(yuv_cpu_level));
+		return yuv_cpu_selfcheck(1) ? 1 : 0;
+	}
+
+	if (generate) {
+		for (sz=sizes; sz->name && !in_list(size_list, sz->name); sz++)
+			;
+		for (ch=chromas; ch->name && !in_list(chroma_list, ch->name); ch++)
+			;
+		if (!sz->name || !ch->name)
+			mjpeg_error_exit1 ("Unknown size or chroma");
+		return write_clip(1, sz, ch, frames, pattern, seed);
+	}
+
+	if (baseline) {
+		nbase = read_baseline(baseline, &base);
+		if (nbase < 0) {
+			mjpeg_warn ("No baseline %s, keep these results with make bench-baseline", baseline);
+			nbase = 0;
+		}
+	}
+
+	if (output) {
+		fdOut = open(output, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		if (fdOut == -1)
+			mjpeg_error_exit1 ("Cannot write %s", output);
+	}
+
+	tmpdir = getenv("TMPDIR");
+
+	for (sz=sizes; sz->name; sz++) {
+		if (!in_list(size_list, sz->name))
+			continue;
+		for (ch=chromas; ch->name; ch++) {
+			if (!in_list(chroma_list, ch->name))
+				continue;
+
+			// the clip is a file so the tools are not waiting on a generator
+			snprintf(clipname, sizeof(clipname), "%s/yuvbenchXXXXXX", tmpdir ? tmpdir : "/tmp");
+			fdClip = mkstemp(clipname);
+			if (fdClip == -1)
+				mjpeg_error_exit1 ("Cannot create %s", clipname);
+			unlink(clipname);
+			if (write_clip(fdClip, sz, ch, frames, pattern, seed))
+				mjpeg_error_exit1 ("Cannot write the %s %s clip", sz->name, ch->name);
+			bytes = lseek(fdClip, 0, SEEK_END);
+
+			for (t=tools; t->name; t++) {
+				if (optind < argc) {
+					for (found=0, i=optind; i<argc; i++)
+						found |= !strcmp(argv[i], t->name);
+					if (!found)
+						continue;
+				}
+
+				snprintf(clipname, sizeof(clipname), "%s/%s", dir, t->name);
+				if (access(clipname, X_OK)) {
+					mjpeg_debug ("%s is not built", t->name);
+					continue;
+				}
+
+				best = -1;
+				maxrss = 0;
+				for (i=0; i<runs; i++) {
+					secs = run_tool(dir, t, fdClip, verbose, &rss);
+					if (secs < 0)
+						break;
+					if (best < 0 || secs < best)
+						best = secs;
+					if (rss > maxrss)
+						maxrss = rss;
+				}
+				if (best < 0) {
+					mjpeg_warn ("%s failed on %s %s", t->name, sz->name, ch->name);
+					continue;
+				}
+				if (best < 1e-6)
+					best = 1e-6;
+
+				strcpy(r.tool, t->name);
+				strcpy(r.size, sz->name);
+				strcpy(r.chroma, ch->name);
+				r.fps = frames / best;
+				r.maxrss_kb = maxrss;
+
+				n = snprintf(line, sizeof(line), "{\"tool\":\"%s\",\"size\":\"%s\",\"chroma\":\"%s\",\"frames\":%d,"
+							 "\"t\":%.3f,\"fps\":%.2f,\"MBps\":%.2f,\"maxrss_kb\":%ld}\n",
+							 r.tool, r.size, r.chroma, frames, best, r.fps, bytes / best / 1048576.0, r.maxrss_kb);
+				if (write(fdOut, line, n) != n)
+					mjpeg_error_exit1 ("Error writing results");
+
+				b = find_result(base, nbase, &r);
+				if (b == NULL) {
+					mjpeg_info ("%s %s %s: %.2f fps, %ld kB", r.tool, r.size, r.chroma, r.fps, r.maxrss_kb);
+				} else if (r.fps < b->fps * (1 - tolerance / 100) ||
+						   (b->maxrss_kb && r.maxrss_kb > b->maxrss_kb * (1 + tolerance / 100))) {
+					mjpeg_warn ("REGRESSION %s %s %s: %.2f fps (baseline %.2f), %ld kB (baseline %ld kB)",
+								r.tool, r.size, r.chroma, r.fps, b->fps, r.maxrss_kb, b->maxrss_kb);
+					regressions++;
+				} else {
+					mjpeg_info ("%s %s %s: %.2f fps (baseline %.2f, %+.1f%%), %ld kB", r.tool, r.size, r.chroma,
+								r.fps, b->fps, (r.fps / b->fps - 1) * 100, r.maxrss_kb);
+				}
+			}
+			close(fdClip);
+		}
+	}
+
+	if (output)
+		close(fdOut);
+	free(base);
+
+	if (regressions)
+		mjpeg_warn ("%d regressions", regressions);
+
+	return regressions ? 1 : 0;
+}
+/*
+ * Local variables:
+ *  tab-width: 8
+ *  indent-tabs-mode: nil
+ * End:
+ */
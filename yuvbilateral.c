@@ -49,6 +49,7 @@
 #include <yuv4mpeg.h>
 #include <mpegconsts.h>
 #include "utilyuv.h"
+#include "yuvstage.h"
 
 #define VERSION "0.1"
 
@@ -69,10 +70,11 @@ struct parameters {
 	unsigned int twoSigmaRSquared;
 
 	int direction;
+	int verbose;
 
-};
+	int width, height, cwidth, cheight;
 
-static struct parameters this;
+};
 
 static void print_usage()
 {
@@ -84,64 +86,64 @@ static void print_usage()
 			);
 }
 
-unsigned int gauss (unsigned int sigma, int x, int y) {
+static unsigned int gauss (unsigned int sigma, int x, int y) {
 	return exp(-((x * x + y * y) / (2.0 * (1.0* sigma/PRECISION) * (1.0*sigma/PRECISION)))) * PRECISION;
 }
 
-unsigned int similarity(int p, int s) {
+static inline unsigned int similarity(struct parameters *this, int p, int s) {
 	// this equals: Math.exp(-(( Math.abs(p-s)) /  2 * this.sigmaR * this.sigmaR));
 	// but is precomputed to improve performance
-	if (this.direction == 0)
-		return this.gaussSimilarity[abs(p-s)];
+	if (this->direction == 0)
+		return this->gaussSimilarity[abs(p-s)];
 
-	return this.gaussSimilarity[255-abs(p-s)];
+	return this->gaussSimilarity[255-abs(p-s)];
 
 }
 
-static void filterinitialize () {
+static void filterinitialize (struct parameters *this) {
 
 	int kernelSize, center;
 	int x,y,i;
 
-	this.kernelRadius = this.sigmaD>this.sigmaR?this.sigmaD * 2:this.sigmaR * 2;
-	this.kernelRadius = this.kernelRadius / PRECISION;
+	this->kernelRadius = this->sigmaD>this->sigmaR?this->sigmaD * 2:this->sigmaR * 2;
+	this->kernelRadius = this->kernelRadius / PRECISION;
 
-	this.twoSigmaRSquared = (2 * (1.0 *this.sigmaR/PRECISION)  * (1.0 *this.sigmaR/PRECISION)) * PRECISION;
+	this->twoSigmaRSquared = (2 * (1.0 *this->sigmaR/PRECISION)  * (1.0 *this->sigmaR/PRECISION)) * PRECISION;
 
-	kernelSize = this.kernelRadius * 2 + 1;
+	kernelSize = this->kernelRadius * 2 + 1;
 	center = (kernelSize - 1) / 2;
 
 
-	this.kernelD = (unsigned int*) malloc( sizeof (unsigned int) * kernelSize * kernelSize);
+	this->kernelD = (unsigned int*) malloc( sizeof (unsigned int) * kernelSize * kernelSize);
 
-	if (this.kernelD == NULL ){
+	if (this->kernelD == NULL ){
 		mjpeg_error_exit1("Cannot allocate memory for filter kernel");
 	}
 
 
 	for ( x = -center; x < -center + kernelSize; x++) {
 		for ( y = -center; y < -center + kernelSize; y++) {
-			this.kernelD[x + center + (y + center) * kernelSize] = gauss(this.sigmaD, x, y);
-			//fprintf(stderr,"x: %d y: %d = %d\n",x,y,this.kernelD[x + center + (y + center) * kernelSize]);
+			this->kernelD[x + center + (y + center) * kernelSize] = gauss(this->sigmaD, x, y);
+			//fprintf(stderr,"x: %d y: %d = %d\n",x,y,this->kernelD[x + center + (y + center) * kernelSize]);
 		}
 	}
 
-	this.gaussSimilarity = (unsigned int*) malloc(sizeof (unsigned int) * 256);
-	if (this.gaussSimilarity == NULL ){
-		free(this.kernelD);
+	this->gaussSimilarity = (unsigned int*) malloc(sizeof (unsigned int) * 256);
+	if (this->gaussSimilarity == NULL ){
+		free(this->kernelD);
 		mjpeg_error_exit1("Cannot allocate memory for gaussian curve");
 	}
 
 	// precomute all possible similarity values for
 	// performance reasons
 	for ( i = 0; i < 256; i++) {
-		this.gaussSimilarity[i] = exp(-((i) / (1.0 * this.twoSigmaRSquared/PRECISION))) * PRECISION;
+		this->gaussSimilarity[i] = exp(-((i) / (1.0 * this->twoSigmaRSquared/PRECISION))) * PRECISION;
 	}
 
 
 }
 
-static void filterpixel(uint8_t *o, uint8_t *p, int i, int j, int w, int h) {
+static void filterpixel(struct parameters *this, uint8_t *o, uint8_t *p, int i, int j, int w, int h) {
 
 	unsigned int sum =0;
 	unsigned int totalWeight = 0;
@@ -149,16 +151,16 @@ static void filterpixel(uint8_t *o, uint8_t *p, int i, int j, int w, int h) {
 	int m,n;
 
 	uint8_t intensityCenter = p[j * w + i];
-	int mMax = i + this.kernelRadius;
-	int nMax = j + this.kernelRadius;
+	int mMax = i + this->kernelRadius;
+	int nMax = j + this->kernelRadius;
 
-	for ( m = i-this.kernelRadius; m < mMax; m++) {
-		for ( n = j-this.kernelRadius; n < nMax; n++) {
+	for ( m = i-this->kernelRadius; m < mMax; m++) {
+		for ( n = j-this->kernelRadius; n < nMax; n++) {
 
 			if (m>=0 && n>=0 && m < w && n < h) {
 				int intensityKernelPos = p[m + n * w];
 
-				weight = this.kernelD[(i-m + this.kernelRadius) + (j-n + this.kernelRadius) * (this.kernelRadius*2)] * similarity(intensityKernelPos,intensityCenter);
+				weight = this->kernelD[(i-m + this->kernelRadius) + (j-n + this->kernelRadius) * (this->kernelRadius*2)] * similarity(this,intensityKernelPos,intensityCenter);
 				totalWeight += weight;
 				sum += (weight * intensityKernelPos);
 			}
@@ -171,28 +173,28 @@ static void filterpixel(uint8_t *o, uint8_t *p, int i, int j, int w, int h) {
 }
 
 
-static void filterframe (uint8_t *m[3], uint8_t *n[3], y4m_stream_info_t *si)
+static void filterframe (struct parameters *this, uint8_t *m[3], uint8_t *n[3])
 {
 
 	int x,y;
 	int height,width,height2,width2;
 
-	height=y4m_si_get_plane_height(si,0);
-	width=y4m_si_get_plane_width(si,0);
+	height=this->height;
+	width=this->width;
 
 	// I'll assume that the chroma subsampling is the same for both u and v channels
-	height2=y4m_si_get_plane_height(si,1);
-	width2=y4m_si_get_plane_width(si,1);
+	height2=this->cheight;
+	width2=this->cwidth;
 
 
 	for (y=0; y < height; y++) {
 		for (x=0; x < width; x++) {
 
-			filterpixel(m[0],n[0],x,y,width,height);
+			filterpixel(this,m[0],n[0],x,y,width,height);
 
 			if (x<width2 && y<height2) {
-				filterpixel(m[1],n[1],x,y,width2,height2);
-				filterpixel(m[2],n[2],x,y,width2,height2);
+				filterpixel(this,m[1],n[1],x,y,width2,height2);
+				filterpixel(this,m[2],n[2],x,y,width2,height2);
 			}
 
 		}
@@ -200,120 +202,131 @@ static void filterframe (uint8_t *m[3], uint8_t *n[3], y4m_stream_info_t *si)
 
 }
 
-static void filter(int fdIn, int fdOut, y4m_stream_info_t  *inStrInfo )
-{
-	y4m_frame_info_t   in_frame ;
-	uint8_t            *yuv_data[3];
-	uint8_t				*yuv_odata[3];
-	int                read_error_code ;
-	int                write_error_code ;
-
-	// Allocate memory for the YUV channels
-
-	if (chromalloc(yuv_data,inStrInfo))
-		mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
-
-	if (chromalloc(yuv_odata,inStrInfo)){
-		chromafree(yuv_data);
-		mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
-	}
-
-	/* Initialize counters */
-
-	write_error_code = Y4M_OK ;
-
-	y4m_init_frame_info( &in_frame );
-	read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
-
-	while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
-
-		// do work
-		if (read_error_code == Y4M_OK) {
-
-			filterframe(yuv_odata,yuv_data,inStrInfo);
-			write_error_code = y4m_write_frame( fdOut, inStrInfo, &in_frame, yuv_odata );
-		}
-
-		y4m_fini_frame_info( &in_frame );
-		y4m_init_frame_info( &in_frame );
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
-	}
-	// Clean-up regardless an error happened or not
-	y4m_fini_frame_info( &in_frame );
-
-	chromafree( yuv_data );
-	chromafree( yuv_odata);
-
-	if( read_error_code != Y4M_ERR_EOF )
-		mjpeg_error_exit1 ("Error reading from input stream!");
-
-}
-
 // *************************************************************************************
-// MAIN
+// STAGE
 // *************************************************************************************
-int main (int argc, char *argv[])
-{
 
-	int verbose = 4; // LOG_ERROR ;
-	int fdIn = 0 ;
-	int fdOut = 1 ;
-	y4m_stream_info_t in_streaminfo ;
+static void *filter_init (int argc, char *argv[])
+{
+	struct parameters *this;
 	int c ;
 	const static char *legal_flags = "v:hr:d:i";
 
 	float sigma;
 
-	this.sigmaR = 0;
-	this.sigmaD = 0;
-	this.direction = 0;
+	this = (struct parameters *)calloc(1, sizeof(struct parameters));
+	if (this == NULL)
+		mjpeg_error_exit1("Cannot allocate memory for filter parameters");
+
+	this->verbose = 4; // LOG_ERROR ;
+	this->sigmaR = 0;
+	this->sigmaD = 0;
+	this->direction = 0;
 
 	while ((c = getopt (argc, argv, legal_flags)) != -1) {
 		switch (c) {
 			case 'v':
-				verbose = atoi (optarg);
-				if (verbose < 0 || verbose > 2)
+				this->verbose = atoi (optarg);
+				if (this->verbose < 0 || this->verbose > 2)
 					mjpeg_error_exit1 ("Verbose level must be [0..2]");
 				break;
 
 			case 'h':
 			case '?':
-				print_usage (argv);
-				return 0 ;
+				free(this);
+				return NULL;
 				break;
 			case 'r':
 				sigma = atof(optarg);
-				this.sigmaR = sigma * PRECISION;
+				this->sigmaR = sigma * PRECISION;
 				break;
 			case 'd':
 				sigma = atof(optarg);
-				this.sigmaD = sigma * PRECISION;
+				this->sigmaD = sigma * PRECISION;
 				break;
 			case 'i':
-				this.direction = 1;
+				this->direction = 1;
 				break;
 
 		}
 	}
 
-	if (this.sigmaR == 0 || this.sigmaD == 0) {
+	if (this->sigmaR == 0 || this->sigmaD == 0) {
 		print_usage();
 		mjpeg_error_exit1("Sigma D and R must be set");
 
 	}
 
+	filterinitialize (this);
+
+	return this;
+}
+
+static int filter_config (void *priv, y4m_stream_info_t *in, y4m_stream_info_t *out)
+{
+	struct parameters *this = priv;
+
+	this->width = y4m_si_get_plane_width(in,0);
+	this->height = y4m_si_get_plane_height(in,0);
+	this->cwidth = y4m_si_get_plane_width(in,1);
+	this->cheight = y4m_si_get_plane_height(in,1);
+
+	y4m_copy_stream_info(out, in);
+
+	return 0;
+}
+
+static int filter_process (void *priv, uint8_t **in, uint8_t **out)
+{
+	filterframe(priv, out, in);
+	return 1;
+}
+
+static void filter_fini (void *priv)
+{
+	struct parameters *this = priv;
+
+	free(this->kernelD);
+	free(this->gaussSimilarity);
+	free(this);
+}
+
+struct yuvstage yuvbilateral_stage = {
+	"yuvbilateral", 0,
+	filter_init, filter_config, filter_process, NULL, filter_fini, print_usage
+};
+
+#ifndef YUVCHAIN
+// *************************************************************************************
+// MAIN
+// *************************************************************************************
+int main (int argc, char *argv[])
+{
+
+	int fdIn = 0 ;
+	int fdOut = 1 ;
+	y4m_stream_info_t in_streaminfo, out_streaminfo ;
+	struct parameters *this;
+
+	this = filter_init(argc, argv);
+	if (this == NULL) {
+		print_usage (argv);
+		return 0 ;
+	}
+
 	// mjpeg tools global initialisations
-	mjpeg_default_handler_verbosity (verbose);
+	mjpeg_default_handler_verbosity (this->verbose);
 
 	// Initialize input streams
 	y4m_init_stream_info (&in_streaminfo);
+	y4m_init_stream_info (&out_streaminfo);
 
 	// ***************************************************************
 	// Get video stream informations (size, framerate, interlacing, aspect ratio).
 	// The streaminfo structure is filled in
 	// ***************************************************************
 	// INPUT comes from stdin, we check for a correct file header
-	if (y4m_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+	if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
 		mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
 
 	// Information output
@@ -323,14 +336,16 @@ int main (int argc, char *argv[])
 
 
 	/* in that function we do all the important work */
-	filterinitialize ();
-	y4m_write_stream_header(fdOut,&in_streaminfo);
-	filter(fdIn,fdOut, &in_streaminfo);
+	filter_config (this, &in_streaminfo, &out_streaminfo);
+	yuv_write_stream_header(fdOut,&out_streaminfo);
+	yuvstage_run(&yuvbilateral_stage, this, fdIn, fdOut, &in_streaminfo, &out_streaminfo);
 	y4m_fini_stream_info (&in_streaminfo);
-	//filteruninitialize();
+	y4m_fini_stream_info (&out_streaminfo);
+	filter_fini(this);
 
 	return 0;
 }
+#endif
 /*
  * Local variables:
  *  tab-width: 8
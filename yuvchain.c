@@ -0,0 +1,475 @@
+/*
+ *  yuvchain.c
+ *    Mark Heath <mjpeg0 at silicontrip.org>
+ *  http://silicontrip.net/~mark/lavtools/
+ *
+**<h3>Filter chain</h3>
+**<p>Runs several yuv filters in one process, instead of a shell pipeline.
+**Each filter runs in its own thread and frames are passed between them
+**by pointer from a pool of frame buffers, so there is no pipe copy and
+**no y4m parsing between the filters.</p>
+**<p>The filters are separated by a : and take the same options as the
+**stand alone tools.</p>
+**<h4>EXAMPLE</h4>
+**<pre>
+**yuvchain yuvtbilateral -r 3 -d 2 : yuvbilateral -r 2 -d 1.5 : yuvadjust -b 10 &lt; in.y4m &gt; out.y4m
+**</pre>
+**<p>is the same as</p>
+**<pre>
+**yuvtbilateral -r 3 -d 2 &lt; in.y4m | yuvbilateral -r 2 -d 1.5 | yuvadjust -b 10 &gt; out.y4m
+**</pre>
+**<p>Filters that change the frame in place (yuvadjust) are handed the frame
+**from the previous stage and need no buffers of their own.</p>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <yuv4mpeg.h>
+#include <mpegconsts.h>
+#include "utilyuv.h"
+#include "progress.h"
+#include "yuvstage.h"
+
+#define VERSION "0.1"
+
+#define DEFAULT_POOL_SIZE 4
+#define MAX_STAGES 32
+
+static struct yuvstage *stages[] = {
+	&yuvadjust_stage,
+	&yuvbilateral_stage,
+	&yuvtbilateral_stage,
+	NULL
+};
+
+struct link;
+
+struct yuvframe {
+	uint8_t *data[3];
+	y4m_frame_info_t fi;
+	struct link *home;
+};
+
+// a bounded queue of frame pointers, NULL marks the end of the stream
+struct frame_queue {
+	struct yuvframe **q;
+	int size;
+	int head;
+	int count;
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+};
+
+// the connection between two stages, frames are returned to their home link
+struct link {
+	int id;
+	y4m_stream_info_t si;
+	struct frame_queue full;
+	struct frame_queue free;
+	struct yuvframe *pool;
+	int pool_size;
+};
+
+struct chain_stage {
+	struct yuvstage *st;
+	void *priv;
+	struct link *in;
+	struct link *out;
+	pthread_t thread;
+};
+
+static void print_usage()
+{
+	fprintf (stderr,
+			 "usage: yuvchain [-q <frames>] [-v 0..2] filter [options] [: filter [options] ...]\n"
+			 "\t -q <frames> frame buffers between each filter (default %d)\n"
+			 "\t -v Verbosity degree : 0=quiet, 1=normal, 2=verbose/debug\n"
+			 "\n"
+			 "filters:\n", DEFAULT_POOL_SIZE
+			 );
+}
+
+static void print_stages()
+{
+	int s;
+
+	for (s=0; stages[s]; s++)
+		fprintf (stderr, "\t %s\n",stages[s]->name);
+}
+
+static void queue_init (struct frame_queue *fq, int size)
+{
+	fq->q = (struct yuvframe **)malloc(sizeof(struct yuvframe *) * size);
+	if (fq->q == NULL)
+		mjpeg_error_exit1("Cannot allocate memory for frame queue");
+	fq->size = size;
+	fq->head = 0;
+	fq->count = 0;
+	pthread_mutex_init(&fq->mutex, NULL);
+	pthread_cond_init(&fq->not_empty, NULL);
+	pthread_cond_init(&fq->not_full, NULL);
+}
+
+static void queue_free (struct frame_queue *fq)
+{
+	pthread_mutex_destroy(&fq->mutex);
+	pthread_cond_destroy(&fq->not_empty);
+	pthread_cond_destroy(&fq->not_full);
+	free(fq->q);
+}
+
+static void queue_put (struct frame_queue *fq, struct yuvframe *f)
+{
+	pthread_mutex_lock(&fq->mutex);
+	while (fq->count == fq->size)
+		pthread_cond_wait(&fq->not_full, &fq->mutex);
+	fq->q[(fq->head + fq->count) % fq->size] = f;
+	fq->count++;
+	pthread_cond_signal(&fq->not_empty);
+	pthread_mutex_unlock(&fq->mutex);
+}
+
+static struct yuvframe *queue_get (struct frame_queue *fq)
+{
+	struct yuvframe *f;
+
+	pthread_mutex_lock(&fq->mutex);
+	while (fq->count == 0)
+		pthread_cond_wait(&fq->not_empty, &fq->mutex);
+	f = fq->q[fq->head];
+	fq->head = (fq->head + 1) % fq->size;
+	fq->count--;
+	pthread_cond_signal(&fq->not_full);
+	pthread_mutex_unlock(&fq->mutex);
+
+	return f;
+}
+
+// passes a frame to the next stage
+static void link_send (struct link *l, struct yuvframe *f)
+{
+	queue_put(&l->full, f);
+	progress_queue(l->id, l->full.count, l->full.size);
+}
+
+// gives a frame back to the link that owns its buffers
+static void frame_release (struct yuvframe *f)
+{
+	y4m_fini_frame_info(&f->fi);
+	y4m_init_frame_info(&f->fi);
+	queue_put(&f->home->free, f);
+}
+
+static void link_init (struct link *l, int id)
+{
+	l->id = id;
+	l->pool = NULL;
+	l->pool_size = 0;
+	y4m_init_stream_info(&l->si);
+}
+
+// frame buffers are only needed for links fed by stages that don't work in place
+static void link_alloc (struct link *l, int pool_size)
+{
+	int c;
+
+	l->pool_size = pool_size;
+	l->pool = (struct yuvframe *)calloc(pool_size, sizeof(struct yuvframe));
+	if (l->pool == NULL)
+		mjpeg_error_exit1("Cannot allocate memory for frame pool");
+
+	queue_init(&l->free, pool_size);
+
+	for (c=0; c<pool_size; c++) {
+		if (chromalloc(l->pool[c].data,&l->si))
+			mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
+		y4m_init_frame_info(&l->pool[c].fi);
+		l->pool[c].home = l;
+		queue_put(&l->free, &l->pool[c]);
+	}
+}
+
+static void link_free (struct link *l)
+{
+	int c;
+
+	if (l->pool) {
+		for (c=0; c<l->pool_size; c++) {
+			chromafree(l->pool[c].data);
+			y4m_fini_frame_info(&l->pool[c].fi);
+		}
+		free(l->pool);
+		queue_free(&l->free);
+	}
+	queue_free(&l->full);
+	y4m_fini_stream_info(&l->si);
+}
+
+struct reader_args {
+	int fd;
+	struct link *out;
+};
+
+static void *read_thread (void *arg)
+{
+	struct reader_args *ra = arg;
+	struct yuvframe *f;
+	int read_error_code;
+
+	for (;;) {
+		f = queue_get(&ra->out->free);
+		read_error_code = yuv_read_frame(ra->fd, &ra->out->si, &f->fi, f->data);
+		if (read_error_code != Y4M_OK) {
+			frame_release(f);
+			if (read_error_code != Y4M_ERR_EOF)
+				mjpeg_error_exit1 ("Error reading from input stream!");
+			break;
+		}
+		link_send(ra->out, f);
+	}
+	link_send(ra->out, NULL);
+
+	return NULL;
+}
+
+static void *stage_thread (void *arg)
+{
+	struct chain_stage *cs = arg;
+	struct yuvframe *f, *o;
+	progress_mark_t mark;
+	int r;
+
+	while ((f = queue_get(&cs->in->full)) != NULL) {
+
+		progress_stage_begin(&mark);
+		if (cs->st->inplace) {
+			cs->st->process(cs->priv, f->data, f->data);
+			progress_stage_end(PROGRESS_STAGE_PROCESS, &mark);
+			link_send(cs->out, f);
+			continue;
+		}
+
+		o = queue_get(&cs->out->free);
+		r = cs->st->process(cs->priv, f->data, o->data);
+		progress_stage_end(PROGRESS_STAGE_PROCESS, &mark);
+
+		if (r) {
+			y4m_copy_frame_info(&o->fi, &f->fi);
+			link_send(cs->out, o);
+		} else {
+			frame_release(o);
+		}
+		frame_release(f);
+	}
+
+	// frames held by temporal filters
+	if (cs->st->flush) {
+		for (;;) {
+			o = queue_get(&cs->out->free);
+			progress_stage_begin(&mark);
+			r = cs->st->flush(cs->priv, o->data);
+			progress_stage_end(PROGRESS_STAGE_PROCESS, &mark);
+			if (!r) {
+				frame_release(o);
+				break;
+			}
+			link_send(cs->out, o);
+		}
+	}
+	link_send(cs->out, NULL);
+
+	return NULL;
+}
+
+static struct yuvstage *find_stage (char *name)
+{
+	int s;
+
+	for (s=0; stages[s]; s++)
+		if (!strcmp(stages[s]->name, name))
+			return stages[s];
+	return NULL;
+}
+
+// *************************************************************************************
+// MAIN
+// *************************************************************************************
+int main (int argc, char *argv[])
+{
+
+	int verbose = 1;
+	int fdIn = 0 ;
+	int fdOut = 1 ;
+	int pool_size = DEFAULT_POOL_SIZE;
+	struct chain_stage chain[MAX_STAGES];
+	struct link links[MAX_STAGES+1];
+	struct reader_args ra;
+	pthread_t reader;
+	struct yuvframe *f;
+	struct link *last;
+	int c, s, nstages, first, arg;
+	int write_error_code;
+	// stop at the first filter name, its options are not ours
+	const static char *legal_flags = "+hq:v:";
+
+	while ((c = getopt (argc, argv, legal_flags)) != -1) {
+		switch (c) {
+			case 'v':
+				verbose = atoi (optarg);
+				if (verbose < 0 || verbose > 2)
+					mjpeg_error_exit1 ("Verbose level must be [0..2]");
+				break;
+			case 'q':
+				pool_size = atoi (optarg);
+				if (pool_size < 1)
+					mjpeg_error_exit1 ("Frame buffers must be at least 1");
+				break;
+			case 'h':
+			case '?':
+				print_usage (argv);
+				print_stages ();
+				return 0 ;
+				break;
+		}
+	}
+
+	if (optind >= argc) {
+		print_usage (argv);
+		print_stages ();
+		return 0 ;
+	}
+
+	// mjpeg tools global initialisations
+	mjpeg_default_handler_verbosity (verbose);
+	progress_stats_init("yuvchain");
+	// the stages are timed in their own threads
+	yuv_process_timing = 0;
+
+	// split the command line on ':' and let each filter parse its own options
+	nstages = 0;
+	arg = optind;
+	while (arg < argc) {
+		first = arg;
+		while (arg < argc && strcmp(argv[arg], ":"))
+			arg++;
+
+		if (arg == first)
+			mjpeg_error_exit1 ("Missing filter name");
+		if (nstages == MAX_STAGES)
+			mjpeg_error_exit1 ("Too many filters (max %d)", MAX_STAGES);
+
+		chain[nstages].st = find_stage(argv[first]);
+		if (chain[nstages].st == NULL) {
+			print_stages ();
+			mjpeg_error_exit1 ("Unknown filter %s", argv[first]);
+		}
+
+		// the filter sees its name as argv[0], as if run on its own
+		argv[arg] = NULL;
+		yuvstage_reset_getopt();
+		chain[nstages].priv = chain[nstages].st->init(arg - first, argv + first);
+		if (chain[nstages].priv == NULL) {
+			chain[nstages].st->usage();
+			return 0;
+		}
+
+		nstages++;
+		arg++;
+	}
+
+	for (s=0; s<=nstages; s++)
+		link_init(&links[s], s);
+
+	// ***************************************************************
+	// Get video stream informations (size, framerate, interlacing, aspect ratio).
+	// The streaminfo structure is filled in
+	// ***************************************************************
+	// INPUT comes from stdin, we check for a correct file header
+	y4m_accept_extensions(1);
+	if (yuv_read_stream_header (fdIn, &links[0].si) != Y4M_OK)
+		mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
+
+	// Information output
+	mjpeg_info ("yuvchain (version " VERSION ") runs yuv filters in one process");
+	mjpeg_info ("yuvchain -h for help");
+
+	// each stage sets up the stream for the next
+	for (s=0; s<nstages; s++) {
+		chain[s].in = &links[s];
+		chain[s].out = &links[s+1];
+		if (chain[s].st->config(chain[s].priv, &links[s].si, &links[s+1].si))
+			mjpeg_error_exit1 ("%s cannot process this stream", chain[s].st->name);
+		if (chain[s].st->inplace && chain[s].st->flush)
+			mjpeg_error_exit1 ("%s cannot flush in place", chain[s].st->name);
+	}
+
+	yuv_write_stream_header(fdOut,&links[nstages].si);
+
+	// the full queues hold every frame of the link plus the end marker
+	link_alloc(&links[0], pool_size);
+	queue_init(&links[0].full, pool_size + 1);
+	for (s=0; s<nstages; s++) {
+		if (!chain[s].st->inplace)
+			link_alloc(&links[s+1], pool_size);
+		// in place stages pass on frames from any link before them
+		queue_init(&links[s+1].full, (s+2) * pool_size + 1);
+	}
+
+	ra.fd = fdIn;
+	ra.out = &links[0];
+	if (pthread_create(&reader, NULL, read_thread, &ra))
+		mjpeg_error_exit1 ("Cannot create reader thread");
+
+	for (s=0; s<nstages; s++)
+		if (pthread_create(&chain[s].thread, NULL, stage_thread, &chain[s]))
+			mjpeg_error_exit1 ("Cannot create %s thread", chain[s].st->name);
+
+	// the main thread writes
+	last = &links[nstages];
+	write_error_code = Y4M_OK;
+	while ((f = queue_get(&last->full)) != NULL) {
+		if (write_error_code == Y4M_OK)
+			write_error_code = yuv_write_frame(fdOut, &last->si, &f->fi, f->data);
+		frame_release(f);
+	}
+
+	if( write_error_code != Y4M_OK )
+		mjpeg_error_exit1 ("Error writing output stream!");
+
+	pthread_join(reader, NULL);
+	for (s=0; s<nstages; s++) {
+		pthread_join(chain[s].thread, NULL);
+		chain[s].st->fini(chain[s].priv);
+	}
+
+	for (s=0; s<=nstages; s++)
+		link_free(&links[s]);
+
+	return 0;
+}
+/*
+ * Local variables:
+ *  tab-width: 8
+ *  indent-tabs-mode: nil
+ * End:
+ */
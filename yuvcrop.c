@@ -97,7 +97,7 @@ static void detect_switching(int fdIn , int fdOut , y4m_stream_info_t  *inStrInf
 
     height = y4m_si_get_plane_height(inStrInfo,0) ; width = y4m_si_get_plane_width(inStrInfo,0);
 
-    read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+    read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
 
     while( Y4M_ERR_EOF != read_error_code ) {
 
@@ -204,8 +204,8 @@ static void detect_switching(int fdIn , int fdOut , y4m_stream_info_t  *inStrInf
         y4m_fini_frame_info( &in_frame );
 		y4m_init_frame_info( &in_frame );
 
-        write_error_code = y4m_write_frame( fdOut, inStrInfo, &in_frame, yuv_odata );
-        read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+        write_error_code = yuv_write_frame( fdOut, inStrInfo, &in_frame, yuv_odata );
+        read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
 
 
     }
@@ -250,7 +250,7 @@ static void detect(int fdIn  , y4m_stream_info_t  *inStrInfo, uint8_t *col, int
 	cwidth = y4m_si_get_plane_width(inStrInfo,1);
 
 	y4m_init_frame_info( &in_frame );
-	read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+	read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
 
 	abottom=height;
 	aright=width;
@@ -322,7 +322,7 @@ static void detect(int fdIn  , y4m_stream_info_t  *inStrInfo, uint8_t *col, int
 
 		y4m_fini_frame_info( &in_frame );
 		y4m_init_frame_info( &in_frame );
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+		read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
 	}
 	// Clean-up regardless an error happened or not
 	y4m_fini_frame_info( &in_frame );
@@ -394,7 +394,7 @@ static void crop (int fdIn, y4m_stream_info_t  *inStrInfo,
 	write_error_code = Y4M_OK ;
 
 	y4m_init_frame_info( &in_frame );
-	read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+	read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
 
 	while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
 
@@ -403,11 +403,11 @@ static void crop (int fdIn, y4m_stream_info_t  *inStrInfo,
         if (dump)
             y4m_dump_frame(outStrInfo,yuv_odata);
         else
-            write_error_code = y4m_write_frame( fdOut, outStrInfo, &in_frame, yuv_odata );
+            write_error_code = yuv_write_frame( fdOut, outStrInfo, &in_frame, yuv_odata );
 
 		y4m_fini_frame_info( &in_frame );
 		y4m_init_frame_info( &in_frame );
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+		read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
 
 	}
 
@@ -493,18 +493,18 @@ static void matte (int fdIn, y4m_stream_info_t  *inStrInfo,
 	write_error_code = Y4M_OK ;
 
 	y4m_init_frame_info( &in_frame );
-	read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+	read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
 
 	while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
 
 		chromacpy(yuv_odata,yuv_data,outStrInfo);
 		paint_matte(yuv_odata,outStrInfo,a,col);
 
-		write_error_code = y4m_write_frame( fdOut, outStrInfo, &in_frame, yuv_odata );
+		write_error_code = yuv_write_frame( fdOut, outStrInfo, &in_frame, yuv_odata );
 
 		y4m_fini_frame_info( &in_frame );
 		y4m_init_frame_info( &in_frame );
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+		read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
 
 	}
 
@@ -614,7 +614,7 @@ int main (int argc, char *argv[])
 	// The streaminfo structure is filled in
 	// ***************************************************************
 	// INPUT comes from stdin, we check for a correct file header
-	if (y4m_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+	if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
 		mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
 
     if (mode == MODE_SWITCHING)
@@ -640,7 +640,7 @@ int main (int argc, char *argv[])
             y4m_si_set_height (&out_streaminfo, area[3]-area[1]);
             y4m_si_set_width (&out_streaminfo, area[2]-area[0]);
         }
-        y4m_write_stream_header(fdOut,&out_streaminfo);
+        yuv_write_stream_header(fdOut,&out_streaminfo);
 	}
 	// Information output
 	mjpeg_info ("yuvcrop (version " YUVDE_VERSION ") crop tool for yuv streams");
@@ -30,6 +30,12 @@
 ** <p>To produce an ASCII file showing the differences between each frame for detecting pulldown or frame rate conversion: <tt> |yuvdiff -g > output.txt</tt> </p>
 ** <p>To search for a reference frame: <tt> | yuvdiff -g search_frame.y4m > output.txt</tt></p>
 ** <p>To search for multiple reference frames and the black level: <tt> | yuvdiff -g -b  start_frame.y4m end_frame.y4m > output.txt</tt></p>
+** <p>A reference frame can be taken from the middle of a longer file with <tt>file.y4m:N</tt>, frames count from 0.
+** The file is mapped, not read, and a yuvindex sidecar is used if there is one.</p>
+** <p>-B file.ystats writes the numbers to a binary statistics file instead of
+** the text (implies -g).  The first column, frame, has the .5 of the second
+** field, then there is a diff column or diff1 to diffN for the reference
+** frames.  yuvstatsdump prints it as the text below.</p>
 ** <p>The program produces this ASCII output:</p>
 ** <p>Interlace, with multiple reference files (if -b specified, is always the last column)
 **<pre>1 20422241 15400627 24882428
@@ -77,6 +83,7 @@
 #include <fcntl.h>
 
 #include "utilyuv.h"
+#include "yuvstats.h"
 
 #include <yuv4mpeg.h>
 #include <mpegconsts.h>
@@ -86,14 +93,16 @@
 static void print_usage()
 {
 	fprintf (stderr,
-			 "usage: yuvdiff [-g -v -h -Ip|b|p] [<file1>...<fileN>]\n"
+			 "usage: yuvdiff [-g -v -h -Ip|b|p] [-B file.ystats] [<file1>...<fileN>]\n"
 			 "yuvdiff produces a video showing frame by frame difference\n"
 			 "Or specify a file to compare differences from the first frame of that file\n"
 			 "\n"
 			 "\t -g produce text output suitable for graphing in gnuplot\n"
+			 "\t -B write the -g numbers to a binary statistics file (see yuvstatsdump)\n"
 			 "\t -v Verbosity degree : 0=quiet, 1=normal, 2=verbose/debug\n"
 			 "\t -I<pbt> Force interlace mode\n"
 			 "\t  <file> a y4m single frame to compare with\n"
+			 "\t  <file:N> frame N of a y4m file to compare with\n"
 			 "\t -b compare with black (requires -g option)\n"
 			 "\t -h print this help\n"
 			 );
@@ -176,7 +185,41 @@ void diff (uint8_t *m[3],uint8_t *n[3],uint8_t *o[3], y4m_stream_info_t  *in)
 }
 
 
-static void detect(  int fdIn, int fdOut , y4m_stream_info_t  *inStrInfo, y4m_stream_info_t *outStrInfo ,int interlacing,int graph, uint8_t ***yuv_cdata, int frames)
+// one row per frame, or per field with the second field at frame + 0.5
+static void graph_stats(yuv_stats_t *st, int frame, int interlacing, int *ti, int *to, int n)
+{
+	int *first = ti, *second = to;
+	int k;
+
+	if (interlacing == Y4M_ILACE_NONE) {
+		yuv_stats_set_float(st, 0, frame);
+		for (k=0; k < n; k++)
+			yuv_stats_set_int(st, k + 1, ti[k] + to[k]);
+		if (yuv_stats_row(st))
+			mjpeg_error_exit1 ("Error writing the statistics file");
+		return;
+	}
+
+	if (interlacing == Y4M_ILACE_BOTTOM_FIRST) {
+		first = to; second = ti;
+	} else if (interlacing != Y4M_ILACE_TOP_FIRST) {
+		return;
+	}
+
+	yuv_stats_set_float(st, 0, frame);
+	for (k=0; k < n; k++)
+		yuv_stats_set_int(st, k + 1, first[k]);
+	if (yuv_stats_row(st))
+		mjpeg_error_exit1 ("Error writing the statistics file");
+	yuv_stats_set_float(st, 0, frame + 0.5);
+	for (k=0; k < n; k++)
+		yuv_stats_set_int(st, k + 1, second[k]);
+	if (yuv_stats_row(st))
+		mjpeg_error_exit1 ("Error writing the statistics file");
+}
+
+static void detect(  int fdIn, int fdOut , y4m_stream_info_t  *inStrInfo, y4m_stream_info_t *outStrInfo ,int interlacing,int graph, uint8_t ***yuv_cdata, int frames,
+				   yuv_stats_t *st)
 {
 	y4m_frame_info_t   in_frame ;
 	uint8_t            *yuv_data[3] ;
@@ -222,13 +265,13 @@ static void detect(  int fdIn, int fdOut , y4m_stream_info_t  *inStrInfo, y4m_st
 		chromacpy (yuv_odata,yuv_cdata[0],inStrInfo);
 	}
 	else {
-		read_error_code = y4m_read_frame(fdIn,inStrInfo,&in_frame,yuv_odata );
+		read_error_code = yuv_read_frame(fdIn,inStrInfo,&in_frame,yuv_odata );
 	}
 	++src_frame_counter ;
 
 	while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
 
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+		read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
 
 		// check for read error
 	//	fprintf(stderr,"src: %d\n",src_frame_counter);
@@ -241,7 +284,16 @@ static void detect(  int fdIn, int fdOut , y4m_stream_info_t  *inStrInfo, y4m_st
 			// I really need to re write this.
 		//	fprintf(stderr,"frames: %d\n",frames);
 
-			if (frames == 0) {
+			if (st) {
+				if (frames == 0) {
+					luma_sum_diff(&bri,&bro,yuv_data,yuv_odata,inStrInfo);
+					graph_stats(st, src_frame_counter, interlacing, &bri, &bro, 1);
+				} else {
+					for (n=0; n<frames;n++)
+						luma_sum_diff(&totali[n],&totalo[n],yuv_data,yuv_cdata[n],inStrInfo);
+					graph_stats(st, src_frame_counter, interlacing, totali, totalo, frames);
+				}
+			} else if (frames == 0) {
 				luma_sum_diff(&bri,&bro,yuv_data,yuv_odata,inStrInfo);
 
 				if (interlacing == Y4M_ILACE_NONE) {
@@ -293,7 +345,7 @@ static void detect(  int fdIn, int fdOut , y4m_stream_info_t  *inStrInfo, y4m_st
 
 		} else {
 			diff(yuv_wdata,yuv_data,yuv_odata,inStrInfo);
-			write_error_code = y4m_write_frame( fdOut, outStrInfo, &in_frame, yuv_wdata );
+			write_error_code = yuv_write_frame( fdOut, outStrInfo, &in_frame, yuv_wdata );
 		}
 
 
@@ -330,38 +382,34 @@ static void detect(  int fdIn, int fdOut , y4m_stream_info_t  *inStrInfo, y4m_st
 
 }
 
+// reads a reference frame, file.y4m:N takes frame N of a longer file.
 int read_frame (uint8_t **yuv_frame, char * filename, y4m_stream_info_t in_streaminfo)
 {
 
-	y4m_stream_info_t compare_streaminfo;
-	y4m_frame_info_t   compare_frame ;
-	int fdCompare = 0;
-
-//	fprintf(stderr,"read_frame\n");
+	yuv_index_t compare_index;
+	uint8_t *compare_frame[3];
+	char *frame;
+	int n = 0;
 
+	if (access(filename, F_OK) && (frame = strrchr(filename,':'))) {
+		n = atoi(frame + 1);
+		*frame = '\0';
+	}
 
-	fdCompare = open (filename,O_RDONLY);
-	if (fdCompare < 0)
+	if (yuv_index_open(&compare_index, filename))
 		return -1;
-	//fprintf(stderr,"y4m_read_stream_header\n");
-
-	if (y4m_read_stream_header (fdCompare, &compare_streaminfo) != Y4M_OK)
-		return -2;
 
-	if (y4m_si_get_framelength(&in_streaminfo) != y4m_si_get_framelength(&compare_streaminfo))
+	if (y4m_si_get_framelength(&in_streaminfo) != y4m_si_get_framelength(&compare_index.si)) {
+		yuv_index_close(&compare_index);
 		return -3;
+	}
 
-
-	y4m_init_frame_info( &compare_frame );
-	if(y4m_read_frame(fdCompare,&compare_streaminfo,&compare_frame,yuv_frame ) != Y4M_OK) {
-		y4m_fini_frame_info( &compare_frame );
-		close (fdCompare);
+	if (yuv_index_frame(&compare_index, n, compare_frame) != Y4M_OK) {
+		yuv_index_close(&compare_index);
 		return -4;
-
 	}
-	y4m_fini_frame_info( &compare_frame );
-	close (fdCompare);
-
+	chromacpy(yuv_frame, compare_frame, &in_streaminfo);
+	yuv_index_close(&compare_index);
 
 	return 0;
 
@@ -378,10 +426,13 @@ int main (int argc, char *argv[])
 	int fdIn = 0 , fdOut=1;
 	y4m_stream_info_t in_streaminfo,out_streaminfo;
 	int src_interlacing = Y4M_UNKNOWN;
-	const static char *legal_flags = "bgI:v:h";
+	const static char *legal_flags = "bgI:v:hB:";
 	int compare_frames = 0;
 	int graph = 0,black=0;
 	int c ;
+	char *stats_file = NULL, name[YUV_STATS_NAME];
+	yuv_stats_t stats;
+	y4m_ratio_t rate;
 
 	uint8_t ***yuv_cdata;
 
@@ -393,6 +444,10 @@ int main (int argc, char *argv[])
 			case 'g':
 				graph = 1;
 				break;
+			case 'B':
+				stats_file = optarg;
+				graph = 1;
+				break;
 			case 'v':
 				verbose = atoi (optarg);
 				if (verbose < 0 || verbose > 2)
@@ -422,7 +477,7 @@ int main (int argc, char *argv[])
 	// The streaminfo structure is filled in
 	// ***************************************************************
 	// INPUT comes from stdin, we check for a correct file header
-	if (y4m_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+	if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
 		mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
 
 	/* Process additional command line arguments */
@@ -473,12 +528,31 @@ int main (int argc, char *argv[])
 
 	if (!graph) {
 		y4m_copy_stream_info( &out_streaminfo, &in_streaminfo );
-		y4m_write_stream_header(fdOut,&out_streaminfo);
+		yuv_write_stream_header(fdOut,&out_streaminfo);
 	}
 
 
+	if (stats_file) {
+		if (compare_frames + 1 > YUV_STATS_MAX_COLUMNS)
+			mjpeg_error_exit1("Too many reference frames for a statistics file");
+		rate = y4m_si_get_framerate(&in_streaminfo);
+		if (yuv_stats_create(&stats, stats_file, "yuvdiff", rate.n, rate.d))
+			mjpeg_error_exit1 ("Cannot create %s", stats_file);
+		yuv_stats_add_column(&stats, "frame", YUV_STATS_DOUBLE);
+		if (compare_frames == 0)
+			yuv_stats_add_column(&stats, "diff", YUV_STATS_INT32);
+		for (c = 1; c <= compare_frames; c++) {
+			snprintf(name, sizeof(name), "diff%d", c);
+			yuv_stats_add_column(&stats, name, YUV_STATS_INT32);
+		}
+	}
+
 	/* in that function we do all the important work */
-	detect( fdIn,fdOut,&in_streaminfo,&out_streaminfo, src_interlacing,graph,yuv_cdata,compare_frames);
+	detect( fdIn,fdOut,&in_streaminfo,&out_streaminfo, src_interlacing,graph,yuv_cdata,compare_frames,
+			stats_file ? &stats : NULL);
+
+	if (stats_file && yuv_stats_close(&stats))
+		mjpeg_error_exit1 ("Error writing %s", stats_file);
 
 	y4m_fini_stream_info (&in_streaminfo);
 	if (!graph) {
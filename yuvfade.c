@@ -6,16 +6,34 @@
 
 ** <h3>Black Fade</h3>
 **
-** <p> Will fade the video to black after X number of frames. Uses a
-** trial and error method of fading to black, could be better.</p>
+** <p> Will fade the video to black after X number of frames.  Fades in
+** from black, dips to black and back, and crossfades into a second clip
+** as well, with a straight or an S shaped curve, to black or any colour.</p>
 **
 ** <P>Use this program to give a more professional feel to the
 ** downloaded internet videos for converting</p>
+**
+** <p>The fade is worked out once, before the first frame: a lookup table
+** for each plane of each frame of the fade.  A fade frame goes through its
+** tables, a crossfade frame is blended with the frame of the second clip,
+** in bands of rows on all CPUs (YUV_THREADS sets how many).  The chroma
+** holds until the luma is a third of the way down and then fades
+** faster.  The frames before and after the fade are copied from input to
+** output without being read in, or are the plain colour.</p>
 **<pre>
-**usage: yuvfps -c Count -f fadeCount [-v -h]
+**usage: yuvfade -c Count -f fadeCount [-i|-d|-x file.y4m] [-s] [-y y,u,v] [-v -h]
 **      -c skip this number of frames
 **      -f fade to black for this many frames
+**      -i fade in from black instead, the first Count frames are black
+**      -d dip to black and back in over the fade frames
+**      -x crossfade into file.y4m, which follows the fade
+**      -s S curve, the fade starts and ends slowly
+**      -y fade to this colour instead of black
 **</pre>
+**<h4>EXAMPLE</h4>
+**<pre>yuvfade -i -f 25 &lt; programme.y4m | yuvfade -c 44975 -f 25 -s | mpeg2enc -o programme.m2v
+**yuvfade -c 250 -f 12 -x part2.y4m &lt; part1.y4m &gt; joined.y4m
+**yuvfade -d -c 100 -f 50 -y 235,128,128 &lt; in.y4m &gt; flash.y4m</pre>
 
  *  based on code:
  *  Copyright (C) 2002 Alfonso Garcia-Pati<F1>o Barbolani <barbolani at jazzfree.com>
@@ -41,53 +59,182 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <math.h>
 
 #include <yuv4mpeg.h>
 #include <mpegconsts.h>
+#include "utilyuv.h"
+#include "yuvbands.h"
+
+#define YUVFPS_VERSION "0.2"
 
-#define YUVFPS_VERSION "0.1"
+#define FADE_OUT 0
+#define FADE_IN 1
+#define FADE_DIP 2
+#define FADE_CROSS 3
 
 static void print_usage()
 {
 	fprintf (stderr,
-			 "usage: yuvfps -c Count -f fadeCount [-v -h]\n"
+			 "usage: yuvfade -c Count -f fadeCount [-i|-d|-x file.y4m] [-s] [-y y,u,v] [-v -h]\n"
 			 "yuvfade fades the last f frames of a yuv video stream read from stdin\n"
 			 "\n"
 			 "\t -c skip this number of frames\n"
 			 "\t -f fade to black for this many frames\n"
+			 "\t -i fade in from black instead, the first Count frames are black\n"
+			 "\t -d dip to black and back in over the fade frames\n"
+			 "\t -x crossfade into this y4m file, which follows the fade\n"
+			 "\t -s S curve, the fade starts and ends slowly\n"
+			 "\t -y fade to this colour instead of black (default 16,128,128)\n"
 			 "\t -v Verbosity degree : 0=quiet, 1=normal, 2=verbose/debug\n"
 			 "\t -h print this help\n"
 			 );
 }
 
-static void resample(  int fdIn
-					 , y4m_stream_info_t  *inStrInfo
-					 , int fdOut
-					 , y4m_stream_info_t  *outStrInfo
-					 , int after
-					 , int count
-					 )
+struct fade {
+	int mode;
+	int after, count;
+	int scurve;
+	int colour[3];
+
+	int planes;
+	int width[YUV_MAX_PLANES], height[YUV_MAX_PLANES];
+
+	// a table for each colour plane of each frame of the fade, the alpha is left as it is
+	uint8_t (*lut)[3][256];
+	// the weight of the second clip in each frame of a crossfade, 0..256
+	int *weight;
+
+	// the frame the bands are working on
+	uint8_t **m;
+	uint8_t **b;
+	int frame;
+};
+
+static double fade_curve(struct fade *this, double t)
+{
+	if (this->scurve)
+		return t * t * (3 - 2 * t);
+	return t;
+}
+
+// how much of the picture is left in frame i of the fade, 1..count
+static double fade_weight(struct fade *this, int i)
+{
+	double t = (double)i / this->count;
+
+	switch (this->mode) {
+		case FADE_IN:
+		case FADE_CROSS:
+			return fade_curve(this, t);
+		case FADE_DIP:
+			if (t <= 0.5)
+				return 1 - fade_curve(this, 2 * t);
+			return fade_curve(this, 2 * t - 1);
+	}
+	return 1 - fade_curve(this, t);
+}
+
+/* every frame of the fade maps each value the same way, so the whole fade
+** is worked out here once.  A crossfade has a weight per frame instead.
+*/
+static void fade_tables(struct fade *this)
+{
+	double w, pw, val;
+	int i, p, v;
+
+	if (this->mode == FADE_CROSS) {
+		this->weight = (int *)malloc(sizeof(int) * this->count);
+		if (this->weight == NULL)
+			mjpeg_error_exit1 ("Could'nt allocate memory for the fade");
+		// the weight of the second clip, which is coming in
+		for (i=0; i<this->count; i++)
+			this->weight[i] = lrint(256 * fade_weight(this, i + 1));
+		return;
+	}
+
+	this->lut = malloc(sizeof(*this->lut) * this->count);
+	if (this->lut == NULL)
+		mjpeg_error_exit1 ("Could'nt allocate memory for the fade");
+
+	for (i=0; i<this->count; i++) {
+		w = fade_weight(this, i + 1);
+		for (p=0; p<3; p++) {
+			/* I think chroma fading needs to be started after luma fading */
+			pw = w;
+			if (p && pw * 1.5 < 1.0)
+				pw = pw * 1.5;
+			else if (p)
+				pw = 1.0;
+			for (v=0; v<256; v++) {
+				val = this->colour[p] + (v - this->colour[p]) * pw;
+				if (val < 0) val = 0;
+				if (val > 255) val = 255;
+				this->lut[i][p][v] = lrint(val);
+			}
+		}
+	}
+}
+
+// rows first to last - 1 of the luma, and the rows of the other planes that go with them
+static void fade_band(void *arg, int first, int last)
+{
+	struct fade *this = arg;
+	int p, pfirst, plast, len;
+	uint8_t *d;
+
+	for (p=0; p<this->planes; p++) {
+		pfirst = (int64_t)first * this->height[p] / this->height[0];
+		plast = (int64_t)last * this->height[p] / this->height[0];
+		d = this->m[p] + pfirst * this->width[p];
+		len = (plast - pfirst) * this->width[p];
+		if (this->b)
+			yuv_kernel.blend(d, d, this->b[p] + pfirst * this->width[p], this->weight[this->frame], len);
+		else if (p < 3)
+			yuv_kernel.lut(d, d, this->lut[this->frame][p], len);
+	}
+}
+
+static void fade_frame(struct fade *this, int i, uint8_t **m, uint8_t **b)
+{
+	this->m = m;
+	this->b = b;
+	this->frame = i - 1;
+	yuv_bands(fade_band, this, this->height[0]);
+}
+
+static void fill_frame(struct fade *this, uint8_t **m)
 {
-	y4m_frame_info_t   in_frame ;
-	uint8_t            *yuv_data[3] ;
-	int                frame_data_size ;
+	int p;
+
+	// the colour is opaque
+	for (p=0; p<this->planes; p++)
+		yuv_kernel.fill(m[p], p < 3 ? this->colour[p] : 255, this->width[p] * this->height[p]);
+}
+
+// frames outside the fade are copied, or are the colour, i is the frame's place in the fade
+static int fade_passes(struct fade *this, int i)
+{
+	if (i < 1)
+		return this->mode != FADE_IN;
+	return this->mode != FADE_OUT;
+}
+
+static void fade(int fdIn, int fdX, int fdOut, y4m_stream_info_t *inStrInfo, struct fade *this)
+{
+	y4m_frame_info_t   in_frame, x_frame ;
+	uint8_t            *yuv_data[YUV_MAX_PLANES], *x_data[YUV_MAX_PLANES] ;
 	int                read_error_code ;
 	int                write_error_code ;
 	int                src_frame_counter ;
-	int w,h,x,y;
-	float mul,val;
+	int i;
 
 	// Allocate memory for the YUV channels
-	h = y4m_si_get_height(inStrInfo) ;
-	w = y4m_si_get_width(inStrInfo);
-	frame_data_size =  w * h;
-	yuv_data[0] = (uint8_t *)malloc( frame_data_size );
-	yuv_data[1] = (uint8_t *)malloc( frame_data_size >> 2);
-	yuv_data[2] = (uint8_t *)malloc( frame_data_size >> 2);
-
-	if( !yuv_data[0] || !yuv_data[1] || !yuv_data[2] )
+	if (planealloc(yuv_data,inStrInfo))
+		mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
+	if (fdX != -1 && planealloc(x_data,inStrInfo))
 		mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
-
 
 	/* Initialize counters */
 
@@ -95,44 +242,51 @@ static void resample(  int fdIn
 
 	src_frame_counter = 0 ;
 	y4m_init_frame_info( &in_frame );
-	read_error_code = y4m_read_frame(fdIn,inStrInfo,&in_frame,yuv_data );
-	++src_frame_counter ;
-
-	while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
-
-		if (src_frame_counter > after) {
-			// fade frame
-			mul =   1.0 * (after + count - src_frame_counter)  / count;
-			if (mul < 0)
-				mul = 0;
-			for (y=0; y<h; y++)
-				for (x=0; x<w; x++)
-				{
-					val = (yuv_data[0][x+y*w] - 16) * mul + 16;
-					yuv_data[0][x+y*w] = val;
-					/* I think chroma fading needs to be started after luma fading */
-					if ( (mul * 1.5 < 1.0) && (!(y%2) && !(x%2)) )
-					{
-						val = (yuv_data[1][x/2+y/2*w/2] - 128) * 1.5 * mul + 128;
-						yuv_data[1][x/2+y/2*w/2] = val;
-						val = (yuv_data[2][x/2+y/2*w/2] - 128) * 1.5 * mul + 128;
-						yuv_data[2][x/2+y/2*w/2] = val;
-					}
-				}
-		}
-
+	y4m_init_frame_info( &x_frame );
 
-		write_error_code = y4m_write_frame( fdOut, outStrInfo, &in_frame, yuv_data );
+	do {
 		++src_frame_counter ;
+		i = src_frame_counter - this->after;
+
+		if ((i < 1 || i > this->count) && fade_passes(this, i)) {
+			// the frame is copied without being read in, from the second clip after a crossfade
+			if (fdX != -1 && i > 0)
+				read_error_code = yuv_pass_frame(fdX, fdOut, inStrInfo, &in_frame);
+			else
+				read_error_code = yuv_pass_frame(fdIn, fdOut, inStrInfo, &in_frame);
+			// part of it may have been written, the stream can't go on
+			if (read_error_code != Y4M_OK && read_error_code != Y4M_ERR_EOF)
+				break;
+			y4m_fini_frame_info( &in_frame );
+			y4m_init_frame_info( &in_frame );
+			continue;
+		}
+
+		read_error_code = yuv_read_frame(fdIn,inStrInfo,&in_frame,yuv_data );
+		if (read_error_code == Y4M_OK) {
+			if (i < 1 || i > this->count) {
+				fill_frame(this, yuv_data);
+			} else if (fdX != -1) {
+				if (yuv_read_frame(fdX, inStrInfo, &x_frame, x_data) != Y4M_OK)
+					mjpeg_error_exit1 ("The crossfade clip is shorter than the fade!");
+				fade_frame(this, i, yuv_data, x_data);
+				y4m_fini_frame_info( &x_frame );
+				y4m_init_frame_info( &x_frame );
+			} else {
+				fade_frame(this, i, yuv_data, NULL);
+			}
+
+			write_error_code = yuv_write_frame( fdOut, inStrInfo, &in_frame, yuv_data );
+		}
 		y4m_fini_frame_info( &in_frame );
 		y4m_init_frame_info( &in_frame );
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
-	}
+	} while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK );
 	// Clean-up regardless an error happened or not
 	y4m_fini_frame_info( &in_frame );
-	free( yuv_data[0] );
-	free( yuv_data[1] );
-	free( yuv_data[2] );
+	y4m_fini_frame_info( &x_frame );
+	planefree(yuv_data);
+	if (fdX != -1)
+		planefree(x_data);
 
 	if( read_error_code != Y4M_ERR_EOF )
 		mjpeg_error_exit1 ("Error reading from input stream!");
@@ -148,14 +302,15 @@ int main (int argc, char *argv[])
 {
 
 	int verbose = 1 ;
-	int count = 0 ;
-	int frames = 0;
 	int fdIn = 0 ;
 	int fdOut = 1 ;
-	y4m_stream_info_t in_streaminfo, out_streaminfo ;
-	y4m_ratio_t  src_frame_rate ;
+	int fdX = -1 ;
+	char *xname = NULL;
+	y4m_stream_info_t in_streaminfo, out_streaminfo, x_streaminfo ;
+	struct fade this = { FADE_OUT, 0, 0, 0, { 16, 128, 128 } };
+	int p;
 
-	const static char *legal_flags = "f:c:v:h";
+	const static char *legal_flags = "f:c:idx:sy:v:h";
 	int c ;
 
 	while ((c = getopt (argc, argv, legal_flags)) != -1) {
@@ -166,10 +321,26 @@ int main (int argc, char *argv[])
 					mjpeg_error_exit1 ("Verbose level must be [0..2]");
 				break;
 			case 'c':
-				count =  atoi (optarg);
+				this.after =  atoi (optarg);
 				break;
 			case 'f':
-				frames = atoi (optarg);
+				this.count = atoi (optarg);
+				break;
+			case 'i':
+				this.mode = FADE_IN;
+				break;
+			case 'd':
+				this.mode = FADE_DIP;
+				break;
+			case 'x':
+				this.mode = FADE_CROSS;
+				xname = optarg;
+				break;
+			case 's':
+				this.scurve = 1;
+				break;
+			case 'y':
+				sscanf (optarg,"%d,%d,%d",&this.colour[0],&this.colour[1],&this.colour[2]);
 				break;
 			case 'h':
 			case '?':
@@ -181,6 +352,12 @@ int main (int argc, char *argv[])
 	// mjpeg tools global initialisations
 	mjpeg_default_handler_verbosity (verbose);
 
+	if (this.count < 0)
+		this.count = 0;
+	for (p=0; p<3; p++)
+		if (this.colour[p] < 0 || this.colour[p] > 255)
+			mjpeg_error_exit1 ("The colour must be y,u,v from 0 to 255");
+
 	// Initialize input streams
 	y4m_init_stream_info (&in_streaminfo);
 	y4m_init_stream_info (&out_streaminfo);
@@ -190,25 +367,51 @@ int main (int argc, char *argv[])
 	// The streaminfo structure is filled in
 	// ***************************************************************
 	// INPUT comes from stdin, we check for a correct file header
-	if (y4m_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+	if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
 		mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
 
+	// the clip faded into has to fit the same frames
+	if (xname) {
+		fdX = open(xname, O_RDONLY);
+		if (fdX == -1)
+			mjpeg_error_exit1 ("Could'nt open %s", xname);
+		y4m_init_stream_info (&x_streaminfo);
+		if (yuv_read_stream_header (fdX, &x_streaminfo) != Y4M_OK)
+			mjpeg_error_exit1 ("Could'nt read YUV4MPEG header from %s!", xname);
+		if (y4m_si_get_width(&x_streaminfo) != y4m_si_get_width(&in_streaminfo) ||
+			y4m_si_get_height(&x_streaminfo) != y4m_si_get_height(&in_streaminfo) ||
+			y4m_si_get_chroma(&x_streaminfo) != y4m_si_get_chroma(&in_streaminfo))
+			mjpeg_error_exit1 ("%s is not the same size and chroma as the input", xname);
+		y4m_fini_stream_info (&x_streaminfo);
+	}
+
+	this.planes = y4m_si_get_plane_count(&in_streaminfo);
+	if (this.planes > YUV_MAX_PLANES)
+		mjpeg_error_exit1 ("Too many planes in the stream");
+	for (p=0; p<this.planes; p++) {
+		this.width[p] = y4m_si_get_plane_width(&in_streaminfo,p);
+		this.height[p] = y4m_si_get_plane_height(&in_streaminfo,p);
+	}
+	// no fade frames, nothing to work out
+	if (this.count)
+		fade_tables(&this);
+
 	// Prepare output stream
-	src_frame_rate = y4m_si_get_framerate( &in_streaminfo );
-	y4m_ratio_t frame_rate = src_frame_rate ;
 	y4m_copy_stream_info( &out_streaminfo, &in_streaminfo );
 
-
 	// Information output
 	mjpeg_info ("yuvfade (version " YUVFPS_VERSION
 				") is a general black fade utility for yuv streams");
 
-	y4m_write_stream_header(fdOut,&out_streaminfo);
+	yuv_write_stream_header(fdOut,&out_streaminfo);
 
 	/* in that function we do all the important work */
-	resample( fdIn,&in_streaminfo,  fdOut,&out_streaminfo,
-			 count, frames );
+	fade( fdIn, fdX, fdOut, &in_streaminfo, &this);
 
+	if (fdX != -1)
+		close(fdX);
+	free(this.lut);
+	free(this.weight);
 	y4m_fini_stream_info (&in_streaminfo);
 	y4m_fini_stream_info (&out_streaminfo);
 
@@ -50,61 +50,77 @@ static void print_usage()
 }
 
 
+// the first field of each frame goes out with the second field of the frame before,
+// the fields are written from where they were read
 static void filter(  int fdIn ,int fdOut  , y4m_stream_info_t  *inStrInfo )
 {
 	y4m_frame_info_t   in_frame ;
-	uint8_t            *yuv_data[3] ;
-	uint8_t            *yuv_odata[3] ;
+	uint8_t            *yuv_data[2][YUV_MAX_PLANES] ;
+	uint8_t            *black[YUV_MAX_PLANES] ;
+	uint8_t            **prev ;
+	yuv_field_t        first, second ;
 
-	int interlace;
+	int interlace, cur = 0;
 	int                read_error_code ;
 	int                write_error_code ;
 
 	// Allocate memory for the YUV channels
 
-	if (chromalloc(yuv_data,inStrInfo))
+	if (planealloc(yuv_data[0],inStrInfo) || planealloc(yuv_data[1],inStrInfo) || planealloc(black,inStrInfo))
 		mjpeg_error_exit1 ("Couldn't allocate memory for the YUV4MPEG data!");
 
-	if (chromalloc(yuv_odata,inStrInfo))
-		mjpeg_error_exit1 ("Couldn't allocate memory for the YUV4MPEG data!");
-
-	// fill with black.
-	chromaset(yuv_odata,inStrInfo,16,128,128);
+	// fill with black, opaque if there is an alpha plane
+	chromaset(black,inStrInfo,16,128,128);
+	if (black[3])
+		yuv_kernel.fill(black[3],255,y4m_si_get_plane_length(inStrInfo,3));
+	prev = black;
 
 	/* Initialize counters */
 
 	interlace = y4m_si_get_interlace(inStrInfo);
+	if (interlace != Y4M_ILACE_TOP_FIRST && interlace != Y4M_ILACE_BOTTOM_FIRST) {
+		mjpeg_warn("video is not interlaced, treating it as top field first");
+		interlace = Y4M_ILACE_TOP_FIRST;
+	}
 	write_error_code = Y4M_OK ;
 
 	y4m_init_frame_info( &in_frame );
-	read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+	read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data[cur] );
 
 	while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
 
 		// do work
 		if (read_error_code == Y4M_OK) {
 
-			copyfield(yuv_odata,yuv_data,inStrInfo,interlace);
-			write_error_code = y4m_write_frame( fdOut, inStrInfo, &in_frame, yuv_odata );
-			copyfield(yuv_odata,yuv_data,inStrInfo,invert_order(interlace));
+			yuv_field_view(&first,yuv_data[cur],inStrInfo,interlace);
+			yuv_field_view(&second,prev,inStrInfo,invert_order(interlace));
+			if (interlace == Y4M_ILACE_TOP_FIRST)
+				write_error_code = yuv_write_weave( fdOut, inStrInfo, &in_frame, &first, &second );
+			else
+				write_error_code = yuv_write_weave( fdOut, inStrInfo, &in_frame, &second, &first );
 
+			prev = yuv_data[cur];
+			cur ^= 1;
 		}
 
 		y4m_fini_frame_info( &in_frame );
 		y4m_init_frame_info( &in_frame );
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+		read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data[cur] );
 	}
-	chromaset(yuv_data,inStrInfo,16,128,128);
-	copyfield(yuv_odata,yuv_data,inStrInfo,interlace);
-	write_error_code = y4m_write_frame( fdOut, inStrInfo, &in_frame, yuv_odata );
+	yuv_field_view(&first,black,inStrInfo,interlace);
+	yuv_field_view(&second,prev,inStrInfo,invert_order(interlace));
+	if (interlace == Y4M_ILACE_TOP_FIRST)
+		write_error_code = yuv_write_weave( fdOut, inStrInfo, &in_frame, &first, &second );
+	else
+		write_error_code = yuv_write_weave( fdOut, inStrInfo, &in_frame, &second, &first );
 
 
 	// Clean-up regardless an error happened or not
 	y4m_fini_frame_info( &in_frame );
 
-	free( yuv_data[0] );
-	free( yuv_data[1] );
-	free( yuv_data[2] );
+	planefree(yuv_data[0]);
+	planefree(yuv_data[1]);
+	planefree(black);
 
 	if( read_error_code != Y4M_ERR_EOF )
 		mjpeg_error_exit1 ("Error reading from input stream!");
@@ -160,7 +176,7 @@ int main (int argc, char *argv[])
 	// The streaminfo structure is filled in
 	// ***************************************************************
 	// INPUT comes from stdin, we check for a correct file header
-	if (y4m_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+	if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
 		mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
 
 	//yuv_interlacing = Y4M_ILACE_TOP_FIRST;
@@ -176,7 +192,7 @@ int main (int argc, char *argv[])
 	y4m_copy_stream_info( &out_streaminfo, &in_streaminfo );
 	y4m_si_set_interlace(&in_streaminfo, yuv_interlacing);
 	y4m_si_set_interlace(&out_streaminfo, invert_order(yuv_interlacing));
-	y4m_write_stream_header(fdOut,&out_streaminfo);
+	yuv_write_stream_header(fdOut,&out_streaminfo);
 
 	/* in that function we do all the important work */
 	filter(fdIn, fdOut, &in_streaminfo);
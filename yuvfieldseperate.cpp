@@ -3,6 +3,9 @@
  * Mark Heath
  * http://github.com/silicontrip/lavtools/
  *
+** <p>Puts the top field of each frame in the top half of the picture and the
+** bottom field in the bottom half.  The fields are written from the frame as
+** it was read, there is no second frame.</p>
  *
  *
  *  This program is free software; you can redistribute it and/or modify
@@ -24,63 +27,54 @@
 #include <yuv4mpeg.h>
 #include <mpegconsts.h>
 #include <string.h>
-#include "libav2yuv/Libyuv.h"
-#include "libav2yuv/AVException.h"
+#include "utilyuv.h"
 
 int main (int argc, char **argv)
 {
 
-    Libyuv iyuv,oyuv;
-    int y;
-    iyuv.setExtensions(1);
-    oyuv.setExtensions(1);
+    y4m_stream_info_t in_streaminfo, out_streaminfo;
+    y4m_frame_info_t in_frame;
+    uint8_t *yuv_data[YUV_MAX_PLANES];
+    yuv_field_t top, bottom;
+    int read_error_code, write_error_code = Y4M_OK;
 
-    try {
+    y4m_accept_extensions(1);
+    y4m_init_stream_info (&in_streaminfo);
+    y4m_init_stream_info (&out_streaminfo);
 
-        iyuv.readHeader();
-        iyuv.dumpInfo();
-        // copy from in to out.
-        oyuv.copyStreamInfo(&iyuv);
+    if (yuv_read_stream_header (0, &in_streaminfo) != Y4M_OK)
+        mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
 
-        oyuv.dumpInfo();
-        oyuv.writeHeader();
+    // copy from in to out.
+    y4m_copy_stream_info (&out_streaminfo, &in_streaminfo);
+    yuv_write_stream_header (1, &out_streaminfo);
 
-        iyuv.allocFrameData();
-        oyuv.allocFrameData();
+    if (planealloc (yuv_data, &in_streaminfo))
+        mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
 
-        int width = iyuv.getWidth();
-        int cwidth = iyuv.getChromaWidth();
+    y4m_init_frame_info (&in_frame);
+    read_error_code = yuv_read_frame (0, &in_streaminfo, &in_frame, yuv_data);
 
-        while(1) {
-            iyuv.read();
-
-            for (y=0; y<iyuv.getHeight();y++)
-            {
-                int ny = (y >> 1) + (iyuv.getHeight() >> 1) * (y % 2);
-
-             //   std::cerr << "in: " << y << " out: " << ny << "\n";
-
-                memcpy (&(oyuv.getYUVFrame()[0][ny*width]),
-                        &(iyuv.getYUVFrame()[0][y*width]),width);
-                // do chroma
-                if (y < iyuv.getChromaHeight())
-                {
-                    int ny = (y >> 1) + (iyuv.getChromaHeight() >> 1) * (y % 2);
-
-                    memcpy (&oyuv.getYUVFrame()[1][ny*cwidth],
-                            &iyuv.getYUVFrame()[1][y*cwidth],cwidth);
-
-                    memcpy (&oyuv.getYUVFrame()[2][ny*cwidth],
-                            &iyuv.getYUVFrame()[2][y*cwidth],cwidth);
-
-
-                }
-
-            }
-
-            oyuv.write();
+    while (read_error_code != Y4M_ERR_EOF && write_error_code == Y4M_OK) {
+        if (read_error_code == Y4M_OK) {
+            yuv_field_view (&top, yuv_data, &in_streaminfo, Y4M_ILACE_TOP_FIRST);
+            yuv_field_view (&bottom, yuv_data, &in_streaminfo, Y4M_ILACE_BOTTOM_FIRST);
+            write_error_code = yuv_write_stacked (1, &out_streaminfo, &in_frame, &top, &bottom);
         }
-    } catch (AVException *e) {
-		std::cerr << "ERROR occurred: " << e->getMessage() << "\n";
-	}
-}
\ No newline at end of file
+        y4m_fini_frame_info (&in_frame);
+        y4m_init_frame_info (&in_frame);
+        read_error_code = yuv_read_frame (0, &in_streaminfo, &in_frame, yuv_data);
+    }
+
+    y4m_fini_frame_info (&in_frame);
+    planefree (yuv_data);
+    y4m_fini_stream_info (&in_streaminfo);
+    y4m_fini_stream_info (&out_streaminfo);
+
+    if (read_error_code != Y4M_ERR_EOF)
+        mjpeg_error_exit1 ("Error reading from input stream!");
+    if (write_error_code != Y4M_OK)
+        mjpeg_error_exit1 ("Error writing output stream!");
+
+    return 0;
+}
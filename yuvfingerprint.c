@@ -0,0 +1,471 @@
+/*
+ *  yuvfingerprint.c
+ *    Mark Heath <mjpeg0 at silicontrip.org>
+ *  http://silicontrip.net/~mark/lavtools/
+ *
+** <h3>Frame fingerprints</h3>
+** <p>Finds where a clip appears in an archive of recordings: the same
+** advertisement in every capture, a programme's titles, a scene that was
+** broadcast again.  Each frame gets a 64 bit perceptual fingerprint from
+** the low frequencies of its luma, which stays within a few bits through
+** noise, a different encoder or a change of size, so the frames don't
+** have to be the same bytes to be found.</p>
+** <p>-o writes the fingerprints of the stream read from stdin to a file,
+** with tables to search it by.  -c copies the stream on to stdout so it
+** can be done while the recording is being processed anyway.  -n names
+** the recording in the file, for the results of a search.</p>
+** <p>-q clip searches fingerprint files for a clip, which may be a y4m file,
+** - for a y4m stream on stdin, or the fingerprint file of one.  -s and -l
+** take part of the clip.  A few frames spread through the clip are looked
+** up, within -r bits, and every place most of them agree on is checked
+** frame by frame.  A place where at least -p of the clip's frames are
+** within -r bits is printed, the recording, the frame and timecode
+** the clip starts at and the fraction of frames that matched:</p>
+** <pre>
+**monday.ts 20478 00:13:39:03 0.98
+**tuesday.ts 61907 00:41:16:07 0.96
+**</pre>
+** <p>Black and other flat frames have no fingerprint and aren't counted.
+** A search of a week of recordings for a clip takes well under a second,
+** as only the table entries near the clip's fingerprints are looked at.</p>
+** <h4>EXAMPLE</h4>
+** <pre>libav2yuv -dk monday.ts | yuvfingerprint -n monday.ts -o monday.yfp
+** libav2yuv -dk ad.mpg | yuvfingerprint -q - *.yfp</pre>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+
+#include <yuv4mpeg.h>
+#include <mpegconsts.h>
+#include "utilyuv.h"
+#include "yuvfp.h"
+
+#define VERSION "0.1"
+
+// the clip frames looked up in the tables, the rest are only checked
+#define SEEDS 32
+
+struct clip {
+	uint64_t *hash;
+	int frames;
+	int hashed;
+};
+
+struct place {
+	int offset;
+	int votes;
+	// the seeds' bits apart, the nearest of offsets a frame or two apart is the one
+	int distance;
+};
+
+struct search {
+	struct place *hit;
+	int count, size;
+	int seed;
+};
+
+struct match {
+	int frame;
+	double score;
+};
+
+static void print_usage()
+{
+	fprintf (stderr,
+			 "usage: yuvfingerprint -o file.yfp [-n name] [-c]\n"
+			 "       yuvfingerprint -q clip [-s first] [-l frames] [-r bits] [-p score] [-d] file.yfp ...\n"
+			 "\t fingerprints the frames of recordings and finds clips in them\n"
+			 "\t -o write the fingerprints of the stream on stdin to this file\n"
+			 "\t -n the name of the recording kept in the file\n"
+			 "\t -c copy the stream to stdout\n"
+			 "\t -q find this clip (a y4m file, - for stdin or a .yfp file)\n"
+			 "\t -s first frame of the clip to use [0]\n"
+			 "\t -l number of frames of the clip to use [all]\n"
+			 "\t -r bits two fingerprints may differ by [10, at most %d]\n"
+			 "\t -p fraction of the clip's frames that must match [0.8]\n"
+			 "\t -d use NTSC drop frame timecode\n"
+			 "\t -v Verbosity degree : 0=quiet, 1=normal, 2=verbose/debug\n"
+			 , YUV_FP_MAX_RADIUS);
+}
+
+static void clip_add(struct clip *cl, uint64_t h, int *size)
+{
+	if (cl->frames == *size) {
+		*size = *size ? *size * 2 : 1024;
+		cl->hash = (uint64_t *)realloc(cl->hash, *size * sizeof(uint64_t));
+		if (cl->hash == NULL)
+			mjpeg_error_exit1 ("Could'nt allocate memory for the fingerprints");
+	}
+	cl->hash[cl->frames++] = h;
+	if (h)
+		cl->hashed++;
+}
+
+// fingerprints frames first to first + count of a y4m stream, -1 for all of them
+static void fingerprint_stream(int fdin, int fdout, y4m_stream_info_t *si, struct clip *cl, int first, int count)
+{
+	y4m_frame_info_t fi;
+	uint8_t *yuv_data[3];
+	yuv_fp_t fp;
+	int err, n = 0, size = 0;
+
+	if (yuv_fp_init(&fp, y4m_si_get_plane_width(si, 0), y4m_si_get_plane_height(si, 0)))
+		mjpeg_error_exit1 ("The frames are too small to fingerprint");
+	if (chromalloc(yuv_data, si))
+		mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
+
+	y4m_init_frame_info(&fi);
+	while ((err = yuv_read_frame(fdin, si, &fi, yuv_data)) == Y4M_OK) {
+		if (n >= first && (count < 0 || n < first + count))
+			clip_add(cl, yuv_fp_frame(&fp, yuv_data[0]), &size);
+		if (fdout != -1 && yuv_write_frame(fdout, si, &fi, yuv_data) != Y4M_OK)
+			mjpeg_error_exit1 ("Error writing the output stream");
+		n++;
+		y4m_fini_frame_info(&fi);
+		y4m_init_frame_info(&fi);
+	}
+	if (err != Y4M_ERR_EOF)
+		mjpeg_warn ("Couldn't read frame %d: %s", n, y4m_strerr(err));
+	y4m_fini_frame_info(&fi);
+
+	chromafree(yuv_data);
+	yuv_fp_fini(&fp);
+	mjpeg_info ("%d frames, %d fingerprinted", cl->frames, cl->hashed);
+}
+
+// a clip in a regular file is taken from the mapping, the frames before first aren't read
+static void fingerprint_index(yuv_index_t *yi, struct clip *cl, int first, int count)
+{
+	uint8_t *planes[3];
+	yuv_fp_t fp;
+	int f, size = 0;
+
+	if (yuv_fp_init(&fp, y4m_si_get_plane_width(&yi->si, 0), y4m_si_get_plane_height(&yi->si, 0)))
+		mjpeg_error_exit1 ("The frames are too small to fingerprint");
+
+	for (f = first; f < yi->frames && (count < 0 || f < first + count); f++) {
+		if (yuv_index_frame(yi, f, planes) != Y4M_OK)
+			mjpeg_error_exit1 ("Couldn't read frame %d", f);
+		clip_add(cl, yuv_fp_frame(&fp, planes[0]), &size);
+	}
+
+	yuv_fp_fini(&fp);
+	mjpeg_info ("%d frames, %d fingerprinted", cl->frames, cl->hashed);
+}
+
+static void load_clip(const char *filename, struct clip *cl, int first, int count)
+{
+	y4m_stream_info_t si;
+	yuv_fp_map_t fm;
+	yuv_index_t yi;
+	int fd, f, size = 0;
+
+	memset(cl, 0, sizeof(*cl));
+
+	if (strcmp(filename, "-") && !yuv_fp_open(&fm, filename)) {
+		for (f = first; f < fm.hdr->frames && (count < 0 || f < first + count); f++)
+			clip_add(cl, fm.hash[f], &size);
+		yuv_fp_close(&fm);
+		return;
+	}
+
+	fd = strcmp(filename, "-") ? open(filename, O_RDONLY) : 0;
+	if (fd == -1)
+		mjpeg_error_exit1 ("Cannot open %s", filename);
+	y4m_init_stream_info(&si);
+	if (yuv_read_stream_header(fd, &si) != Y4M_OK)
+		mjpeg_error_exit1 ("%s is neither a y4m stream nor a fingerprint file", filename);
+	if (!yuv_index_fd(&yi, fd, &si)) {
+		fingerprint_index(&yi, cl, first, count);
+		yuv_index_close(&yi);
+	} else {
+		fingerprint_stream(fd, -1, &si, cl, first, count);
+	}
+	y4m_fini_stream_info(&si);
+	if (fd)
+		close(fd);
+}
+
+static void vote(void *arg, int frame, int distance)
+{
+	struct search *s = (struct search *)arg;
+
+	if (s->count == s->size) {
+		s->size = s->size ? s->size * 2 : 256;
+		s->hit = (struct place *)realloc(s->hit, s->size * sizeof(struct place));
+		if (s->hit == NULL)
+			mjpeg_error_exit1 ("Could'nt allocate memory for the search");
+	}
+	s->hit[s->count].offset = frame - s->seed;
+	s->hit[s->count].votes = 1;
+	s->hit[s->count].distance = distance;
+	s->count++;
+}
+
+static int compare_offset(const void *a, const void *b)
+{
+	const struct place *x = (const struct place *)a, *y = (const struct place *)b;
+
+	return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static int compare_votes(const void *a, const void *b)
+{
+	const struct place *x = (const struct place *)a, *y = (const struct place *)b;
+
+	if (x->votes != y->votes)
+		return y->votes - x->votes;
+	if (x->distance != y->distance)
+		return x->distance - y->distance;
+	return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static int compare_frame(const void *a, const void *b)
+{
+	const struct match *x = (const struct match *)a, *y = (const struct match *)b;
+
+	return x->frame < y->frame ? -1 : x->frame > y->frame;
+}
+
+// the fraction of the clip's fingerprinted frames within radius at offset, -1 if too few overlap
+static double verify(const yuv_fp_map_t *fm, const struct clip *cl, int offset, int radius)
+{
+	int i, f, compared = 0, matched = 0;
+
+	for (i = 0; i < cl->frames; i++) {
+		f = offset + i;
+		if (f < 0 || f >= fm->hdr->frames || cl->hash[i] == 0 || fm->hash[f] == 0)
+			continue;
+		compared++;
+		if (yuv_fp_distance(cl->hash[i], fm->hash[f]) <= radius)
+			matched++;
+	}
+	// a clip hanging off the start or end of the recording is still found
+	if (compared == 0 || compared * 2 < cl->hashed)
+		return -1;
+	return (double)matched / compared;
+}
+
+static void print_timecode(y4m_stream_info_t *si, int fc, int df)
+{
+	int tch,tcm,tcs,tcf;
+
+	framecount2timecode(si, &tch,&tcm,&tcs,&tcf, fc, &df);
+	printf ("%02d:%02d:%02d%c%02d",tch,tcm,tcs,df?';':':',tcf);
+}
+
+static int query(const char *filename, const struct clip *cl, int radius, double min_score, int df)
+{
+	yuv_fp_map_t fm;
+	struct search s;
+	struct place *place;
+	struct match *match = NULL;
+	y4m_stream_info_t si;
+	y4m_ratio_t rate;
+	double score;
+	int seeds, step, i, n, k, places = 0, matches = 0, min_votes;
+
+	if (yuv_fp_open(&fm, filename)) {
+		mjpeg_warn ("%s is not a readable fingerprint file", filename);
+		return 0;
+	}
+
+	// seed frames spread evenly through the clip's fingerprinted frames
+	memset(&s, 0, sizeof(s));
+	step = (cl->hashed + SEEDS - 1) / SEEDS;
+	seeds = 0;
+	for (i = 0, n = 0; i < cl->frames; i++) {
+		if (cl->hash[i] == 0)
+			continue;
+		if (n++ % step)
+			continue;
+		s.seed = i;
+		yuv_fp_search(&fm, cl->hash[i], radius, vote, &s);
+		seeds++;
+	}
+
+	// an offset most seeds agree on, at least a quarter of them
+	qsort(s.hit, s.count, sizeof(struct place), compare_offset);
+	place = s.hit;
+	for (i = 0; i < s.count; i = n) {
+		place[places] = s.hit[i];
+		for (n = i + 1; n < s.count && s.hit[n].offset == s.hit[i].offset; n++) {
+			place[places].votes++;
+			place[places].distance += s.hit[n].distance;
+		}
+		places++;
+	}
+	qsort(place, places, sizeof(struct place), compare_votes);
+	min_votes = seeds / 4 > 1 ? seeds / 4 : 1;
+	mjpeg_debug ("%s: %d seeds, %d hits, %d offsets", filename, seeds, s.count, places);
+
+	// the best places first, a place overlapping one already found is the same one
+	for (i = 0; i < places && place[i].votes >= min_votes; i++) {
+		for (k = 0; k < matches; k++)
+			if (abs(match[k].frame - place[i].offset) < cl->frames)
+				break;
+		if (k < matches)
+			continue;
+		score = verify(&fm, cl, place[i].offset, radius);
+		mjpeg_debug ("%s: frame %d, %d votes, score %g", filename, place[i].offset, place[i].votes, score);
+		if (score < min_score)
+			continue;
+		match = (struct match *)realloc(match, (matches + 1) * sizeof(struct match));
+		if (match == NULL)
+			mjpeg_error_exit1 ("Could'nt allocate memory for the search");
+		match[matches].frame = place[i].offset;
+		match[matches].score = score;
+		matches++;
+	}
+	qsort(match, matches, sizeof(struct match), compare_frame);
+
+	y4m_init_stream_info(&si);
+	rate.n = fm.hdr->rate_n;
+	rate.d = fm.hdr->rate_d;
+	// no rate was kept, the frame numbers are still right
+	if (rate.n == 0 || rate.d == 0) {
+		rate.n = 25;
+		rate.d = 1;
+	}
+	y4m_si_set_framerate(&si, rate);
+	for (k = 0; k < matches; k++) {
+		printf ("%.*s %d ", YUV_FP_SOURCE, fm.hdr->source[0] ? fm.hdr->source : filename, match[k].frame);
+		print_timecode(&si, match[k].frame, df);
+		printf (" %.2f\n", match[k].score);
+	}
+	y4m_fini_stream_info(&si);
+
+	free(match);
+	free(s.hit);
+	yuv_fp_close(&fm);
+	return matches;
+}
+
+// *************************************************************************************
+// MAIN
+// *************************************************************************************
+int main (int argc, char *argv[])
+{
+
+	int verbose = 1;
+	int fdIn = 0, fdOut = 1;
+	y4m_stream_info_t in_streaminfo;
+	y4m_ratio_t rate;
+	struct clip cl;
+	char *out_file = NULL, *clip_file = NULL, *name = NULL;
+	int copy = 0, drop_frame = 0, first = 0, count = -1, radius = 10;
+	double min_score = 0.8;
+	int c, found = 0;
+	const static char *legal_flags = "o:n:cq:s:l:r:p:dv:h";
+
+	while ((c = getopt (argc, argv, legal_flags)) != -1) {
+		switch (c) {
+			case 'o':
+				out_file = optarg;
+				break;
+			case 'n':
+				name = optarg;
+				break;
+			case 'c':
+				copy = 1;
+				break;
+			case 'q':
+				clip_file = optarg;
+				break;
+			case 's':
+				first = atoi(optarg);
+				break;
+			case 'l':
+				count = atoi(optarg);
+				break;
+			case 'r':
+				radius = atoi(optarg);
+				if (radius < 0 || radius > YUV_FP_MAX_RADIUS)
+					mjpeg_error_exit1 ("The radius must be [0..%d]", YUV_FP_MAX_RADIUS);
+				break;
+			case 'p':
+				min_score = atof(optarg);
+				break;
+			case 'd':
+				drop_frame = 1;
+				break;
+			case 'v':
+				verbose = atoi (optarg);
+				if (verbose < 0 || verbose > 2)
+					mjpeg_error_exit1 ("Verbose level must be [0..2]");
+				break;
+			case 'h':
+			case '?':
+				print_usage ();
+				return 0 ;
+				break;
+		}
+	}
+
+	if ((out_file == NULL) == (clip_file == NULL) || (out_file && optind != argc) || (clip_file && optind == argc)) {
+		print_usage ();
+		return 0 ;
+	}
+	if (first < 0)
+		first = 0;
+
+	// mjpeg tools global initialisations
+	mjpeg_default_handler_verbosity (verbose);
+
+	if (clip_file) {
+		load_clip(clip_file, &cl, first, count);
+		if (cl.hashed == 0)
+			mjpeg_error_exit1 ("The clip has no frames to look for, they are all flat");
+		for (; optind < argc; optind++)
+			found += query(argv[optind], &cl, radius, min_score, drop_frame);
+		free(cl.hash);
+		return found ? 0 : 1;
+	}
+
+	// Initialize input streams
+	y4m_init_stream_info (&in_streaminfo);
+	if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+		mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
+
+	mjpeg_info ("yuvfingerprint (version " VERSION ") perceptual frame fingerprints");
+	mjpeg_info ("yuvfingerprint -h for help");
+
+	if (copy && yuv_write_stream_header (fdOut, &in_streaminfo) != Y4M_OK)
+		mjpeg_error_exit1 ("Could'nt write YUV4MPEG header!");
+
+	memset(&cl, 0, sizeof(cl));
+	fingerprint_stream(fdIn, copy ? fdOut : -1, &in_streaminfo, &cl, 0, -1);
+
+	rate = y4m_si_get_framerate(&in_streaminfo);
+	if (yuv_fp_write(out_file, name, cl.hash, cl.frames, rate.n, rate.d))
+		mjpeg_error_exit1 ("Error writing %s", out_file);
+
+	free(cl.hash);
+	y4m_fini_stream_info (&in_streaminfo);
+	return 0;
+}
+/*
+ * Local variables:
+ *  tab-width: 8
+ *  indent-tabs-mode: nil
+ * End:
+ */
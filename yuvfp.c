@@ -0,0 +1,355 @@
+/*
+ *  yuvfp.c
+ *    Mark Heath <mjpeg0 at silicontrip.org>
+ *  http://silicontrip.net/~mark/lavtools/
+ *
+ * perceptual frame fingerprints and their search tables
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "yuvfp.h"
+
+// the standard deviation of the 32x32 luma under which a frame is flat
+#define FP_FLAT 1.5
+
+#define FP_CHUNK(h,c) ((uint16_t)((h) >> ((c) * 16)))
+
+int yuv_fp_init(yuv_fp_t *fp, int width, int height)
+{
+	int i, u;
+
+	memset(fp, 0, sizeof(*fp));
+	if (width < YUV_FP_SIZE || height < YUV_FP_SIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+	fp->width = width;
+	fp->height = height;
+	for (i = 0; i <= YUV_FP_SIZE; i++) {
+		fp->x[i] = i * width / YUV_FP_SIZE;
+		fp->y[i] = i * height / YUV_FP_SIZE;
+	}
+
+	// frequencies 1 to 8, the DC term says nothing about the picture
+	for (u = 0; u < 8; u++)
+		for (i = 0; i < YUV_FP_SIZE; i++)
+			fp->cosine[u][i] = cos(M_PI * (2 * i + 1) * (u + 1) / (2 * YUV_FP_SIZE));
+
+	fp->column = (uint32_t *)malloc(width * sizeof(uint32_t));
+	if (fp->column == NULL)
+		return -1;
+	return 0;
+}
+
+void yuv_fp_fini(yuv_fp_t *fp)
+{
+	free(fp->column);
+	fp->column = NULL;
+}
+
+// box averages, a band of rows summed into columns at a time
+static void fp_scale(yuv_fp_t *fp, const uint8_t *luma, float small[YUV_FP_SIZE][YUV_FP_SIZE])
+{
+	const uint8_t *row;
+	uint32_t sum;
+	int i, j, x, y;
+
+	for (j = 0; j < YUV_FP_SIZE; j++) {
+		memset(fp->column, 0, fp->width * sizeof(uint32_t));
+		for (y = fp->y[j]; y < fp->y[j + 1]; y++) {
+			row = luma + (size_t)y * fp->width;
+			for (x = 0; x < fp->width; x++)
+				fp->column[x] += row[x];
+		}
+		for (i = 0; i < YUV_FP_SIZE; i++) {
+			sum = 0;
+			for (x = fp->x[i]; x < fp->x[i + 1]; x++)
+				sum += fp->column[x];
+			small[j][i] = (float)sum / ((fp->x[i + 1] - fp->x[i]) * (fp->y[j + 1] - fp->y[j]));
+		}
+	}
+}
+
+uint64_t yuv_fp_frame(yuv_fp_t *fp, const uint8_t *luma)
+{
+	float small[YUV_FP_SIZE][YUV_FP_SIZE];
+	float row[YUV_FP_SIZE][8];
+	float coef[64], sorted[64], t, median;
+	double sum = 0, sum2 = 0;
+	uint64_t h = 0;
+	int i, j, u, v, k;
+
+	fp_scale(fp, luma, small);
+
+	for (j = 0; j < YUV_FP_SIZE; j++)
+		for (i = 0; i < YUV_FP_SIZE; i++) {
+			sum += small[j][i];
+			sum2 += small[j][i] * small[j][i];
+		}
+	sum /= YUV_FP_SIZE * YUV_FP_SIZE;
+	if (sum2 / (YUV_FP_SIZE * YUV_FP_SIZE) - sum * sum < FP_FLAT * FP_FLAT)
+		return 0;
+
+	// separable, only the low frequencies are worked out
+	for (j = 0; j < YUV_FP_SIZE; j++)
+		for (u = 0; u < 8; u++) {
+			t = 0;
+			for (i = 0; i < YUV_FP_SIZE; i++)
+				t += small[j][i] * fp->cosine[u][i];
+			row[j][u] = t;
+		}
+	for (v = 0; v < 8; v++)
+		for (u = 0; u < 8; u++) {
+			t = 0;
+			for (j = 0; j < YUV_FP_SIZE; j++)
+				t += row[j][u] * fp->cosine[v][j];
+			coef[v * 8 + u] = t;
+		}
+
+	memcpy(sorted, coef, sizeof(coef));
+	for (i = 1; i < 64; i++) {
+		t = sorted[i];
+		for (k = i; k > 0 && sorted[k - 1] > t; k--)
+			sorted[k] = sorted[k - 1];
+		sorted[k] = t;
+	}
+	median = (sorted[31] + sorted[32]) / 2;
+
+	for (k = 0; k < 64; k++)
+		if (coef[k] > median)
+			h |= (uint64_t)1 << k;
+	return h;
+}
+
+static int fp_write_all(int fd, const void *buf, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int yuv_fp_write(const char *filename, const char *source, const uint64_t *hash, int frames, int rate_n, int rate_d)
+{
+	struct yuv_fp_header hdr;
+	uint32_t bucket[YUV_FP_BUCKETS + 1];
+	uint32_t *start, *frame = NULL;
+	int fd, c, f, k, hashed = 0, err;
+
+	for (f = 0; f < frames; f++)
+		if (hash[f])
+			hashed++;
+
+	start = (uint32_t *)calloc(65536 + 1, sizeof(uint32_t));
+	if (hashed)
+		frame = (uint32_t *)malloc(hashed * sizeof(uint32_t));
+	if (start == NULL || (hashed && frame == NULL)) {
+		free(start);
+		return -1;
+	}
+
+	fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		free(start);
+		free(frame);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, YUV_FP_MAGIC, 8);
+	hdr.frames = frames;
+	hdr.hashed = hashed;
+	hdr.rate_n = rate_n;
+	hdr.rate_d = rate_d;
+	if (source)
+		strncpy(hdr.source, source, YUV_FP_SOURCE - 1);
+
+	if (fp_write_all(fd, &hdr, sizeof(hdr)) ||
+		fp_write_all(fd, hash, (size_t)frames * sizeof(uint64_t)))
+		goto fail;
+
+	// a counting sort on each chunk keeps the frames of a chunk value in order
+	for (c = 0; c < YUV_FP_CHUNKS; c++) {
+		memset(start, 0, (65536 + 1) * sizeof(uint32_t));
+		for (f = 0; f < frames; f++)
+			if (hash[f])
+				start[FP_CHUNK(hash[f], c) + 1]++;
+		for (k = 0; k < 65536; k++)
+			start[k + 1] += start[k];
+		for (k = 0; k <= YUV_FP_BUCKETS; k++)
+			bucket[k] = start[k << 8];
+		for (f = 0; f < frames; f++)
+			if (hash[f])
+				frame[start[FP_CHUNK(hash[f], c)]++] = f;
+		if (fp_write_all(fd, bucket, sizeof(bucket)) ||
+			fp_write_all(fd, frame, hashed * sizeof(uint32_t)))
+			goto fail;
+	}
+
+	free(start);
+	free(frame);
+	return close(fd);
+
+fail:
+	err = errno;
+	close(fd);
+	free(start);
+	free(frame);
+	errno = err;
+	return -1;
+}
+
+int yuv_fp_open(yuv_fp_map_t *fm, const char *filename)
+{
+	struct stat st;
+	size_t table;
+	const uint8_t *p;
+	int fd, c;
+
+	memset(fm, 0, sizeof(*fm));
+	fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+	if (st.st_size < sizeof(struct yuv_fp_header)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	fm->length = st.st_size;
+	fm->map = mmap(NULL, fm->length, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (fm->map == MAP_FAILED) {
+		fm->map = NULL;
+		return -1;
+	}
+
+	fm->hdr = (const struct yuv_fp_header *)fm->map;
+	if (memcmp(fm->hdr->magic, YUV_FP_MAGIC, 8) ||
+		fm->hdr->frames < 0 || fm->hdr->hashed < 0 || fm->hdr->hashed > fm->hdr->frames)
+		goto invalid;
+
+	table = (YUV_FP_BUCKETS + 1 + (size_t)fm->hdr->hashed) * sizeof(uint32_t);
+	if (fm->length != sizeof(struct yuv_fp_header) + (size_t)fm->hdr->frames * sizeof(uint64_t) + YUV_FP_CHUNKS * table)
+		goto invalid;
+
+	fm->hash = (const uint64_t *)(fm->map + sizeof(struct yuv_fp_header));
+	p = (const uint8_t *)(fm->hash + fm->hdr->frames);
+	for (c = 0; c < YUV_FP_CHUNKS; c++) {
+		fm->bucket[c] = (const uint32_t *)p;
+		fm->frame[c] = fm->bucket[c] + YUV_FP_BUCKETS + 1;
+		if (fm->bucket[c][YUV_FP_BUCKETS] != fm->hdr->hashed)
+			goto invalid;
+		p += table;
+	}
+	return 0;
+
+invalid:
+	yuv_fp_close(fm);
+	errno = EINVAL;
+	return -1;
+}
+
+// every chunk value within s bits of key
+static int fp_variants(uint16_t *out, int n, uint16_t key, int from, int s)
+{
+	int b;
+
+	out[n++] = key;
+	if (s > 0)
+		for (b = from; b < 16; b++)
+			n = fp_variants(out, n, key ^ (1 << b), b + 1, s - 1);
+	return n;
+}
+
+int yuv_fp_search(const yuv_fp_map_t *fm, uint64_t h, int radius,
+				  void (*fn)(void *arg, int frame, int distance), void *arg)
+{
+	// 1 + 16 + 120 + 560 chunk values are within 3 bits
+	uint16_t key[697];
+	const uint32_t *frame;
+	uint32_t lo, hi, mid, f;
+	int s, c, e, k, keys, d, found = 0;
+
+	if (radius < 0 || radius > YUV_FP_MAX_RADIUS || h == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	s = radius / YUV_FP_CHUNKS;
+
+	for (c = 0; c < YUV_FP_CHUNKS; c++) {
+		frame = fm->frame[c];
+		keys = fp_variants(key, 0, FP_CHUNK(h, c), 0, s);
+		for (k = 0; k < keys; k++) {
+			// the frames of a top byte are sorted by the whole chunk
+			lo = fm->bucket[c][key[k] >> 8];
+			hi = fm->bucket[c][(key[k] >> 8) + 1];
+			while (lo < hi) {
+				mid = lo + (hi - lo) / 2;
+				if (FP_CHUNK(fm->hash[frame[mid]], c) < key[k])
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			for (; lo < fm->hdr->hashed && FP_CHUNK(fm->hash[frame[lo]], c) == key[k]; lo++) {
+				f = frame[lo];
+				d = yuv_fp_distance(fm->hash[f], h);
+				if (d > radius)
+					continue;
+				// an earlier chunk has already found it
+				for (e = 0; e < c; e++)
+					if (__builtin_popcount(FP_CHUNK(fm->hash[f], e) ^ FP_CHUNK(h, e)) <= s)
+						break;
+				if (e < c)
+					continue;
+				fn(arg, f, d);
+				found++;
+			}
+		}
+	}
+	return found;
+}
+
+void yuv_fp_close(yuv_fp_map_t *fm)
+{
+	if (fm->map)
+		munmap(fm->map, fm->length);
+	fm->map = NULL;
+}
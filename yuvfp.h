@@ -0,0 +1,94 @@
+#ifndef _YUVFP_H_
+#define _YUVFP_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+** Perceptual fingerprints of frames, and a file of them for a recording
+** that can be searched for the frames of a clip.
+**
+** The luma is scaled to 32x32 and the 8x8 lowest frequencies of its DCT,
+** without the first row and column, give a 64 bit hash: a bit for each
+** coefficient over the median.  Frames that look alike have hashes a few
+** bits apart, whatever the noise, scaling or encoding of the recording.
+** A flat frame (black, a test card colour) has no fingerprint, its hash
+** is 0.
+**
+** A fingerprint file (.yfp) is a header, the hash of every frame, then a
+** multi-index hash table: the hash split into YUV_FP_CHUNKS chunks of 16
+** bits and for each chunk the frame numbers sorted by it, with the start
+** of every YUV_FP_BUCKETS value of the chunk's top byte.  A hash within r
+** bits of another is within r / YUV_FP_CHUNKS bits of it in one chunk at
+** least, so yuv_fp_search() only looks up the chunk values that close
+** and checks the frames it finds there.
+** Values are in the byte order of the machine that wrote them.
+**
+** Nothing is logged, the functions return -1 with errno set.
+*/
+
+#define YUV_FP_MAGIC "YUVFP1\n"
+#define YUV_FP_SIZE 32
+#define YUV_FP_CHUNKS 4
+#define YUV_FP_BUCKETS 256
+// chunks are searched at most 3 bits out
+#define YUV_FP_MAX_RADIUS (YUV_FP_CHUNKS * 4 - 1)
+#define YUV_FP_SOURCE 256
+
+struct yuv_fp_header {
+	char magic[8];
+	int32_t frames;
+	// frames with a fingerprint, in each chunk's table
+	int32_t hashed;
+	int32_t rate_n;
+	int32_t rate_d;
+	// the recording the fingerprints are of
+	char source[YUV_FP_SOURCE];
+};
+
+typedef struct {
+	int width, height;
+	// the edges of the boxes averaged into the 32x32 luma
+	int x[YUV_FP_SIZE + 1];
+	int y[YUV_FP_SIZE + 1];
+	uint32_t *column;
+	float cosine[8][YUV_FP_SIZE];
+} yuv_fp_t;
+
+int yuv_fp_init(yuv_fp_t *fp, int width, int height);
+// the fingerprint of a luma plane width bytes a row, 0 if it is flat
+uint64_t yuv_fp_frame(yuv_fp_t *fp, const uint8_t *luma);
+void yuv_fp_fini(yuv_fp_t *fp);
+
+static inline int yuv_fp_distance(uint64_t a, uint64_t b)
+{
+	return __builtin_popcountll(a ^ b);
+}
+
+// writes the fingerprints of a recording and its tables
+int yuv_fp_write(const char *filename, const char *source, const uint64_t *hash, int frames, int rate_n, int rate_d);
+
+typedef struct {
+	uint8_t *map;
+	size_t length;
+	const struct yuv_fp_header *hdr;
+	const uint64_t *hash;
+	const uint32_t *bucket[YUV_FP_CHUNKS];
+	const uint32_t *frame[YUV_FP_CHUNKS];
+} yuv_fp_map_t;
+
+int yuv_fp_open(yuv_fp_map_t *fm, const char *filename);
+// calls fn once for every frame within radius bits of h, returns how many
+int yuv_fp_search(const yuv_fp_map_t *fm, uint64_t h, int radius,
+				  void (*fn)(void *arg, int frame, int distance), void *arg);
+void yuv_fp_close(yuv_fp_map_t *fm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
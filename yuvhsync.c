@@ -2,6 +2,14 @@
   *  yuvhsync.c
 ** <p>attempts to align horizontal sync drift.
 ** work in progress </p>
+** <p>By default the shift of a line is where the picture starts after the
+** black of the sync.  -c finds the shift that best matches the line two
+** below instead, first on lines decimated by 4 and then at full resolution
+** around the best of those.  -p starts each line from the shift it had in
+** the previous frame and only searches the whole range when the match there
+** is worse than the last full search found.  The lines of a frame are
+** searched and shifted on a band of threads, YUV_THREADS sets how many.</p>
+** <p>EXAMPLE <tt>yuvhsync -c -p -m 64 -s 640 &lt; capture.y4m &gt; tbc.y4m</tt></p>
   *
   *  modified from yuvadjust.c by
   *  Copyright (C) 2010 Mark Heath
@@ -29,11 +37,30 @@
 #include <unistd.h>
 #include <signal.h>
 #include <string.h>
+#include <limits.h>
 #include <math.h>
 
 #include <yuv4mpeg.h>
 #include <mpegconsts.h>
 #include "utilyuv.h"
+#include "yuvbands.h"
+
+// the coarse search works on averages of this many pixels
+#define DECIMATE 4
+// how far either side of the previous frame's shift is searched with -p
+#define REUSE_RANGE 2
+
+struct hsync {
+	int w, h;
+	int max, search;
+	int correlate, reuse;
+	y4m_stream_info_t *si;
+	uint8_t **yuv_data;
+	// the shift of each line, and the match of the last full search for -p
+	int *lineresult;
+	unsigned int *linesad;
+	int have_prev;
+};
 
 static void print_usage()
 {
@@ -43,83 +70,53 @@ static void print_usage()
            "-v\tVerbosity degree : 0=quiet, 1=normal, 2=verbose/debug\n"
            "-m\tMaximum number of pixels to shift\n"
            "-s\tCompare this number of pixels when determining shift\n"
+           "-c\tFind the shift by matching each line with the line below\n"
+           "-p\tStart from the previous frame's shift of each line (with -c)\n"
            "-n\tDo not shift video\n"
 		);
 }
 
+static void shift_row(uint8_t *row, int w, int s, uint8_t fill)
+{
+	if (s >= w || -s >= w) {
+		memset(row, fill, w);
+	} else if (s > 0) {
+		memmove(row + s, row, w - s);
+		memset(row, fill, s);
+	} else if (s < 0) {
+		memmove(row, row - s, w + s);
+		memset(row + w + s, fill, -s);
+	}
+}
+
 void shift_video (int s, int line, uint8_t *yuv_data[3],y4m_stream_info_t *sinfo)
 {
 
-	int x,w,cw,cs;
+	int w,cw,cs;
 	int vss;
-    int linew,linecw;
-
-//	mjpeg_debug("shift_video %d %d",s,line);
-
 
-		w = y4m_si_get_plane_width(sinfo,0);
-		cw = y4m_si_get_plane_width(sinfo,1);
-
-		vss = y4m_si_get_plane_height(sinfo,0) / y4m_si_get_plane_height(sinfo,1);
-
-		cs = s * cw / w;
-
-    linew = line * w;
-    linecw = line * cw;
-	// could memcpy() do this?
-		if (s>0) {
-			for (x=w-1; x>=0; x--)
-                if (x>=s)
-                    *(yuv_data[0]+x+(linew))= *(yuv_data[0]+(x-s)+(linew));
-                else
-                    *(yuv_data[0]+x+(linew))= 16;
+	w = y4m_si_get_plane_width(sinfo,0);
+	cw = y4m_si_get_plane_width(sinfo,1);
 
-		// one day I should start catering for more or less than 3 planes.
-            // have to take proper interlace chroma into account.
-            // would be easier to work with 422 or 444
+	vss = y4m_si_get_plane_height(sinfo,0) / y4m_si_get_plane_height(sinfo,1);
 
-			if (line % vss) {
-				for (x=cw; x>=0; x--) {
-                    if (x>=cs) {
-                        *(yuv_data[1]+x+linecw)= *(yuv_data[1]+(x-cs)+linecw);
-                        *(yuv_data[2]+x+linecw)= *(yuv_data[2]+(x-cs)+linecw);
-                    } else {
-                        *(yuv_data[1]+x+linecw)= 128;
-                        *(yuv_data[2]+x+linecw)= 128;
-                    }
-				}
-			}
-		}
-		if (s<0) {
-			for (x=0; x<=w; x++)
-                    if (x-s < w)
-                        *(yuv_data[0]+x+(linew))= *(yuv_data[0]+(x-s)+(linew));
-                    else
-                        *(yuv_data[0]+x+linew)=16;
-
-			// one day I should start catering for more or less than 3 planes.
-			if (line % vss) {
-				for (x=0; x<=cw; x++) {
-                    if (x-cs<=cw) {
-                        *(yuv_data[1]+x+(linecw))= *(yuv_data[1]+(x-cs)+(linecw));
-                        *(yuv_data[2]+x+(linecw))= *(yuv_data[2]+(x-cs)+(linecw));
-                    } else {
-                        *(yuv_data[1]+x+(linecw))= 128;
-                        *(yuv_data[2]+x+(linecw))= 128;
-                    }
-				}
-			}
+	cs = s * cw / w;
 
-		}
-//	mjpeg_debug("exit shift_video %d %d",s,line);
+	shift_row(yuv_data[0] + line * w, w, s, 16);
 
+	// the last luma line of a chroma line moves it
+	// have to take proper interlace chroma into account.
+	if (line % vss == vss - 1) {
+		shift_row(yuv_data[1] + line / vss * cw, cw, cs, 128);
+		shift_row(yuv_data[2] + line / vss * cw, cw, cs, 128);
+	}
 }
 
 int search_video (int m, int s, int line, uint8_t *yuv_data[3],y4m_stream_info_t *sinfo)
 {
 
-	int w,x1,diff;
-	int max,c=0,linew;
+	int w,x1;
+	int linew;
 
 	w = y4m_si_get_plane_width(sinfo,0);
 
@@ -144,127 +141,181 @@ int search_video (int m, int s, int line, uint8_t *yuv_data[3],y4m_stream_info_t
         }
     }
      */
-	//	fprintf(stderr," %d",diff);
-
-//	fprintf (stderr,"\n");
 	return 0;
 }
 
-// this method isn't too effective
-int search_video_1 (int m, int s, int line, uint8_t *yuv_data[3],y4m_stream_info_t *sinfo)
+// a[x1 + x] against b[x] for x = 0 .. s-1, pixels outside the line cost 128
+static unsigned int line_sad(const uint8_t *a, const uint8_t *b, int w, int x1, int s)
 {
+	int lo, hi;
 
-	int w,h;
-	int x1,x2;
-	int min,shift,tot;
-	int linew, line1w;
+	lo = x1 < 0 ? -x1 : 0;
+	hi = x1 + s > w ? w - x1 : s;
+	if (hi <= lo)
+		return 128 * s;
 
-    int ilace = y4m_si_get_interlace(sinfo);
+	return yuv_kernel.sad(a + x1 + lo, b + lo, hi - lo) + 128 * (s - (hi - lo));
+}
 
-	w = y4m_si_get_plane_width(sinfo,0);
-	h = y4m_si_get_plane_height(sinfo,0);
+// best of the shifts from .. to, a tie goes to the smaller shift
+static void scan_shifts(const uint8_t *a, const uint8_t *b, int w, int s, int from, int to, int *shift, unsigned int *sad)
+{
+	unsigned int tot;
+	int x1;
+
+	for (x1=from; x1<=to; x1++) {
+		tot = line_sad(a, b, w, x1, s);
+		if (tot < *sad || (tot == *sad && abs(x1) < abs(*shift))) {
+			*sad = tot;
+			*shift = x1;
+		}
+	}
+}
 
-	linew = line * w;
+static void decimate(uint8_t *d, const uint8_t *s, int len)
+{
+	int x;
 
-    if (ilace == Y4M_ILACE_NONE)
-        line1w = (line+1) * w ;
-    else
-        line1w = (line+2) * w;
+	for (x=0; x<len; x++, s+=DECIMATE)
+		d[x] = (s[0] + s[1] + s[2] + s[3] + 2) >> 2;
+}
 
-    line1w = (line+2) * w;
+// the shift in [-m, m) that best matches the line with the one 2 below it
+// da and db hold the decimated lines, w / DECIMATE pixels each
+static int search_video_sad (struct hsync *this, int line, uint8_t *da, uint8_t *db)
+{
+	const uint8_t *a, *b;
+	unsigned int sad = UINT_MAX;
+	int w = this->w, m = this->max, s = this->search;
+	int shift = 0, coarse = 0, dw, from, to;
 
+	// 2 or 1 dependent on interlace or not.
+	if (line + 2 >= this->h)
+		return 0;
 
-	mjpeg_debug("search_video %d",line);
+	a = this->yuv_data[0] + line * w;
+	b = this->yuv_data[0] + (line + 2) * w;
+
+	if (this->reuse && this->have_prev) {
+		from = this->lineresult[line] - REUSE_RANGE;
+		to = this->lineresult[line] + REUSE_RANGE;
+		scan_shifts(a, b, w, s, from < -m ? -m : from, to > m - 1 ? m - 1 : to, &shift, &sad);
+		// no worse than the last full search, give or take a level a pixel
+		if (sad <= this->linesad[line] + this->linesad[line] / 8 + s)
+			return shift;
+		sad = UINT_MAX;
+		shift = 0;
+	}
 
-    // 2 or 1 dependent on interlace or not.
-	if (line+2 > h) {
-		mjpeg_warn("line > height");
-		return 0;
+	if (m >= 2 * DECIMATE && s >= 2 * DECIMATE) {
+		dw = w / DECIMATE;
+		decimate(da, a, dw);
+		decimate(db, b, dw);
+		scan_shifts(da, db, dw, s / DECIMATE, -m / DECIMATE, (m - 1) / DECIMATE, &coarse, &sad);
+
+		from = coarse * DECIMATE - (DECIMATE - 1);
+		to = coarse * DECIMATE + (DECIMATE - 1);
+		sad = UINT_MAX;
+		scan_shifts(a, b, w, s, from < -m ? -m : from, to > m - 1 ? m - 1 : to, &shift, &sad);
+	} else {
+		scan_shifts(a, b, w, s, -m, m - 1, &shift, &sad);
 	}
 
-	shift = 0;
-	for (x1=-m;x1<m;x1++)
-	{
-		tot = 0;
-		for(x2=0; x2<s;x2++)
-		{
-			// don't know if I should apply a standard addition to pixels outside the box.
-			if (x1+x2 >=0 && x1+x2 < w)
-				tot += abs ( *(yuv_data[0]+x1+x2+linew) - *(yuv_data[0]+x2+line1w));
-			else
-				tot += 128;
-		}
+	this->linesad[line] = sad;
+	return shift;
+}
 
-		// ok it wasn't max afterall, it was min.
-		if (x1==0) min = tot;
-		if (tot < min) { min = tot; shift = x1;}
-	}
+// the lines are all searched before any are shifted, each uses the one below
+static void search_band(void *arg, int first, int last)
+{
+	struct hsync *this = arg;
+	uint8_t *da, *db;
+	int y;
+
+	da = (uint8_t *)malloc(this->w / DECIMATE + 1);
+	db = (uint8_t *)malloc(this->w / DECIMATE + 1);
+	if (!da || !db)
+		mjpeg_error_exit1 ("Could'nt allocate memory for the search lines");
+
+	for (y=first; y<last; y++)
+		if (this->correlate)
+			this->lineresult[y] = search_video_sad(this, y, da, db);
+		else
+			this->lineresult[y] = search_video(this->max, this->search, y, this->yuv_data, this->si);
+
+	free(da);
+	free(db);
+}
 
-	mjpeg_debug("exit search_video %d",line);
+static void shift_band(void *arg, int first, int last)
+{
+	struct hsync *this = arg;
+	int y;
 
-	return shift;
+	for (y=first; y<last; y++)
+		shift_video(-this->lineresult[y], y, this->yuv_data, this->si);
 }
 
 static void process(  int fdIn , y4m_stream_info_t  *inStrInfo,
 	int fdOut, y4m_stream_info_t  *outStrInfo,
-	int max,int search, int noshift)
+	int max,int search, int noshift, int correlate, int reuse)
 {
 	y4m_frame_info_t   in_frame ;
-	uint8_t            *yuv_data[3],*yuv_odata[3];
-	// int result[720]; // will change to malloc based on max shift
-	int *lineresult;
-	int                y_frame_data_size, uv_frame_data_size ;
+	uint8_t            *yuv_data[3];
+	struct hsync       hs;
 	int                read_error_code  = Y4M_OK;
 	int                write_error_code = Y4M_OK ;
-	int                src_frame_counter ;
-	int x,y,w,h,cw,ch;
+	int x;
 
-	h = y4m_si_get_plane_height(inStrInfo,0);
-	ch = y4m_si_get_plane_height(inStrInfo,1);
+	hs.h = y4m_si_get_plane_height(inStrInfo,0);
+	hs.w = y4m_si_get_plane_width(inStrInfo,0);
+	hs.max = max > hs.w ? hs.w : max;
+	hs.search = search < 1 || search > hs.w ? hs.w : search;
+	hs.correlate = correlate;
+	hs.reuse = reuse;
+	hs.have_prev = 0;
+	hs.si = inStrInfo;
+	hs.yuv_data = yuv_data;
 
-    lineresult = (int *) malloc(sizeof(int) * h);
+	hs.lineresult = (int *) calloc(hs.h, sizeof(int));
+	hs.linesad = (unsigned int *) calloc(hs.h, sizeof(unsigned int));
 
-	chromalloc(yuv_data,inStrInfo);
+	if (!hs.lineresult || !hs.linesad || chromalloc(yuv_data,inStrInfo))
+		mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
 
 // initialise and read the first number of frames
 	y4m_init_frame_info( &in_frame );
-	read_error_code = y4m_read_frame(fdIn,inStrInfo,&in_frame,yuv_data );
+	read_error_code = yuv_read_frame(fdIn,inStrInfo,&in_frame,yuv_data );
 
 	while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
-		for (y=0; y<h-1; y++)
-			lineresult[y] = search_video(max,search,y,yuv_data,inStrInfo);
-
-
-        if (noshift) {
-			/* graphing this would be nice */
-			for (x=0; x < h; x++) {
-                if (x!=0) printf(", ");
-				printf ("%d",lineresult[x]);
-            }
-			printf("\n");
-
-        } else {
-
-            int shifter = 0;
-            for (y=0; y<h-1; y++) {
-               // shifter += lineresult[y];
-                shifter = -lineresult[y];
-                shift_video(shifter,y,yuv_data,inStrInfo);
+		if (read_error_code == Y4M_OK) {
+			yuv_bands(search_band, &hs, hs.h - 1);
+			hs.have_prev = 1;
+
+			if (noshift) {
+				/* graphing this would be nice */
+				for (x=0; x < hs.h; x++) {
+					if (x!=0) printf(", ");
+					printf ("%d",hs.lineresult[x]);
+				}
+				printf("\n");
 
-            }
-            write_error_code = y4m_write_frame( fdOut, outStrInfo, &in_frame, yuv_data );
-        }
+			} else {
+				yuv_bands(shift_band, &hs, hs.h - 1);
+				write_error_code = yuv_write_frame( fdOut, outStrInfo, &in_frame, yuv_data );
+			}
+		}
 		y4m_fini_frame_info( &in_frame );
 		y4m_init_frame_info( &in_frame );
-		read_error_code = y4m_read_frame(fdIn,inStrInfo,&in_frame,yuv_data );
-		++src_frame_counter ;
+		read_error_code = yuv_read_frame(fdIn,inStrInfo,&in_frame,yuv_data );
 	}
 
   // Clean-up regardless an error happened or not
 
     y4m_fini_frame_info( &in_frame );
 
-    free (lineresult);
+    free (hs.lineresult);
+    free (hs.linesad);
     chromafree(yuv_data);
 
   if( read_error_code != Y4M_ERR_EOF )
@@ -281,15 +332,12 @@ int main (int argc, char *argv[])
 {
 
 	int verbose = 1 ; // LOG_ERROR ?
-	int drop_frames = 0;
 	int fdIn = 0 ;
 	int fdOut = 1 ;
 	y4m_stream_info_t in_streaminfo,out_streaminfo;
-	int src_interlacing = Y4M_UNKNOWN;
-	y4m_ratio_t src_frame_rate;
-	const static char *legal_flags = "v:m:s:n";
+	const static char *legal_flags = "v:m:s:ncp";
 	int max_shift = 0, search = 0;
-    int noshift=0;
+    int noshift=0, correlate=0, reuse=0;
 	int c;
 
   while ((c = getopt (argc, argv, legal_flags)) != -1) {
@@ -308,6 +356,12 @@ int main (int argc, char *argv[])
     case 'n':
             noshift=1;
             break;
+    case 'c':
+            correlate=1;
+            break;
+    case 'p':
+            reuse=1;
+            break;
 	case '?':
           print_usage (argv);
           return 0 ;
@@ -328,10 +382,9 @@ int main (int argc, char *argv[])
   // The streaminfo structure is filled in
   // ***************************************************************
   // INPUT comes from stdin, we check for a correct file header
-	if (y4m_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+	if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
 		mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
 
-	src_frame_rate = y4m_si_get_framerate( &in_streaminfo );
 	y4m_copy_stream_info( &out_streaminfo, &in_streaminfo );
 
 
@@ -339,9 +392,9 @@ int main (int argc, char *argv[])
 
   /* in that function we do all the important work */
     if (!noshift)
-        y4m_write_stream_header(fdOut,&out_streaminfo);
+        yuv_write_stream_header(fdOut,&out_streaminfo);
 
-	process( fdIn,&in_streaminfo,fdOut,&out_streaminfo,max_shift,search,noshift);
+	process( fdIn,&in_streaminfo,fdOut,&out_streaminfo,max_shift,search,noshift,correlate,reuse);
 
   y4m_fini_stream_info (&in_streaminfo);
   y4m_fini_stream_info (&out_streaminfo);
@@ -0,0 +1,110 @@
+/*
+ *  yuvindex.c
+ *    Mark Heath <mjpeg0 at silicontrip.org>
+ *  http://silicontrip.net/~mark/lavtools/
+ *
+** <h3>y4m frame index</h3>
+** <p>Writes a sidecar index of frame offsets (file.y4m.y4mi) for each y4m file
+** given.  Tools that read y4m files randomly map the file and use the index
+** instead of walking every FRAME line: yuvdiff reference frames, the input
+** of yuvparallel, and when it is a regular file, yuvwater's input and a
+** yuvfingerprint -q clip.  The other tools read their input in order and
+** don't use it.  The index is ignored if the file has changed since it was
+** written.</p>
+** <h4>EXAMPLE</h4>
+** <pre>yuvindex capture.y4m
+** yuvdiff -g capture.y4m:1500 &lt; capture.y4m &gt; match.txt</pre>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <yuv4mpeg.h>
+#include <mpegconsts.h>
+#include "utilyuv.h"
+
+#define VERSION "0.1"
+
+static void print_usage()
+{
+	fprintf (stderr,
+			 "usage: yuvindex [-v 0..2] file.y4m ...\n"
+			 "\t writes file.y4m.y4mi, an index of the frame offsets\n"
+			 "\t -v Verbosity degree : 0=quiet, 1=normal, 2=verbose/debug\n"
+			 );
+}
+
+// *************************************************************************************
+// MAIN
+// *************************************************************************************
+int main (int argc, char *argv[])
+{
+
+	int verbose = 1;
+	yuv_index_t yi;
+	int c, err = 0;
+	const static char *legal_flags = "v:h";
+
+	while ((c = getopt (argc, argv, legal_flags)) != -1) {
+		switch (c) {
+			case 'v':
+				verbose = atoi (optarg);
+				if (verbose < 0 || verbose > 2)
+					mjpeg_error_exit1 ("Verbose level must be [0..2]");
+				break;
+			case 'h':
+			case '?':
+				print_usage ();
+				return 0 ;
+				break;
+		}
+	}
+
+	if (optind >= argc) {
+		print_usage ();
+		return 0 ;
+	}
+
+	// mjpeg tools global initialisations
+	mjpeg_default_handler_verbosity (verbose);
+
+	for (; optind < argc; optind++) {
+		if (yuv_index_open(&yi, argv[optind])) {
+			mjpeg_warn ("%s is not a readable y4m file", argv[optind]);
+			err = 1;
+			continue;
+		}
+		if (yuv_index_write(&yi, argv[optind])) {
+			mjpeg_warn ("Cannot write the index for %s", argv[optind]);
+			err = 1;
+		} else {
+			mjpeg_info ("%s: %d frames", argv[optind], yi.frames);
+		}
+		yuv_index_close(&yi);
+	}
+
+	return err;
+}
+/*
+ * Local variables:
+ *  tab-width: 8
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -813,7 +813,7 @@ static void deinterlace(int fdIn,
 	write_error_code = Y4M_OK ;
 
 	y4m_init_frame_info( &in_frame );
-	read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+	read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
 
 	while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
 
@@ -832,20 +832,20 @@ static void deinterlace(int fdIn,
 
 
 			if (getMark() == 3 || getMark() == 1 || getMark() == 5) {
-				write_error_code = y4m_write_frame( fdOut, outStrInfo, &in_frame, yuv_bdata );
+				write_error_code = yuv_write_frame( fdOut, outStrInfo, &in_frame, yuv_bdata );
 			} else if (interlaced == Y4M_ILACE_TOP_FIRST) {
-				write_error_code = y4m_write_frame( fdOut, outStrInfo, &in_frame, yuv_tdata );
-				write_error_code = y4m_write_frame( fdOut, outStrInfo, &in_frame, yuv_bdata );
+				write_error_code = yuv_write_frame( fdOut, outStrInfo, &in_frame, yuv_tdata );
+				write_error_code = yuv_write_frame( fdOut, outStrInfo, &in_frame, yuv_bdata );
 			} else {
-				write_error_code = y4m_write_frame( fdOut, outStrInfo, &in_frame, yuv_bdata );
-				write_error_code = y4m_write_frame( fdOut, outStrInfo, &in_frame, yuv_tdata );
+				write_error_code = yuv_write_frame( fdOut, outStrInfo, &in_frame, yuv_bdata );
+				write_error_code = yuv_write_frame( fdOut, outStrInfo, &in_frame, yuv_tdata );
 			}
 
 		}
 
 		y4m_fini_frame_info( &in_frame );
 		y4m_init_frame_info( &in_frame );
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+		read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
 	}
 	// Clean-up regardless an error happened or not
 	y4m_fini_frame_info( &in_frame );
@@ -906,16 +906,16 @@ static void depro(  int fdIn
 	y4m_init_frame_info( &in_frame );
 
 	if (interlaced == Y4M_ILACE_BOTTOM_FIRST ) {
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_o2data );
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_o1data );
+		read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_o2data );
+		read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_o1data );
 	} else if (interlaced == Y4M_ILACE_TOP_FIRST) {
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_o1data );
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_o2data );
+		read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_o1data );
+		read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_o2data );
 	} else {
 		mjpeg_warn ("Cannot determine interlace order (assuming top first)\n");
 		/* assume top first */
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_o1data );
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_o2data );
+		read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_o1data );
+		read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_o2data );
 	}
 
 
@@ -970,18 +970,18 @@ static void depro(  int fdIn
 				}
 			}
 
-			write_error_code = y4m_write_frame( fdOut, outStrInfo, &in_frame, yuv_data );
+			write_error_code = yuv_write_frame( fdOut, outStrInfo, &in_frame, yuv_data );
 
 		}
 
 		y4m_fini_frame_info( &in_frame );
 		y4m_init_frame_info( &in_frame );
 		if (interlaced == Y4M_ILACE_BOTTOM_FIRST ) {
-			read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_o2data );
-			read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_o1data );
+			read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_o2data );
+			read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_o1data );
 		} else {
-			read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_o1data );
-			read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_o2data );
+			read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_o1data );
+			read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_o2data );
 		}
 	}
 
@@ -1077,7 +1077,7 @@ int main (int argc, char *argv[])
 	// The streaminfo structure is filled in
 	// ***************************************************************
 	// INPUT comes from stdin, we check for a correct file header
-	if (y4m_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+	if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
 		mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
 
 	// Check input parameters
@@ -1138,7 +1138,7 @@ int main (int argc, char *argv[])
 	y4m_si_set_framerate( &out_streaminfo, frame_rate );
 	y4m_si_set_height (&out_streaminfo, height);
 	y4m_si_set_interlace(&out_streaminfo, interlaced);
-	y4m_write_stream_header(fdOut,&out_streaminfo);
+	yuv_write_stream_header(fdOut,&out_streaminfo);
 
 	/* in that function we do all the important work */
 	if (getMark() != 4)
@@ -884,7 +884,7 @@ static void filter(int fdIn, int fdOut, y4m_stream_info_t  *inStrInfo )
 	write_error_code = Y4M_OK ;
 
 	y4m_init_frame_info( &in_frame );
-	read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+	read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
 
 	while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
 
@@ -903,12 +903,12 @@ static void filter(int fdIn, int fdOut, y4m_stream_info_t  *inStrInfo )
 				filterframeNL(yuv_odata,yuv_data,inStrInfo);
 			}
 			 */
-			write_error_code = y4m_write_frame( fdOut, inStrInfo, &in_frame, yuv_odata );
+			write_error_code = yuv_write_frame( fdOut, inStrInfo, &in_frame, yuv_odata );
 		}
 
 		y4m_fini_frame_info( &in_frame );
 		y4m_init_frame_info( &in_frame );
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+		read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
 	}
 	// Clean-up regardless an error happened or not
 	y4m_fini_frame_info( &in_frame );
@@ -1008,7 +1008,7 @@ int main (int argc, char *argv[])
 	// The streaminfo structure is filled in
 	// ***************************************************************
 	// INPUT comes from stdin, we check for a correct file header
-	if (y4m_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+	if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
 		mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
 
 	// Information output
@@ -1024,7 +1024,7 @@ int main (int argc, char *argv[])
 	this.fSigma = sigma;
 	this.fFiltPar = filtpar;
 
-	y4m_write_stream_header(fdOut,&in_streaminfo);
+	yuv_write_stream_header(fdOut,&in_streaminfo);
 	filter(fdIn,fdOut, &in_streaminfo);
 	y4m_fini_stream_info (&in_streaminfo);
 	filteruninitialize();
@@ -3,6 +3,15 @@
  * This program takes a horizontal and vertically scrolling video. (say a view of a map from a computer game)
  * And attempts to assemble it into a single large image.  Uses the opencv2 library. http://http://opencv.org
  *
+ * The movement between frames is found by phase correlation on a pyramid, the
+ * whole shift on the smallest level then only what is left of it at full
+ * resolution, on the part of the two frames that overlap.  The picture is
+ * kept in tiles which are made when first painted, only the most recently
+ * used are kept in memory and the rest are spooled to $TMPDIR, so there is
+ * no limit to how far the capture can scroll.  The result is written as a
+ * PGM one row of tiles at a time.
+ *
+ * usage: yuvopencv [-o out.pgm] [-l levels] [-t tile size] [-m tiles in memory] < scroll.y4m
  *
  * Mark Heath
  * http://github.com/silicontrip/lavtools/
@@ -28,149 +37,362 @@
 #include <yuv4mpeg.h>
 #include <mpegconsts.h>
 #include <string.h>
-#include "libav2yuv/Libyuv.h"
-#include "libav2yuv/AVException.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include "Libyuv.h"
+#include "AVException.h"
 
 
 #include <vector>
+#include <list>
+#include <map>
+#include <string>
 #include <stdio.h>
 #include <opencv2/opencv.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
-#define IMAGEDIM 7200
 #define CROP 32
+#define TILE_SIZE 512
+#define TILES_IN_MEMORY 64
+// the smallest pyramid level is kept at least this big
+#define PYRAMID_MIN 64
+// an overlap smaller than this is not worth refining
+#define REFINE_MIN 32
 
 using namespace cv;
 using namespace std;
 
-
-int main (int argc, char **argv)
+static void print_usage()
 {
+    fprintf (stderr,
+             "usage: yuvopencv [-o <file>] [-l <levels>] [-t <size>] [-m <tiles>] < scroll.y4m\n"
+             "\t -o <file> write the assembled picture to this PGM (default out.pgm)\n"
+             "\t -l <levels> pyramid levels for the coarse search (default as many as fit)\n"
+             "\t -t <size> canvas tile size (default %d)\n"
+             "\t -m <tiles> tiles kept in memory, the rest are spooled to $TMPDIR (default %d)\n",
+             TILE_SIZE, TILES_IN_MEMORY);
+}
+
+static int floor_div(int a, int b)
+{
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
 
-    Mat image;
-    Libyuv iyuv,oyuv;
-    int y;
-    iyuv.setExtensions(1);
-    oyuv.setExtensions(1);
-
-    Mat img1, img2, imgout;
-
-    try {
-
-        iyuv.readHeader();
-        iyuv.dumpInfo();
-        // copy from in to out.
-        oyuv.copyStreamInfo(&iyuv);
+class TileCanvas
+{
+public:
+    TileCanvas(int size, int resident) : tileSize(size), maxResident(resident), resident(0), painted(false)
+    {
+        char dir[1024];
+        const char *tmpdir = getenv("TMPDIR");
+
+        snprintf(dir, sizeof(dir), "%s/yuvopencvXXXXXX", tmpdir ? tmpdir : "/tmp");
+        if (mkdtemp(dir) == NULL)
+            mjpeg_error_exit1 ("Cannot create spool directory %s", dir);
+        spool = dir;
+    }
 
-        oyuv.dumpInfo();
+    ~TileCanvas()
+    {
+        char name[1100];
 
-    //    oyuv.writeHeader();
+        for (TileMap::iterator t = tiles.begin(); t != tiles.end(); ++t)
+            if (t->second.onDisk) {
+                spoolName(name, sizeof(name), t->first);
+                unlink(name);
+            }
+        rmdir(spool.c_str());
+    }
 
-        iyuv.allocFrameData();
-        oyuv.allocFrameData();
+    // copies a w x h block of rows to x,y on the canvas
+    void paint(const uint8_t *src, int stride, int w, int h, int x, int y)
+    {
+        int tx, ty, x0, y0, x1, y1, r;
 
-        int width = iyuv.getWidth();
-        int height = iyuv.getHeight();
+        if (w <= 0 || h <= 0)
+            return;
 
-//        std::cerr << "width: " << width <<" height: " << height << "\n";
+        for (ty = floor_div(y, tileSize); ty <= floor_div(y + h - 1, tileSize); ty++)
+            for (tx = floor_div(x, tileSize); tx <= floor_div(x + w - 1, tileSize); tx++) {
+                Mat &t = tile(tx, ty);
 
-        int cwidth = iyuv.getChromaWidth();
-        int cheight = iyuv.getChromaHeight();
+                x0 = max(x, tx * tileSize);
+                y0 = max(y, ty * tileSize);
+                x1 = min(x + w, (tx + 1) * tileSize);
+                y1 = min(y + h, (ty + 1) * tileSize);
+                for (r = y0; r < y1; r++)
+                    memcpy(t.ptr(r - ty * tileSize) + x0 - tx * tileSize, src + (r - y) * stride + x0 - x, x1 - x0);
+            }
 
+        if (!painted || x < left) left = x;
+        if (!painted || y < top) top = y;
+        if (!painted || x + w > right) right = x + w;
+        if (!painted || y + h > bottom) bottom = y + h;
+        painted = true;
+    }
 
-        // set to black
-        memset (oyuv.getYUVFrame()[0],16,width*height);
-        memset (oyuv.getYUVFrame()[1],128,cwidth*cheight);
-        memset (oyuv.getYUVFrame()[2],128,cwidth*cheight);
+    // the painted area, a row of tiles at a time, unpainted parts are black
+    int writePGM(const char *filename)
+    {
+        FILE *fp;
+        vector<uint8_t> band;
+        int width, ty, tx, r, x0, x1, y0, y1;
+
+        if (!painted)
+            return -1;
+
+        fp = fopen(filename, "wb");
+        if (fp == NULL)
+            return -1;
+
+        width = right - left;
+        fprintf(fp, "P5\n%d %d\n255\n", width, bottom - top);
+
+        for (ty = floor_div(top, tileSize); ty <= floor_div(bottom - 1, tileSize); ty++) {
+            y0 = max(top, ty * tileSize);
+            y1 = min(bottom, (ty + 1) * tileSize);
+            band.assign((size_t)width * (y1 - y0), 0);
+
+            for (tx = floor_div(left, tileSize); tx <= floor_div(right - 1, tileSize); tx++) {
+                if (tiles.find(make_pair(tx, ty)) == tiles.end())
+                    continue;
+                Mat &t = tile(tx, ty);
+
+                x0 = max(left, tx * tileSize);
+                x1 = min(right, (tx + 1) * tileSize);
+                for (r = y0; r < y1; r++)
+                    memcpy(&band[(size_t)(r - y0) * width + x0 - left], t.ptr(r - ty * tileSize) + x0 - tx * tileSize, x1 - x0);
+            }
 
-     //   img1 = cv::Mat(height,width,CV_8UC1,oyuv.getYUVFrame()[0],width);
-        img1.create(height,width,CV_32FC1);
+            if (fwrite(&band[0], 1, band.size(), fp) != band.size()) {
+                fclose(fp);
+                return -1;
+            }
+        }
 
-        image.create(IMAGEDIM,IMAGEDIM,CV_8UC1);
-        //imgout = img1.clone();
+        return fclose(fp);
+    }
 
-        cv::Point2d shift;
+private:
+    typedef pair<int, int> Key;
+    struct Tile {
+        Mat data;
+        bool onDisk;
+        list<Key>::iterator used;
+    };
+    typedef map<Key, Tile> TileMap;
+
+    int tileSize;
+    int maxResident;
+    int resident;
+    TileMap tiles;
+    // most recently used first, resident tiles only
+    list<Key> lru;
+    string spool;
+    bool painted;
+    int left, top, right, bottom;
+
+    void spoolName(char *name, int len, const Key &k)
+    {
+        snprintf(name, len, "%s/%d_%d", spool.c_str(), k.first, k.second);
+    }
 
-        cv::Point2d acc (3600,6400);
+    void evict()
+    {
+        char name[1100];
+        FILE *fp;
+        Key k = lru.back();
+        Tile &t = tiles[k];
+
+        spoolName(name, sizeof(name), k);
+        fp = fopen(name, "wb");
+        if (fp == NULL || fwrite(t.data.ptr(0), 1, (size_t)tileSize * tileSize, fp) != (size_t)tileSize * tileSize)
+            mjpeg_error_exit1 ("Cannot spool tile to %s", name);
+        fclose(fp);
+
+        t.data.release();
+        t.onDisk = true;
+        lru.pop_back();
+        resident--;
+    }
 
-        while(1) {
-            iyuv.read();
+    Mat &tile(int tx, int ty)
+    {
+        char name[1100];
+        FILE *fp;
+        Key k(tx, ty);
+        TileMap::iterator it = tiles.find(k);
 
-            imgout = cv::Mat(height,width,CV_8UC1,iyuv.getYUVFrame()[0],width);
+        if (it != tiles.end() && !it->second.data.empty()) {
+            lru.splice(lru.begin(), lru, it->second.used);
+            return it->second.data;
+        }
 
-            imgout.assignTo(img2,CV_32FC1);
+        if (resident >= maxResident)
+            evict();
+
+        Tile &t = tiles[k];
+        // continuous, so a tile is one read or write
+        t.data.create(tileSize, tileSize, CV_8UC1);
+        if (t.onDisk) {
+            spoolName(name, sizeof(name), k);
+            fp = fopen(name, "rb");
+            if (fp == NULL || fread(t.data.ptr(0), 1, (size_t)tileSize * tileSize, fp) != (size_t)tileSize * tileSize)
+                mjpeg_error_exit1 ("Cannot read spooled tile %s", name);
+            fclose(fp);
+        } else {
+            t.data = Scalar(0);
+        }
+        lru.push_front(k);
+        t.used = lru.begin();
+        resident++;
 
-        //    imgout = img2.clone();
+        return t.data;
+    }
+};
 
-        //    cv::accumulate(img2, imgout);
+// finds the movement from one frame to the next
+class Registration
+{
+public:
+    Registration(int w, int h, int l) : width(w), height(h), levels(l), first(true)
+    {
+        if (levels < 0)
+            for (levels = 0; min(width, height) >> (levels + 1) >= PYRAMID_MIN; levels++)
+                ;
+        prev.resize(levels + 1);
+        cur.resize(levels + 1);
+    }
 
-       //     std::cerr << "img1: " << img1.type() << " / img2: " << img2.type() << "\n";
+    int getLevels() { return levels; }
+
+    // the shift of this frame from the last one
+    Point2d shift(const Mat &frame)
+    {
+        Point2d coarse, fine, d(0, 0);
+        int l, dx, dy;
+
+        // the float planes and the pyramid keep their buffers from frame to frame
+        frame.convertTo(cur[0], CV_32F);
+        for (l = 1; l <= levels; l++)
+            pyrDown(cur[l - 1], cur[l]);
+
+        if (!first) {
+            if (coarseWindow.empty())
+                createHanningWindow(coarseWindow, cur[levels].size(), CV_32F);
+            coarse = phaseCorrelate(prev[levels], cur[levels], coarseWindow);
+            d = coarse * (double)(1 << levels);
+
+            if (levels > 0) {
+                dx = cvRound(d.x);
+                dy = cvRound(d.y);
+                Size s(width - abs(dx), height - abs(dy));
+
+                if (s.width >= REFINE_MIN && s.height >= REFINE_MIN) {
+                    // prev(x, y) is cur(x + dx, y + dy)
+                    Rect r1(max(0, -dx), max(0, -dy), s.width, s.height);
+                    Rect r2(max(0, dx), max(0, dy), s.width, s.height);
+
+                    if (fineWindow.size() != s)
+                        createHanningWindow(fineWindow, s, CV_32F);
+                    fine = phaseCorrelate(prev[0](r1), cur[0](r2), fineWindow);
+                    d = Point2d(dx + fine.x, dy + fine.y);
+                }
+            }
+        }
 
-            shift = cv::phaseCorrelate(img1,img2);
-            img1 = img2.clone();
+        prev.swap(cur);
+        first = false;
+        return d;
+    }
 
+private:
+    int width, height;
+    int levels;
+    bool first;
+    vector<Mat> prev, cur;
+    Mat coarseWindow, fineWindow;
+};
 
-            acc = acc + shift;
+int main (int argc, char **argv)
+{
 
-       //     std::cout << shift << " - " << acc  << "\n";
+    Libyuv iyuv;
+    const char *output = "out.pgm";
+    int levels = -1;
+    int tileSize = TILE_SIZE;
+    int resident = TILES_IN_MEMORY;
+    int c;
+
+    while ((c = getopt (argc, argv, "o:l:t:m:h")) != -1) {
+        switch (c) {
+            case 'o':
+                output = optarg;
+                break;
+            case 'l':
+                levels = atoi(optarg);
+                break;
+            case 't':
+                tileSize = atoi(optarg);
+                if (tileSize < 16)
+                    mjpeg_error_exit1 ("Tile size must be at least 16");
+                break;
+            case 'm':
+                resident = atoi(optarg);
+                if (resident < 1)
+                    mjpeg_error_exit1 ("At least one tile must be in memory");
+                break;
+            case 'h':
+            case '?':
+                print_usage ();
+                return 0;
+        }
+    }
 
-//std::cout  << shift << " - " << acc << "\n";
+    iyuv.setExtensions(1);
 
-            int xl = IMAGEDIM - acc.x;
-            int yl = IMAGEDIM - acc.y;
+    TileCanvas canvas(tileSize, resident);
 
-            cout << xl << "," << yl << "\n";
+    try {
 
-            int y;
+        iyuv.readHeader();
+        iyuv.dumpInfo();
 
+        iyuv.allocFrameData();
 
-            for (y=0;y<16;y++)
-            {
-                memcpy(image.ptr (CROP+y+yl) + xl + CROP,imgout.ptr(y+CROP)+CROP,width-CROP-CROP);
-                memcpy(image.ptr (y+height-CROP+yl-16) + xl + CROP,imgout.ptr(y+height-CROP-16)+CROP,width-CROP-CROP);
+        int width = iyuv.getWidth();
+        int height = iyuv.getHeight();
 
-            }
+        Registration reg(width, height, levels);
+        mjpeg_info ("%d pyramid levels", reg.getLevels());
 
-            for (y=CROP;y<height-CROP;y++)
-            {
-                //*(image.ptr (y+yl) + xl + CROP) = * (imgout.ptr(y)+CROP);
+        cv::Point2d acc (0,0);
 
-                memcpy(image.ptr (y+yl) + xl + CROP,imgout.ptr(y)+CROP,10);
-                memcpy(image.ptr (y+yl) + xl + width - CROP -10 ,imgout.ptr(y)+width-CROP-10,10);
-            }
+        while (iyuv.read()) {
 
+            Mat imgout(height,width,CV_8UC1,iyuv.getYUVFrame()[0],width);
 
+            acc = acc + reg.shift(imgout);
 
+            int xl = (int)floor(-acc.x);
+            int yl = (int)floor(-acc.y);
 
-            img1 = img2.clone();
+            cout << xl << "," << yl << "\n";
 
-  /*
-            if (imgout.step == width)
-            {
-                oyuv.getYUVFrame()[0] = imgout.ptr(0);
-            }
-            else
-            {
-                int y;
-                for (y=0;y<height;y++)
-                {
-                    memcpy(oyuv.getYUVFrame()[0] + y * width,imgout.ptr(y),width);
-                }
-            }
-            oyuv.write();
-   */
+            // the top and bottom 16 rows and 10 columns either side, inside the crop
+            canvas.paint(imgout.ptr(CROP) + CROP, width, width-CROP-CROP, 16, xl + CROP, yl + CROP);
+            canvas.paint(imgout.ptr(height-CROP-16) + CROP, width, width-CROP-CROP, 16, xl + CROP, yl + height-CROP-16);
+            canvas.paint(imgout.ptr(CROP) + CROP, width, 10, height-CROP-CROP, xl + CROP, yl + CROP);
+            canvas.paint(imgout.ptr(CROP) + width-CROP-10, width, 10, height-CROP-CROP, xl + width-CROP-10, yl + CROP);
         }
-    } catch (AVException *e) {
-		std::cerr << "ERROR occurred: " << e->getMessage() << "\n";
-	} catch (cv::Exception *e) {
-        std::cerr << "Exception occurred: " << e  << "\n";
+    } catch (AVException &e) {
+        std::cerr << "ERROR occurred: " << e.getMessage() << "\n";
+    } catch (cv::Exception &e) {
+        std::cerr << "Exception occurred: " << e.what()  << "\n";
     }
 
-    vector<int> compression_params;
-    compression_params.push_back(CV_IMWRITE_PNG_COMPRESSION);
-    compression_params.push_back(9);
-
-    imwrite("out.png", image, compression_params);
-
+    if (canvas.writePGM(output))
+        mjpeg_error_exit1 ("Cannot write %s", output);
 
-}
\ No newline at end of file
+}
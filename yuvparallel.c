@@ -0,0 +1,296 @@
+/*
+ *  yuvparallel.c
+ *    Mark Heath <mjpeg0 at silicontrip.org>
+ *  http://silicontrip.net/~mark/lavtools/
+ *
+** <h3>Parallel segment processing</h3>
+** <p>Splits a y4m file into segments and runs a filter on every segment at
+** the same time, each in its own process, then joins the results.  For the
+** temporal filters (yuvtbilateral, yuvtshot, yuvnlmeans) each segment is
+** given extra halo frames either side of it, so the frames at the joins
+** see the same neighbours as they would in one long run.  The halo frames
+** are dropped from the output.  The halo must be at least as many frames as
+** the filter looks ahead or behind, for yuvtbilateral this is twice the
+** larger of its -r and -d.</p>
+** <p>The filter must output one frame for every input frame, the frame
+** count of every segment is checked.  The input must be a file, not a
+** pipe.  Segment output is spooled to temporary files in $TMPDIR.</p>
+** <h4>EXAMPLE</h4>
+** <pre>yuvparallel -j 16 -o 6 in.y4m yuvtbilateral -r 3 -d 2 &gt; out.y4m</pre>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include <yuv4mpeg.h>
+#include <mpegconsts.h>
+#include "utilyuv.h"
+
+#define VERSION "0.1"
+
+#define DEFAULT_HALO 8
+
+struct segment {
+	int id;
+	// frames of the segment, and the frames given to the filter including halos
+	int first, last;
+	int in_first, in_last;
+	yuv_index_t *in;
+	int fdIn;
+	int fdOut;
+	char spool[64];
+	pid_t pid;
+	pthread_t feeder;
+	int feed_error;
+};
+
+static void print_usage()
+{
+	fprintf (stderr,
+			 "usage: yuvparallel [-j <jobs>] [-o <halo>] [-v 0..2] <input.y4m> filter [options]\n"
+			 "\t -j <jobs> number of segments run at once (default: number of cpus)\n"
+			 "\t -o <halo> frames of overlap given either side of a segment (default %d)\n"
+			 "\t -v Verbosity degree : 0=quiet, 1=normal, 2=verbose/debug\n"
+			 "The output goes to stdout\n", DEFAULT_HALO
+			 );
+}
+
+static int write_all(int fd, const uint8_t *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+// byte range from the FRAME line of frame a to the end of the data of frame b
+static void frame_range(yuv_index_t *yi, int a, int b, off_t *start, off_t *end)
+{
+	*start = a ? yuv_index_end(yi, a-1) : yi->first;
+	*end = yuv_index_end(yi, b);
+}
+
+// the frames are contiguous in the file, so the filter gets the header and one block
+static void *feed_thread (void *arg)
+{
+	struct segment *sg = arg;
+	off_t start, end;
+
+	frame_range(sg->in, sg->in_first, sg->in_last, &start, &end);
+
+	if (write_all(sg->fdIn, sg->in->map, sg->in->first) ||
+		write_all(sg->fdIn, sg->in->map + start, end - start))
+		sg->feed_error = errno;
+
+	close(sg->fdIn);
+	return NULL;
+}
+
+static void start_segment (struct segment *sg, char **filter)
+{
+	int p[2];
+	char *tmpdir;
+
+	tmpdir = getenv("TMPDIR");
+	snprintf(sg->spool, sizeof(sg->spool), "%s/yuvparallelXXXXXX", tmpdir ? tmpdir : "/tmp");
+	sg->fdOut = mkstemp(sg->spool);
+	if (sg->fdOut == -1)
+		mjpeg_error_exit1 ("Cannot create spool file %s", sg->spool);
+	unlink(sg->spool);
+	fcntl(sg->fdOut, F_SETFD, FD_CLOEXEC);
+
+	if (pipe(p))
+		mjpeg_error_exit1 ("Cannot create pipe");
+	fcntl(p[0], F_SETFD, FD_CLOEXEC);
+	fcntl(p[1], F_SETFD, FD_CLOEXEC);
+
+	sg->pid = fork();
+	if (sg->pid == -1)
+		mjpeg_error_exit1 ("Cannot start %s", filter[0]);
+
+	if (sg->pid == 0) {
+		dup2(p[0], 0);
+		dup2(sg->fdOut, 1);
+		execvp(filter[0], filter);
+		mjpeg_error("Cannot run %s: %s", filter[0], strerror(errno));
+		_exit(127);
+	}
+
+	close(p[0]);
+	sg->fdIn = p[1];
+	sg->feed_error = 0;
+	if (pthread_create(&sg->feeder, NULL, feed_thread, sg))
+		mjpeg_error_exit1 ("Cannot create feeder thread");
+}
+
+// waits for the filter and checks what it made
+static void finish_segment (struct segment *sg, yuv_index_t *out)
+{
+	y4m_stream_info_t si;
+	int status;
+	int expected;
+
+	pthread_join(sg->feeder, NULL);
+	if (waitpid(sg->pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status))
+		mjpeg_error_exit1 ("segment %d: filter failed", sg->id);
+	if (sg->feed_error)
+		mjpeg_error_exit1 ("segment %d: writing to filter: %s", sg->id, strerror(sg->feed_error));
+
+	lseek(sg->fdOut, 0, SEEK_SET);
+	y4m_init_stream_info(&si);
+	if (y4m_read_stream_header(sg->fdOut, &si) != Y4M_OK)
+		mjpeg_error_exit1 ("segment %d: filter output is not y4m", sg->id);
+	if (yuv_index_fd(out, sg->fdOut, &si))
+		mjpeg_error_exit1 ("segment %d: cannot index filter output", sg->id);
+	y4m_fini_stream_info(&si);
+
+	expected = sg->in_last - sg->in_first + 1;
+	if (out->frames != expected)
+		mjpeg_error_exit1 ("segment %d: filter output %d frames, expected %d", sg->id, out->frames, expected);
+}
+
+// *************************************************************************************
+// MAIN
+// *************************************************************************************
+int main (int argc, char *argv[])
+{
+
+	int verbose = 1;
+	int jobs = 0;
+	int halo = DEFAULT_HALO;
+	yuv_index_t in, out;
+	struct segment *sg;
+	int c, s, frames, length, written = 0;
+	off_t start, end;
+	// stop at the filter name, its options are not ours
+	const static char *legal_flags = "+j:o:v:h";
+
+	while ((c = getopt (argc, argv, legal_flags)) != -1) {
+		switch (c) {
+			case 'j':
+				jobs = atoi (optarg);
+				break;
+			case 'o':
+				halo = atoi (optarg);
+				if (halo < 0)
+					mjpeg_error_exit1 ("Halo must not be negative");
+				break;
+			case 'v':
+				verbose = atoi (optarg);
+				if (verbose < 0 || verbose > 2)
+					mjpeg_error_exit1 ("Verbose level must be [0..2]");
+				break;
+			case 'h':
+			case '?':
+				print_usage ();
+				return 0 ;
+				break;
+		}
+	}
+
+	if (argc - optind < 2) {
+		print_usage ();
+		return 0 ;
+	}
+
+	// mjpeg tools global initialisations
+	mjpeg_default_handler_verbosity (verbose);
+
+	if (jobs < 1)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs < 1)
+		jobs = 1;
+
+	if (yuv_index_open(&in, argv[optind]))
+		mjpeg_error_exit1 ("Cannot index %s, it must be a y4m file", argv[optind]);
+	frames = in.frames;
+	if (frames == 0)
+		mjpeg_error_exit1 ("%s has no frames", argv[optind]);
+	if (jobs > frames)
+		jobs = frames;
+
+	// a writer that goes away is reported by the feeder
+	signal(SIGPIPE, SIG_IGN);
+
+	mjpeg_info ("yuvparallel (version " VERSION ") runs a filter on segments of a y4m file");
+	mjpeg_info ("%d frames in %d segments, %d halo frames", frames, jobs, halo);
+
+	sg = (struct segment *)calloc(jobs, sizeof(struct segment));
+	if (sg == NULL)
+		mjpeg_error_exit1 ("Cannot allocate memory for segments");
+
+	length = frames / jobs;
+	for (s=0; s<jobs; s++) {
+		sg[s].id = s;
+		sg[s].first = s * length + (s < frames % jobs ? s : frames % jobs);
+		sg[s].last = sg[s].first + length + (s < frames % jobs ? 1 : 0) - 1;
+		sg[s].in_first = sg[s].first - halo < 0 ? 0 : sg[s].first - halo;
+		sg[s].in_last = sg[s].last + halo >= frames ? frames - 1 : sg[s].last + halo;
+		sg[s].in = &in;
+
+		mjpeg_debug ("segment %d: frames %d-%d, filtering %d-%d", s,
+					 sg[s].first, sg[s].last, sg[s].in_first, sg[s].in_last);
+		start_segment(&sg[s], argv + optind + 1);
+	}
+
+	// stitch in order, each segment is written as one block without its halos
+	for (s=0; s<jobs; s++) {
+		finish_segment(&sg[s], &out);
+
+		if (s == 0 && write_all(1, out.map, out.first))
+			mjpeg_error_exit1 ("Error writing output stream!");
+
+		frame_range(&out, sg[s].first - sg[s].in_first, sg[s].last - sg[s].in_first, &start, &end);
+		if (write_all(1, out.map + start, end - start))
+			mjpeg_error_exit1 ("Error writing output stream!");
+		written += sg[s].last - sg[s].first + 1;
+
+		yuv_index_close(&out);
+		close(sg[s].fdOut);
+	}
+
+	if (written != frames)
+		mjpeg_error_exit1 ("Output %d frames, expected %d", written, frames);
+
+	yuv_index_close(&in);
+	free(sg);
+
+	return 0;
+}
+/*
+ * Local variables:
+ *  tab-width: 8
+ *  indent-tabs-mode: nil
+ * End:
+ */
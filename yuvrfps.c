@@ -57,6 +57,7 @@
 
 #include <yuv4mpeg.h>
 #include <mpegconsts.h>
+#include "utilyuv.h"
 
 #define YUVRFPS_VERSION "0.1"
 
@@ -75,38 +76,6 @@ static void print_usage()
 			 );
 }
 
-void copyfield(int which, y4m_stream_info_t *sinfo, unsigned char *input[], unsigned char *output[])
-{
-	// "which" is 0 for top field, 1 for bottom field
-	int r = 0;
-
-	int h,w,cw,ch;
-
-	h = y4m_si_get_plane_height(sinfo,0);
-	w = y4m_si_get_plane_width(sinfo,0);
-	cw = y4m_si_get_plane_width(sinfo,1);
-	ch = y4m_si_get_plane_height(sinfo,1);
-
-	int chromapos = which * cw;
-	int lumapos = which * w;
-
-
-
-	for (r = which; r < h; r += 2)
-	{
-		memcpy(&output[0][lumapos], &input[0][lumapos], w);
-		if (r < ch) {
-			memcpy(&output[1][chromapos], &input[1][chromapos], cw);
-			memcpy(&output[2][chromapos], &input[2][chromapos], cw);
-			chromapos += cw * 2;
-		}
-		lumapos += w * 2;
-	}
-}
-
-
-
-
 // read X frames
 // diff each frame (X-1)
 // for 1 to X
@@ -119,12 +88,14 @@ static void detect(  int fdIn , y4m_stream_info_t  *inStrInfo,
 				   int iforce, int oforce,int skip)
 {
 	y4m_frame_info_t   in_frame ;
-	uint8_t            *yuv_data[drop_frames+1][3] ;
+	uint8_t            *yuv_data[drop_frames+1][YUV_MAX_PLANES] ;
+	uint8_t            *swap[YUV_MAX_PLANES] ;
+	yuv_field_t        top, bottom ;
 
 	int                frame_data_size ;
 	int                read_error_code ;
 	int                write_error_code ;
-	int *bri, *bro,l=0,f=0,mini=0,mino=0,dropmo=0,dropmi=0,x,w,h;
+	int *bri, *bro,l=0,f=0,mini=0,mino=0,dropmo=0,dropmi=0,x,w,h,p;
 
 	// Allocate memory for the YUV channels
 	w = y4m_si_get_width(inStrInfo);
@@ -136,10 +107,7 @@ static void detect(  int fdIn , y4m_stream_info_t  *inStrInfo,
 	// should check for allocation errors here.
 
 	for (f=0; f<= drop_frames; f++) {
-		yuv_data[f][0] = (uint8_t *)malloc( frame_data_size );
-		yuv_data[f][1] = (uint8_t *)malloc( frame_data_size >> 2);
-		yuv_data[f][2] = (uint8_t *)malloc( frame_data_size >> 2);
-		if( !yuv_data[f][0] || !yuv_data[f][1] || !yuv_data[f][2])
+		if (planealloc(yuv_data[f],inStrInfo))
 		    mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
 	}
 
@@ -149,16 +117,16 @@ static void detect(  int fdIn , y4m_stream_info_t  *inStrInfo,
 	// initialise and read the first number of frames
 	for (f=0; f <= skip; f++) {
 		y4m_init_frame_info( &in_frame );
-		read_error_code = y4m_read_frame(fdIn,inStrInfo,&in_frame,yuv_data[0] );
+		read_error_code = yuv_read_frame(fdIn,inStrInfo,&in_frame,yuv_data[0] );
 
 	// we will never drop the first frame of a file
-		write_error_code = y4m_write_frame( fdOut, outStrInfo, &in_frame, yuv_data[0] );
+		write_error_code = yuv_write_frame( fdOut, outStrInfo, &in_frame, yuv_data[0] );
 	}
 
 	for (f=1; f<=drop_frames && Y4M_ERR_EOF != read_error_code; f++) {
 		y4m_fini_frame_info( &in_frame );
 		y4m_init_frame_info( &in_frame );
-		read_error_code = y4m_read_frame(fdIn,inStrInfo,&in_frame,yuv_data[f] );
+		read_error_code = yuv_read_frame(fdIn,inStrInfo,&in_frame,yuv_data[f] );
 	}
 
 	// f should be drop_frames + 1
@@ -228,25 +196,16 @@ static void detect(  int fdIn , y4m_stream_info_t  *inStrInfo,
 			for (f=1; f<=drop_frames;f++) {
 				if (f != dropmi) {
 					//	fprintf(stderr,"writing %d (drop %d)\n",f,dropmi);
-					write_error_code = y4m_write_frame( fdOut, outStrInfo, &in_frame, yuv_data[f] );
+					write_error_code = yuv_write_frame( fdOut, outStrInfo, &in_frame, yuv_data[f] );
 				}
 			}
 		} else {
 			mjpeg_info("Dropping fields even: %d odd: %d",dropmi,dropmo);
+			// from the dropped field on each field comes from the next frame
 			for (f=1; f<drop_frames;f++) {
-
-
-				if (f == dropmi)
-					for (l=f; l<drop_frames; l++)
-						copyfield (0,inStrInfo, yuv_data[l+1],yuv_data[l]);
-
-				if (f == dropmo)
-					for (l=f; l<drop_frames; l++)
-						copyfield (1,inStrInfo, yuv_data[l+1],yuv_data[l]);
-
-
-				write_error_code = y4m_write_frame( fdOut, outStrInfo, &in_frame, yuv_data[f] );
-
+				yuv_field_view(&top, yuv_data[f >= dropmi ? f+1 : f], inStrInfo, Y4M_ILACE_TOP_FIRST);
+				yuv_field_view(&bottom, yuv_data[f >= dropmo ? f+1 : f], inStrInfo, Y4M_ILACE_BOTTOM_FIRST);
+				write_error_code = yuv_write_weave( fdOut, outStrInfo, &in_frame, &top, &bottom );
 			}
 		}
 		// output all but the minimum difference frame.
@@ -256,30 +215,20 @@ static void detect(  int fdIn , y4m_stream_info_t  *inStrInfo,
 		// we do not want to write it twice
 
 
-		// copy the last frame to the first
+		// the last frame becomes the first
 
-		memcpy(yuv_data[0][0],yuv_data[drop_frames][0],frame_data_size);
-		// assumes 420 video
-		// TODO: read chroma subsampling from stream
-		memcpy(yuv_data[0][1],yuv_data[drop_frames][1],frame_data_size>>2);
-		memcpy(yuv_data[0][2],yuv_data[drop_frames][2],frame_data_size>>2);
-
-		/*
-		 for (l=0; l< frame_data_size; l++) {
-		 yuv_data[0][0][l] = yuv_data[drop_frames][0][l];
-		 if (!l%2) {
-		 yuv_data[0][1][l>>2] = yuv_data[drop_frames][1][l>>2];
-		 yuv_data[0][2][l>>2] = yuv_data[drop_frames][2][l>>2];
-		 }
-		 }
-		 */
+		for (p=0; p<YUV_MAX_PLANES; p++) {
+			swap[p] = yuv_data[0][p];
+			yuv_data[0][p] = yuv_data[drop_frames][p];
+			yuv_data[drop_frames][p] = swap[p];
+		}
 
 		// TODO if read fewer than drop_frames main loop will exit.
 
 		for (f=1; f<=drop_frames && Y4M_ERR_EOF != read_error_code; f++) {
 			y4m_fini_frame_info( &in_frame );
 			y4m_init_frame_info( &in_frame );
-			read_error_code = y4m_read_frame(fdIn,inStrInfo,&in_frame,yuv_data[f] );
+			read_error_code = yuv_read_frame(fdIn,inStrInfo,&in_frame,yuv_data[f] );
 		}
 
 
@@ -290,11 +239,8 @@ static void detect(  int fdIn , y4m_stream_info_t  *inStrInfo,
 
 	y4m_fini_frame_info( &in_frame );
 
-	for (f=0; f<=drop_frames; f++) {
-		free( yuv_data[f][0] );
-		free( yuv_data[f][1] );
-		free( yuv_data[f][2] );
-	}
+	for (f=0; f<=drop_frames; f++)
+		planefree(yuv_data[f]);
 
 	if( read_error_code != Y4M_ERR_EOF )
 		mjpeg_error_exit1 ("Error reading from input stream!");
@@ -305,36 +251,6 @@ static void detect(  int fdIn , y4m_stream_info_t  *inStrInfo,
 
 }
 
-static int parse_interlacing(char *str)
-{
-	if (str[0] != '\0' && str[1] == '\0')
-	{
-		switch (str[0])
-		{
-			case 'p':
-				return Y4M_ILACE_NONE;
-			case 't':
-				return Y4M_ILACE_TOP_FIRST;
-			case 'b':
-				return Y4M_ILACE_BOTTOM_FIRST;
-		}
-	}
-	mjpeg_error_exit1("Valid interlacing modes are: p - progressive, t - top-field first, b - bottom-field first");
-	return Y4M_UNKNOWN; /* to avoid compiler warnings */
-}
-
-//
-// Returns the greatest common divisor (GCD) of the input parameters.
-//
-static int gcd(int a, int b)
-{
-	if (b == 0)
-		return a;
-	else
-		return gcd(b, a % b);
-}
-
-
 // *************************************************************************************
 // MAIN
 // *************************************************************************************
@@ -400,7 +316,7 @@ int main (int argc, char *argv[])
 	// ***************************************************************
 	// INPUT comes from stdin, we check for a correct file header
 	y4m_accept_extensions(1); // because we handle different chroma subsampling
-	if (y4m_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+	if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
 		mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
 
 	src_frame_rate = y4m_si_get_framerate( &in_streaminfo );
@@ -426,7 +342,7 @@ int main (int argc, char *argv[])
 
 
 	/* in that function we do all the important work */
-	y4m_write_stream_header(fdOut,&out_streaminfo);
+	yuv_write_stream_header(fdOut,&out_streaminfo);
 
 	detect( fdIn,&in_streaminfo,fdOut,&out_streaminfo,src_interlacing,drop_frames,iforce,oforce,skip);
 
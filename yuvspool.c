@@ -0,0 +1,464 @@
+/*
+ *  yuvspool.c
+ *    Mark Heath <mjpeg0 at silicontrip.org>
+ *  http://silicontrip.net/~mark/lavtools/
+ *
+ * lossless frame coding for spool files
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "yuvspool.h"
+#include "yuvbands.h"
+
+// unary codes this long are followed by the residual as it is
+#define SPOOL_ESCAPE 16
+// the Rice parameter follows the mean of about this many residuals
+#define SPOOL_RICE_RESET 64
+
+typedef struct {
+	uint64_t acc;
+	int bits;
+	uint8_t *p;
+	const uint8_t *end;
+} spool_bits_t;
+
+typedef struct {
+	int a;
+	int n;
+} spool_rice_t;
+
+static inline void rice_init(spool_rice_t *r)
+{
+	r->a = 4;
+	r->n = 1;
+}
+
+// the smallest k with n << k at least a
+static inline int rice_k(const spool_rice_t *r)
+{
+	int k = __builtin_clz(r->n) - __builtin_clz(r->a | 1);
+
+	if (k < 0)
+		return 0;
+	return (r->n << k) < r->a ? k + 1 : k;
+}
+
+static inline void rice_update(spool_rice_t *r, int e)
+{
+	r->a += e;
+	if (++r->n == SPOOL_RICE_RESET) {
+		r->a >>= 1;
+		r->n >>= 1;
+	}
+}
+
+static inline int median3(int a, int b, int c)
+{
+	int lo = a < b ? a : b;
+	int hi = a < b ? b : a;
+
+	return c < lo ? lo : c > hi ? hi : c;
+}
+
+// the residual folded so small differences either way are small numbers
+static inline int fold(int x, int pred)
+{
+	int s = (int8_t)(x - pred);
+
+	return (s << 1) ^ (s >> 31);
+}
+
+static inline int unfold(int e, int pred)
+{
+	return (pred + ((e >> 1) ^ -(e & 1))) & 0xff;
+}
+
+// bits are written 32 at a time, most significant first
+static inline void put_bits(spool_bits_t *b, uint32_t v, int n)
+{
+	uint32_t w;
+
+	b->acc = (b->acc << n) | v;
+	b->bits += n;
+	if (b->bits >= 32) {
+		b->bits -= 32;
+		w = (uint32_t)(b->acc >> b->bits);
+		b->p[0] = w >> 24;
+		b->p[1] = w >> 16;
+		b->p[2] = w >> 8;
+		b->p[3] = w;
+		b->p += 4;
+	}
+}
+
+static inline void put_symbol(spool_bits_t *b, spool_rice_t *r, int e)
+{
+	int k = rice_k(r);
+	int q = e >> k;
+
+	if (q < SPOOL_ESCAPE)
+		put_bits(b, (((1u << q) - 1) << (k + 1)) | (e & ((1u << k) - 1)), q + 1 + k);
+	else
+		put_bits(b, (((1u << SPOOL_ESCAPE) - 1) << 8) | e, SPOOL_ESCAPE + 8);
+	rice_update(r, e);
+}
+
+// reading keeps the bits at the top of acc, past the end it reads zeros
+static inline void get_refill(spool_bits_t *b)
+{
+	uint32_t w = 0;
+
+	if (b->p + 4 <= b->end)
+		w = (uint32_t)b->p[0] << 24 | b->p[1] << 16 | b->p[2] << 8 | b->p[3];
+	b->p += 4;
+	b->acc |= (uint64_t)w << (32 - b->bits);
+	b->bits += 32;
+}
+
+static inline int get_symbol(spool_bits_t *b, spool_rice_t *r)
+{
+	int k = rice_k(r);
+	uint64_t u;
+	int q, e;
+
+	if (b->bits < SPOOL_ESCAPE + 8)
+		get_refill(b);
+
+	u = ~b->acc;
+	q = u ? __builtin_clzll(u) : 64;
+	if (q >= SPOOL_ESCAPE) {
+		e = (int)(b->acc >> (64 - SPOOL_ESCAPE - 8)) & 0xff;
+		b->acc <<= SPOOL_ESCAPE + 8;
+		b->bits -= SPOOL_ESCAPE + 8;
+	} else {
+		b->acc <<= q + 1;
+		e = q << k;
+		if (k) {
+			e |= (int)(b->acc >> (64 - k));
+			b->acc <<= k;
+		}
+		b->bits -= q + 1 + k;
+		e &= 0xff;
+	}
+	rice_update(r, e);
+	return e;
+}
+
+// rows of a plane in slice s of n
+static void slice_rows(const yuv_spool_t *sp, int p, int s, int n, int *first, int *last)
+{
+	*first = (int)((int64_t)sp->height[p] * s / n);
+	*last = (int)((int64_t)sp->height[p] * (s + 1) / n);
+}
+
+static size_t slice_length(const yuv_spool_t *sp, int s, int n)
+{
+	size_t len = 0;
+	int p, first, last;
+
+	for (p=0; p<sp->planes; p++) {
+		slice_rows(sp, p, s, n, &first, &last);
+		len += (size_t)sp->width[p] * (last - first);
+	}
+	return len;
+}
+
+// the first rows of a slice only have their left neighbours
+static void encode_plane(spool_bits_t *b, const uint8_t *row, int w, int rows, int above)
+{
+	spool_rice_t r;
+	const uint8_t *up;
+	int x, y, pred;
+
+	rice_init(&r);
+	for (y=0; y<rows; y++, row += w) {
+		if (y < above) {
+			pred = 128;
+			for (x=0; x<w; x++) {
+				put_symbol(b, &r, fold(row[x], pred));
+				pred = row[x];
+			}
+			continue;
+		}
+		up = row - (size_t)above * w;
+		put_symbol(b, &r, fold(row[0], up[0]));
+		for (x=1; x<w; x++) {
+			pred = median3(row[x-1], up[x], row[x-1] + up[x] - up[x-1]);
+			put_symbol(b, &r, fold(row[x], pred));
+		}
+	}
+}
+
+static void decode_plane(spool_bits_t *b, uint8_t *row, int w, int rows, int above)
+{
+	spool_rice_t r;
+	const uint8_t *up;
+	int x, y, pred;
+
+	rice_init(&r);
+	for (y=0; y<rows; y++, row += w) {
+		if (y < above) {
+			pred = 128;
+			for (x=0; x<w; x++)
+				pred = row[x] = unfold(get_symbol(b, &r), pred);
+			continue;
+		}
+		up = row - (size_t)above * w;
+		row[0] = unfold(get_symbol(b, &r), up[0]);
+		for (x=1; x<w; x++) {
+			pred = median3(row[x-1], up[x], row[x-1] + up[x] - up[x-1]);
+			row[x] = unfold(get_symbol(b, &r), pred);
+		}
+	}
+}
+
+static void encode_slice(yuv_spool_t *sp, int s)
+{
+	uint8_t *out = sp->buffer + sp->slice_max * s;
+	size_t raw = slice_length(sp, s, sp->slices);
+	int above = sp->head.flags & YUV_SPOOL_FIELDS ? 2 : 1;
+	spool_bits_t b;
+	int p, first, last;
+
+	b.acc = 0;
+	b.bits = 0;
+	b.p = out;
+	for (p=0; p<sp->planes; p++) {
+		slice_rows(sp, p, s, sp->slices, &first, &last);
+		encode_plane(&b, sp->m[p] + (size_t)first * sp->width[p], sp->width[p], last - first, above);
+	}
+	if (b.bits)
+		put_bits(&b, 0, 32 - b.bits);
+
+	if ((size_t)(b.p - out) < raw) {
+		sp->size[s] = b.p - out;
+		return;
+	}
+
+	// noise codes larger than it is
+	for (p=0; p<sp->planes; p++) {
+		slice_rows(sp, p, s, sp->slices, &first, &last);
+		memcpy(out, sp->m[p] + (size_t)first * sp->width[p], (size_t)sp->width[p] * (last - first));
+		out += (size_t)sp->width[p] * (last - first);
+	}
+	sp->size[s] = raw | YUV_SPOOL_RAW;
+}
+
+static void decode_slice(yuv_spool_t *sp, int s, int n)
+{
+	const uint8_t *in = sp->data[s];
+	int above = sp->head.flags & YUV_SPOOL_FIELDS ? 2 : 1;
+	spool_bits_t b;
+	int p, first, last;
+
+	if (sp->size[s] & YUV_SPOOL_RAW) {
+		for (p=0; p<sp->planes; p++) {
+			slice_rows(sp, p, s, n, &first, &last);
+			memcpy(sp->m[p] + (size_t)first * sp->width[p], in, (size_t)sp->width[p] * (last - first));
+			in += (size_t)sp->width[p] * (last - first);
+		}
+		return;
+	}
+
+	b.acc = 0;
+	b.bits = 0;
+	b.p = (uint8_t *)in;
+	b.end = in + sp->size[s];
+	for (p=0; p<sp->planes; p++) {
+		slice_rows(sp, p, s, n, &first, &last);
+		decode_plane(&b, sp->m[p] + (size_t)first * sp->width[p], sp->width[p], last - first, above);
+	}
+	// the padding is less than a word, anything more ran off the end
+	if (b.p - b.end > 4)
+		sp->error = 1;
+}
+
+// the bands are rows of the luma plane, a band does the slices that start in it
+static void slice_range(const yuv_spool_t *sp, int n, int first, int last, int *s0, int *s1)
+{
+	int s = 0;
+
+	while (s < n && (int64_t)sp->height[0] * s / n < first)
+		s++;
+	*s0 = s;
+	while (s < n && (int64_t)sp->height[0] * s / n < last)
+		s++;
+	*s1 = s;
+}
+
+static void encode_band(void *arg, int first, int last)
+{
+	yuv_spool_t *sp = (yuv_spool_t *)arg;
+	int s, s0, s1;
+
+	slice_range(sp, sp->slices, first, last, &s0, &s1);
+	for (s=s0; s<s1; s++)
+		encode_slice(sp, s);
+}
+
+static void decode_band(void *arg, int first, int last)
+{
+	yuv_spool_t *sp = (yuv_spool_t *)arg;
+	int s, s0, s1;
+
+	slice_range(sp, sp->head.slices, first, last, &s0, &s1);
+	for (s=s0; s<s1; s++)
+		decode_slice(sp, s, sp->head.slices);
+}
+
+int yuv_spool_init(yuv_spool_t *sp, const y4m_stream_info_t *si)
+{
+	size_t largest = 0, len;
+	int p, s;
+
+	sp->buffer = NULL;
+	sp->planes = y4m_si_get_plane_count(si);
+	if (sp->planes < 1 || sp->planes > YUV_SPOOL_PLANES) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (p=0; p<sp->planes; p++) {
+		sp->width[p] = y4m_si_get_plane_width(si, p);
+		sp->height[p] = y4m_si_get_plane_height(si, p);
+	}
+
+	sp->flags = 0;
+	if (y4m_si_get_interlace(si) == Y4M_ILACE_TOP_FIRST || y4m_si_get_interlace(si) == Y4M_ILACE_BOTTOM_FIRST)
+		sp->flags |= YUV_SPOOL_FIELDS;
+
+	sp->slices = sp->height[0] / YUV_SPOOL_SLICE_ROWS;
+	if (sp->slices < 1)
+		sp->slices = 1;
+	if (sp->slices > YUV_SPOOL_MAX_SLICES)
+		sp->slices = YUV_SPOOL_MAX_SLICES;
+
+	for (s=0; s<sp->slices; s++) {
+		len = slice_length(sp, s, sp->slices);
+		if (len > largest)
+			largest = len;
+	}
+	// a whole slice of escapes is three bytes a sample, and a word of padding
+	sp->slice_max = (largest * 3 + sizeof(uint32_t) + 15) & ~(size_t)15;
+	sp->buffer = (uint8_t *)malloc(sp->slice_max * sp->slices);
+	if (sp->buffer == NULL)
+		return -1;
+
+	memcpy(sp->head.magic, YUV_SPOOL_MAGIC, 4);
+	sp->head.slices = sp->slices;
+	sp->head.flags = sp->flags;
+	sp->error = 0;
+	return 0;
+}
+
+size_t yuv_spool_frame_max(const yuv_spool_t *sp)
+{
+	size_t len = 0;
+	int p;
+
+	// a stored slice is never larger than its rows
+	for (p=0; p<sp->planes; p++)
+		len += (size_t)sp->width[p] * sp->height[p];
+	return sizeof(struct yuv_spool_frame) + sizeof(uint32_t) * YUV_SPOOL_MAX_SLICES + len;
+}
+
+int yuv_spool_encode(yuv_spool_t *sp, uint8_t * const *m, struct iovec *iov)
+{
+	int s;
+
+	sp->head.slices = sp->slices;
+	sp->head.flags = sp->flags;
+	sp->m = m;
+	yuv_bands(encode_band, sp, sp->height[0]);
+
+	sp->head.length = sizeof(uint32_t) * sp->slices;
+	iov[0].iov_base = &sp->head;
+	iov[0].iov_len = sizeof(sp->head);
+	iov[1].iov_base = sp->size;
+	iov[1].iov_len = sizeof(uint32_t) * sp->slices;
+	for (s=0; s<sp->slices; s++) {
+		iov[s + 2].iov_base = sp->buffer + sp->slice_max * s;
+		iov[s + 2].iov_len = sp->size[s] & ~YUV_SPOOL_RAW;
+		sp->head.length += iov[s + 2].iov_len;
+	}
+	return sp->slices + 2;
+}
+
+int yuv_spool_decode(yuv_spool_t *sp, const uint8_t *frame, size_t len, uint8_t * const *m)
+{
+	struct yuv_spool_frame head;
+	const uint8_t *data;
+	size_t used, size;
+	int s, n;
+
+	// a frame in a mapped file is wherever its FRAME line ended
+	if (len < sizeof(head)) {
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(&head, frame, sizeof(head));
+	if (memcmp(head.magic, YUV_SPOOL_MAGIC, 4) || head.length > len - sizeof(head) ||
+		head.slices < 1 || head.slices > YUV_SPOOL_MAX_SLICES || head.slices > sp->height[0] ||
+		head.length < sizeof(uint32_t) * head.slices) {
+		errno = EINVAL;
+		return -1;
+	}
+	n = head.slices;
+	memcpy(sp->size, frame + sizeof(head), sizeof(uint32_t) * n);
+
+	// every slice has to be where its size says before any is decoded
+	data = frame + sizeof(head) + sizeof(uint32_t) * n;
+	used = sizeof(uint32_t) * n;
+	for (s=0; s<n; s++) {
+		size = sp->size[s] & ~YUV_SPOOL_RAW;
+		if (size > head.length - used) {
+			errno = EINVAL;
+			return -1;
+		}
+		if ((sp->size[s] & YUV_SPOOL_RAW) ? size != slice_length(sp, s, n) : (size & 3) != 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		sp->data[s] = data;
+		data += size;
+		used += size;
+	}
+	if (used != head.length) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	sp->head = head;
+	sp->m = m;
+	sp->error = 0;
+	yuv_bands(decode_band, sp, sp->height[0]);
+
+	if (sp->error) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+void yuv_spool_fini(yuv_spool_t *sp)
+{
+	free(sp->buffer);
+	sp->buffer = NULL;
+}
@@ -0,0 +1,82 @@
+#ifndef _YUVSPOOL_H_
+#define _YUVSPOOL_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <yuv4mpeg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+** Lossless frame coding for spool files, the intermediate y4m written
+** between the passes of a two pass job.  utilyuv.c writes a spooled stream
+** with an XYUVSPOOL tag in the stream header and a coded frame after each
+** FRAME line, and decodes it again in yuv_read_frame(), so the tools read
+** a spool as they read y4m.
+**
+** Each plane is predicted from its left, upper and upper left neighbours
+** (the median predictor) and the residuals are written with Golomb-Rice
+** codes whose parameter follows the recent residuals.  Interlaced frames
+** are predicted from the row two above, in the same field.  A frame is cut
+** into slices of rows that are coded independently, so they are coded and
+** decoded on the yuv_bands() threads.  A slice that would code larger than
+** it is stays as it is.
+**
+** A coded frame is a struct yuv_spool_frame, the size of every slice, then
+** the slices.  Sizes are in the byte order of the machine that wrote them.
+*/
+
+#define YUV_SPOOL_TAG "XYUVSPOOL="
+#define YUV_SPOOL_VERSION 1
+#define YUV_SPOOL_MAGIC "YSF\n"
+// rows of the luma plane in a slice, and the most slices in a frame
+#define YUV_SPOOL_SLICE_ROWS 32
+#define YUV_SPOOL_MAX_SLICES 64
+// set in a slice size when the slice is stored as it is
+#define YUV_SPOOL_RAW 0x80000000u
+// the frame was predicted from the row two above
+#define YUV_SPOOL_FIELDS 1
+#define YUV_SPOOL_PLANES 4
+
+struct yuv_spool_frame {
+	char magic[4];
+	// bytes after this header, the slice sizes and the slices
+	uint32_t length;
+	uint16_t slices;
+	uint16_t flags;
+};
+
+typedef struct yuv_spool {
+	int planes;
+	int width[YUV_SPOOL_PLANES];
+	int height[YUV_SPOOL_PLANES];
+	int flags;
+	int slices;
+	// a coded slice each, slice_max bytes apart
+	uint8_t *buffer;
+	size_t slice_max;
+	struct yuv_spool_frame head;
+	uint32_t size[YUV_SPOOL_MAX_SLICES];
+	// the frame the bands are working on
+	uint8_t * const *m;
+	const uint8_t *data[YUV_SPOOL_MAX_SLICES];
+	int error;
+} yuv_spool_t;
+
+int yuv_spool_init(yuv_spool_t *sp, const y4m_stream_info_t *si);
+// the largest coded frame, with its header
+size_t yuv_spool_frame_max(const yuv_spool_t *sp);
+// codes a frame, iov gets YUV_SPOOL_MAX_SLICES + 2 entries at most, returns how many it used
+int yuv_spool_encode(yuv_spool_t *sp, uint8_t * const *m, struct iovec *iov);
+// decodes the coded frame of len bytes at frame, -1 if it is damaged
+int yuv_spool_decode(yuv_spool_t *sp, const uint8_t *frame, size_t len, uint8_t * const *m);
+void yuv_spool_fini(yuv_spool_t *sp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ *  yuvspoolcat.c
+ *    Mark Heath <mjpeg0 at silicontrip.org>
+ *  http://silicontrip.net/~mark/lavtools/
+ *
+** <h3>Lossless spool files</h3>
+** <p>Two pass jobs (yuvwater -d then the removal, yuvcrop -d then the crop,
+** yuvdiff against a reference file) keep the decoded video on disk between
+** the passes.  A spool file holds the same frames losslessly, typically in
+** half the space, and is read back faster than the raw y4m comes off a disk.
+** The tools read a spool wherever they read y4m: from stdin, as a yuvdiff
+** reference file, through yuvindex and yuvparallel.  Other programs can't,
+** yuvspoolcat -d turns it back into y4m for them.</p>
+** <p>yuvspoolcat copies y4m or a spool from stdin to a spool on stdout.  A
+** tool writes a spool itself when YUV_SPOOL is set and its output is a
+** file.  The frames are coded and decoded in slices on YUV_THREADS
+** threads.</p>
+** <h4>EXAMPLE</h4>
+** <pre>libav2yuv capture.mpg | yuvspoolcat &gt; capture.y4ms
+** yuvwater -d &lt; capture.y4ms &gt; mask.pgm
+** yuvwater -m mask.pgm &lt; capture.y4ms | yuvspoolcat -d | mpeg2enc -o clean.m2v
+** YUV_SPOOL=1 yuvcrop -d &lt; capture.y4ms &gt; cropped.y4ms</pre>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <yuv4mpeg.h>
+#include <mpegconsts.h>
+#include "utilyuv.h"
+
+#define VERSION "0.1"
+
+static void print_usage()
+{
+	fprintf (stderr,
+			 "usage: yuvspoolcat [-d] [-v 0..2] < in > out\n"
+			 "\t copies a y4m stream to a lossless spool file\n"
+			 "\t -d write plain y4m instead, to decode a spool for other programs\n"
+			 "\t -v Verbosity degree : 0=quiet, 1=normal, 2=verbose/debug\n"
+			 );
+}
+
+static void copy(int fdIn, int fdOut, y4m_stream_info_t *inStrInfo)
+{
+	y4m_frame_info_t in_frame ;
+	uint8_t *yuv_data[4] = { NULL, NULL, NULL, NULL };
+	int read_error_code ;
+	int write_error_code = Y4M_OK ;
+	int frames = 0 ;
+	int p;
+	off_t raw, written;
+
+	for (p=0; p<y4m_si_get_plane_count(inStrInfo); p++) {
+		yuv_data[p] = (uint8_t *)malloc(y4m_si_get_plane_length(inStrInfo,p));
+		if (yuv_data[p] == NULL)
+			mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
+	}
+
+	y4m_init_frame_info( &in_frame );
+	read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+
+	while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
+
+		if (read_error_code == Y4M_OK) {
+			write_error_code = yuv_write_frame( fdOut, inStrInfo, &in_frame, yuv_data );
+			frames++;
+		}
+
+		y4m_fini_frame_info( &in_frame );
+		y4m_init_frame_info( &in_frame );
+		read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+	}
+
+	// Clean-up regardless an error happened or not
+	y4m_fini_frame_info( &in_frame );
+	for (p=0; p<4; p++)
+		free(yuv_data[p]);
+
+	if( read_error_code != Y4M_ERR_EOF )
+		mjpeg_error_exit1 ("Error reading from input stream!");
+	if( write_error_code != Y4M_OK )
+		mjpeg_error_exit1 ("Error writing output stream!");
+
+	// only a file knows how much was written
+	raw = (off_t)frames * y4m_si_get_framelength(inStrInfo);
+	written = lseek(fdOut, 0, SEEK_CUR);
+	if (written > 0 && raw > 0)
+		mjpeg_info ("%d frames, %lld bytes, %.2f:1", frames, (long long)written, (double)raw / written);
+	else
+		mjpeg_info ("%d frames", frames);
+}
+
+// *************************************************************************************
+// MAIN
+// *************************************************************************************
+int main (int argc, char *argv[])
+{
+
+	int verbose = 1;
+	int fdIn = 0 ;
+	int fdOut = 1 ;
+	int decode = 0 ;
+	y4m_stream_info_t in_streaminfo ;
+	int c ;
+	const static char *legal_flags = "dv:h";
+
+	while ((c = getopt (argc, argv, legal_flags)) != -1) {
+		switch (c) {
+			case 'd':
+				decode = 1;
+				break;
+			case 'v':
+				verbose = atoi (optarg);
+				if (verbose < 0 || verbose > 2)
+					mjpeg_error_exit1 ("Verbose level must be [0..2]");
+				break;
+			case 'h':
+			case '?':
+				print_usage ();
+				return 0 ;
+				break;
+		}
+	}
+
+	// mjpeg tools global initialisations
+	mjpeg_default_handler_verbosity (verbose);
+
+	// Initialize input streams
+	y4m_init_stream_info (&in_streaminfo);
+
+	// the 444 with alpha planes are copied as well
+	y4m_accept_extensions(1);
+
+	// INPUT comes from stdin, we check for a correct file header
+	if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+		mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
+
+	mjpeg_info ("yuvspoolcat (version " VERSION ") copies y4m to and from lossless spool files");
+	if (yuv_spool_reading(fdIn))
+		mjpeg_debug ("input is a spool");
+
+	if (decode)
+		unsetenv("YUV_SPOOL");
+	else if (yuv_write_spool(fdOut))
+		mjpeg_error_exit1 ("Cannot write a spool");
+	if (yuv_write_stream_header(fdOut,&in_streaminfo) != Y4M_OK)
+		mjpeg_error_exit1 ("Could'nt write YUV4MPEG header!");
+
+	copy(fdIn, fdOut, &in_streaminfo);
+	y4m_fini_stream_info (&in_streaminfo);
+
+	return 0;
+}
+/*
+ * Local variables:
+ *  tab-width: 8
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,101 @@
+/*
+ *  yuvstage.c
+ *    Mark Heath <mjpeg0 at silicontrip.org>
+ *  http://silicontrip.net/~mark/lavtools/
+ *
+ * stage runner shared by the stand alone filters and yuvchain
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <yuv4mpeg.h>
+#include <mpegconsts.h>
+#include "utilyuv.h"
+#include "yuvstage.h"
+
+void yuvstage_reset_getopt(void)
+{
+#if defined(__GLIBC__)
+	optind = 0;
+#else
+	extern int optreset;
+	optreset = 1;
+	optind = 1;
+#endif
+}
+
+int yuvstage_run(struct yuvstage *st, void *priv, int fdIn, int fdOut,
+				 y4m_stream_info_t *in, y4m_stream_info_t *out)
+{
+	y4m_frame_info_t   in_frame ;
+	uint8_t            *yuv_data[3];
+	uint8_t            *yuv_odata[3];
+	uint8_t            **yuv_out;
+	int                read_error_code ;
+	int                write_error_code ;
+
+	if (chromalloc(yuv_data,in))
+		mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
+
+	yuv_out = yuv_data;
+	if (!st->inplace) {
+		if (chromalloc(yuv_odata,out)) {
+			chromafree(yuv_data);
+			mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
+		}
+		yuv_out = yuv_odata;
+	}
+
+	write_error_code = Y4M_OK ;
+
+	y4m_init_frame_info( &in_frame );
+	read_error_code = yuv_read_frame(fdIn, in, &in_frame, yuv_data );
+
+	while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
+
+		if (read_error_code == Y4M_OK) {
+			if (st->process(priv, yuv_data, yuv_out))
+				write_error_code = yuv_write_frame( fdOut, out, &in_frame, yuv_out );
+		}
+
+		y4m_fini_frame_info( &in_frame );
+		y4m_init_frame_info( &in_frame );
+		read_error_code = yuv_read_frame(fdIn, in, &in_frame, yuv_data );
+	}
+
+	// frames still held by temporal filters
+	y4m_fini_frame_info( &in_frame );
+	y4m_init_frame_info( &in_frame );
+	if (st->flush)
+		while (write_error_code == Y4M_OK && st->flush(priv, yuv_out))
+			write_error_code = yuv_write_frame( fdOut, out, &in_frame, yuv_out );
+
+	y4m_fini_frame_info( &in_frame );
+
+	chromafree(yuv_data);
+	if (!st->inplace)
+		chromafree(yuv_odata);
+
+	if( read_error_code != Y4M_ERR_EOF )
+		mjpeg_error_exit1 ("Error reading from input stream!");
+	if( write_error_code != Y4M_OK )
+		mjpeg_error_exit1 ("Error writing output stream!");
+
+	return 0;
+}
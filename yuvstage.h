@@ -0,0 +1,46 @@
+#ifndef _YUVSTAGE_H_
+#define _YUVSTAGE_H_
+
+#include <yuv4mpeg.h>
+#include <stdint.h>
+
+/*
+** A filter stage, the frame loop of a tool pulled out so that the tool
+** can run on its own or as one stage of yuvchain.
+**
+** init()    parses the command line (getopt) and returns the stage state,
+**           or NULL for a usage error.
+** config()  is given the input stream and fills in the output stream.
+** process() is given one input frame.  Returns 1 when a frame was written
+**           to out, 0 when the stage is holding frames (temporal filters).
+**           The stage may keep the input planes by swapping the pointers in
+**           in[] with planes of its own of the same size.
+** flush()   is called at the end of the stream until it returns 0, may be NULL.
+** fini()    frees the stage.
+**
+** Inplace stages modify the input and are given the same planes as in and out.
+*/
+
+struct yuvstage {
+	const char *name;
+	int inplace;
+	void *(*init)(int argc, char *argv[]);
+	int (*config)(void *priv, y4m_stream_info_t *in, y4m_stream_info_t *out);
+	int (*process)(void *priv, uint8_t **in, uint8_t **out);
+	int (*flush)(void *priv, uint8_t **out);
+	void (*fini)(void *priv);
+	void (*usage)(void);
+};
+
+extern struct yuvstage yuvadjust_stage;
+extern struct yuvstage yuvbilateral_stage;
+extern struct yuvstage yuvtbilateral_stage;
+
+// runs a stage over a y4m stream, the main loop of the stand alone tools
+int yuvstage_run(struct yuvstage *st, void *priv, int fdIn, int fdOut,
+				 y4m_stream_info_t *in, y4m_stream_info_t *out);
+
+// resets getopt so that the next stage can parse its own arguments
+void yuvstage_reset_getopt(void);
+
+#endif
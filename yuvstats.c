@@ -0,0 +1,361 @@
+/*
+ *  yuvstats.c
+ *    Mark Heath <mjpeg0 at silicontrip.org>
+ *  http://silicontrip.net/~mark/lavtools/
+ *
+ * binary per frame statistics files for the analysis tools
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "yuvstats.h"
+
+static int stats_type_width(int type)
+{
+	switch (type) {
+		case YUV_STATS_INT32: return 4;
+		case YUV_STATS_INT64: return 8;
+		case YUV_STATS_FLOAT: return 4;
+		case YUV_STATS_DOUBLE: return 8;
+	}
+	return 0;
+}
+
+const char *yuv_stats_type_name(int type)
+{
+	switch (type) {
+		case YUV_STATS_INT32: return "int32";
+		case YUV_STATS_INT64: return "int64";
+		case YUV_STATS_FLOAT: return "float";
+		case YUV_STATS_DOUBLE: return "double";
+	}
+	return "unknown";
+}
+
+// every column array starts 8 byte aligned, so the mapped values can be used in place
+static size_t stats_column_offset(const struct yuv_stats_column *c, int col, int rows)
+{
+	size_t o = sizeof(struct yuv_stats_block);
+	int k;
+
+	for (k = 0; k < col; k++)
+		o += ((size_t)c[k].width * rows + 7) & ~(size_t)7;
+	return o;
+}
+
+static int stats_write_all(int fd, const void *buf, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int yuv_stats_create(yuv_stats_t *st, const char *filename, const char *tool, int rate_n, int rate_d)
+{
+	memset(st, 0, sizeof(*st));
+	st->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (st->fd == -1)
+		return -1;
+
+	memcpy(st->hdr.magic, YUV_STATS_MAGIC, 8);
+	st->hdr.block_rows = YUV_STATS_BLOCK;
+	st->hdr.rate_n = rate_n;
+	st->hdr.rate_d = rate_d;
+	strncpy(st->hdr.tool, tool, sizeof(st->hdr.tool) - 1);
+	return 0;
+}
+
+int yuv_stats_add_column(yuv_stats_t *st, const char *name, int type)
+{
+	struct yuv_stats_column *c;
+
+	if (st->block || st->hdr.columns == YUV_STATS_MAX_COLUMNS || stats_type_width(type) == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	c = &st->column[st->hdr.columns];
+	strncpy(c->name, name, YUV_STATS_NAME - 1);
+	c->type = type;
+	c->width = stats_type_width(type);
+	return st->hdr.columns++;
+}
+
+// the columns are fixed from the first value, the header goes out then
+static int stats_start(yuv_stats_t *st)
+{
+	int c;
+
+	if (st->block)
+		return 0;
+	if (st->error)
+		return -1;
+
+	st->hdr.header_size = sizeof(st->hdr) + st->hdr.columns * sizeof(struct yuv_stats_column);
+	for (c = 0; c < st->hdr.columns; c++)
+		st->offset[c] = stats_column_offset(st->column, c, YUV_STATS_BLOCK);
+
+	st->block = (uint8_t *)calloc(1, stats_column_offset(st->column, st->hdr.columns, YUV_STATS_BLOCK));
+	if (st->block == NULL ||
+		stats_write_all(st->fd, &st->hdr, sizeof(st->hdr)) ||
+		stats_write_all(st->fd, st->column, st->hdr.columns * sizeof(struct yuv_stats_column))) {
+		st->error = errno;
+		return -1;
+	}
+	return 0;
+}
+
+void yuv_stats_set_int(yuv_stats_t *st, int col, int64_t v)
+{
+	uint8_t *p;
+
+	if (col < 0 || col >= st->hdr.columns || stats_start(st))
+		return;
+	p = st->block + st->offset[col];
+	switch (st->column[col].type) {
+		case YUV_STATS_INT32: ((int32_t *)p)[st->rows] = v; break;
+		case YUV_STATS_INT64: ((int64_t *)p)[st->rows] = v; break;
+		case YUV_STATS_FLOAT: ((float *)p)[st->rows] = v; break;
+		case YUV_STATS_DOUBLE: ((double *)p)[st->rows] = v; break;
+	}
+}
+
+void yuv_stats_set_float(yuv_stats_t *st, int col, double v)
+{
+	uint8_t *p;
+
+	if (col < 0 || col >= st->hdr.columns || stats_start(st))
+		return;
+	p = st->block + st->offset[col];
+	switch (st->column[col].type) {
+		case YUV_STATS_INT32: ((int32_t *)p)[st->rows] = v; break;
+		case YUV_STATS_INT64: ((int64_t *)p)[st->rows] = v; break;
+		case YUV_STATS_FLOAT: ((float *)p)[st->rows] = v; break;
+		case YUV_STATS_DOUBLE: ((double *)p)[st->rows] = v; break;
+	}
+}
+
+static int stats_flush(yuv_stats_t *st)
+{
+	struct yuv_stats_block *b = (struct yuv_stats_block *)st->block;
+	size_t to;
+	int c;
+
+	if (st->rows == 0)
+		return 0;
+
+	// a short last block has its columns moved up against each other
+	if (st->rows < YUV_STATS_BLOCK)
+		for (c = 1; c < st->hdr.columns; c++) {
+			to = stats_column_offset(st->column, c, st->rows);
+			memmove(st->block + to, st->block + st->offset[c], (size_t)st->column[c].width * st->rows);
+		}
+
+	memcpy(b->magic, YUV_STATS_BLOCK_MAGIC, 4);
+	b->rows = st->rows;
+	if (stats_write_all(st->fd, st->block, stats_column_offset(st->column, st->hdr.columns, st->rows))) {
+		st->error = errno;
+		return -1;
+	}
+	st->written += st->rows;
+	st->rows = 0;
+	memset(st->block, 0, stats_column_offset(st->column, st->hdr.columns, YUV_STATS_BLOCK));
+	return 0;
+}
+
+int yuv_stats_row(yuv_stats_t *st)
+{
+	if (stats_start(st))
+		return -1;
+	if (++st->rows == YUV_STATS_BLOCK)
+		return stats_flush(st);
+	return 0;
+}
+
+int yuv_stats_close(yuv_stats_t *st)
+{
+	int err;
+
+	// an empty file still gets its header
+	if (!stats_start(st))
+		stats_flush(st);
+	if (close(st->fd) && !st->error)
+		st->error = errno;
+	free(st->block);
+	st->block = NULL;
+
+	err = st->error;
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+int yuv_stats_open(yuv_stats_map_t *sm, const char *filename)
+{
+	const struct yuv_stats_block *b;
+	struct stat st;
+	size_t rest, last;
+	int fd, c;
+
+	memset(sm, 0, sizeof(*sm));
+	fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+	if (st.st_size < sizeof(struct yuv_stats_header)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	sm->length = st.st_size;
+	sm->map = mmap(NULL, sm->length, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (sm->map == MAP_FAILED) {
+		sm->map = NULL;
+		return -1;
+	}
+
+	sm->hdr = (const struct yuv_stats_header *)sm->map;
+	sm->column = (const struct yuv_stats_column *)(sm->map + sizeof(struct yuv_stats_header));
+	sm->columns = sm->hdr->columns;
+	if (memcmp(sm->hdr->magic, YUV_STATS_MAGIC, 8) ||
+		sm->columns < 0 || sm->columns > YUV_STATS_MAX_COLUMNS || sm->hdr->block_rows <= 0 ||
+		sm->hdr->header_size != sizeof(struct yuv_stats_header) + sm->columns * sizeof(struct yuv_stats_column) ||
+		sm->hdr->header_size > sm->length)
+		goto invalid;
+	for (c = 0; c < sm->columns; c++)
+		if (sm->column[c].width != stats_type_width(sm->column[c].type))
+			goto invalid;
+
+	for (c = 0; c < sm->columns; c++)
+		sm->offset[c] = stats_column_offset(sm->column, c, sm->hdr->block_rows);
+	sm->block_size = stats_column_offset(sm->column, sm->columns, sm->hdr->block_rows);
+
+	// whole blocks, then a short last block if it has all been written
+	rest = sm->length - sm->hdr->header_size;
+	sm->blocks = rest / sm->block_size;
+	sm->rows = (int64_t)sm->blocks * sm->hdr->block_rows;
+	rest -= sm->blocks * sm->block_size;
+	if (rest >= sizeof(struct yuv_stats_block)) {
+		b = (const struct yuv_stats_block *)(sm->map + sm->hdr->header_size + sm->blocks * sm->block_size);
+		last = stats_column_offset(sm->column, sm->columns, b->rows);
+		if (!memcmp(b->magic, YUV_STATS_BLOCK_MAGIC, 4) && b->rows > 0 && b->rows < sm->hdr->block_rows && last <= rest) {
+			sm->blocks++;
+			sm->rows += b->rows;
+		}
+	}
+	return 0;
+
+invalid:
+	yuv_stats_close_map(sm);
+	errno = EINVAL;
+	return -1;
+}
+
+int yuv_stats_find(const yuv_stats_map_t *sm, const char *name)
+{
+	int c;
+
+	for (c = 0; c < sm->columns; c++)
+		if (!strncmp(sm->column[c].name, name, YUV_STATS_NAME))
+			return c;
+	return -1;
+}
+
+const void *yuv_stats_column(const yuv_stats_map_t *sm, int col, int b, int *rows)
+{
+	const uint8_t *p;
+	int n;
+
+	if (col < 0 || col >= sm->columns || b < 0 || b >= sm->blocks)
+		return NULL;
+	p = sm->map + sm->hdr->header_size + (size_t)b * sm->block_size;
+	n = ((const struct yuv_stats_block *)p)->rows;
+	if (rows)
+		*rows = n;
+	if (n == sm->hdr->block_rows)
+		return p + sm->offset[col];
+	return p + stats_column_offset(sm->column, col, n);
+}
+
+double yuv_stats_get(const yuv_stats_map_t *sm, int col, int64_t row)
+{
+	const void *p;
+
+	if (row < 0 || row >= sm->rows)
+		return 0;
+	p = yuv_stats_column(sm, col, row / sm->hdr->block_rows, NULL);
+	if (p == NULL)
+		return 0;
+	row %= sm->hdr->block_rows;
+	switch (sm->column[col].type) {
+		case YUV_STATS_INT32: return ((const int32_t *)p)[row];
+		case YUV_STATS_INT64: return ((const int64_t *)p)[row];
+		case YUV_STATS_FLOAT: return ((const float *)p)[row];
+		case YUV_STATS_DOUBLE: return ((const double *)p)[row];
+	}
+	return 0;
+}
+
+int64_t yuv_stats_get_int(const yuv_stats_map_t *sm, int col, int64_t row)
+{
+	const void *p;
+
+	if (row < 0 || row >= sm->rows)
+		return 0;
+	p = yuv_stats_column(sm, col, row / sm->hdr->block_rows, NULL);
+	if (p == NULL)
+		return 0;
+	row %= sm->hdr->block_rows;
+	switch (sm->column[col].type) {
+		case YUV_STATS_INT32: return ((const int32_t *)p)[row];
+		case YUV_STATS_INT64: return ((const int64_t *)p)[row];
+		case YUV_STATS_FLOAT: return ((const float *)p)[row];
+		case YUV_STATS_DOUBLE: return ((const double *)p)[row];
+	}
+	return 0;
+}
+
+void yuv_stats_close_map(yuv_stats_map_t *sm)
+{
+	if (sm->map)
+		munmap(sm->map, sm->length);
+	sm->map = NULL;
+}
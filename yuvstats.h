@@ -0,0 +1,114 @@
+#ifndef _YUVSTATS_H_
+#define _YUVSTATS_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+** Per frame statistics in a binary file, for the analysis tools (-B).
+**
+** The file is a header naming the columns and their types, then blocks of
+** YUV_STATS_BLOCK rows.  In a block each column is one array, so reading a
+** column only touches that column.  The writer only appends and writes a
+** block with one write(), so a file can be read while it is being written,
+** up to the last whole block.  Only the last block may be short.
+** Values are in the byte order of the machine that wrote them.
+**
+** Writing: yuv_stats_create(), yuv_stats_add_column() for each column, then
+** for each row yuv_stats_set_int() or yuv_stats_set_float() for the columns
+** and yuv_stats_row().  yuv_stats_close() writes the last block.
+**
+** Reading maps the file: yuv_stats_open(), yuv_stats_find() for a column,
+** yuv_stats_get() for a value or yuv_stats_column() for a block's array.
+**
+** Nothing is logged, the functions return -1 with errno set.
+*/
+
+#define YUV_STATS_MAGIC "YSTATS1\n"
+#define YUV_STATS_BLOCK_MAGIC "YSB\n"
+#define YUV_STATS_BLOCK 4096
+#define YUV_STATS_MAX_COLUMNS 64
+#define YUV_STATS_NAME 24
+
+#define YUV_STATS_INT32 1
+#define YUV_STATS_INT64 2
+#define YUV_STATS_FLOAT 3
+#define YUV_STATS_DOUBLE 4
+
+struct yuv_stats_header {
+	char magic[8];
+	int32_t header_size;
+	int32_t columns;
+	int32_t block_rows;
+	// frame rate of the rows, 0:0 when they are not frames
+	int32_t rate_n;
+	int32_t rate_d;
+	int32_t reserved;
+	char tool[32];
+};
+
+struct yuv_stats_column {
+	char name[YUV_STATS_NAME];
+	int32_t type;
+	int32_t width;
+};
+
+struct yuv_stats_block {
+	char magic[4];
+	int32_t rows;
+};
+
+typedef struct {
+	int fd;
+	struct yuv_stats_header hdr;
+	struct yuv_stats_column column[YUV_STATS_MAX_COLUMNS];
+	// the block being filled, its columns are YUV_STATS_BLOCK rows apart
+	uint8_t *block;
+	size_t offset[YUV_STATS_MAX_COLUMNS];
+	int rows;
+	int64_t written;
+	int error;
+} yuv_stats_t;
+
+int yuv_stats_create(yuv_stats_t *st, const char *filename, const char *tool, int rate_n, int rate_d);
+// returns the column number, all columns are added before the first row
+int yuv_stats_add_column(yuv_stats_t *st, const char *name, int type);
+void yuv_stats_set_int(yuv_stats_t *st, int col, int64_t v);
+void yuv_stats_set_float(yuv_stats_t *st, int col, double v);
+int yuv_stats_row(yuv_stats_t *st);
+// -1 if any write failed
+int yuv_stats_close(yuv_stats_t *st);
+
+typedef struct {
+	uint8_t *map;
+	size_t length;
+	const struct yuv_stats_header *hdr;
+	const struct yuv_stats_column *column;
+	int columns;
+	int blocks;
+	int64_t rows;
+	// bytes of a whole block and where its columns start
+	size_t block_size;
+	size_t offset[YUV_STATS_MAX_COLUMNS];
+} yuv_stats_map_t;
+
+int yuv_stats_open(yuv_stats_map_t *sm, const char *filename);
+// the column number of name, -1 if there isn't one
+int yuv_stats_find(const yuv_stats_map_t *sm, const char *name);
+// the array of column col in block b, *rows is set to its length
+const void *yuv_stats_column(const yuv_stats_map_t *sm, int col, int b, int *rows);
+double yuv_stats_get(const yuv_stats_map_t *sm, int col, int64_t row);
+int64_t yuv_stats_get_int(const yuv_stats_map_t *sm, int col, int64_t row);
+void yuv_stats_close_map(yuv_stats_map_t *sm);
+
+const char *yuv_stats_type_name(int type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,248 @@
+/*
+ *  yuvstatsdump.c
+ *    Mark Heath <mjpeg0 at silicontrip.org>
+ *  http://silicontrip.net/~mark/lavtools/
+ *
+** <h3>Statistics file export</h3>
+** <p>The analysis tools (yuvvalues, yuvdiff -g, yuvtout -d, yuvaddetect and
+** libav-bitrate) can write their per frame numbers to a binary statistics
+** file with -B instead of printing them.  The file has a typed array per
+** column and is mapped rather than parsed, so a query over hours of
+** frames does not re-read any text.  yuvstatsdump prints a file as the
+** text the tool would have printed, space separated for gnuplot, or as
+** CSV with a line of column names.</p>
+** <p>-f picks columns by name, -s and -n a range of rows.  -t prints a
+** frame number column as a timecode as well, from the frame rate kept in
+** the file (-d for drop frame).</p>
+** <h4>EXAMPLE</h4>
+** <pre>libav2yuv -dk -m archive.mpg | yuvvalues -B archive.ystats
+** yuvstatsdump -t frame archive.ystats &gt; values.txt
+** yuvstatsdump -c -f frame,yavg archive.ystats &gt; luma.csv</pre>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <yuv4mpeg.h>
+#include <mpegconsts.h>
+#include "utilyuv.h"
+#include "yuvstats.h"
+
+#define VERSION "0.1"
+
+static void print_usage()
+{
+	fprintf (stderr,
+			 "usage: yuvstatsdump [-c] [-i] [-f col,col...] [-s first] [-n rows] [-t col [-d]] file.ystats\n"
+			 "\t prints a statistics file written with -B as text\n"
+			 "\t -c comma separated with a line of column names\n"
+			 "\t -i print the columns and the number of rows only\n"
+			 "\t -f print these columns only\n"
+			 "\t -s first row to print (from 0)\n"
+			 "\t -n number of rows to print\n"
+			 "\t -t print the frame numbers in this column as timecode too\n"
+			 "\t -d use NTSC drop frame timecode\n"
+			 "\t -v Verbosity degree : 0=quiet, 1=normal, 2=verbose/debug\n"
+			 );
+}
+
+static void print_value(const yuv_stats_map_t *sm, int col, const void *p, int row)
+{
+	switch (sm->column[col].type) {
+		case YUV_STATS_INT32: printf ("%d", ((const int32_t *)p)[row]); break;
+		case YUV_STATS_INT64: printf ("%lld", (long long)((const int64_t *)p)[row]); break;
+		case YUV_STATS_FLOAT: printf ("%g", ((const float *)p)[row]); break;
+		case YUV_STATS_DOUBLE: printf ("%.12g", ((const double *)p)[row]); break;
+	}
+}
+
+static void print_timecode(y4m_stream_info_t *si, int fc, int df)
+{
+	int tch,tcm,tcs,tcf;
+
+	framecount2timecode(si, &tch,&tcm,&tcs,&tcf, fc, &df);
+	printf ("%02d:%02d:%02d%c%02d",tch,tcm,tcs,df?';':':',tcf);
+}
+
+static void dump(const yuv_stats_map_t *sm, int *cols, int ncols, int64_t first, int64_t count,
+				 int csv, int tc, int df)
+{
+	const void *p[YUV_STATS_MAX_COLUMNS];
+	const char *sep = csv ? "," : " ";
+	y4m_stream_info_t si;
+	y4m_ratio_t rate;
+	int64_t end, row;
+	int b, rows, i, r;
+
+	y4m_init_stream_info(&si);
+	rate.n = sm->hdr->rate_n;
+	rate.d = sm->hdr->rate_d;
+	y4m_si_set_framerate(&si, rate);
+
+	if (csv) {
+		for (i = 0; i < ncols; i++) {
+			printf ("%s%.*s", i ? sep : "", YUV_STATS_NAME, sm->column[cols[i]].name);
+			if (cols[i] == tc)
+				printf ("%stimecode", sep);
+		}
+		printf ("\n");
+	}
+
+	end = sm->rows;
+	if (count >= 0 && first + count < end)
+		end = first + count;
+
+	// a block at a time, the column arrays are used where they are mapped
+	for (row = first; row < end; ) {
+		b = row / sm->hdr->block_rows;
+		for (i = 0; i < ncols; i++)
+			p[i] = yuv_stats_column(sm, cols[i], b, &rows);
+		for (r = row % sm->hdr->block_rows; r < rows && row < end; r++, row++) {
+			for (i = 0; i < ncols; i++) {
+				if (i)
+					printf ("%s", sep);
+				print_value(sm, cols[i], p[i], r);
+				if (cols[i] == tc) {
+					printf ("%s", sep);
+					print_timecode(&si, yuv_stats_get_int(sm, tc, row), df);
+				}
+			}
+			printf ("\n");
+		}
+	}
+
+	y4m_fini_stream_info(&si);
+}
+
+static void info(const yuv_stats_map_t *sm, const char *filename)
+{
+	int c;
+
+	printf ("%s: written by %.32s, %lld rows", filename, sm->hdr->tool, (long long)sm->rows);
+	if (sm->hdr->rate_d)
+		printf (" at %d:%d", sm->hdr->rate_n, sm->hdr->rate_d);
+	printf ("\n");
+	for (c = 0; c < sm->columns; c++)
+		printf ("%3d %-24.*s %s\n", c, YUV_STATS_NAME, sm->column[c].name, yuv_stats_type_name(sm->column[c].type));
+}
+
+// *************************************************************************************
+// MAIN
+// *************************************************************************************
+int main (int argc, char *argv[])
+{
+
+	int verbose = 1;
+	yuv_stats_map_t sm;
+	int cols[YUV_STATS_MAX_COLUMNS];
+	int ncols = 0, csv = 0, show_info = 0, drop_frame = 0, tc = -1;
+	char *fields = NULL, *tcname = NULL, *name;
+	int64_t first = 0, count = -1;
+	int c;
+	const static char *legal_flags = "cidf:s:n:t:v:h";
+
+	while ((c = getopt (argc, argv, legal_flags)) != -1) {
+		switch (c) {
+			case 'c':
+				csv = 1;
+				break;
+			case 'i':
+				show_info = 1;
+				break;
+			case 'd':
+				drop_frame = 1;
+				break;
+			case 'f':
+				fields = optarg;
+				break;
+			case 's':
+				first = atoll(optarg);
+				break;
+			case 'n':
+				count = atoll(optarg);
+				break;
+			case 't':
+				tcname = optarg;
+				break;
+			case 'v':
+				verbose = atoi (optarg);
+				if (verbose < 0 || verbose > 2)
+					mjpeg_error_exit1 ("Verbose level must be [0..2]");
+				break;
+			case 'h':
+			case '?':
+				print_usage ();
+				return 0 ;
+				break;
+		}
+	}
+
+	if (optind != argc - 1) {
+		print_usage ();
+		return 0 ;
+	}
+
+	// mjpeg tools global initialisations
+	mjpeg_default_handler_verbosity (verbose);
+
+	if (yuv_stats_open(&sm, argv[optind]))
+		mjpeg_error_exit1 ("%s is not a readable statistics file", argv[optind]);
+
+	if (show_info) {
+		info(&sm, argv[optind]);
+		yuv_stats_close_map(&sm);
+		return 0;
+	}
+
+	if (fields) {
+		for (name = strtok(fields, ","); name; name = strtok(NULL, ",")) {
+			if (ncols == YUV_STATS_MAX_COLUMNS)
+				mjpeg_error_exit1 ("Too many columns");
+			cols[ncols] = yuv_stats_find(&sm, name);
+			if (cols[ncols] == -1)
+				mjpeg_error_exit1 ("There is no column %s in %s", name, argv[optind]);
+			ncols++;
+		}
+	} else {
+		for (ncols = 0; ncols < sm.columns; ncols++)
+			cols[ncols] = ncols;
+	}
+
+	if (tcname) {
+		tc = yuv_stats_find(&sm, tcname);
+		if (tc == -1)
+			mjpeg_error_exit1 ("There is no column %s in %s", tcname, argv[optind]);
+		if (sm.hdr->rate_n == 0 || sm.hdr->rate_d == 0)
+			mjpeg_error_exit1 ("%s has no frame rate for a timecode", argv[optind]);
+	}
+
+	if (first < 0)
+		first = 0;
+	dump(&sm, cols, ncols, first, count, csv, tc, drop_frame);
+
+	yuv_stats_close_map(&sm);
+	return 0;
+}
+/*
+ * Local variables:
+ *  tab-width: 8
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -345,28 +345,29 @@ static void filter(  int fdIn, int fdOut , y4m_stream_info_t  *inStrInfo, FT_Fac
 
 
 	y4m_init_frame_info( &in_frame );
-	read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
-	framecounter++;
-	while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
-
-		// do work
+	do {
+		framecounter++;
 
 	//	mjpeg_info("frame: %d",framecounter);
-		if (read_error_code == Y4M_OK) {
-
-			text=get_sub(subs,framecounter);
-			if (text != '\0') {
+		text=get_sub(subs,framecounter);
+		if (text == NULL) {
+			// no subtitle on this frame, it is copied without being read in
+			read_error_code = yuv_pass_frame(fdIn, fdOut, inStrInfo, &in_frame);
+			// part of it may have been written, the stream can't go on
+			if (read_error_code != Y4M_OK && read_error_code != Y4M_ERR_EOF)
+				break;
+		} else {
+			read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+			if (read_error_code == Y4M_OK) {
 				filterframe(yuv_data,inStrInfo,face,text,pen_y,yc,uc,vc,yadvance);
+				write_error_code = yuv_write_frame( fdOut, inStrInfo, &in_frame, yuv_data );
 			}
-			write_error_code = y4m_write_frame( fdOut, inStrInfo, &in_frame, yuv_data );
 		}
 
 		y4m_fini_frame_info( &in_frame );
 		y4m_init_frame_info( &in_frame );
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
-		framecounter++;
 
-	}
+	} while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK );
 	// Clean-up regardless an error happened or not
 	y4m_fini_frame_info( &in_frame );
 
@@ -579,7 +580,7 @@ int main (int argc, char *argv[])
 	// The streaminfo structure is filled in
 	// ***************************************************************
 	// INPUT comes from stdin, we check for a correct file header
-	if (y4m_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+	if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
 		mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
 
 	// Information output
@@ -592,7 +593,7 @@ int main (int argc, char *argv[])
 	}
 
 
-	y4m_write_stream_header(fdOut,&in_streaminfo);
+	yuv_write_stream_header(fdOut,&in_streaminfo);
 
 	if (subname != NULL) {
 	// read the subtitle file
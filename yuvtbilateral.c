@@ -23,6 +23,8 @@
 ** </p>
 ** <h4>History</h4>
 ** <p>6-Nov-2011 added y4m accept extensions. To allow for other chroma subsampling.</p>
+** <p>Now outputs every frame, the first and last frames are repeated to fill the window at the ends of the stream.
+** Can be run as a yuvchain stage.</p>
 
 
  *
@@ -55,6 +57,7 @@
 #include <yuv4mpeg.h>
 #include <mpegconsts.h>
 #include "utilyuv.h"
+#include "yuvstage.h"
 
 #define VERSION "0.1"
 
@@ -77,11 +80,16 @@ struct parameters {
 	unsigned int twoSigmaRSquared;
 
 	int direction;
+	int verbose;
 
-};
+	y4m_stream_info_t si;
 
-static struct parameters this;
+	// temporal window
+	uint8_t ***yuv_data;
+	int frames_in;
+	int frames_out;
 
+};
 
 static void print_usage()
 {
@@ -93,7 +101,7 @@ static void print_usage()
 }
 
 
-unsigned int gauss (unsigned int sigma, int x, int y) {
+static unsigned int gauss (unsigned int sigma, int x, int y) {
 
 	// fprintf (stderr,"%f , %d %d\n", (1.0* sigma/PRECISION) ,x,y);
 
@@ -102,52 +110,46 @@ unsigned int gauss (unsigned int sigma, int x, int y) {
 	return (exp(-((1.0 * x * x) / (2.0 * (1.0* sigma/PRECISION) * (1.0*sigma/PRECISION))))) * PRECISION;
 }
 
-unsigned int similarity(int p, int s) {
+static inline unsigned int similarity(struct parameters *this, int p, int s) {
 	// this equals: Math.exp(-(( Math.abs(p-s)) /  2 * this.sigmaR * this.sigmaR));
 	// but is precomputed to improve performance
-		return this.gaussSimilarity[abs(p-s)];
+		return this->gaussSimilarity[abs(p-s)];
 
 }
 
-static void filterinitialize () {
+static void filterinitialize (struct parameters *this) {
 
 	// int center;
 	int x,i;
 
-	this.kernelRadius = this.sigmaD>this.sigmaR?this.sigmaD * 2:this.sigmaR * 2;
-	this.kernelRadius = this.kernelRadius / PRECISION;
+	this->kernelRadius = this->sigmaD>this->sigmaR?this->sigmaD * 2:this->sigmaR * 2;
+	this->kernelRadius = this->kernelRadius / PRECISION;
 
-//	this.twoSigmaRSquared = (2 * (1.0 *this.sigmaR/PRECISION)  * (1.0 *this.sigmaR/PRECISION)) * PRECISION;
-	this.twoSigmaRSquared = (2 * (this.sigmaR * this.sigmaR)/PRECISION);
+//	this->twoSigmaRSquared = (2 * (1.0 *this->sigmaR/PRECISION)  * (1.0 *this->sigmaR/PRECISION)) * PRECISION;
+	this->twoSigmaRSquared = (2 * (this->sigmaR * this->sigmaR)/PRECISION);
 
 
-	this.kernelSize = this.kernelRadius * 2 + 1;
-	// center = (this.kernelSize - 1) / 2;
+	this->kernelSize = this->kernelRadius * 2 + 1;
+	// center = (this->kernelSize - 1) / 2;
 
 
-	this.kernelD = (unsigned int*) malloc( sizeof (unsigned int) * this.kernelSize );
+	this->kernelD = (unsigned int*) malloc( sizeof (unsigned int) * this->kernelSize );
 
-	if (this.kernelD == NULL ){
+	if (this->kernelD == NULL ){
 		mjpeg_error_exit1("Cannot allocate memory for filter kernel");
 	}
 
-// fprintf(stderr,"size %d, radius %d \n",this.kernelSize,this.kernelRadius);
-
-	// x = -center;
-	//fprintf (stderr,"x %d < %d\n",x,this.kernelSize - center);
+// fprintf(stderr,"size %d, radius %d \n",this->kernelSize,this->kernelRadius);
 
-
-	for ( x=0; x < this.kernelSize ; x++) {
+	for ( x=0; x < this->kernelSize ; x++) {
 	//	fprintf (stderr,"x %d\n",x);
-		this.kernelD[x] = gauss(this.sigmaD, x-this.kernelRadius, 0);
-	//fprintf(stderr,"x: %d  = %d\n",x,this.kernelD[x]);
+		this->kernelD[x] = gauss(this->sigmaD, x-this->kernelRadius, 0);
+	//fprintf(stderr,"x: %d  = %d\n",x,this->kernelD[x]);
 	}
 
-	// fprintf (stderr,"gauss Similarity malloc\n",i);
-
-	this.gaussSimilarity = (unsigned int*) malloc(sizeof (unsigned int) * 256);
-	if (this.gaussSimilarity == NULL ){
-		free(this.kernelD);
+	this->gaussSimilarity = (unsigned int*) malloc(sizeof (unsigned int) * 256);
+	if (this->gaussSimilarity == NULL ){
+		free(this->kernelD);
 		mjpeg_error_exit1("Cannot allocate memory for gaussian curve");
 	}
 
@@ -155,7 +157,7 @@ static void filterinitialize () {
 	// performance reasons
 	for ( i = 0; i < 256; i++) {
 		//fprintf (stderr,"i %d\n",i);
-		this.gaussSimilarity[i] = exp(-((i) / (1.0 * this.twoSigmaRSquared/PRECISION))) * PRECISION;
+		this->gaussSimilarity[i] = exp(-((i) / (1.0 * this->twoSigmaRSquared/PRECISION))) * PRECISION;
 	}
 
 
@@ -163,7 +165,7 @@ static void filterinitialize () {
 
 
 
-static void filterpixel(uint8_t **o, uint8_t ***p,int chan, int i, int j, int w, int h) {
+static void filterpixel(struct parameters *this, uint8_t **o, uint8_t ***p,int chan, int i, int j, int w, int h) {
 
 	unsigned int sum =0;
 	unsigned int totalWeight = 0;
@@ -172,16 +174,14 @@ static void filterpixel(uint8_t **o, uint8_t ***p,int chan, int i, int j, int w,
 	int pixel_loc;
 
 	pixel_loc = j * w + i;
-	uint8_t intensityCenter = p[this.kernelRadius][chan][pixel_loc];
+	uint8_t intensityCenter = p[this->kernelRadius][chan][pixel_loc];
 
-	for ( z = 0; z < this.kernelSize; z++) {
+	for ( z = 0; z < this->kernelSize; z++) {
 
 		int intensityKernelPos = p[z][chan][pixel_loc];
 
-		//fprintf (stderr,"kernel D %d. kp %d cen %d\n",this.kernelD[z],intensityKernelPos,intensityCenter);
-
 		// multiplying two fixed precision numbers together squares the PRECISION. So need to remove it.
-		weight = this.kernelD[z] * similarity(intensityKernelPos,intensityCenter) / PRECISION;
+		weight = this->kernelD[z] * similarity(this,intensityKernelPos,intensityCenter) / PRECISION;
 		totalWeight += weight;
 		sum += (weight * intensityKernelPos);
 
@@ -194,28 +194,28 @@ static void filterpixel(uint8_t **o, uint8_t ***p,int chan, int i, int j, int w,
 
 }
 
-static void filterframe (uint8_t *m[3], uint8_t ***n, y4m_stream_info_t *si)
+static void filterframe (struct parameters *this, uint8_t *m[3], uint8_t ***n)
 {
 
 	int x,y;
 	int height,width,height2,width2;
 
-	height=y4m_si_get_plane_height(si,0);
-	width=y4m_si_get_plane_width(si,0);
+	height=y4m_si_get_plane_height(&this->si,0);
+	width=y4m_si_get_plane_width(&this->si,0);
 
 	// I'll assume that the chroma subsampling is the same for both u and v channels
-	height2=y4m_si_get_plane_height(si,1);
-	width2=y4m_si_get_plane_width(si,1);
+	height2=y4m_si_get_plane_height(&this->si,1);
+	width2=y4m_si_get_plane_width(&this->si,1);
 
 
 	for (y=0; y < height; y++) {
 		for (x=0; x < width; x++) {
 
-			filterpixel(m,n,0,x,y,width,height);
+			filterpixel(this,m,n,0,x,y,width,height);
 
 			if (x<width2 && y<height2) {
-				filterpixel(m,n,1,x,y,width2,height2);
-				filterpixel(m,n,2,x,y,width2,height2);
+				filterpixel(this,m,n,1,x,y,width2,height2);
+				filterpixel(this,m,n,2,x,y,width2,height2);
 			}
 
 		}
@@ -223,176 +223,174 @@ static void filterframe (uint8_t *m[3], uint8_t ***n, y4m_stream_info_t *si)
 
 }
 
-// temporal filter loop
-static void filter(  int fdIn ,int fdOut , y4m_stream_info_t  *inStrInfo )
+// *************************************************************************************
+// STAGE
+// *************************************************************************************
+
+static void *filter_init (int argc, char *argv[])
 {
-	y4m_frame_info_t   in_frame ;
-	uint8_t            ***yuv_data;
-	uint8_t				*yuv_odata[3];
-	uint8_t				**temp_yuv;
-	int                read_error_code ;
-	int                write_error_code ;
-	int c,d;
-
-	// Allocate memory for the YUV channels
-	// may move these off into utility functions
-	if (chromalloc(yuv_odata,inStrInfo))
-		mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
-
-	// sanity check!!!
-	yuv_data= (uint8_t ***) malloc(sizeof (uint8_t *) * this.kernelSize);
-	if (yuv_data == NULL) {
-		chromafree(yuv_odata);
-		mjpeg_error_exit1("cannot allocate memory for frame buffer");
-	}
-	for (c=0;c<this.kernelSize;c++) {
-		yuv_data[c] = (uint8_t **) malloc(sizeof (uint8_t *) * 3);
-		if (yuv_data[c] == NULL) {
-			// how am I going to keep track of what I've allocated?
-			mjpeg_error_exit1("cannot allocate memory for frame buffer");
-		}
-		if(chromalloc(yuv_data[c],inStrInfo)) {
-			mjpeg_error_exit1("cannot allocate memory for frame buffer");
-		}
-	}
+	struct parameters *this;
+	float sigma;
+	int c ;
+	const static char *legal_flags = "?hv:r:d:";
 
-	/* Initialize counters */
+	this = (struct parameters *)calloc(1, sizeof(struct parameters));
+	if (this == NULL)
+		mjpeg_error_exit1("Cannot allocate memory for filter parameters");
 
-	write_error_code = Y4M_OK ;
+	this->verbose = 4; // LOG_ERROR ;
 
-	y4m_init_frame_info( &in_frame );
-	read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data[this.kernelSize-1] );
+	while ((c = getopt (argc, argv, legal_flags)) != -1) {
+		switch (c) {
+			case 'v':
+				this->verbose = atoi (optarg);
+				if (this->verbose < 0 || this->verbose > 2)
+					mjpeg_error_exit1 ("Verbose level must be [0..2]");
+				break;
+
+			case 'h':
+			case '?':
+				free(this);
+				return NULL;
+				break;
+			case 'r':
+				sigma = atof(optarg);
+				this->sigmaR = sigma * PRECISION;
+				break;
+			case 'd':
+				sigma = atof(optarg);
+				this->sigmaD = sigma * PRECISION;
+				break;
 
-	//init loop mode
-	for (c=this.kernelSize-1;c>0;c--) {
-		chromacpy(yuv_data[c-1],yuv_data[c],inStrInfo);
-	}
 
-	for(d=1;d<this.kernelRadius;d++) {
-		y4m_fini_frame_info( &in_frame );
-		y4m_init_frame_info( &in_frame );
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data[this.kernelSize-1] );
-		// shuffle
-		// should use pointers...
-
-		temp_yuv = yuv_data[0];
-		for (c=0;c<this.kernelSize-1;c++) {
-	//		chromacpy(yuv_data[c],yuv_data[c+1],inStrInfo);
-			yuv_data[c] = yuv_data[c+1];
 		}
-		yuv_data[this.kernelSize-1] = temp_yuv;
+	}
+
+	if (this->sigmaR == 0 || this->sigmaD == 0) {
+		print_usage();
+		mjpeg_error_exit1("Sigma D and R must be set");
 
 	}
 
-	while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
+	filterinitialize (this);
 
-		// do work
-		if (read_error_code == Y4M_OK) {
-			filterframe(yuv_odata,yuv_data,inStrInfo);
-			write_error_code = y4m_write_frame( fdOut, inStrInfo, &in_frame, yuv_odata );
-		}
+	return this;
+}
 
-		y4m_fini_frame_info( &in_frame );
-		y4m_init_frame_info( &in_frame );
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data[this.kernelSize-1] );
-		// shuffle
-		temp_yuv = yuv_data[0];
-		for (c=0;c<this.kernelSize-1;c++) {
-			// should use pointers...
-			//		chromacpy(yuv_data[c],yuv_data[c+1],inStrInfo);
-			yuv_data[c] = yuv_data[c+1];
-		}
-		yuv_data[this.kernelSize-1] = temp_yuv;
+static int filter_config (void *priv, y4m_stream_info_t *in, y4m_stream_info_t *out)
+{
+	struct parameters *this = priv;
 
-	}
-	// finalise loop
-	for(c=0;c<this.kernelRadius;c++) {
-		if (read_error_code == Y4M_OK) {
-			filterframe(yuv_odata,yuv_data,inStrInfo);
-			write_error_code = y4m_write_frame( fdOut, inStrInfo, &in_frame, yuv_odata );
-		}
+	y4m_init_stream_info(&this->si);
+	y4m_copy_stream_info(&this->si, in);
+	y4m_copy_stream_info(out, in);
 
-		y4m_fini_frame_info( &in_frame );
-		y4m_init_frame_info( &in_frame );
+	// temporal window, the newest frame is at the end
+	if (temporalalloc(&this->yuv_data,in,this->kernelSize))
+		mjpeg_error_exit1("cannot allocate memory for frame buffer");
 
-		// shuffle
-		temp_yuv = yuv_data[0];
-		for (c=0;c<this.kernelSize-1;c++) {
-			// should use pointers...
-			//		chromacpy(yuv_data[c],yuv_data[c+1],inStrInfo);
-			yuv_data[c] = yuv_data[c+1];
-		}
-		yuv_data[this.kernelSize-1] = temp_yuv;
+	this->frames_in = 0;
+	this->frames_out = 0;
 
+	return 0;
+}
+
+/*
+** Frame n goes into the end of the window, so the centre of the window is
+** frame n - radius.  The first frame is repeated before the start of the
+** stream and the last frame after the end, so every input frame has an output.
+*/
+static int filter_process (void *priv, uint8_t **in, uint8_t **out)
+{
+	struct parameters *this = priv;
+	uint8_t **slot;
+	uint8_t *temp;
+	int c;
+
+	// the window moves on below, so slot 0 is the one not needed
+	if (this->frames_in == 0)
+		for (c=1;c<this->kernelSize;c++)
+			chromacpy(this->yuv_data[c],in,&this->si);
+
+	// take the input planes into the window and give the host the oldest planes
+	temporalshuffle(this->yuv_data,this->kernelSize);
+	slot = this->yuv_data[this->kernelSize-1];
+	for (c=0;c<3;c++) {
+		temp = slot[c];
+		slot[c] = in[c];
+		in[c] = temp;
 	}
+	this->frames_in++;
+
+	if (this->frames_in <= this->kernelRadius)
+		return 0;
+
+	filterframe(this,out,this->yuv_data);
+	this->frames_out++;
+
+	return 1;
+}
+
+static int filter_flush (void *priv, uint8_t **out)
+{
+	struct parameters *this = priv;
+	uint8_t **slot;
 
-	// deallocate temporal buffer
+	if (this->frames_out >= this->frames_in)
+		return 0;
 
-	// Clean-up regardless an error happened or not
+	temporalshuffle(this->yuv_data,this->kernelSize);
+	slot = this->yuv_data[this->kernelSize-1];
+	chromacpy(slot,this->yuv_data[this->kernelSize-2],&this->si);
 
+	filterframe(this,out,this->yuv_data);
+	this->frames_out++;
 
-	y4m_fini_frame_info( &in_frame );
-	chromafree(yuv_odata);
-	chromafree(yuv_data);
+	return 1;
+}
 
-	if( read_error_code != Y4M_ERR_EOF )
-		mjpeg_error_exit1 ("Error reading from input stream!");
+static void filter_fini (void *priv)
+{
+	struct parameters *this = priv;
 
+	if (this->yuv_data) {
+		temporalfree(this->yuv_data,this->kernelSize);
+		y4m_fini_stream_info(&this->si);
+	}
+	free(this->kernelD);
+	free(this->gaussSimilarity);
+	free(this);
 }
 
+struct yuvstage yuvtbilateral_stage = {
+	"yuvtbilateral", 0,
+	filter_init, filter_config, filter_process, filter_flush, filter_fini, print_usage
+};
+
+#ifndef YUVCHAIN
 // *************************************************************************************
 // MAIN
 // *************************************************************************************
 int main (int argc, char *argv[])
 {
 
-	int verbose = 4; // LOG_ERROR ;
 	int fdIn = 0 ;
 	int fdOut = 1 ;
-	y4m_stream_info_t in_streaminfo ;
-	float sigma;
-	int c ;
-	const static char *legal_flags = "?hv:r:d:";
-
-	while ((c = getopt (argc, argv, legal_flags)) != -1) {
-		switch (c) {
-			case 'v':
-				verbose = atoi (optarg);
-				if (verbose < 0 || verbose > 2)
-					mjpeg_error_exit1 ("Verbose level must be [0..2]");
-				break;
-
-			case 'h':
-			case '?':
-				print_usage (argv);
-				return 0 ;
-				break;
-			case 'r':
-				sigma = atof(optarg);
-				this.sigmaR = sigma * PRECISION;
-				break;
-			case 'd':
-				sigma = atof(optarg);
-				this.sigmaD = sigma * PRECISION;
-				break;
-
+	y4m_stream_info_t in_streaminfo, out_streaminfo ;
+	struct parameters *this;
 
-		}
+	this = filter_init(argc, argv);
+	if (this == NULL) {
+		print_usage (argv);
+		return 0 ;
 	}
 
-	if (this.sigmaR == 0 || this.sigmaD == 0) {
-		print_usage();
-		mjpeg_error_exit1("Sigma D and R must be set");
-
-	}
-
-	y4m_accept_extensions(1);
-
 	// mjpeg tools global initialisations
-	mjpeg_default_handler_verbosity (verbose);
+	mjpeg_default_handler_verbosity (this->verbose);
 
 	// Initialize input streams
 	y4m_init_stream_info (&in_streaminfo);
+	y4m_init_stream_info (&out_streaminfo);
 
 	// ***************************************************************
 	// Get video stream informations (size, framerate, interlacing, aspect ratio).
@@ -400,7 +398,7 @@ int main (int argc, char *argv[])
 	// ***************************************************************
 	// INPUT comes from stdin, we check for a correct file header
 	y4m_accept_extensions(1);
-	if (y4m_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+	if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
 		mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
 
 	// Information output
@@ -410,15 +408,18 @@ int main (int argc, char *argv[])
 
 
 	/* in that function we do all the important work */
-	filterinitialize ();
-	y4m_write_stream_header(fdOut,&in_streaminfo);
+	filter_config (this, &in_streaminfo, &out_streaminfo);
+	yuv_write_stream_header(fdOut,&out_streaminfo);
 
-	filter(fdIn, fdOut, &in_streaminfo);
+	yuvstage_run(&yuvtbilateral_stage, this, fdIn, fdOut, &in_streaminfo, &out_streaminfo);
 
 	y4m_fini_stream_info (&in_streaminfo);
+	y4m_fini_stream_info (&out_streaminfo);
+	filter_fini(this);
 
 	return 0;
 }
+#endif
 /*
  * Local variables:
  *  tab-width: 8
@@ -10,6 +10,8 @@
 **<p> I have spent a while tuning the detection algorithm, it appears quite effective.
 ** This filter is more useful at removing VHS noise than the tshot filter.  </p>
 **<p>Added a detect only feature which outputs the frame number and 0-1.0 pixel ratio.</p>
+**<p>-B file.ystats detects only and writes the ratios to a binary statistics
+** file rather than text, see yuvstatsdump.</p>
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -40,6 +42,7 @@
 #include <yuv4mpeg.h>
 #include <mpegconsts.h>
 #include "utilyuv.h"
+#include "yuvstats.h"
 
 #define VERSION "0.1"
 
@@ -50,8 +53,9 @@
 static void print_usage()
 {
 	fprintf (stderr,
-			 "usage: yuvtout [-hvdt <threshold> ]\n"
+			 "usage: yuvtout [-hvdt <threshold> ] [-B file.ystats]\n"
 			 "\t-d detect only, output frame vs %% of outlier pixels\n"
+			 "\t-B detect only, write a binary statistics file rather than text\n"
 			 "\t-t threshold, higher values mean less detected. defaults to 4\n"
 			 "\t-h help -v verbose <0-2>"
 			 );
@@ -203,7 +207,7 @@ static double detectframe (uint8_t **n, y4m_stream_info_t *si)
 
 
 // temporal filter loop
-static void filter(  int fdIn ,int fdOut , y4m_stream_info_t  *inStrInfo , int thresh, int detect)
+static void filter(  int fdIn ,int fdOut , y4m_stream_info_t  *inStrInfo , int thresh, int detect, yuv_stats_t *st)
 {
 	y4m_frame_info_t   in_frame ;
 	uint8_t            *yuv_data[3];
@@ -231,20 +235,25 @@ static void filter(  int fdIn ,int fdOut , y4m_stream_info_t  *inStrInfo , int t
 	read_error_code = Y4M_OK;
 
 	//y4m_init_frame_info( &in_frame );
-	//read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+	//read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
 
 	while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
 
 		y4m_init_frame_info( &in_frame );
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+		read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
 
 		// do work
 		if (read_error_code == Y4M_OK) {
-			if (detect) {
+			if (st) {
+				yuv_stats_set_int(st, 0, counter++);
+				yuv_stats_set_float(st, 1, detectframe(yuv_data,inStrInfo));
+				if (yuv_stats_row(st))
+					mjpeg_error_exit1 ("Error writing the statistics file");
+			} else if (detect) {
 				printf ("%d %g\n",counter++,detectframe(yuv_data,inStrInfo));
 			} else {
 				filterframe(yuv_odata,yuv_data,inStrInfo);
-				write_error_code = y4m_write_frame( fdOut, inStrInfo, &in_frame, yuv_odata );
+				write_error_code = yuv_write_frame( fdOut, inStrInfo, &in_frame, yuv_odata );
 
 			}
 		}
@@ -281,7 +290,10 @@ int main (int argc, char *argv[])
 	y4m_stream_info_t in_streaminfo ;
 	int c ;
 	int threshold = 4, detect = 0;
-	const static char *legal_flags = "?hv:t:d";
+	char *stats_file = NULL;
+	yuv_stats_t stats;
+	y4m_ratio_t rate;
+	const static char *legal_flags = "?hv:t:dB:";
 
 	while ((c = getopt (argc, argv, legal_flags)) != -1) {
 		switch (c) {
@@ -302,6 +314,10 @@ int main (int argc, char *argv[])
 			case 'd':
 				detect = 1;
 				break;
+			case 'B':
+				stats_file = optarg;
+				detect = 1;
+				break;
 
 		}
 	}
@@ -319,7 +335,7 @@ int main (int argc, char *argv[])
 	// The streaminfo structure is filled in
 	// ***************************************************************
 	// INPUT comes from stdin, we check for a correct file header
-	if (y4m_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+	if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
 		mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
 
 	// Information output
@@ -331,10 +347,21 @@ int main (int argc, char *argv[])
 	//filterinitialize ();
 	// sorry for this conditional logic
 	if (!detect) {
-		y4m_write_stream_header(fdOut,&in_streaminfo);
+		yuv_write_stream_header(fdOut,&in_streaminfo);
 	}
 
-	filter(fdIn, fdOut, &in_streaminfo,threshold,detect);
+	if (stats_file) {
+		rate = y4m_si_get_framerate(&in_streaminfo);
+		if (yuv_stats_create(&stats, stats_file, "yuvtout", rate.n, rate.d))
+			mjpeg_error_exit1 ("Cannot create %s", stats_file);
+		yuv_stats_add_column(&stats, "frame", YUV_STATS_INT32);
+		yuv_stats_add_column(&stats, "outliers", YUV_STATS_DOUBLE);
+	}
+
+	filter(fdIn, fdOut, &in_streaminfo,threshold,detect,stats_file ? &stats : NULL);
+
+	if (stats_file && yuv_stats_close(&stats))
+		mjpeg_error_exit1 ("Error writing %s", stats_file);
 
 	if (!detect) {
 		y4m_fini_stream_info (&in_streaminfo);
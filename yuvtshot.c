@@ -281,8 +281,8 @@ static void process(  int fdIn , y4m_stream_info_t  *inStrInfo,
 
 // initialise and read the first number of frames
 	y4m_init_frame_info( &in_frame );
-	read_error_code = y4m_read_frame(fdIn,inStrInfo,&in_frame,yuv_data[1]);
-	read_error_code = y4m_read_frame(fdIn,inStrInfo,&in_frame,yuv_data[0]);
+	read_error_code = yuv_read_frame(fdIn,inStrInfo,&in_frame,yuv_data[1]);
+	read_error_code = yuv_read_frame(fdIn,inStrInfo,&in_frame,yuv_data[0]);
 
 
 	while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
@@ -294,7 +294,7 @@ static void process(  int fdIn , y4m_stream_info_t  *inStrInfo,
 			clean (yuv_data[0],yuv_data[1],yuv_data[2],inStrInfo,t,1,adp);
 			clean (yuv_data[0],yuv_data[1],yuv_data[2],inStrInfo,t,2,adp);
 		}
-		write_error_code = y4m_write_frame( fdOut, outStrInfo, &in_frame, yuv_data[1] );
+		write_error_code = yuv_write_frame( fdOut, outStrInfo, &in_frame, yuv_data[1] );
 		y4m_fini_frame_info( &in_frame );
 
 		// nothing to see here, move along, move along
@@ -321,7 +321,7 @@ static void process(  int fdIn , y4m_stream_info_t  *inStrInfo,
 
 
 		y4m_init_frame_info( &in_frame );
-		read_error_code = y4m_read_frame(fdIn,inStrInfo,&in_frame,yuv_data[0] );
+		read_error_code = yuv_read_frame(fdIn,inStrInfo,&in_frame,yuv_data[0] );
 		++src_frame_counter ;
 	}
 
@@ -333,7 +333,7 @@ static void process(  int fdIn , y4m_stream_info_t  *inStrInfo,
 		clean (yuv_data[0],yuv_data[1],yuv_data[2],inStrInfo,t,1,adp);
 		clean (yuv_data[0],yuv_data[1],yuv_data[2],inStrInfo,t,2,adp);
 
-		write_error_code = y4m_write_frame( fdOut, outStrInfo, &in_frame, yuv_data[1] );
+		write_error_code = yuv_write_frame( fdOut, outStrInfo, &in_frame, yuv_data[1] );
 	}
   // Clean-up regardless an error happened or not
 
@@ -411,7 +411,7 @@ int main (int argc, char *argv[])
   // The streaminfo structure is filled in
   // ***************************************************************
   // INPUT comes from stdin, we check for a correct file header
-	if (y4m_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+	if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
 		mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
 
 	y4m_ratio_t src_frame_rate = y4m_si_get_framerate( &in_streaminfo );
@@ -423,7 +423,7 @@ int main (int argc, char *argv[])
   mjpeg_info ("yuvtshot -? for help");
 
   /* in that function we do all the important work */
-	y4m_write_stream_header(fdOut,&out_streaminfo);
+	yuv_write_stream_header(fdOut,&out_streaminfo);
 
 	process( fdIn,&in_streaminfo,fdOut,&out_streaminfo,max_shift,cl,adp);
 
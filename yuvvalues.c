@@ -6,6 +6,8 @@
 ** <h4> yuv values </h4>
 ** <p> prints timecode, difference and min/average/max of the yuv channels for each frame</p>
 ** <p> -d to use NTSC drop frame timecode</p>
+** <p> -B file.ystats writes the numbers to a binary statistics file instead,
+** yuvstatsdump -t frame prints it as the text below</p>
 ** <h4>EXAMPLE Output</h4>
 ** <pre>
 ** 1 00:00:00:01 1.45315 10 17.4508 145 126 127.005 128 125 127.995 130
@@ -50,14 +52,16 @@ gcc yuvdeinterlace.c -I/sw/include/mjpegtools -lmjpegutils
 #include <yuv4mpeg.h>
 #include <mpegconsts.h>
 #include "utilyuv.h"
+#include "yuvstats.h"
 
 #define VERSION "0.1"
 
 static void print_usage()
 {
 	fprintf (stderr,
-			 "usage: yuvvalues [-d]\n"
+			 "usage: yuvvalues [-d] [-B file.ystats]\n"
 			 "-d\t use NTSC drop frame timecode\n"
+			 "-B\t write a binary statistics file rather than text (see yuvstatsdump)\n"
 			);
 }
 
@@ -90,7 +94,26 @@ void luma_sum_diff  (int *bri, int *bro, 	uint8_t *m[3], uint8_t *n[3], y4m_stre
 
 
 
-static void filterframe (uint8_t *m[3], y4m_stream_info_t *si, int fc,int df, int diff)
+// the columns of the statistics file, in the order of the text
+enum { COL_FRAME, COL_DIFF, COL_YMIN, COL_YAVG, COL_YMAX, COL_UMIN, COL_UAVG, COL_UMAX,
+	COL_VMIN, COL_VAVG, COL_VMAX };
+
+static void stats_columns(yuv_stats_t *st)
+{
+	yuv_stats_add_column(st, "frame", YUV_STATS_INT32);
+	yuv_stats_add_column(st, "diff", YUV_STATS_DOUBLE);
+	yuv_stats_add_column(st, "ymin", YUV_STATS_INT32);
+	yuv_stats_add_column(st, "yavg", YUV_STATS_DOUBLE);
+	yuv_stats_add_column(st, "ymax", YUV_STATS_INT32);
+	yuv_stats_add_column(st, "umin", YUV_STATS_INT32);
+	yuv_stats_add_column(st, "uavg", YUV_STATS_DOUBLE);
+	yuv_stats_add_column(st, "umax", YUV_STATS_INT32);
+	yuv_stats_add_column(st, "vmin", YUV_STATS_INT32);
+	yuv_stats_add_column(st, "vavg", YUV_STATS_DOUBLE);
+	yuv_stats_add_column(st, "vmax", YUV_STATS_INT32);
+}
+
+static void filterframe (uint8_t *m[3], y4m_stream_info_t *si, int fc,int df, int diff, yuv_stats_t *st)
 {
 
 	int x,y;
@@ -154,6 +177,23 @@ static void filterframe (uint8_t *m[3], y4m_stream_info_t *si, int fc,int df, in
 		w += width;
 	}
 
+	if (st) {
+		yuv_stats_set_int(st, COL_FRAME, fc);
+		yuv_stats_set_float(st, COL_DIFF, 1.0*diff/fs);
+		yuv_stats_set_int(st, COL_YMIN, miny);
+		yuv_stats_set_float(st, COL_YAVG, 1.0*toty/fs);
+		yuv_stats_set_int(st, COL_YMAX, maxy);
+		yuv_stats_set_int(st, COL_UMIN, minu);
+		yuv_stats_set_float(st, COL_UAVG, 1.0*totu/cfs);
+		yuv_stats_set_int(st, COL_UMAX, maxu);
+		yuv_stats_set_int(st, COL_VMIN, minv);
+		yuv_stats_set_float(st, COL_VAVG, 1.0*totv/cfs);
+		yuv_stats_set_int(st, COL_VMAX, maxv);
+		if (yuv_stats_row(st))
+			mjpeg_error_exit1 ("Error writing the statistics file");
+		return;
+	}
+
 	framecount2timecode(si, &tch,&tcm,&tcs,&tcf, fc, &df);
 
 	printf ("%d %02d:%02d:%02d%c%02d %g %d %g %d %d %g %d %d %g %d\n",
@@ -166,7 +206,7 @@ static void filterframe (uint8_t *m[3], y4m_stream_info_t *si, int fc,int df, in
 }
 
 
-static void filter(  int fdIn  , y4m_stream_info_t  *inStrInfo, int df )
+static void filter(  int fdIn  , y4m_stream_info_t  *inStrInfo, int df, yuv_stats_t *st )
 {
 	y4m_frame_info_t   in_frame ;
 	uint8_t            *yuv_data[3], *yuv_odata[3] ;
@@ -191,14 +231,14 @@ static void filter(  int fdIn  , y4m_stream_info_t  *inStrInfo, int df )
 
 	y4m_init_frame_info( &in_frame );
 	chromaset(yuv_odata,inStrInfo,16,128,128); // set the compare frame to black.
-	read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+	read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
 
 	while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
 
 		// do work
 		if (read_error_code == Y4M_OK) {
 			luma_sum_diff (&odd_diff,&even_diff,yuv_data,yuv_odata,inStrInfo);
-			filterframe(yuv_data,inStrInfo,frame_count,df,odd_diff+even_diff);
+			filterframe(yuv_data,inStrInfo,frame_count,df,odd_diff+even_diff,st);
 		}
 
 		y4m_fini_frame_info( &in_frame );
@@ -209,7 +249,7 @@ static void filter(  int fdIn  , y4m_stream_info_t  *inStrInfo, int df )
 		yuv_tdata = yuv_odata[1];  yuv_odata[1] = yuv_data[1]; yuv_data[1] = yuv_tdata;
 		yuv_tdata = yuv_odata[2];  yuv_odata[2] = yuv_data[2]; yuv_data[2] = yuv_tdata;
 
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+		read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
 		frame_count ++;
 	}
 	// Clean-up regardless an error happened or not
@@ -235,7 +275,10 @@ int main (int argc, char *argv[])
 	y4m_stream_info_t in_streaminfo ;
 	int c ;
 	int drop_frame=0;
-	const static char *legal_flags = "hv:d";
+	char *stats_file = NULL;
+	yuv_stats_t stats;
+	y4m_ratio_t rate;
+	const static char *legal_flags = "hv:dB:";
 
 	while ((c = getopt (argc, argv, legal_flags)) != -1) {
 		switch (c) {
@@ -247,6 +290,9 @@ int main (int argc, char *argv[])
 			case 'd':
 				drop_frame=1;
 				break;
+			case 'B':
+				stats_file = optarg;
+				break;
 				case 'h':
 				case '?':
 				print_usage (argv);
@@ -268,7 +314,7 @@ int main (int argc, char *argv[])
 
 	y4m_accept_extensions(1); // because we can handle different chroma subsampling
 	// INPUT comes from stdin, we check for a correct file header
-	if (y4m_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+	if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
 		mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
 
 	// Information output
@@ -277,9 +323,17 @@ int main (int argc, char *argv[])
 	// mjpeg_info ("yuvcropdetect -h for help");
 
 
-	// y4m_write_stream_header(fdOut,&in_streaminfo);
+	// yuv_write_stream_header(fdOut,&in_streaminfo);
 	/* in that function we do all the important work */
-	filter(fdIn, &in_streaminfo,drop_frame);
+	if (stats_file) {
+		rate = y4m_si_get_framerate(&in_streaminfo);
+		if (yuv_stats_create(&stats, stats_file, "yuvvalues", rate.n, rate.d))
+			mjpeg_error_exit1 ("Cannot create %s", stats_file);
+		stats_columns(&stats);
+	}
+	filter(fdIn, &in_streaminfo,drop_frame,stats_file ? &stats : NULL);
+	if (stats_file && yuv_stats_close(&stats))
+		mjpeg_error_exit1 ("Error writing %s", stats_file);
 	y4m_fini_stream_info (&in_streaminfo);
 
 	return 0;
@@ -28,7 +28,7 @@
 **<p>Attempts to detect and remove semi-transperant watermarks from
 **the source.  Produces a PGM file of the detected watermark which
 **is used to remove or reduce the effect.  This is a two pass process,
-**the documentation is a little sparse.  </p>
+**or one run with -a, the documentation is a little sparse.  </p>
 
 **<p> The first pass produces a grey image file (PGM format) this is
 **done by averaging luma of all the frames.  The idea is that the
@@ -52,6 +52,9 @@
 **<p> May also use a black frame with the watermark showing, extracted
 **by other means.</P>
 
+**<p> When the input is a file rather than a pipe the detect pass maps
+**the file and averages the frames in place.</p>
+
 **<p> pass 2 <tt>| yuvwater  yuvwater -m 145 -l 72  -u 384  -i
 **watermark.pgm | </tt> -m specifies the amount to remove, the lower
 **the number the darker the resulting watermark, good starting values
@@ -60,6 +63,16 @@
 **this value.  -u specifies the white level, good starting value 384,
 **if the white is too dark, decrease this value.  </p>
 
+**<p> One run: <tt>yuvwater -a 500 -m 145 -l 72 -u 384 &lt; in.y4m |
+**</tt> detects the watermark from the first 500 frames then removes
+**it from the whole stream.  A file is read twice, from a pipe the
+**first frames are held in memory until the watermark is known.  </p>
+
+**<p> The removal is a table of the output luma for every watermark
+**and luma value, only the rectangle of the watermark which is not
+**black is looked up per pixel, the rest of the frame has a
+**watermark of 0 and goes through one row of the table.  </p>
+
 **<h4>HISTORY</h4>
 **<ul> <li>26th April 2005. Fixed a bug which incorrectly detected
 **the end of file, creating more frames in the output.</li> <li>17th
@@ -76,7 +89,9 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
+#include <string.h>
 #include <strings.h>
+#include <limits.h>
 #include <fcntl.h>
 
 #include <yuv4mpeg.h>
@@ -89,6 +104,30 @@
 /* the scale from 0 to 1 */
 #define MUL_SCALE 224
 
+// frames of 8 bit luma that fit in a 16 bit sum
+#define ACCUMULATE_FRAMES 257
+
+struct detect {
+	int length;
+	int frames;
+	int pending;
+	uint16_t *acc16;
+	uint32_t *acc32;
+};
+
+struct watermark {
+	int w, h;
+	uint8_t *mask;
+	// rectangle of the non zero mask, empty when x1 < x0
+	int x0, y0, x1, y1;
+	int bri, mul, lr, ur;
+	int lp, up;
+	int identity;
+	// output luma for [mask][luma], and the [mask][luma] pairs met so far
+	uint8_t lut[256 * 256];
+	uint8_t seen[256 * 256];
+};
+
 static void print_usage()
 {
   fprintf (stderr,
@@ -97,125 +136,320 @@ static void print_usage()
 	   "producing a watermark pgm, which can be used\n"
            "to remove the watermark\n"
            "\n"
-    "-d\tDetect mode. Output a pgm file."
-           "-i <filename>\tRemove Mode."
+	   "-d\tDetect mode. Output a pgm file.\n"
+	   "-f <frames>\tDetect from the first <frames> frames only\n"
+	   "-i <filename>\tRemove Mode.\n"
+	   "-a <frames>\tDetect from the first <frames> frames then remove in the same run\n"
+	   "-m <mul>\tAmount to remove, lower is darker (default %d)\n"
+	   "-l <lower> -u <upper>\tBlack and white levels to normalise to\n"
 	   "-v\tVerbosity degree : 0=quiet, 1=normal, 2=verbose/debug\n"
-	   "-h\tprint this help\n"
+	   "-h\tprint this help\n", MUL_SCALE
          );
 }
 
-static int removewm (int fdWM, int fdIn, y4m_stream_info_t  *inStrInfo, int fdOut, y4m_stream_info_t *outStrInfo, int bri, int mul,int lr,int ur)
+static void detect_init(struct detect *d, int length)
 {
+	d->length = length;
+	d->frames = 0;
+	d->pending = 0;
+	d->acc16 = (uint16_t *)calloc(length, sizeof(uint16_t));
+	d->acc32 = (uint32_t *)calloc(length, sizeof(uint32_t));
+
+	if (!d->acc16 || !d->acc32)
+		mjpeg_error_exit1 ("Could'nt allocate memory for the watermark sums!");
+}
 
-	y4m_frame_info_t   in_frame ;
-	uint8_t *yuv_data[3] ;
-	uint8_t *yuvwm_data ;
-	int frame_data_size ;
-	int write_error_code ;
-	int read_error_code ;
-	int w,h,l=0,yuv,yuvmin,yuvmax,lp=0,up=0;
-	char buf[80],buf2[80];
+static void detect_flush(struct detect *d)
+{
+	int l;
 
-	h = y4m_si_get_height(inStrInfo) ; w = y4m_si_get_width(inStrInfo);
-	frame_data_size = h * w;
+	for (l=0; l < d->length; l++)
+		d->acc32[l] += d->acc16[l];
+	memset(d->acc16, 0, d->length * sizeof(uint16_t));
+	d->pending = 0;
+}
+
+// the sums are kept in 16 bits and moved to 32 bits before they can wrap
+static void detect_add(struct detect *d, const uint8_t *luma)
+{
+	yuv_kernel.accumulate(d->acc16, luma, d->length);
+	d->frames++;
+	if (++d->pending == ACCUMULATE_FRAMES)
+		detect_flush(d);
+}
+
+static void detect_mask(struct detect *d, uint8_t *mask)
+{
+	int l;
+
+	if (d->frames == 0)
+		mjpeg_error_exit1 ("No frames to detect the watermark from!");
 
-	read(fdWM,buf,3);
-	if (strncmp (buf,"P5",2)) {
-		perror ("Watermark file is not a binary PGM\n");
+	detect_flush(d);
+	for (l=0; l < d->length; l++)
+		mask[l] = d->acc32[l] / d->frames;
+}
+
+static void detect_free(struct detect *d)
+{
+	free(d->acc16);
+	free(d->acc32);
+}
+
+static int read_pgm(int fdWM, uint8_t *mask, int w, int h)
+{
+	FILE *fp;
+	int pw, ph, maxval;
+
+	fp = fdopen(fdWM, "r");
+	if (fp == NULL)
+		return -1;
+
+	if (fscanf(fp, "P5 %d %d %d", &pw, &ph, &maxval) != 3) {
+		mjpeg_error ("Watermark file is not a binary PGM");
+		fclose(fp);
 		return -1;
 	}
-	sprintf (buf2,"%d %d\n",w,h);
-	read(fdWM,buf,strlen(buf2));
-	if (strncmp (buf,buf2,strlen(buf2)-1)) {
-		fprintf (stderr, "(%s != %s)",buf,buf2);
-		perror ("Watermark file's dimensions do not match video\n");
+	if (pw != w || ph != h) {
+		mjpeg_error ("Watermark file's dimensions do not match video (%dx%d != %dx%d)", pw, ph, w, h);
+		fclose(fp);
 		return -1;
 	}
-	read(fdWM,buf,4);
-	if (strncmp (buf,"255",3)) {
-		perror ("Watermark file is not 8 bit\n");
+	if (maxval != 255) {
+		mjpeg_error ("Watermark file is not 8 bit");
+		fclose(fp);
+		return -1;
+	}
+	// a single white space character ends the header
+	fgetc(fp);
+	if (fread(mask, 1, w * h, fp) != w * h) {
+		mjpeg_error ("Watermark file is too short");
+		fclose(fp);
 		return -1;
 	}
 
+	fclose(fp);
+	return 0;
+}
 
-	yuvwm_data = (uint8_t  *)malloc( frame_data_size );
-
-	read (fdWM,yuvwm_data,frame_data_size);
-
-	yuv_data[0] = (uint8_t *)malloc( frame_data_size );
-	yuv_data[1] = (uint8_t *)malloc( frame_data_size >> 2 );
-	yuv_data[2] = (uint8_t *)malloc( frame_data_size >> 2 );
-
-	if( !yuv_data[0] || !yuv_data[1] || !yuv_data[2] || !yuvwm_data )
-		mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
-
+// the header and the image in one write
+static void write_pgm(FILE *fp, struct detect *d, int w, int h)
+{
+	uint8_t *pgm;
+	int n;
 
-	write_error_code = Y4M_OK ;
+	pgm = (uint8_t *)malloc(32 + w * h);
+	if (pgm == NULL)
+		mjpeg_error_exit1 ("Could'nt allocate memory for the PGM!");
 
-	y4m_init_frame_info( &in_frame );
-	read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+	n = sprintf((char *)pgm, "P5\n%d %d\n255\n", w, h);
+	detect_mask(d, pgm + n);
+	if (fwrite(pgm, 1, n + w * h, fp) != n + w * h || fflush(fp))
+		mjpeg_error_exit1 ("Error writing the PGM!");
 
-	yuvmax = yuvmin =
-			 (yuv_data[0][l]) + (bri - ((255 - yuv_data[0][l])  * yuvwm_data[l] / mul));
+	free(pgm);
+}
 
-        while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
+static inline int wm_raw(struct watermark *wm, int m, int y)
+{
+	return y + (wm->bri - ((255 - y) * m / wm->mul));
+}
 
-		if (read_error_code == Y4M_OK) {
+static void wm_init(struct watermark *wm, int bri, int mul, int lr, int ur)
+{
+	int m, y, yuv;
 
-		for (l=0;l<frame_data_size;l++)
-		{
-			yuv = (yuv_data[0][l]) + (bri - ((255 - yuv_data[0][l])  * yuvwm_data[l] / mul));
+	wm->bri = bri;
+	wm->mul = mul;
+	wm->lr = lr;
+	wm->ur = ur;
+	wm->lp = 0;
+	wm->up = 0;
+	memset(wm->seen, 0, sizeof(wm->seen));
 
-		/* find extremes */
-			if (yuvmin > yuv) yuvmin = yuv;
-			if (yuvmax < yuv) yuvmax = yuv;
+	for (m=0; m<256; m++)
+		for (y=0; y<256; y++) {
+			yuv = wm_raw(wm, m, y);
 
 		/* use upper and lower scaling */
-		if (ur>lr) yuv = (yuv - lr) *  224 / (ur - lr)  + 16;
+			if (ur>lr) yuv = (yuv - lr) *  224 / (ur - lr)  + 16;
 
 		/* prevent clipping */
 			if (yuv > 240) yuv = 240;
 			if (yuv < 16) yuv = 16;
 
-			yuv_data[0][l] = yuv;
+			wm->lut[m << 8 | y] = yuv;
 		}
 
-		write_error_code = y4m_write_frame( fdOut, outStrInfo, &in_frame, yuv_data );
-		}
-                y4m_fini_frame_info( &in_frame );
-                y4m_init_frame_info( &in_frame );
-                read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
-	if (ur==lr)
+	wm->identity = 1;
+	for (y=0; y<256; y++)
+		if (wm->lut[y] != y)
+			wm->identity = 0;
+}
+
+static void wm_bounds(struct watermark *wm)
+{
+	int x, y;
+
+	wm->x0 = wm->w;
+	wm->y0 = wm->h;
+	wm->x1 = -1;
+	wm->y1 = -1;
+	for (y=0; y < wm->h; y++)
+		for (x=0; x < wm->w; x++)
+			if (wm->mask[y * wm->w + x]) {
+				if (x < wm->x0) wm->x0 = x;
+				if (x > wm->x1) wm->x1 = x;
+				if (y < wm->y0) wm->y0 = y;
+				wm->y1 = y;
+			}
+
+	if (wm->x1 < wm->x0)
+		mjpeg_debug ("Watermark is empty");
+	else
+		mjpeg_debug ("Watermark is inside %dx%d+%d+%d", wm->x1 - wm->x0 + 1, wm->y1 - wm->y0 + 1, wm->x0, wm->y0);
+}
+
+// the watermark is 0 here, one row of the table and its extremes
+static void remove_outside(struct watermark *wm, uint8_t *d, int len)
+{
+	uint8_t lo, hi;
+	uint64_t sum;
+
+	if (len <= 0)
+		return;
+
+	yuv_kernel.minmaxsum(d, len, &lo, &hi, &sum);
+	wm->seen[lo] = 1;
+	wm->seen[hi] = 1;
+	if (!wm->identity)
+		yuv_kernel.lut(d, d, wm->lut, len);
+}
+
+static void remove_inside(struct watermark *wm, uint8_t *d, const uint8_t *m, int len)
+{
+	int i, idx;
+
+	for (i=0; i<len; i++) {
+		idx = m[i] << 8 | d[i];
+		wm->seen[idx] = 1;
+		d[i] = wm->lut[idx];
+	}
+}
+
+static void remove_frame(struct watermark *wm, uint8_t *luma)
+{
+	int w = wm->w, y;
+
+	if (wm->x1 < wm->x0) {
+		remove_outside(wm, luma, w * wm->h);
+		return;
+	}
+
+	remove_outside(wm, luma, wm->y0 * w);
+	for (y=wm->y0; y<=wm->y1; y++) {
+		remove_outside(wm, luma + y * w, wm->x0);
+		remove_inside(wm, luma + y * w + wm->x0, wm->mask + y * w + wm->x0, wm->x1 - wm->x0 + 1);
+		remove_outside(wm, luma + y * w + wm->x1 + 1, w - wm->x1 - 1);
+	}
+	remove_outside(wm, luma + (wm->y1 + 1) * w, (wm->h - wm->y1 - 1) * w);
+}
+
+// extremes of the unscaled luma so far, it rises with the luma for any mask
+static void wm_range(struct watermark *wm, int *yuvmin, int *yuvmax)
+{
+	const uint8_t *seen;
+	int m, lo, hi;
+
+	*yuvmin = INT_MAX;
+	*yuvmax = INT_MIN;
+	for (m=0; m<256; m++) {
+		seen = wm->seen + (m << 8);
+		for (lo=0; lo<256 && !seen[lo]; lo++)
+			;
+		if (lo == 256)
+			continue;
+		for (hi=255; !seen[hi]; hi--)
+			;
+		if (wm_raw(wm, m, lo) < *yuvmin) *yuvmin = wm_raw(wm, m, lo);
+		if (wm_raw(wm, m, hi) > *yuvmax) *yuvmax = wm_raw(wm, m, hi);
+	}
+}
+
+static void report_range(struct watermark *wm)
+{
+	int yuvmin, yuvmax;
+
+	wm_range(wm, &yuvmin, &yuvmax);
+	if (wm->ur==wm->lr)
 		fprintf (stderr, "Range: %d - %d\n",yuvmin,yuvmax);
 	else {
-		if ((yuvmax > ur) && (yuvmax > up )) {
-			fprintf (stderr, "Warning: Max %d > %d upper limit\n",yuvmax,ur);
-			up = yuvmax;
-			// ur = yuvmax;
+		if ((yuvmax > wm->ur) && (yuvmax > wm->up )) {
+			fprintf (stderr, "Warning: Max %d > %d upper limit\n",yuvmax,wm->ur);
+			wm->up = yuvmax;
 		}
-		if ((yuvmin < lr) && (yuvmin < lp)) {
-			fprintf (stderr, "Warning: Min %d < %d lower limit\n",yuvmin,lr);
-			lp = yuvmin;
-			// lr = yuvmin;
+		if ((yuvmin < wm->lr) && (yuvmin < wm->lp)) {
+			fprintf (stderr, "Warning: Min %d < %d lower limit\n",yuvmin,wm->lr);
+			wm->lp = yuvmin;
 		}
 	}
-	// f++;
+}
 
-	}
+static int remove_write(struct watermark *wm, int fdOut, y4m_stream_info_t *outStrInfo, y4m_frame_info_t *frame, uint8_t *yuv_data[3])
+{
+	int write_error_code;
 
-	y4m_fini_frame_info( &in_frame );
+	remove_frame(wm, yuv_data[0]);
+	write_error_code = yuv_write_frame( fdOut, outStrInfo, frame, yuv_data );
+	report_range(wm);
 
-	fprintf (stderr, "Range: %d - %d\n",yuvmin,yuvmax);
+	return write_error_code;
+}
+
+static void remove_finish(struct watermark *wm, int read_error_code, int write_error_code)
+{
+	int yuvmin, yuvmax;
 
-	free( yuvwm_data );
-	free( yuv_data[0] );
-	free( yuv_data[1] );
-	free( yuv_data[2] );
+	wm_range(wm, &yuvmin, &yuvmax);
+	if (yuvmin <= yuvmax)
+		fprintf (stderr, "Range: %d - %d\n",yuvmin,yuvmax);
 
 	if( read_error_code != Y4M_ERR_EOF )
 		mjpeg_error_exit1 ("Error reading from input stream!");
 	if( write_error_code != Y4M_OK )
 		mjpeg_error_exit1 ("Error writing output stream!");
+}
+
+static int removewm (struct watermark *wm, int fdIn, y4m_stream_info_t  *inStrInfo, int fdOut, y4m_stream_info_t *outStrInfo)
+{
+
+	y4m_frame_info_t   in_frame ;
+	uint8_t *yuv_data[3] ;
+	int write_error_code ;
+	int read_error_code ;
+
+	if (chromalloc(yuv_data, inStrInfo))
+		mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
+
+	write_error_code = Y4M_OK ;
+
+	y4m_init_frame_info( &in_frame );
+	read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+
+        while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
+
+		if (read_error_code == Y4M_OK)
+			write_error_code = remove_write(wm, fdOut, outStrInfo, &in_frame, yuv_data);
+
+                y4m_fini_frame_info( &in_frame );
+                y4m_init_frame_info( &in_frame );
+                read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+	}
+
+	y4m_fini_frame_info( &in_frame );
+	chromafree(yuv_data);
+
+	remove_finish(wm, read_error_code, write_error_code);
 
 	return 0;
 }
@@ -224,76 +458,130 @@ static void detectwm(int fdIn , y4m_stream_info_t  *inStrInfo, int frames )
 {
 	y4m_frame_info_t in_frame ;
 	uint8_t *yuv_data[3] ;
-	unsigned int	*yuvf_data;
-	int frame_data_size ;
+	struct detect det;
 	int read_error_code ;
-	int w,h,y,l,f=0;
+	int w,h,f=0;
+	yuv_index_t index;
 
-// Allocate memory for the YUV channels
 	h = y4m_si_get_height(inStrInfo) ; w = y4m_si_get_width(inStrInfo);
-	frame_data_size = h * w;
-	yuv_data[0] = (uint8_t *)malloc( frame_data_size );
-	yuv_data[1] = (uint8_t *)malloc( frame_data_size >> 2 );
-	yuv_data[2] = (uint8_t *)malloc( frame_data_size >> 2 );
-	yuvf_data = (unsigned int *)malloc( frame_data_size * sizeof(unsigned int) );
+	detect_init(&det, w * h);
 
-
-	if( !yuv_data[0] || !yuv_data[1] || !yuv_data[2] || !yuvf_data )
+	if (chromalloc(yuv_data, inStrInfo))
 		mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
 
-/* Initialize counters */
-
-	for (l=0; l < frame_data_size; l++)
-		yuvf_data[l] = 0;
-
 	y4m_init_frame_info( &in_frame );
-	read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
-
-	while((Y4M_ERR_EOF != read_error_code ) && (f != frames)) {
-
-// calculate average.
-		if (read_error_code == Y4M_OK) {
 
-		int l = 0;
-		for (y=0; y<h; y++)
-		{
-			int x;
-			for (x=0; x<w; x++)
-			{
-				yuvf_data[l]  += yuv_data[0][l];
-				l++;
-			}
+	if (!yuv_index_fd(&index, fdIn, inStrInfo)) {
+		// a file is averaged straight from the mapping
+		uint8_t *planes[3];
 
+		for (f=0; f<index.frames && f != frames; f++) {
+			yuv_index_frame(&index, f, planes);
+			detect_add(&det, planes[0]);
 		}
+		yuv_index_close(&index);
+		read_error_code = Y4M_ERR_EOF;
+	} else {
 
-		f++;
+	read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+
+	while((Y4M_ERR_EOF != read_error_code ) && (f != frames)) {
 
+		if (read_error_code == Y4M_OK) {
+			detect_add(&det, yuv_data[0]);
+			f++;
 		}
 
 		y4m_fini_frame_info( &in_frame );
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
+		read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data );
 
 	}
+	}
 
   // Clean-up regardless an error happened or not
 	y4m_fini_frame_info( &in_frame );
+	chromafree(yuv_data);
 
-	free( yuv_data[0] );
-	free( yuv_data[1] );
-	free( yuv_data[2] );
+	if( read_error_code != Y4M_ERR_EOF && f != frames )
+		mjpeg_error_exit1 ("Error reading from input stream!");
 
 	// Output resulting PGM mask
+	write_pgm(stdout, &det, w, h);
+	detect_free(&det);
+}
 
-	fprintf (stdout,"P5\n%d %d\n255\n",w,h);
-	for (l=0; l < frame_data_size; l++)
-		fprintf (stdout,"%c",(yuvf_data[l] / f));
+// detects from the first frames then removes from all of them
+static void autowm (struct watermark *wm, int fdIn, y4m_stream_info_t  *inStrInfo, int fdOut, y4m_stream_info_t *outStrInfo, int frames)
+{
+	y4m_frame_info_t frame ;
+	uint8_t *yuv_data[3], *planes[3] ;
+	uint8_t ***held;
+	struct detect det;
+	yuv_index_t index;
+	int write_error_code = Y4M_OK ;
+	int read_error_code ;
+	int f, n;
 
+	detect_init(&det, wm->w * wm->h);
+	if (chromalloc(yuv_data, inStrInfo))
+		mjpeg_error_exit1 ("Could'nt allocate memory for the YUV4MPEG data!");
 
-	free( yuvf_data );
+	if (!yuv_index_fd(&index, fdIn, inStrInfo)) {
+		// a file is read twice from the mapping
+		for (f=0; f<index.frames && f<frames; f++) {
+			yuv_index_frame(&index, f, planes);
+			detect_add(&det, planes[0]);
+		}
+		detect_mask(&det, wm->mask);
+		wm_bounds(wm);
+
+		for (f=0; f<index.frames && write_error_code == Y4M_OK; f++) {
+			yuv_index_frame(&index, f, planes);
+			chromacpy(yuv_data, planes, inStrInfo);
+			y4m_init_frame_info( &frame );
+			write_error_code = remove_write(wm, fdOut, outStrInfo, &frame, yuv_data);
+			y4m_fini_frame_info( &frame );
+		}
+		yuv_index_close(&index);
+		read_error_code = Y4M_ERR_EOF;
+	} else {
+		// a pipe has its first frames held until the watermark is known
+		if (temporalalloc(&held, inStrInfo, frames))
+			mjpeg_error_exit1 ("Could'nt allocate memory for %d frames!", frames);
+
+		y4m_init_frame_info( &frame );
+		read_error_code = Y4M_OK;
+		for (n=0; n<frames && read_error_code == Y4M_OK; n++) {
+			read_error_code = yuv_read_frame(fdIn, inStrInfo, &frame, held[n]);
+			y4m_fini_frame_info( &frame );
+			y4m_init_frame_info( &frame );
+			if (read_error_code == Y4M_OK)
+				detect_add(&det, held[n][0]);
+		}
+		n = det.frames;
+		detect_mask(&det, wm->mask);
+		wm_bounds(wm);
+
+		for (f=0; f<n && write_error_code == Y4M_OK; f++)
+			write_error_code = remove_write(wm, fdOut, outStrInfo, &frame, held[f]);
+		temporalfree(held, frames);
+
+		if (read_error_code == Y4M_OK)
+			read_error_code = yuv_read_frame(fdIn, inStrInfo, &frame, yuv_data);
+		while( Y4M_ERR_EOF != read_error_code && write_error_code == Y4M_OK ) {
+			if (read_error_code == Y4M_OK)
+				write_error_code = remove_write(wm, fdOut, outStrInfo, &frame, yuv_data);
+			y4m_fini_frame_info( &frame );
+			y4m_init_frame_info( &frame );
+			read_error_code = yuv_read_frame(fdIn, inStrInfo, &frame, yuv_data);
+		}
+		y4m_fini_frame_info( &frame );
+	}
 
-	if( read_error_code != Y4M_ERR_EOF )
-    mjpeg_error_exit1 ("Error reading from input stream!");
+	chromafree(yuv_data);
+	detect_free(&det);
 
+	remove_finish(wm, read_error_code, write_error_code);
 }
 
 // ***************************************************************************
@@ -307,9 +595,9 @@ int main (int argc, char *argv[])
 	int fdWM = 0 ;
 	y4m_stream_info_t in_streaminfo, out_streaminfo ;
 	int multiple=MUL_SCALE;
-	int upper=0,lower=0,frames=-1;
+	int upper=0,lower=0,frames=-1,autoframes=0;
 
-	const static char *legal_flags = "v:dhi:m:u:l:f:";
+	const static char *legal_flags = "v:dhi:m:u:l:f:a:";
 	int c ;
 
 	while ((c = getopt (argc, argv, legal_flags)) != -1) {
@@ -324,6 +612,11 @@ int main (int argc, char *argv[])
 			case 'l': lower = atoi(optarg); break;
 			case 'm': multiple = atoi(optarg); break;
 			case 'f': frames = atoi(optarg); break;
+			case 'a':
+				autoframes = atoi(optarg);
+				if (autoframes < 1)
+					mjpeg_error_exit1 ("Detect frames must be at least 1");
+			break;
 			case 'i': fdWM = open (optarg,O_RDONLY,0); break;
 			case 'h':
 			case '?':
@@ -335,10 +628,12 @@ int main (int argc, char *argv[])
   // mjpeg tools global initialisations
   mjpeg_default_handler_verbosity (verbose);
 
-	if ((!fdWM) && (!detect))  {
+	if ((fdWM <= 0) && (!detect) && (!autoframes))  {
 		perror ("Could not open Watermark file\n");
 		exit (-1);
 	}
+	if (multiple < 1)
+		mjpeg_error_exit1 ("-m must be at least 1");
 
   // Initialize input streams
   y4m_init_stream_info (&in_streaminfo);
@@ -348,7 +643,7 @@ int main (int argc, char *argv[])
   // The streaminfo structure is filled in
   // ***************************************************************
   // INPUT comes from stdin, we check for a correct file header
-  if (y4m_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+  if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
     mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
 
 
@@ -359,13 +654,34 @@ int main (int argc, char *argv[])
 	else {
 		int fdOut = 1 ;
 		int brightness=128;
-
+		struct watermark *wm;
+
+		wm = (struct watermark *)malloc(sizeof(struct watermark));
+		if (wm == NULL)
+			mjpeg_error_exit1 ("Could'nt allocate memory for the watermark!");
+		wm->h = y4m_si_get_height(&in_streaminfo) ; wm->w = y4m_si_get_width(&in_streaminfo);
+		wm->mask = (uint8_t *)malloc(wm->w * wm->h);
+		if (wm->mask == NULL)
+			mjpeg_error_exit1 ("Could'nt allocate memory for the watermark!");
+		wm_init(wm, brightness, multiple, lower, upper);
+
+		if (!autoframes) {
+			if (read_pgm(fdWM, wm->mask, wm->w, wm->h))
+				exit (-1);
+			wm_bounds(wm);
+		}
 
 		y4m_init_stream_info (&out_streaminfo);
 		y4m_copy_stream_info( &out_streaminfo, &in_streaminfo );
-		y4m_write_stream_header(fdOut,&out_streaminfo);
-		removewm(fdWM,fdIn,&in_streaminfo,fdOut,&out_streaminfo,brightness,multiple,lower,upper);
+		yuv_write_stream_header(fdOut,&out_streaminfo);
+		if (autoframes)
+			autowm(wm,fdIn,&in_streaminfo,fdOut,&out_streaminfo,autoframes);
+		else
+			removewm(wm,fdIn,&in_streaminfo,fdOut,&out_streaminfo);
 		y4m_fini_stream_info (&out_streaminfo);
+
+		free(wm->mask);
+		free(wm);
 	}
 
 	y4m_fini_stream_info (&in_streaminfo);
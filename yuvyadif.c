@@ -221,7 +221,7 @@ static void filter(  int fdIn ,int fdOut , y4m_stream_info_t  *inStrInfo, int yu
 	write_error_code = Y4M_OK ;
 
 	y4m_init_frame_info( &in_frame );
-	read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data[temporalLength-1] );
+	read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data[temporalLength-1] );
 
 
 	//init loop mode
@@ -234,7 +234,7 @@ static void filter(  int fdIn ,int fdOut , y4m_stream_info_t  *inStrInfo, int yu
 		y4m_fini_frame_info( &in_frame );
 		y4m_init_frame_info( &in_frame );
 		// makes assumption that the video is longer than temporalLength frames.
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data[temporalLength-1] );
+		read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data[temporalLength-1] );
 
 		temporalshuffle(yuv_data,temporalLength);
 
@@ -245,12 +245,12 @@ static void filter(  int fdIn ,int fdOut , y4m_stream_info_t  *inStrInfo, int yu
 		// do work
 		if (read_error_code == Y4M_OK) {
 			filterframe(yuv_odata,yuv_data,inStrInfo,yuv_interlacing);
-			write_error_code = y4m_write_frame( fdOut, inStrInfo, &in_frame, yuv_odata );
+			write_error_code = yuv_write_frame( fdOut, inStrInfo, &in_frame, yuv_odata );
 		}
 
 		y4m_fini_frame_info( &in_frame );
 		y4m_init_frame_info( &in_frame );
-		read_error_code = y4m_read_frame(fdIn, inStrInfo,&in_frame,yuv_data[temporalLength-1] );
+		read_error_code = yuv_read_frame(fdIn, inStrInfo,&in_frame,yuv_data[temporalLength-1] );
 		// shuffle
 		temporalshuffle(yuv_data,temporalLength);
 	}
@@ -258,7 +258,7 @@ static void filter(  int fdIn ,int fdOut , y4m_stream_info_t  *inStrInfo, int yu
 	for(c=0;c<temporalLength/2;c++) {
 		if (read_error_code == Y4M_OK) {
 			filterframe(yuv_odata,yuv_data,inStrInfo,temporalLength);
-			write_error_code = y4m_write_frame( fdOut, inStrInfo, &in_frame, yuv_odata );
+			write_error_code = yuv_write_frame( fdOut, inStrInfo, &in_frame, yuv_odata );
 		}
 
 		y4m_fini_frame_info( &in_frame );
@@ -340,7 +340,7 @@ int main (int argc, char *argv[])
 	// The streaminfo structure is filled in
 	// ***************************************************************
 	// INPUT comes from stdin, we check for a correct file header
-	if (y4m_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
+	if (yuv_read_stream_header (fdIn, &in_streaminfo) != Y4M_OK)
 		mjpeg_error_exit1 ("Could'nt read YUV4MPEG header!");
 
 	if (yuv_interlacing==Y4M_UNKNOWN) {
@@ -352,7 +352,7 @@ int main (int argc, char *argv[])
 	}
 
 	y4m_si_set_interlace(&in_streaminfo, Y4M_ILACE_NONE);
-	y4m_write_stream_header(fdOut,&in_streaminfo);
+	yuv_write_stream_header(fdOut,&in_streaminfo);
 
 
 	// Information output